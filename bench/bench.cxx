@@ -0,0 +1,563 @@
+#include "execution_context.hxx"
+#include "module.hxx"
+#include "runtime.hxx"
+#include "simd.hxx"
+#include "wasm_writer.hxx"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Benchmarks for the decoder and the interpreters. Every module they run is
+ * generated here, with fixed sizes and contents, so that two runs of the same
+ * build measure exactly the same work. Each benchmark is repeated until a
+ * sample has taken long enough to time reliably, and the fastest of several
+ * samples is reported, as noise only ever makes a sample slower.
+ *
+ * usage: treble-bench [--filter=<substring>] [--tier=stack|register|jit]
+ *                     [--simd=scalar|sse4.1|avx2] [--save=<file>]
+ *                     [--baseline=<file>]
+ *
+ * --simd picks the kernels the SIMD benchmarks run on, rather than the best
+ * ones the host supports.
+ * --save writes the results to a file, which a later run can be compared
+ * against with --baseline.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+// number of samples per benchmark, of which the fastest is reported
+static constexpr int SAMPLE_COUNT = 7;
+// a sample repeats the benchmark until it has run for at least this long
+static constexpr auto MIN_SAMPLE_TIME = std::chrono::milliseconds(20);
+
+/**
+ * A function body that starts off with an i32 on the stack and repeats the
+ * given pattern, which must leave the stack as it found it, the given number
+ * of times.
+ */
+static std::vector<uint8_t> repeat_pattern(const WasmWriter &pattern,
+										   size_t repeat_count) {
+	WasmWriter body;
+	body.i32_const(1);
+	for (size_t i = 0; i < repeat_count; ++i) {
+		body.append(pattern.bytes);
+	}
+	body.op(0x0B);
+	return body.bytes;
+}
+
+struct Result {
+	std::string name;
+	double value;
+	// "ns/op" or "MB/s"
+	std::string unit;
+};
+
+/**
+ * Runs body, which does `ops` operations every time it is called, in samples
+ * of enough calls to take at least MIN_SAMPLE_TIME, and returns the shortest
+ * time per operation in nanoseconds.
+ */
+static double time_per_op(const std::function<void()> &body, double ops) {
+	// warm up caches, the branch predictors and the tiers
+	body();
+
+	double fastest = 0;
+	for (int i = 0; i < SAMPLE_COUNT; ++i) {
+		size_t calls = 0;
+		const Clock::time_point start = Clock::now();
+		Clock::duration elapsed;
+		do {
+			body();
+			calls++;
+			elapsed = Clock::now() - start;
+		} while (elapsed < MIN_SAMPLE_TIME);
+
+		const double ns =
+			std::chrono::duration<double, std::nano>(elapsed).count();
+		const double per_op = ns / (calls * ops);
+		if (i == 0 || per_op < fastest) {
+			fastest = per_op;
+		}
+	}
+
+	return fastest;
+}
+
+struct InterpreterBenchmark {
+	const char *name;
+	WasmWriter pattern;
+	// number of instructions the pattern executes
+	size_t ops;
+	bool needs_memory;
+};
+
+// each body repeats its pattern this many times
+static constexpr size_t PATTERN_REPEAT_COUNT = 10000;
+
+/**
+ * One benchmark per family of op codes. Every pattern takes the i32 on top of
+ * the stack and leaves another one in its place, so that every instruction
+ * depends on the one before it.
+ */
+static std::vector<InterpreterBenchmark> interpreter_benchmarks() {
+	std::vector<InterpreterBenchmark> benchmarks;
+
+	WasmWriter arithmetic;
+	// i32.add, i32.mul, i32.sub, i32.xor
+	arithmetic.i32_const(7).op(0x6A).i32_const(3).op(0x6C);
+	arithmetic.i32_const(1).op(0x6B).i32_const(0x55).op(0x73);
+	benchmarks.push_back({"interp/i32-arithmetic", arithmetic, 8, false});
+
+	WasmWriter arithmetic64;
+	// i64.add, i64.mul, i64.sub, i32.wrap_i64, i32.add
+	arithmetic64.i64_const(7).i64_const(9).op(0x7C).i64_const(3).op(0x7E);
+	arithmetic64.i64_const(1).op(0x7D).op(0xA7).op(0x6A);
+	benchmarks.push_back({"interp/i64-arithmetic", arithmetic64, 9, false});
+
+	WasmWriter compares;
+	// i32.lt_u, i32.eq, i32.ge_s
+	compares.i32_const(5).op(0x49).i32_const(0).op(0x46);
+	compares.i32_const(-1).op(0x4E);
+	benchmarks.push_back({"interp/i32-compares", compares, 6, false});
+
+	WasmWriter compares64;
+	// i64.lt_s, i32.add, i64.ne, i32.xor
+	compares64.i64_const(3).i64_const(5).op(0x53).op(0x6A);
+	compares64.i64_const(3).i64_const(5).op(0x52).op(0x73);
+	benchmarks.push_back({"interp/i64-compares", compares64, 8, false});
+
+	WasmWriter shifts;
+	// i32.rotl, i32.shr_u, i32.shl, i32.rotr, i32.shr_s
+	shifts.i32_const(3).op(0x77).i32_const(1).op(0x76).i32_const(2).op(0x74);
+	shifts.i32_const(5).op(0x78).i32_const(1).op(0x75);
+	benchmarks.push_back({"interp/i32-shifts", shifts, 10, false});
+
+	WasmWriter branches;
+	// i32.add the result of an if that takes its first arm, and then of one
+	// that takes its else arm
+	branches.i32_const(1).op(0x04).op(I32).i32_const(2);
+	branches.op(0x05).i32_const(3).op(0x0B).op(0x6A);
+	branches.i32_const(0).op(0x04).op(I32).i32_const(2);
+	branches.op(0x05).i32_const(3).op(0x0B).op(0x6A);
+	// the first arm jumps from its else to the end, the else arm runs into it
+	benchmarks.push_back({"interp/if-else", branches, 11, false});
+
+	WasmWriter memory;
+	// i32.store the operand at 0 and i32.load it back, plus one
+	memory.op(0x1A).i32_const(0).i32_const(42).memarg(0x36);
+	memory.i32_const(0).memarg(0x28).i32_const(1).op(0x6A);
+	benchmarks.push_back({"interp/memory", memory, 8, true});
+
+	WasmWriter simd_integer;
+	// i32x4.splat the operand, i32x4.add, i32x4.mul, v128.xor, i32x4.shl and
+	// i32x4.extract_lane 0
+	simd_integer.simd(0x11).v128_const(7).simd(0xAE).v128_const(3).simd(0xB5);
+	simd_integer.v128_const(0x55).simd(0x51).i32_const(1).simd(0xAB);
+	simd_integer.simd(0x1B).op(0);
+	benchmarks.push_back({"interp/simd-integer", simd_integer, 10, false});
+
+	WasmWriter simd_float;
+	// i32x4.splat the operand, f32x4.convert_i32x4_s, f32x4.add, f32x4.mul,
+	// f32x4.sqrt, i32x4.trunc_sat_f32x4_s and i32x4.extract_lane 0
+	simd_float.simd(0x11).simd(0xFA).v128_const(0x3FC00000).simd(0xE4);
+	simd_float.v128_const(0x40000000).simd(0xE6).simd(0xE3).simd(0xF8);
+	simd_float.simd(0x1B).op(0);
+	benchmarks.push_back({"interp/simd-float", simd_float, 9, false});
+
+	return benchmarks;
+}
+
+/**
+ * A module whose start function computes the nth fibonacci number the naive
+ * recursive way, in function 1, which calls itself either directly or through
+ * the table.
+ */
+static std::vector<uint8_t> make_fib_module(int32_t n, bool indirect) {
+	WasmWriter module;
+	module.bytes = {0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00};
+
+	// [] -> [i32] and [i32] -> [i32]
+	WasmWriter types;
+	types.u32(2).op(0x60).u32(0).u32(1).op(I32);
+	types.op(0x60).u32(1).op(I32).u32(1).op(I32);
+	module.section(1, types);
+
+	WasmWriter funcs;
+	funcs.u32(2).u32(0).u32(1);
+	module.section(3, funcs);
+
+	if (indirect) {
+		// a funcref table of one entry
+		WasmWriter table;
+		table.u32(1).op(0x70).op(0x00).u32(1);
+		module.section(4, table);
+	}
+
+	WasmWriter start;
+	start.u32(0);
+	module.section(8, start);
+
+	if (indirect) {
+		// function 1 at index 0 of the table
+		WasmWriter elements;
+		elements.u32(1).u32(0).i32_const(0).op(0x0B).u32(1).u32(1);
+		module.section(9, elements);
+	}
+
+	WasmWriter recurse;
+	if (indirect) {
+		recurse.i32_const(0).op(0x11).u32(1).u32(0);
+	} else {
+		recurse.op(0x10).u32(1);
+	}
+
+	WasmWriter main;
+	main.u32(0).i32_const(n).op(0x10).u32(1).op(0x0B);
+
+	// local.get 0 if it is below 2, and otherwise the sum of the calls for
+	// local.get 0 minus 1 and minus 2
+	WasmWriter fib;
+	fib.u32(0).op(0x20).u32(0).i32_const(2).op(0x49).op(0x04).op(I32);
+	fib.op(0x20).u32(0).op(0x05);
+	fib.op(0x20).u32(0).i32_const(1).op(0x6B).append(recurse.bytes);
+	fib.op(0x20).u32(0).i32_const(2).op(0x6B).append(recurse.bytes);
+	fib.op(0x6A).op(0x0B).op(0x0B);
+
+	WasmWriter code;
+	code.u32(2);
+	code.u32(main.bytes.size()).append(main.bytes);
+	code.u32(fib.bytes.size()).append(fib.bytes);
+	module.section(10, code);
+
+	return module.bytes;
+}
+
+/**
+ * A module whose start function counts a local down from the given number of
+ * iterations to 0 in a loop, branching back to its start every time. The loop
+ * either adds the counter to a sum, or, with dispatch set, picks one of four
+ * updates of the sum by the low bits of the counter, through a br_table.
+ */
+static std::vector<uint8_t> make_loop_module(int32_t iterations,
+											 bool dispatch) {
+	// the counter is local 0, and the sum local 1
+	WasmWriter update;
+	if (dispatch) {
+		// one block for every case, and one more around them all to leave
+		// them. a case that is not the last branches out of the blocks left.
+		update.op(0x02).op(0x40).op(0x02).op(0x40);
+		update.op(0x02).op(0x40).op(0x02).op(0x40);
+		update.op(0x20).u32(0).i32_const(3).op(0x71);
+		update.op(0x0E).u32(3).u32(0).u32(1).u32(2).u32(3).op(0x0B);
+		update.op(0x20).u32(1).i32_const(1).op(0x6A).op(0x21).u32(1);
+		update.op(0x0C).u32(2).op(0x0B);
+		update.op(0x20).u32(1).i32_const(3).op(0x73).op(0x21).u32(1);
+		update.op(0x0C).u32(1).op(0x0B);
+		update.op(0x20).u32(1).i32_const(1).op(0x74).op(0x21).u32(1);
+		update.op(0x0B);
+	} else {
+		update.op(0x20).u32(1).op(0x20).u32(0).op(0x6A).op(0x21).u32(1);
+	}
+
+	WasmWriter body;
+	body.u32(1).u32(2).op(I32);
+	body.i32_const(iterations).op(0x21).u32(0);
+	// leaves the loop once the counter is 0
+	body.op(0x02).op(0x40).op(0x03).op(0x40);
+	body.op(0x20).u32(0).op(0x45).op(0x0D).u32(1);
+	body.append(update.bytes);
+	body.op(0x20).u32(0).i32_const(1).op(0x6B).op(0x21).u32(0);
+	body.op(0x0C).u32(0).op(0x0B).op(0x0B);
+	body.op(0x20).u32(1).op(0x0B);
+
+	WasmWriter module;
+	module.bytes = {0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00};
+
+	WasmWriter types;
+	types.u32(1).op(0x60).u32(0).u32(1).op(I32);
+	module.section(1, types);
+
+	WasmWriter funcs;
+	funcs.u32(1).u32(0);
+	module.section(3, funcs);
+
+	WasmWriter start;
+	start.u32(0);
+	module.section(8, start);
+
+	WasmWriter code;
+	code.u32(1).u32(body.bytes.size()).append(body.bytes);
+	module.section(10, code);
+
+	return module.bytes;
+}
+
+/**
+ * A module with many mid-sized functions, for the decoder.
+ */
+static std::vector<uint8_t> make_large_module(size_t func_count) {
+	WasmWriter pattern;
+	pattern.i32_const(123456).op(0x6A).i64_const(-987654321).i64_const(3);
+	pattern.op(0x7E).op(0xA7).op(0x73).i32_const(7).op(0x77);
+
+	std::vector<std::vector<uint8_t>> bodies;
+	for (size_t i = 0; i < func_count; ++i) {
+		bodies.push_back(repeat_pattern(pattern, 200));
+	}
+	return make_module(bodies);
+}
+
+struct Options {
+	std::string filter;
+	Treble::RuntimeConfig config;
+	std::optional<std::string> save_path;
+	std::optional<std::string> baseline_path;
+};
+
+static bool selected(const Options &options, std::string_view name) {
+	return name.find(options.filter) != std::string_view::npos;
+}
+
+static void run_interpreter_benchmarks(const Options &options,
+									   std::vector<Result> &results) {
+	for (const InterpreterBenchmark &benchmark : interpreter_benchmarks()) {
+		if (!selected(options, benchmark.name)) {
+			continue;
+		}
+
+		const std::vector<uint8_t> binary = make_module(
+			{repeat_pattern(benchmark.pattern, PATTERN_REPEAT_COUNT)},
+			benchmark.needs_memory);
+		// the patterns are made of constants, which would otherwise be folded
+		// away before they ever run
+		const std::optional<Treble::Module> module =
+			Treble::parse_binary(binary, {.fold_constants = false});
+		Treble::ModuleInstance instance{};
+		if (!module || !Treble::instantiate_module(instance, *module)) {
+			std::cerr << benchmark.name << ": invalid module" << std::endl;
+			continue;
+		}
+
+		Treble::ExecutionContext context;
+		Treble::FunctionInstance &func = instance.store.funcs[0];
+		const double ns = time_per_op(
+			[&] { Treble::invoke(context, func, {}, options.config); },
+			benchmark.ops * PATTERN_REPEAT_COUNT);
+		results.push_back({benchmark.name, ns, "ns/op"});
+	}
+}
+
+static void run_call_benchmarks(const Options &options,
+								std::vector<Result> &results) {
+	// fib(n) makes 2 fib(n + 1) - 1 calls
+	constexpr int32_t n = 20;
+	double previous = 0, fib = 1;
+	for (int32_t i = 0; i < n; ++i) {
+		const double next = previous + fib;
+		previous = fib;
+		fib = next;
+	}
+	const double calls = 2 * fib - 1;
+
+	for (const bool indirect : {false, true}) {
+		const std::string name =
+			indirect ? "interp/indirect-calls" : "interp/calls";
+		if (!selected(options, name)) {
+			continue;
+		}
+
+		const std::vector<uint8_t> binary = make_fib_module(n, indirect);
+		const std::optional<Treble::Module> module =
+			Treble::parse_binary(binary);
+		Treble::ModuleInstance instance{};
+		if (!module || !Treble::instantiate_module(instance, *module)) {
+			std::cerr << name << ": invalid module" << std::endl;
+			continue;
+		}
+
+		Treble::ExecutionContext context;
+		Treble::FunctionInstance &func = instance.store.funcs[0];
+		const double ns = time_per_op(
+			[&] { Treble::invoke(context, func, {}, options.config); }, calls);
+		results.push_back({name, ns, "ns/op"});
+	}
+}
+
+static void run_loop_benchmarks(const Options &options,
+								std::vector<Result> &results) {
+	constexpr int32_t iterations = 100000;
+
+	for (const bool dispatch : {false, true}) {
+		const std::string name = dispatch ? "interp/br-table" : "interp/loop";
+		if (!selected(options, name)) {
+			continue;
+		}
+
+		const std::vector<uint8_t> binary =
+			make_loop_module(iterations, dispatch);
+		const std::optional<Treble::Module> module =
+			Treble::parse_binary(binary);
+		Treble::ModuleInstance instance{};
+		if (!module || !Treble::instantiate_module(instance, *module)) {
+			std::cerr << name << ": invalid module" << std::endl;
+			continue;
+		}
+
+		Treble::ExecutionContext context;
+		Treble::FunctionInstance &func = instance.store.funcs[0];
+		const double ns = time_per_op(
+			[&] { Treble::invoke(context, func, {}, options.config); },
+			iterations);
+		results.push_back({name, ns, "ns/op"});
+	}
+}
+
+static void run_decoder_benchmarks(const Options &options,
+								   std::vector<Result> &results) {
+	const std::vector<uint8_t> binary = make_large_module(4000);
+	const double megabytes = binary.size() / 1e6;
+
+	for (const unsigned threads : {1u, 0u}) {
+		const std::string name = threads == 1 ? "decode/large-module"
+											  : "decode/large-module-parallel";
+		if (!selected(options, name)) {
+			continue;
+		}
+
+		const Treble::DecodeConfig config{.decode_threads = threads,
+										  .allocator = {}};
+		const double ns = time_per_op(
+			[&] { Treble::parse_binary(binary, config); }, 1);
+		results.push_back({name, megabytes / (ns / 1e9), "MB/s"});
+	}
+}
+
+static void run_end_to_end_benchmarks(const Options &options,
+									  std::vector<Result> &results) {
+	const std::string name = "e2e/decode-instantiate-run";
+	if (!selected(options, name)) {
+		return;
+	}
+
+	WasmWriter pattern;
+	pattern.i32_const(7).op(0x6A).i32_const(3).op(0x6C);
+	std::vector<std::vector<uint8_t>> bodies;
+	for (int i = 0; i < 16; ++i) {
+		bodies.push_back(repeat_pattern(pattern, 500));
+	}
+	const std::vector<uint8_t> binary = make_module(bodies, true);
+
+	Treble::ExecutionContext context;
+	const double ns = time_per_op(
+		[&] {
+			std::optional<Treble::Module> module = Treble::parse_binary(binary);
+			Treble::ModuleInstance instance{};
+			Treble::instantiate_module(instance, *module);
+			Treble::invoke(context, instance.store.funcs[0], {},
+						   options.config);
+		},
+		1);
+	results.push_back({name, ns, "ns/op"});
+}
+
+/**
+ * Reads results written by --save: one per line, as name, value and unit.
+ */
+static std::map<std::string, double> read_results(const std::string &path) {
+	std::map<std::string, double> results;
+	std::ifstream in(path);
+	std::string name, unit;
+	double value;
+	while (in >> name >> value >> unit) {
+		results[name] = value;
+	}
+	return results;
+}
+
+int main(int argc, char *argv[]) {
+	Options options;
+	options.config.use_jit = false;
+	options.config.use_register_ir = false;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string_view arg = argv[i];
+		const std::string value(arg.substr(arg.find('=') + 1));
+		if (arg.starts_with("--filter=")) {
+			options.filter = value;
+		} else if (arg.starts_with("--tier=")) {
+			// every function is promoted on its first call, which the warm up
+			// makes
+			options.config.use_register_ir = value != "stack";
+			options.config.use_jit = value == "jit";
+			options.config.tier_up_threshold = 0;
+			options.config.background_compile = false;
+		} else if (arg.starts_with("--simd=")) {
+			const std::optional<Treble::SimdLevel> level =
+				Treble::simd_level_named(value);
+			if (!level || !Treble::set_simd_level(*level)) {
+				std::cerr << "SIMD level " << value << " is not supported"
+						  << std::endl;
+				return -1;
+			}
+		} else if (arg.starts_with("--save=")) {
+			options.save_path = value;
+		} else if (arg.starts_with("--baseline=")) {
+			options.baseline_path = value;
+		} else {
+			std::cerr << "unknown option " << arg << std::endl;
+			return -1;
+		}
+	}
+
+	std::vector<Result> results;
+	run_interpreter_benchmarks(options, results);
+	run_call_benchmarks(options, results);
+	run_loop_benchmarks(options, results);
+	run_decoder_benchmarks(options, results);
+	run_end_to_end_benchmarks(options, results);
+
+	const std::map<std::string, double> baseline =
+		options.baseline_path ? read_results(*options.baseline_path)
+							  : std::map<std::string, double>();
+
+	for (const Result &result : results) {
+		std::printf("%-32s %12.3f %-6s", result.name.c_str(), result.value,
+					result.unit.c_str());
+
+		const auto found = baseline.find(result.name);
+		if (found != baseline.end()) {
+			// positive is always an improvement: less time, or more bytes
+			const double change =
+				result.unit == "MB/s"
+					? (result.value - found->second) / found->second
+					: (found->second - result.value) / found->second;
+			std::printf("  baseline %12.3f  %+7.2f%%", found->second,
+						change * 100);
+		}
+		std::printf("\n");
+	}
+
+	if (options.save_path) {
+		std::ofstream out(*options.save_path);
+		for (const Result &result : results) {
+			out << result.name << ' ' << result.value << ' ' << result.unit
+				<< '\n';
+		}
+		if (!out) {
+			std::cerr << "failed to write " << *options.save_path << std::endl;
+			return -1;
+		}
+	}
+}
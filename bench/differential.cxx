@@ -0,0 +1,300 @@
+#include "execution_context.hxx"
+#include "jit.hxx"
+#include "module.hxx"
+#include "register_ir.hxx"
+#include "runtime.hxx"
+#include "wasm_writer.hxx"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Differential check of the tiers. It generates random function bodies out of
+ * the integer instructions every tier supports, runs each of them on the stack
+ * interpreter, on native code and on the register IR, and reports every body
+ * whose result or trap differs between them. The stack interpreter is taken
+ * to be right. The bodies are generated from the seed, so a run can be
+ * repeated exactly.
+ *
+ * usage: treble-differential [--seed=<n>] [--count=<n>]
+ *
+ * Exits with 1 if any of the bodies gave different results.
+ */
+
+// how deep the expression of a body nests at most
+static constexpr int MAX_DEPTH = 6;
+
+/**
+ * What running a body came to: its result, or the trap that cut it short.
+ */
+struct Outcome {
+	Treble::Trap trap;
+	uint64_t result;
+
+	bool operator==(const Outcome &other) const = default;
+};
+
+/**
+ * Generates function bodies that compute an i32 out of constants, with every
+ * numeric instruction the tiers support and if/else.
+ */
+class BodyGenerator {
+  public:
+	explicit BodyGenerator(uint64_t seed) : rng(seed) {}
+
+	std::vector<uint8_t> body() {
+		WasmWriter body;
+		expression(body, I32, MAX_DEPTH);
+		body.op(0x0B);
+		return body.bytes;
+	}
+
+  private:
+	/**
+	 * Appends an expression that leaves a single value of the given type,
+	 * nesting at most depth instructions deep.
+	 */
+	void expression(WasmWriter &body, uint8_t type, int depth) {
+		const bool wide = type == I64;
+		switch (depth == 0 ? 0 : pick(8)) {
+		case 0:
+		case 1:
+			constant(body, type);
+			break;
+
+		case 2:
+			// eqz of either type, or wrap_i64
+			if (!wide) {
+				const uint64_t choice = pick(3);
+				expression(body, choice == 0 ? I32 : I64, depth - 1);
+				body.op(choice == 0 ? 0x45 : choice == 1 ? 0x50 : 0xA7);
+				break;
+			}
+			[[fallthrough]];
+
+		case 3:
+			// clz, ctz or popcnt
+			expression(body, type, depth - 1);
+			body.op((wide ? 0x79 : 0x67) + pick(3));
+			break;
+
+		case 4:
+			// a comparison, of operands of either type
+			if (!wide) {
+				const bool operands_wide = pick(2) == 0;
+				expression(body, operands_wide ? I64 : I32, depth - 1);
+				expression(body, operands_wide ? I64 : I32, depth - 1);
+				body.op((operands_wide ? 0x51 : 0x46) + pick(10));
+				break;
+			}
+			[[fallthrough]];
+
+		case 5:
+			// a division or remainder, which is what traps
+			expression(body, type, depth - 1);
+			expression(body, type, depth - 1);
+			body.op((wide ? 0x7F : 0x6D) + pick(4));
+			break;
+
+		case 6:
+			// any other arithmetic
+			expression(body, type, depth - 1);
+			expression(body, type, depth - 1);
+			body.op((wide ? 0x7C : 0x6A) + pick(15));
+			break;
+
+		default:
+			expression(body, I32, depth - 1);
+			body.op(0x04).op(type);
+			expression(body, type, depth - 1);
+			body.op(0x05);
+			expression(body, type, depth - 1);
+			body.op(0x0B);
+			break;
+		}
+	}
+
+	/**
+	 * Appends a constant, mostly one of the values divisions and shifts treat
+	 * specially.
+	 */
+	void constant(WasmWriter &body, uint8_t type) {
+		const bool wide = type == I64;
+		const int64_t min = wide ? std::numeric_limits<int64_t>::min()
+								 : std::numeric_limits<int32_t>::min();
+		const int64_t max = wide ? std::numeric_limits<int64_t>::max()
+								 : std::numeric_limits<int32_t>::max();
+		const int64_t special[] = {0, 1, -1, 2, -2, 31, 32, 63, 64, min, max};
+
+		int64_t value;
+		if (pick(2) == 0) {
+			value = special[pick(std::size(special))];
+		} else if (pick(2) == 0) {
+			value = static_cast<int64_t>(pick(1000)) - 500;
+		} else {
+			value = static_cast<int64_t>(rng());
+		}
+
+		if (wide) {
+			body.i64_const(value);
+		} else {
+			body.i32_const(static_cast<int32_t>(value));
+		}
+	}
+
+	// a random number below count
+	uint64_t pick(uint64_t count) { return rng() % count; }
+
+	std::mt19937_64 rng;
+};
+
+static std::string describe(const Outcome &outcome) {
+	if (outcome.trap != Treble::Trap::None) {
+		return std::string("trap: ") + Treble::trap_message(outcome.trap);
+	}
+	return std::to_string(outcome.result);
+}
+
+/**
+ * Runs the function on the stack interpreter, on its own, without promoting
+ * it to another tier.
+ */
+static Outcome run_interpreter(Treble::FunctionInstance &func) {
+	Treble::ExecutionContext context;
+	const std::optional<std::span<const uint64_t>> results = Treble::invoke(
+		context, func, {},
+		{.use_register_ir = false, .use_jit = false});
+	if (!results) {
+		return {.trap = context.trap, .result = 0};
+	}
+	return {.trap = Treble::Trap::None, .result = results->back()};
+}
+
+/**
+ * Runs the function on native code, or returns nothing if the JIT cannot
+ * compile it.
+ */
+static std::optional<Outcome> run_native(const Treble::Function &code) {
+	Treble::JitFunction *jit = Treble::compile_function(code);
+	if (jit == nullptr) {
+		return std::nullopt;
+	}
+
+	std::vector<uint64_t> stack(jit->max_stack_height);
+	const Treble::Trap trap = jit->entry(stack.data());
+	Treble::free_jit_function(jit);
+	return Outcome{
+		.trap = trap,
+		.result = trap == Treble::Trap::None ? stack[0] : 0,
+	};
+}
+
+/**
+ * Runs the function on the register IR, or returns nothing if it cannot be
+ * lowered.
+ */
+static std::optional<Outcome> run_register_ir(const Treble::Function &code) {
+	Treble::RegisterFunction *lowered = Treble::lower_function(code);
+	if (lowered == nullptr) {
+		return std::nullopt;
+	}
+
+	std::vector<uint64_t> registers(lowered->register_count);
+	const Treble::Trap trap =
+		Treble::execute_register_function(*lowered, registers.data());
+	const uint64_t result = registers[lowered->constant_count];
+	Treble::free_register_function(lowered);
+	return Outcome{
+		.trap = trap,
+		.result = trap == Treble::Trap::None ? result : 0,
+	};
+}
+
+/**
+ * Reports a body whose outcome on the given tier is not the one the stack
+ * interpreter came to.
+ */
+static void report_mismatch(uint64_t index, const char *tier,
+							const std::vector<uint8_t> &body,
+							const Outcome &expected, const Outcome &actual) {
+	std::cerr << "body " << index << " on " << tier << ": "
+			  << describe(actual) << ", the stack interpreter "
+			  << describe(expected) << std::endl;
+	std::cerr << "   ";
+	for (const uint8_t byte : body) {
+		char hex[4];
+		std::snprintf(hex, sizeof(hex), " %02x", byte);
+		std::cerr << hex;
+	}
+	std::cerr << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t seed = 1;
+	uint64_t count = 10000;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string_view arg = argv[i];
+		const std::string value(arg.substr(arg.find('=') + 1));
+		if (arg.starts_with("--seed=")) {
+			seed = std::stoull(value);
+		} else if (arg.starts_with("--count=")) {
+			count = std::stoull(value);
+		} else {
+			std::cerr << "unknown option " << arg << std::endl;
+			return -1;
+		}
+	}
+
+	BodyGenerator generator(seed);
+	size_t native_count = 0;
+	size_t register_count = 0;
+	size_t mismatch_count = 0;
+
+	for (uint64_t i = 0; i < count; ++i) {
+		const std::vector<uint8_t> body = generator.body();
+		const std::vector<uint8_t> binary = make_module({body});
+		// constants would otherwise be folded before any tier sees them
+		const std::optional<Treble::Module> module =
+			Treble::parse_binary(binary, {.fold_constants = false});
+		Treble::ModuleInstance instance{};
+		if (!module || !Treble::instantiate_module(instance, *module)) {
+			std::cerr << "body " << i << " is invalid" << std::endl;
+			mismatch_count++;
+			continue;
+		}
+
+		Treble::FunctionInstance &func = instance.store.funcs[0];
+		const Outcome expected = run_interpreter(func);
+
+		if (const std::optional<Outcome> native = run_native(func.code)) {
+			native_count++;
+			if (*native != expected) {
+				report_mismatch(i, "native code", body, expected, *native);
+				mismatch_count++;
+			}
+		}
+		if (const std::optional<Outcome> registers =
+				run_register_ir(func.code)) {
+			register_count++;
+			if (*registers != expected) {
+				report_mismatch(i, "the register IR", body, expected,
+								*registers);
+				mismatch_count++;
+			}
+		}
+	}
+
+	std::cout << count << " bodies, " << native_count << " run on native code, "
+			  << register_count << " on the register IR, " << mismatch_count
+			  << " mismatches" << std::endl;
+	return mismatch_count == 0 ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+#ifndef __TREBLE__BENCH_WASM_WRITER_HXX__
+#define __TREBLE__BENCH_WASM_WRITER_HXX__
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/**
+ * Builds the wasm binaries the benchmarks and the differential check of the
+ * tiers generate.
+ */
+
+static constexpr uint8_t I32 = 0x7F;
+static constexpr uint8_t I64 = 0x7E;
+
+/**
+ * Appends wasm instructions, and whole modules, to a byte buffer.
+ */
+class WasmWriter {
+  public:
+	std::vector<uint8_t> bytes;
+
+	WasmWriter &op(uint8_t op_code) {
+		bytes.push_back(op_code);
+		return *this;
+	}
+
+	WasmWriter &u32(uint32_t value) {
+		do {
+			uint8_t byte = value & 0x7F;
+			value >>= 7;
+			bytes.push_back(value != 0 ? byte | 0x80 : byte);
+		} while (value != 0);
+		return *this;
+	}
+
+	WasmWriter &s64(int64_t value) {
+		while (true) {
+			const uint8_t byte = value & 0x7F;
+			value >>= 7;
+			if ((value == 0 && (byte & 0x40) == 0) ||
+				(value == -1 && (byte & 0x40) != 0)) {
+				bytes.push_back(byte);
+				return *this;
+			}
+			bytes.push_back(byte | 0x80);
+		}
+	}
+
+	WasmWriter &i32_const(int32_t value) { return op(0x41).s64(value); }
+	WasmWriter &i64_const(int64_t value) { return op(0x42).s64(value); }
+
+	// alignment 2, offset 0
+	WasmWriter &memarg(uint8_t op_code) { return op(op_code).u32(2).u32(0); }
+
+	// an instruction of the SIMD proposal, given by its op code after the
+	// prefix
+	WasmWriter &simd(uint32_t op_code) { return op(0xFD).u32(op_code); }
+
+	// a v128.const of the given 32 bit value in every lane
+	WasmWriter &v128_const(uint32_t lane) {
+		simd(0x0C);
+		for (int i = 0; i < 4; ++i) {
+			for (int byte = 0; byte < 4; ++byte) {
+				bytes.push_back(lane >> (8 * byte));
+			}
+		}
+		return *this;
+	}
+
+	WasmWriter &append(std::span<const uint8_t> other) {
+		bytes.insert(bytes.end(), other.begin(), other.end());
+		return *this;
+	}
+
+	WasmWriter &section(uint8_t id, const WasmWriter &payload) {
+		op(id).u32(payload.bytes.size());
+		return append(payload.bytes);
+	}
+};
+
+/**
+ * A module whose functions all take nothing and return an i32, with the given
+ * bodies, each of which must end in its end marker. Function 0 is the start
+ * function.
+ */
+inline std::vector<uint8_t>
+make_module(const std::vector<std::vector<uint8_t>> &bodies,
+			bool with_memory = false) {
+	WasmWriter module;
+	module.bytes = {0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00};
+
+	WasmWriter types;
+	types.u32(1).op(0x60).u32(0).u32(1).op(I32);
+	module.section(1, types);
+
+	WasmWriter funcs;
+	funcs.u32(bodies.size());
+	for (size_t i = 0; i < bodies.size(); ++i) {
+		funcs.u32(0);
+	}
+	module.section(3, funcs);
+
+	if (with_memory) {
+		WasmWriter memory;
+		memory.u32(1).op(0x00).u32(1);
+		module.section(5, memory);
+	}
+
+	WasmWriter start;
+	start.u32(0);
+	module.section(8, start);
+
+	WasmWriter code;
+	code.u32(bodies.size());
+	for (const std::vector<uint8_t> &body : bodies) {
+		// no locals
+		code.u32(body.size() + 1).u32(0).append(body);
+	}
+	module.section(10, code);
+
+	return module.bytes;
+}
+
+#endif
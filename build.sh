@@ -7,15 +7,67 @@ root="$(dirname $script_path)"
 pushd "$(dirname $0)"
 
 compiler=${CC:-g++}
+# interpreter dispatch engine: "threaded" or "switch"
+dispatch=${DISPATCH:-threaded}
+# "debug", or "release" for an optimized build that traces nothing
+mode=${MODE:-debug}
+# overrides the trace level of the mode, see src/trace.hxx
+trace=${TRACE:-}
+# "treble", "bench" for the benchmarks in bench/, or "differential" for the
+# differential check of the tiers in bench/. both are always built in release
+# mode
+target=${1:-treble}
 
 src_files=(
     src/main.cxx
+	src/arena.cxx
+	src/atomic_wait.cxx
+	src/bytecode.cxx
+	src/constant_folding.cxx
+	src/execution_context.cxx
+	src/jit.cxx
+	src/linear_memory.cxx
+	src/mapped_file.cxx
 	src/module.cxx
+	src/module_cache.cxx
+	src/perf_map.cxx
+	src/profiler.cxx
+	src/register_ir.cxx
 	src/runtime.cxx
+	src/sampler.cxx
+	src/scheduler.cxx
+	src/simd.cxx
+	src/thread_pool.cxx
+	src/tiering.cxx
+	src/trace.cxx
+	src/validator.cxx
 )
 
-common_opts="-I$root/src -Wall --std=c++20"
+common_opts="-I$root/src -Wall --std=c++20 -pthread"
+if [ "$dispatch" = "switch" ]; then
+	common_opts+=" -DTREBLE_SWITCH_DISPATCH"
+fi
+if [ -n "$trace" ]; then
+	common_opts+=" -DTREBLE_TRACE_LEVEL=$trace"
+fi
 debug_opts="--debug -g -DDEBUG $common_opts"
+release_opts="-O2 -DNDEBUG $common_opts"
+
+build_opts=$debug_opts
+if [ "$mode" = "release" ]; then
+	build_opts=$release_opts
+fi
+
+output=treble
+if [ "$target" = "bench" ]; then
+	src_files[0]=bench/bench.cxx
+	build_opts=$release_opts
+	output=treble-bench
+elif [ "$target" = "differential" ]; then
+	src_files[0]=bench/differential.cxx
+	build_opts=$release_opts
+	output=treble-differential
+fi
 
 popd >> /dev/null
 
@@ -27,7 +79,7 @@ for p in "${src_files[@]}"; do
 	all_src+=" ../${p}"
 done
 
-compile="$compiler $all_src -o treble $debug_opts"
+compile="$compiler $all_src -o $output $build_opts"
 
 echo $compile
 $compile
@@ -0,0 +1,109 @@
+#include "arena.hxx"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+
+namespace Treble {
+
+void *default_allocate(size_t size, void *user_data) {
+	return std::malloc(size);
+}
+
+void default_deallocate(void *block, size_t size, void *user_data) {
+	std::free(block);
+}
+
+Arena::Arena(const BackingAllocator &backing, size_t block_size)
+	: backing_allocator(backing), block_size(block_size) {}
+
+Arena::~Arena() { release(); }
+
+Arena::Arena(Arena &&other)
+	: backing_allocator(other.backing_allocator), block_size(other.block_size),
+	  blocks(std::exchange(other.blocks, nullptr)),
+	  cursor(std::exchange(other.cursor, nullptr)),
+	  limit(std::exchange(other.limit, nullptr)) {}
+
+Arena &Arena::operator=(Arena &&other) {
+	if (this != &other) {
+		release();
+		backing_allocator = other.backing_allocator;
+		block_size = other.block_size;
+		blocks = std::exchange(other.blocks, nullptr);
+		cursor = std::exchange(other.cursor, nullptr);
+		limit = std::exchange(other.limit, nullptr);
+	}
+	return *this;
+}
+
+void Arena::release() {
+	while (blocks != nullptr) {
+		Block *next = blocks->next;
+		backing_allocator.deallocate(blocks, blocks->size,
+									 backing_allocator.user_data);
+		blocks = next;
+	}
+	cursor = nullptr;
+	limit = nullptr;
+}
+
+void *Arena::allocate_block(size_t size, size_t alignment) {
+	// allocations that would waste much of a block get a block of their own,
+	// and the current block stays open for the next ones
+	const bool dedicated = size + alignment > block_size / 4;
+	const size_t total_size =
+		sizeof(Block) + alignment +
+		(dedicated ? size : std::max(size, block_size - sizeof(Block)));
+
+	auto *block = static_cast<Block *>(
+		backing_allocator.allocate(total_size, backing_allocator.user_data));
+	if (block == nullptr) {
+		return nullptr;
+	}
+	block->size = total_size;
+
+	auto *data = reinterpret_cast<uint8_t *>(block + 1);
+	const uintptr_t aligned =
+		(reinterpret_cast<uintptr_t>(data) + alignment - 1) & ~(alignment - 1);
+
+	if (dedicated && blocks != nullptr) {
+		block->next = blocks->next;
+		blocks->next = block;
+	} else {
+		block->next = blocks;
+		blocks = block;
+		cursor = reinterpret_cast<uint8_t *>(aligned + size);
+		limit = reinterpret_cast<uint8_t *>(block) + total_size;
+	}
+
+	return reinterpret_cast<void *>(aligned);
+}
+
+void Arena::adopt(Arena &other) {
+	if (other.blocks == nullptr) {
+		return;
+	}
+
+	// other's blocks go behind the current one, which stays open
+	Block *last = other.blocks;
+	while (last->next != nullptr) {
+		last = last->next;
+	}
+
+	if (blocks == nullptr) {
+		blocks = other.blocks;
+		cursor = other.cursor;
+		limit = other.limit;
+	} else {
+		last->next = blocks->next;
+		blocks->next = other.blocks;
+	}
+
+	other.blocks = nullptr;
+	other.cursor = nullptr;
+	other.limit = nullptr;
+}
+
+} // namespace Treble
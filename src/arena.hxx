@@ -0,0 +1,98 @@
+#ifndef __TREBLE__ARENA_HXX__
+#define __TREBLE__ARENA_HXX__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Treble {
+
+void *default_allocate(size_t size, void *user_data);
+void default_deallocate(void *block, size_t size, void *user_data);
+
+/**
+ * Where arenas get their blocks from. By default that is std::malloc;
+ * embedders that want treble's memory to come out of their own allocator
+ * fill in both functions, which receive user_data as their last argument.
+ */
+struct BackingAllocator {
+	void *(*allocate)(size_t size, void *user_data) = default_allocate;
+	void (*deallocate)(void *block, size_t size,
+					   void *user_data) = default_deallocate;
+	void *user_data = nullptr;
+};
+
+/**
+ * A bump-pointer allocator. Memory is carved out of large blocks taken from
+ * the backing allocator, and is only ever released all at once, when the
+ * arena is destroyed. Not thread-safe: threads that allocate concurrently
+ * need arenas of their own, which can be merged with adopt afterwards.
+ */
+class Arena {
+  public:
+	Arena() = default;
+	explicit Arena(const BackingAllocator &backing,
+				   size_t block_size = DEFAULT_BLOCK_SIZE);
+	~Arena();
+
+	Arena(Arena &&other);
+	Arena &operator=(Arena &&other);
+
+	Arena(const Arena &) = delete;
+	Arena &operator=(const Arena &) = delete;
+
+	const BackingAllocator &backing() const { return backing_allocator; }
+
+	/**
+	 * Returns size bytes aligned to alignment, which must be a power of two.
+	 * The memory is not initialized. Returns nullptr if the backing allocator
+	 * is out of memory.
+	 */
+	void *allocate(size_t size, size_t alignment) {
+		const uintptr_t end = reinterpret_cast<uintptr_t>(limit);
+		const uintptr_t aligned =
+			(reinterpret_cast<uintptr_t>(cursor) + alignment - 1) &
+			~(alignment - 1);
+		if (cursor != nullptr && aligned <= end && size <= end - aligned) {
+			cursor = reinterpret_cast<uint8_t *>(aligned + size);
+			return reinterpret_cast<void *>(aligned);
+		}
+		return allocate_block(size, alignment);
+	}
+
+	/**
+	 * Returns uninitialized room for count values of type T.
+	 */
+	template <typename T> T *allocate_array(size_t count) {
+		return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+	}
+
+	/**
+	 * Takes over every block of other, which is left empty. Whatever was
+	 * allocated from other lives as long as this arena from then on. Both
+	 * arenas must use the same backing allocator.
+	 */
+	void adopt(Arena &other);
+
+  private:
+	static constexpr size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+	struct Block {
+		Block *next;
+		size_t size;
+	};
+
+	void *allocate_block(size_t size, size_t alignment);
+	void release();
+
+	BackingAllocator backing_allocator;
+	size_t block_size = DEFAULT_BLOCK_SIZE;
+
+	Block *blocks = nullptr;
+	// the free part of the block allocations are bumped out of
+	uint8_t *cursor = nullptr;
+	uint8_t *limit = nullptr;
+};
+
+} // namespace Treble
+
+#endif
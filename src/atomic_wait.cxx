@@ -0,0 +1,138 @@
+#include "atomic_wait.hxx"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <linux/futex.h>
+#include <mutex>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace Treble {
+
+/**
+ * A thread blocked in wait_for_notify. It lives on the stack of that thread
+ * for as long as it waits.
+ */
+struct Waiter {
+	const void *address;
+	// set to 1 by the notify that wakes the waiter. the waiter sleeps on it
+	// with a futex, so every waiter can be woken on its own.
+	uint32_t notified;
+	Waiter *next;
+};
+
+/**
+ * Waiters are queued in buckets by address. The lock of a bucket is what makes
+ * checking the value and queueing one step: a notify needs it to find any
+ * waiter.
+ */
+struct WaiterBucket {
+	std::mutex lock;
+	Waiter *head = nullptr;
+	Waiter *tail = nullptr;
+};
+
+static constexpr size_t BUCKET_COUNT = 256;
+
+static WaiterBucket &bucket_of(const void *address) {
+	static WaiterBucket buckets[BUCKET_COUNT];
+	// atomic accesses are at least 4 byte aligned
+	return buckets[(reinterpret_cast<uintptr_t>(address) >> 2) % BUCKET_COUNT];
+}
+
+/**
+ * Takes the waiter that comes right after previous, or first if previous is
+ * nullptr, out of the bucket.
+ */
+static void unlink(WaiterBucket &bucket, Waiter *previous, Waiter *waiter) {
+	(previous != nullptr ? previous->next : bucket.head) = waiter->next;
+	if (bucket.tail == waiter) {
+		bucket.tail = previous;
+	}
+}
+
+WaitResult wait_for_notify(void *address, uint64_t expected, size_t size,
+						   int64_t timeout) {
+	using Clock = std::chrono::steady_clock;
+	const Clock::time_point start = Clock::now();
+
+	WaiterBucket &bucket = bucket_of(address);
+	Waiter waiter{.address = address, .notified = 0, .next = nullptr};
+	{
+		std::lock_guard guard(bucket.lock);
+
+		const uint64_t value =
+			size == sizeof(uint32_t)
+				? std::atomic_ref(*static_cast<uint32_t *>(address)).load()
+				: std::atomic_ref(*static_cast<uint64_t *>(address)).load();
+		if (value != expected) {
+			return WaitResult::NotEqual;
+		}
+
+		(bucket.tail != nullptr ? bucket.tail->next : bucket.head) = &waiter;
+		bucket.tail = &waiter;
+	}
+
+	const std::atomic_ref notified(waiter.notified);
+	while (notified.load(std::memory_order_acquire) == 0) {
+		timespec remaining;
+		if (timeout >= 0) {
+			const auto elapsed =
+				std::chrono::duration_cast<std::chrono::nanoseconds>(
+					Clock::now() - start);
+			const int64_t left = timeout - elapsed.count();
+			if (left <= 0) {
+				break;
+			}
+			remaining.tv_sec = left / 1'000'000'000;
+			remaining.tv_nsec = left % 1'000'000'000;
+		}
+
+		// returns early on a signal, or right away if the notify came first
+		syscall(SYS_futex, &waiter.notified, FUTEX_WAIT_PRIVATE, 0,
+				timeout >= 0 ? &remaining : nullptr, nullptr, 0);
+	}
+
+	// the notify wakes the futex while it holds the lock, so the waiter must
+	// not go away before it can take the lock itself
+	std::lock_guard guard(bucket.lock);
+	if (notified.load(std::memory_order_relaxed) != 0) {
+		return WaitResult::Ok;
+	}
+
+	Waiter *previous = nullptr;
+	for (Waiter *w = bucket.head; w != &waiter; w = w->next) {
+		previous = w;
+	}
+	unlink(bucket, previous, &waiter);
+	return WaitResult::TimedOut;
+}
+
+uint32_t notify_waiters(const void *address, uint32_t count) {
+	WaiterBucket &bucket = bucket_of(address);
+	std::lock_guard guard(bucket.lock);
+
+	uint32_t woken = 0;
+	Waiter *previous = nullptr;
+	for (Waiter *waiter = bucket.head; waiter != nullptr && woken < count;) {
+		Waiter *next = waiter->next;
+		if (waiter->address != address) {
+			previous = waiter;
+			waiter = next;
+			continue;
+		}
+
+		unlink(bucket, previous, waiter);
+		std::atomic_ref(waiter->notified).store(1, std::memory_order_release);
+		syscall(SYS_futex, &waiter->notified, FUTEX_WAKE_PRIVATE, 1, nullptr,
+				nullptr, 0);
+		woken++;
+		waiter = next;
+	}
+
+	return woken;
+}
+
+} // namespace Treble
@@ -0,0 +1,41 @@
+#ifndef __TREBLE__ATOMIC_WAIT_HXX__
+#define __TREBLE__ATOMIC_WAIT_HXX__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Treble {
+
+/**
+ * What memory.atomic.wait32 and memory.atomic.wait64 return.
+ */
+enum class WaitResult : uint32_t {
+	// woken by a notify
+	Ok = 0,
+	// the memory did not hold the expected value
+	NotEqual = 1,
+	TimedOut = 2,
+};
+
+/**
+ * Blocks the calling thread until notify_waiters is called for the same
+ * address, provided that the size bytes at address, which must be 4 or 8 and
+ * naturally aligned, hold the expected value. A negative timeout in
+ * nanoseconds waits forever.
+ *
+ * The value is checked and the thread queued as one step with respect to
+ * notify_waiters, so a notify that comes after a store to the address can
+ * never be missed by a thread that saw the value from before the store.
+ */
+WaitResult wait_for_notify(void *address, uint64_t expected, size_t size,
+						   int64_t timeout);
+
+/**
+ * Wakes up to count of the threads waiting on the address, in the order they
+ * started waiting, and returns the number of threads it woke.
+ */
+uint32_t notify_waiters(const void *address, uint32_t count);
+
+} // namespace Treble
+
+#endif
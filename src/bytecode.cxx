@@ -0,0 +1,647 @@
+#include "bytecode.hxx"
+#include "arena.hxx"
+#include "instructions.hxx"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+namespace Treble {
+
+ByteOp byte_op(const Instruction &instr) {
+	if (instr.op_code == Instruction::OpCode::drop && instr.args.drop.v128) {
+		return ByteOp::drop_v128;
+	}
+
+	// locals that hold a v128 take two slots, and have ops of their own
+	switch (instr.op_code) {
+	case Instruction::OpCode::local_get:
+		if (instr.args.local.v128) {
+			return ByteOp::local_get_v128;
+		}
+		break;
+
+	case Instruction::OpCode::local_set:
+		if (instr.args.local.v128) {
+			return ByteOp::local_set_v128;
+		}
+		break;
+
+	case Instruction::OpCode::local_tee:
+		if (instr.args.local.v128) {
+			return ByteOp::local_tee_v128;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	switch (instr.op_code) {
+#define BYTE_OP_CASE(name, op_code, text)                                      \
+	case Instruction::OpCode::name:                                            \
+		return ByteOp::name;
+
+		TREBLE_FOREACH_OPCODE(BYTE_OP_CASE)
+
+#undef BYTE_OP_CASE
+
+	default:
+		return ByteOp::unknown;
+	}
+}
+
+static Instruction::OpCode instruction_op_code(ByteOp op) {
+	switch (op) {
+#define INSTRUCTION_OP_CODE_CASE(name, op_code, text)                          \
+	case ByteOp::name:                                                         \
+		return Instruction::OpCode::name;
+
+		TREBLE_FOREACH_OPCODE(INSTRUCTION_OP_CODE_CASE)
+
+#undef INSTRUCTION_OP_CODE_CASE
+
+	case ByteOp::drop_v128:
+		return Instruction::OpCode::drop;
+
+	case ByteOp::local_get_v128:
+		return Instruction::OpCode::local_get;
+
+	case ByteOp::local_set_v128:
+		return Instruction::OpCode::local_set;
+
+	case ByteOp::local_tee_v128:
+		return Instruction::OpCode::local_tee;
+
+	case ByteOp::end_function:
+		return Instruction::OpCode::end;
+
+	default:
+		return Instruction::OpCode::end;
+	}
+}
+
+template <typename T>
+static void write_immediate(uint8_t *pc, T value, size_t offset = 0) {
+	std::memcpy(pc + sizeof(ByteOp) + offset, &value, sizeof(value));
+}
+
+/**
+ * The superinstruction that does the work of first and then second, if there
+ * is one. A const only fuses with an op of its own type, so that a fused body
+ * is valid exactly when the unfused one is.
+ */
+static std::optional<ByteOp> fuse(Instruction::OpCode first,
+								  Instruction::OpCode second) {
+	switch (second) {
+#define I32_IMM_CASE(name, op_code, text)                                      \
+	case Instruction::OpCode::name:                                            \
+		if (first == Instruction::OpCode::i32_const) {                         \
+			return ByteOp::name##_imm;                                         \
+		}                                                                      \
+		return std::nullopt;
+
+		TREBLE_FOREACH_I32_COMPARE_OPCODE(I32_IMM_CASE)
+		TREBLE_FOREACH_I32_ARITHMETIC_OPCODE(I32_IMM_CASE)
+
+#undef I32_IMM_CASE
+
+#define I64_IMM_CASE(name, op_code, text)                                      \
+	case Instruction::OpCode::name:                                            \
+		if (first == Instruction::OpCode::i64_const) {                         \
+			return ByteOp::name##_imm;                                         \
+		}                                                                      \
+		return std::nullopt;
+
+		TREBLE_FOREACH_I64_COMPARE_OPCODE(I64_IMM_CASE)
+		TREBLE_FOREACH_I64_ARITHMETIC_OPCODE(I64_IMM_CASE)
+
+#undef I64_IMM_CASE
+
+	case Instruction::OpCode::if_:
+		switch (first) {
+#define IF_CASE(name, op_code, text)                                           \
+	case Instruction::OpCode::name:                                            \
+		return ByteOp::name##_if;
+
+			TREBLE_FOREACH_TEST_OPCODE(IF_CASE)
+			TREBLE_FOREACH_COMPARE_OPCODE(IF_CASE)
+
+#undef IF_CASE
+
+		default:
+			return std::nullopt;
+		}
+
+	case Instruction::OpCode::i32_wrap_i64:
+		switch (first) {
+#define WRAP_CASE(name, op_code, text)                                         \
+	case Instruction::OpCode::name:                                            \
+		return ByteOp::name##_wrap;
+
+			TREBLE_FOREACH_I64_ARITHMETIC_OPCODE(WRAP_CASE)
+
+#undef WRAP_CASE
+
+		default:
+			return std::nullopt;
+		}
+
+	default:
+		return std::nullopt;
+	}
+}
+
+uint8_t *encode_function(const Instruction *instructions, size_t count,
+						 Arena &arena, size_t &encoded_size) {
+	// the op every instruction is encoded as, fusing pairs greedily from the
+	// start. the second instruction of a pair is encoded as part of the first,
+	// and gets no op of its own.
+	std::vector<ByteOp> ops(count);
+	// byte position of every instruction in the encoded body, followed by the
+	// size of the whole body. both instructions of a pair are at the position
+	// of the pair.
+	std::vector<size_t> positions(count + 1);
+	positions[0] = 0;
+	for (size_t i = 0; i < count; ++i) {
+		std::optional<ByteOp> fused;
+		if (i + 1 < count) {
+			fused = fuse(instructions[i].op_code, instructions[i + 1].op_code);
+		}
+
+		ops[i] = fused.value_or(byte_op(instructions[i]));
+		// the last instruction is the end marker of the function body
+		if (i + 1 == count) {
+			ops[i] = ByteOp::end_function;
+		}
+		const size_t end =
+			positions[i] + sizeof(ByteOp) + immediate_size(ops[i]);
+		if (fused) {
+			positions[i + 1] = positions[i];
+			++i;
+		}
+		positions[i + 1] = end;
+	}
+
+	// the jump tables of the br_tables follow the instructions, and the end
+	// marker of every block, loop and if is found up front, so that forward
+	// branches can be resolved as soon as they come up
+	size_t table_size = 0;
+	std::vector<size_t> end_markers(count);
+	std::vector<size_t> open_blocks;
+	for (size_t i = 0; i < count; ++i) {
+		switch (instructions[i].op_code) {
+		case Instruction::OpCode::block:
+		case Instruction::OpCode::loop:
+		case Instruction::OpCode::if_:
+			open_blocks.push_back(i);
+			break;
+
+		case Instruction::OpCode::end:
+			if (!open_blocks.empty()) {
+				end_markers[open_blocks.back()] = i;
+				open_blocks.pop_back();
+			}
+			break;
+
+		case Instruction::OpCode::br_table:
+			table_size += (instructions[i].args.branch_table.count + 1) *
+						  JUMP_TABLE_ENTRY_SIZE;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	encoded_size = positions[count] + table_size;
+	auto *code = arena.allocate_array<uint8_t>(encoded_size);
+	size_t table_position = positions[count];
+
+	// the position a branch out of the given number of blocks continues at
+	const auto branch_target = [&](uint32_t depth) -> size_t {
+		if (depth == open_blocks.size()) {
+			// the body of the function, which the branch returns from
+			return positions[count - 1];
+		}
+
+		const size_t block = open_blocks[open_blocks.size() - 1 - depth];
+		if (instructions[block].op_code == Instruction::OpCode::loop) {
+			return positions[block + 1];
+		}
+		return positions[end_markers[block] + 1];
+	};
+
+	for (size_t i = 0; i < count; ++i) {
+		const Instruction &instr = instructions[i];
+		uint8_t *pc = code + positions[i];
+
+		const ByteOp op = ops[i];
+		std::memcpy(pc, &op, sizeof(op));
+
+		ByteOp parts[2];
+		if (split_superinstruction(op, parts)) {
+			// the const of an _imm op carries its value, the if of an _if op
+			// its branch
+			const Instruction &second = instructions[++i];
+			if (parts[0] == ByteOp::i32_const) {
+				write_immediate(pc, instr.args.i32);
+			} else if (parts[0] == ByteOp::i64_const) {
+				write_immediate(pc, instr.args.i64);
+			} else if (parts[1] == ByteOp::if_) {
+				const size_t target = i + second.args.if_branch.instr_2_offset;
+				const int32_t offset = positions[target] - positions[i];
+				write_immediate(pc, offset);
+				write_immediate(pc, second.args.if_branch.block_type,
+								sizeof(offset));
+				open_blocks.push_back(i);
+			}
+			continue;
+		}
+
+		switch (op) {
+		case ByteOp::i32_const:
+			write_immediate(pc, instr.args.i32);
+			break;
+
+		case ByteOp::i64_const:
+			write_immediate(pc, instr.args.i64);
+			break;
+
+		case ByteOp::f32_const:
+			write_immediate(pc, instr.args.f32);
+			break;
+
+		case ByteOp::block:
+		case ByteOp::loop:
+			write_immediate(pc, instr.args.block.block_type);
+			open_blocks.push_back(i);
+			break;
+
+		case ByteOp::if_: {
+			const size_t target = i + instr.args.if_branch.instr_2_offset;
+			const int32_t offset = positions[target] - positions[i];
+			write_immediate(pc, offset);
+			write_immediate(pc, instr.args.if_branch.block_type,
+							sizeof(offset));
+			open_blocks.push_back(i);
+			break;
+		}
+
+		case ByteOp::end:
+			open_blocks.pop_back();
+			break;
+
+		case ByteOp::br:
+		case ByteOp::br_if: {
+			const int32_t offset =
+				branch_target(instr.args.branch.depth) - positions[i];
+			write_immediate(pc, offset);
+			write_immediate(pc, instr.args.branch.arity, 4);
+			write_immediate(pc, instr.args.branch.drop, 8);
+			break;
+		}
+
+		case ByteOp::br_table: {
+			const auto &table = instr.args.branch_table;
+			write_immediate(pc, table.count);
+			write_immediate(pc, table.arity, 4);
+			write_immediate(
+				pc, static_cast<uint32_t>(table_position - positions[i]), 8);
+
+			for (size_t j = 0; j <= table.count; ++j) {
+				const BranchLabel &label = table.labels[j];
+				const int32_t offset =
+					branch_target(label.depth) - positions[i];
+				uint8_t *const entry = code + table_position;
+				std::memcpy(entry, &offset, 4);
+				std::memcpy(entry + 4, &label.drop, 4);
+				table_position += JUMP_TABLE_ENTRY_SIZE;
+			}
+			break;
+		}
+
+		case ByteOp::else_: {
+			const size_t target = i + instr.args.else_branch.end_marker_offset;
+			const int32_t offset = positions[target] - positions[i];
+			write_immediate(pc, offset);
+			break;
+		}
+
+#define LOCAL_CASE(name, op_code, text)                                        \
+	case ByteOp::name:                                                         \
+	case ByteOp::name##_v128:
+			TREBLE_FOREACH_LOCAL_OPCODE(LOCAL_CASE)
+#undef LOCAL_CASE
+			write_immediate(pc, instr.args.local.slot);
+			break;
+
+		case ByteOp::call:
+			write_immediate(pc, instr.args.call.func_index);
+			break;
+
+		case ByteOp::call_indirect:
+			write_immediate(pc, instr.args.call_indirect.type_index);
+			write_immediate(pc, instr.args.call_indirect.site,
+							sizeof(instr.args.call_indirect.type_index));
+			break;
+
+#define MEMARG_CASE(name, op_code, text) case ByteOp::name:
+			TREBLE_FOREACH_MEMARG_OPCODE(MEMARG_CASE)
+#undef MEMARG_CASE
+			write_immediate(pc, instr.args.memarg.offset);
+			break;
+
+#define LANE_ACCESS_CASE(name, op_code, text) case ByteOp::name:
+			TREBLE_FOREACH_SIMD_LOAD_LANE_OPCODE(LANE_ACCESS_CASE)
+			TREBLE_FOREACH_SIMD_STORE_LANE_OPCODE(LANE_ACCESS_CASE)
+#undef LANE_ACCESS_CASE
+			write_immediate(pc, instr.args.memarg.offset);
+			write_immediate(pc, instr.args.memarg.lane,
+							sizeof(instr.args.memarg.offset));
+			break;
+
+#define LANE_CASE(name, op_code, text) case ByteOp::name:
+			TREBLE_FOREACH_SIMD_EXTRACT_LANE_OPCODE(LANE_CASE)
+			TREBLE_FOREACH_SIMD_REPLACE_LANE_OPCODE(LANE_CASE)
+#undef LANE_CASE
+			write_immediate(pc, instr.args.lane);
+			break;
+
+		case ByteOp::v128_const:
+		case ByteOp::i8x16_shuffle:
+			std::memcpy(pc + sizeof(ByteOp), instr.args.v128,
+						sizeof(instr.args.v128));
+			break;
+
+		case ByteOp::unknown:
+			write_immediate(pc, static_cast<uint16_t>(instr.op_code));
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return code;
+}
+
+Instruction read_instruction(const uint8_t *&pc) {
+	const ByteOp op = read_byte_op(pc);
+
+	Instruction instr;
+	instr.op_code = instruction_op_code(op);
+
+	switch (op) {
+	case ByteOp::i32_const:
+		instr.args.i32 = read_immediate<uint32_t>(pc);
+		break;
+
+	case ByteOp::i64_const:
+		instr.args.i64 = read_immediate<uint64_t>(pc);
+		break;
+
+	case ByteOp::f32_const:
+		instr.args.f32 = read_immediate<float>(pc);
+		break;
+
+	case ByteOp::block:
+	case ByteOp::loop:
+		instr.args.block.block_type = read_immediate<uint8_t>(pc);
+		break;
+
+	case ByteOp::br:
+	case ByteOp::br_if:
+		instr.args.branch.arity = read_immediate<uint32_t>(pc, 4);
+		instr.args.branch.drop = read_immediate<uint32_t>(pc, 8);
+		break;
+
+	case ByteOp::br_table:
+		instr.args.branch_table.labels = nullptr;
+		instr.args.branch_table.count = read_immediate<uint32_t>(pc);
+		instr.args.branch_table.arity = read_immediate<uint32_t>(pc, 4);
+		break;
+
+	case ByteOp::if_:
+		instr.args.if_branch.block_type =
+			read_immediate<uint8_t>(pc, sizeof(int32_t));
+		instr.args.if_branch.instr_1_offset =
+			sizeof(ByteOp) + immediate_size(ByteOp::if_);
+		instr.args.if_branch.instr_2_offset = read_immediate<int32_t>(pc);
+		break;
+
+	case ByteOp::else_:
+		instr.args.else_branch.end_marker_offset = read_immediate<int32_t>(pc);
+		break;
+
+#define LOCAL_CASE(name, op_code, text)                                        \
+	case ByteOp::name:                                                         \
+	case ByteOp::name##_v128:
+		TREBLE_FOREACH_LOCAL_OPCODE(LOCAL_CASE)
+#undef LOCAL_CASE
+		instr.args.local.slot = read_immediate<uint32_t>(pc);
+		instr.args.local.v128 = op == ByteOp::local_get_v128 ||
+								op == ByteOp::local_set_v128 ||
+								op == ByteOp::local_tee_v128;
+		break;
+
+	case ByteOp::call:
+		instr.args.call.func_index = read_immediate<uint32_t>(pc);
+		break;
+
+	case ByteOp::call_indirect:
+		instr.args.call_indirect.type_index = read_immediate<uint32_t>(pc);
+		instr.args.call_indirect.site = read_immediate<uint32_t>(
+			pc, sizeof(instr.args.call_indirect.type_index));
+		break;
+
+#define MEMARG_CASE(name, op_code, text) case ByteOp::name:
+		TREBLE_FOREACH_MEMARG_OPCODE(MEMARG_CASE)
+#undef MEMARG_CASE
+		instr.args.memarg.align = 0;
+		instr.args.memarg.offset = read_immediate<uint32_t>(pc);
+		break;
+
+#define LANE_ACCESS_CASE(name, op_code, text) case ByteOp::name:
+		TREBLE_FOREACH_SIMD_LOAD_LANE_OPCODE(LANE_ACCESS_CASE)
+		TREBLE_FOREACH_SIMD_STORE_LANE_OPCODE(LANE_ACCESS_CASE)
+#undef LANE_ACCESS_CASE
+		instr.args.memarg.align = 0;
+		instr.args.memarg.offset = read_immediate<uint32_t>(pc);
+		instr.args.memarg.lane =
+			read_immediate<uint8_t>(pc, sizeof(instr.args.memarg.offset));
+		break;
+
+#define LANE_CASE(name, op_code, text) case ByteOp::name:
+		TREBLE_FOREACH_SIMD_EXTRACT_LANE_OPCODE(LANE_CASE)
+		TREBLE_FOREACH_SIMD_REPLACE_LANE_OPCODE(LANE_CASE)
+#undef LANE_CASE
+		instr.args.lane = read_immediate<uint8_t>(pc);
+		break;
+
+	case ByteOp::v128_const:
+	case ByteOp::i8x16_shuffle:
+		std::memcpy(instr.args.v128, pc + sizeof(ByteOp),
+					sizeof(instr.args.v128));
+		break;
+
+	case ByteOp::drop:
+	case ByteOp::drop_v128:
+		instr.args.drop.v128 = op == ByteOp::drop_v128;
+		break;
+
+	case ByteOp::unknown:
+		instr.op_code =
+			static_cast<Instruction::OpCode>(read_immediate<uint16_t>(pc));
+		break;
+
+	default:
+		break;
+	}
+
+	pc += sizeof(ByteOp) + immediate_size(op);
+	return instr;
+}
+
+bool split_superinstruction(ByteOp op, ByteOp (&parts)[2]) {
+	switch (op) {
+#define I32_IMM_CASE(name, op_code, text)                                      \
+	case ByteOp::name##_imm:                                                   \
+		parts[0] = ByteOp::i32_const;                                          \
+		parts[1] = ByteOp::name;                                               \
+		return true;
+
+		TREBLE_FOREACH_I32_COMPARE_OPCODE(I32_IMM_CASE)
+		TREBLE_FOREACH_I32_ARITHMETIC_OPCODE(I32_IMM_CASE)
+
+#undef I32_IMM_CASE
+
+#define I64_IMM_CASE(name, op_code, text)                                      \
+	case ByteOp::name##_imm:                                                   \
+		parts[0] = ByteOp::i64_const;                                          \
+		parts[1] = ByteOp::name;                                               \
+		return true;
+
+		TREBLE_FOREACH_I64_COMPARE_OPCODE(I64_IMM_CASE)
+		TREBLE_FOREACH_I64_ARITHMETIC_OPCODE(I64_IMM_CASE)
+
+#undef I64_IMM_CASE
+
+#define IF_CASE(name, op_code, text)                                           \
+	case ByteOp::name##_if:                                                    \
+		parts[0] = ByteOp::name;                                               \
+		parts[1] = ByteOp::if_;                                                \
+		return true;
+
+		TREBLE_FOREACH_TEST_OPCODE(IF_CASE)
+		TREBLE_FOREACH_COMPARE_OPCODE(IF_CASE)
+
+#undef IF_CASE
+
+#define WRAP_CASE(name, op_code, text)                                         \
+	case ByteOp::name##_wrap:                                                  \
+		parts[0] = ByteOp::name;                                               \
+		parts[1] = ByteOp::i32_wrap_i64;                                       \
+		return true;
+
+		TREBLE_FOREACH_I64_ARITHMETIC_OPCODE(WRAP_CASE)
+
+#undef WRAP_CASE
+
+	default:
+		return false;
+	}
+}
+
+Instruction InstructionReader::next() {
+	if (pending) {
+		const Instruction instr = *pending;
+		pending.reset();
+		return instr;
+	}
+
+	const ByteOp op = read_byte_op(pc);
+	ByteOp parts[2];
+	if (!split_superinstruction(op, parts)) {
+		return read_instruction(pc);
+	}
+
+	Instruction first;
+	first.op_code = instruction_op_code(parts[0]);
+	Instruction second;
+	second.op_code = instruction_op_code(parts[1]);
+
+	if (parts[0] == ByteOp::i32_const) {
+		first.args.i32 = read_immediate<uint32_t>(pc);
+	} else if (parts[0] == ByteOp::i64_const) {
+		first.args.i64 = read_immediate<uint64_t>(pc);
+	} else if (parts[1] == ByteOp::if_) {
+		second.args.if_branch.block_type =
+			read_immediate<uint8_t>(pc, sizeof(int32_t));
+		second.args.if_branch.instr_1_offset =
+			sizeof(ByteOp) + immediate_size(op);
+		second.args.if_branch.instr_2_offset = read_immediate<int32_t>(pc);
+	}
+
+	pc += sizeof(ByteOp) + immediate_size(op);
+	pending = second;
+	return first;
+}
+
+const char *op_name(ByteOp op) {
+	switch (op) {
+#define OP_NAME_CASE(name, op_code, text)                                      \
+	case ByteOp::name:                                                         \
+		return text;
+
+		TREBLE_FOREACH_OPCODE(OP_NAME_CASE)
+
+#undef OP_NAME_CASE
+
+#define IMM_NAME_CASE(name, op_code, text)                                     \
+	case ByteOp::name##_imm:                                                   \
+		return text "_imm";
+
+		TREBLE_FOREACH_BINARY_OPCODE(IMM_NAME_CASE)
+
+#undef IMM_NAME_CASE
+
+#define IF_NAME_CASE(name, op_code, text)                                      \
+	case ByteOp::name##_if:                                                    \
+		return text "_if";
+
+		TREBLE_FOREACH_TEST_OPCODE(IF_NAME_CASE)
+		TREBLE_FOREACH_COMPARE_OPCODE(IF_NAME_CASE)
+
+#undef IF_NAME_CASE
+
+#define WRAP_NAME_CASE(name, op_code, text)                                    \
+	case ByteOp::name##_wrap:                                                  \
+		return text "_wrap";
+
+		TREBLE_FOREACH_I64_ARITHMETIC_OPCODE(WRAP_NAME_CASE)
+
+#undef WRAP_NAME_CASE
+
+	case ByteOp::drop_v128:
+		return "drop_v128";
+
+	case ByteOp::local_get_v128:
+		return "local.get_v128";
+
+	case ByteOp::local_set_v128:
+		return "local.set_v128";
+
+	case ByteOp::local_tee_v128:
+		return "local.tee_v128";
+
+	case ByteOp::end_function:
+		return "end_function";
+
+	default:
+		return "unknown";
+	}
+}
+
+} // namespace Treble
@@ -0,0 +1,279 @@
+#ifndef __TREBLE__BYTECODE_HXX__
+#define __TREBLE__BYTECODE_HXX__
+
+#include "arena.hxx"
+#include "instructions.hxx"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+
+/**
+ * Function bodies are stored in a compact encoding: one contiguous buffer per
+ * function, holding a sequence of instructions. Each instruction is a 16 bit
+ * ByteOp followed by only the immediates that op needs:
+ *
+ *   i32.const   u32 value
+ *   i64.const   u64 value
+ *   f32.const   f32 value
+ *   block,      u8 block type
+ *   loop
+ *   if          i32 offset from the if to the start of the else arm, or to the
+ *               end marker if there is no else arm, then u8 block type
+ *   else        i32 offset from the else to the end marker
+ *   br, br_if   i32 offset from the branch to its target, u32 number of slots
+ *               the values it takes along take, then u32 number of slots
+ *               below those that it takes off the stack
+ *   br_table    u32 number of labels besides the default one, u32 number of
+ *               slots the values it takes along take, then u32 offset from
+ *               the br_table to its jump table
+ *   local ops   u32 index of the first slot of the local in the frame
+ *   call        u32 index of the function
+ *   call        u32 index of the type of the callee, then u32 index of the
+ *   _indirect   call among the call_indirect instructions of the function
+ *   memory      u32 offset that is added to the address
+ *   accesses
+ *   v128 lane   u32 offset that is added to the address, then u8 lane index
+ *   accesses
+ *   v128.const  16 bytes of the value
+ *   i8x16       16 u8 lane indices
+ *   .shuffle
+ *   lane ops    u8 lane index, for extract_lane and replace_lane
+ *   unknown     u16 op code found in the binary
+ *
+ * Everything else has no immediates. Values are stored in host byte order and
+ * are not aligned.
+ *
+ * Common pairs of instructions are fused into superinstructions, which do the
+ * work of both with a single dispatch:
+ *
+ *   <op>_imm    a const followed by the binary op of the same type; the value
+ *               of the const, u32 for i32 and u64 for i64
+ *   <op>_if     a compare or eqz followed by an if; the immediates of the if
+ *   <op>_wrap   an i64 arithmetic op followed by i32.wrap_i64
+ *
+ * Branches never target the second instruction of a pair, as the only targets
+ * are the arms of an if, end markers, and the instructions right after a loop
+ * or an end marker.
+ *
+ * Branches are resolved when the body is encoded, so that taking one never
+ * needs to look at the blocks around it: a branch to a block or an if
+ * continues right after its end marker, one to a loop at the first
+ * instruction of the loop, and one to the body of the function at its
+ * end_function. How many slots it takes off the stack is found out by
+ * validation.
+ *
+ * The jump tables of the br_tables of a function follow its end_function, in
+ * the order of the br_tables. A table has an entry of JUMP_TABLE_ENTRY_SIZE
+ * bytes for each label, followed by one for the default label: i32 offset
+ * from the br_table to the target, then u32 number of slots the branch takes
+ * off the stack below the values it takes along.
+ *
+ * A drop whose operand is a v128 is encoded as drop_v128, as it takes two
+ * slots off the stack. Which drops those are is only known once the function
+ * has been validated. Accesses to a v128 local are encoded as the _v128
+ * variant of the local op, which moves two slots.
+ *
+ * The end marker that closes the function body is encoded as end_function,
+ * which returns from the function, so that the end markers of blocks need no
+ * check for whether they are the last one.
+ */
+
+namespace Treble {
+
+/**
+ * Op codes of the compact encoding. Instructions are numbered densely in the
+ * order of TREBLE_FOREACH_OPCODE so that dispatch tables stay small. The
+ * superinstructions follow: the _imm ops in the order of
+ * TREBLE_FOREACH_BINARY_OPCODE, the _if ops in the order of
+ * TREBLE_FOREACH_TEST_OPCODE and then TREBLE_FOREACH_COMPARE_OPCODE, and the
+ * _wrap ops in the order of TREBLE_FOREACH_I64_ARITHMETIC_OPCODE. Ops that
+ * only exist in the encoding come last.
+ */
+enum class ByteOp : uint16_t {
+#define BYTE_OP_ENUM_ENTRY(name, op_code, text) name,
+	TREBLE_FOREACH_OPCODE(BYTE_OP_ENUM_ENTRY)
+#undef BYTE_OP_ENUM_ENTRY
+
+#define IMM_ENUM_ENTRY(name, op_code, text) name##_imm,
+	TREBLE_FOREACH_BINARY_OPCODE(IMM_ENUM_ENTRY)
+#undef IMM_ENUM_ENTRY
+
+#define IF_ENUM_ENTRY(name, op_code, text) name##_if,
+	TREBLE_FOREACH_TEST_OPCODE(IF_ENUM_ENTRY)
+	TREBLE_FOREACH_COMPARE_OPCODE(IF_ENUM_ENTRY)
+#undef IF_ENUM_ENTRY
+
+#define WRAP_ENUM_ENTRY(name, op_code, text) name##_wrap,
+	TREBLE_FOREACH_I64_ARITHMETIC_OPCODE(WRAP_ENUM_ENTRY)
+#undef WRAP_ENUM_ENTRY
+
+	// a drop of a v128
+	drop_v128,
+
+	// accesses to a v128 local
+	local_get_v128,
+	local_set_v128,
+	local_tee_v128,
+
+	// the end marker of the function body
+	end_function,
+
+	// an op code treble does not understand, kept around for diagnostics
+	unknown,
+};
+
+inline ByteOp read_byte_op(const uint8_t *pc) {
+	ByteOp op;
+	std::memcpy(&op, pc, sizeof(op));
+	return op;
+}
+
+/**
+ * Reads an immediate of the instruction at pc. offset is the number of bytes
+ * of immediates that come before it.
+ */
+template <typename T>
+inline T read_immediate(const uint8_t *pc, size_t offset = 0) {
+	T value;
+	std::memcpy(&value, pc + sizeof(ByteOp) + offset, sizeof(value));
+	return value;
+}
+
+/**
+ * Size of an entry of the jump table of a br_table.
+ */
+constexpr size_t JUMP_TABLE_ENTRY_SIZE = 8;
+
+/**
+ * Size of the immediates that follow the given op.
+ */
+constexpr size_t immediate_size(ByteOp op) {
+	switch (op) {
+	case ByteOp::i32_const:
+	case ByteOp::f32_const:
+	case ByteOp::else_:
+	case ByteOp::call:
+		return 4;
+
+#define LOCAL_CASE(name, op_code, text) case ByteOp::name:
+		TREBLE_FOREACH_LOCAL_OPCODE(LOCAL_CASE)
+#undef LOCAL_CASE
+	case ByteOp::local_get_v128:
+	case ByteOp::local_set_v128:
+	case ByteOp::local_tee_v128:
+		return 4;
+
+#define MEMARG_CASE(name, op_code, text) case ByteOp::name:
+		TREBLE_FOREACH_MEMARG_OPCODE(MEMARG_CASE)
+#undef MEMARG_CASE
+		return 4;
+
+#define I32_IMM_CASE(name, op_code, text) case ByteOp::name##_imm:
+		TREBLE_FOREACH_I32_COMPARE_OPCODE(I32_IMM_CASE)
+		TREBLE_FOREACH_I32_ARITHMETIC_OPCODE(I32_IMM_CASE)
+#undef I32_IMM_CASE
+		return 4;
+
+	case ByteOp::if_:
+#define IF_CASE(name, op_code, text) case ByteOp::name##_if:
+		TREBLE_FOREACH_TEST_OPCODE(IF_CASE)
+		TREBLE_FOREACH_COMPARE_OPCODE(IF_CASE)
+#undef IF_CASE
+		return 5;
+
+	case ByteOp::i64_const:
+	case ByteOp::call_indirect:
+#define I64_IMM_CASE(name, op_code, text) case ByteOp::name##_imm:
+		TREBLE_FOREACH_I64_COMPARE_OPCODE(I64_IMM_CASE)
+		TREBLE_FOREACH_I64_ARITHMETIC_OPCODE(I64_IMM_CASE)
+#undef I64_IMM_CASE
+		return 8;
+
+	case ByteOp::block:
+	case ByteOp::loop:
+#define LANE_CASE(name, op_code, text) case ByteOp::name:
+		TREBLE_FOREACH_SIMD_EXTRACT_LANE_OPCODE(LANE_CASE)
+		TREBLE_FOREACH_SIMD_REPLACE_LANE_OPCODE(LANE_CASE)
+#undef LANE_CASE
+		return 1;
+
+	case ByteOp::br:
+	case ByteOp::br_if:
+	case ByteOp::br_table:
+		return 12;
+
+#define LANE_ACCESS_CASE(name, op_code, text) case ByteOp::name:
+		TREBLE_FOREACH_SIMD_LOAD_LANE_OPCODE(LANE_ACCESS_CASE)
+		TREBLE_FOREACH_SIMD_STORE_LANE_OPCODE(LANE_ACCESS_CASE)
+#undef LANE_ACCESS_CASE
+		return 5;
+
+	case ByteOp::v128_const:
+	case ByteOp::i8x16_shuffle:
+		return 16;
+
+	case ByteOp::unknown:
+		return 2;
+
+	default:
+		return 0;
+	}
+}
+
+/**
+ * The op the given instruction is encoded as, leaving superinstructions
+ * aside. The end marker that closes the function body comes out as end,
+ * although encode_function encodes it as end_function.
+ */
+ByteOp byte_op(const Instruction &instr);
+
+/**
+ * Encodes the given instructions, whose branch offsets count instructions, and
+ * returns the encoded body, allocated from the given arena. The depths of
+ * their branches have to be in range.
+ */
+uint8_t *encode_function(const Instruction *instructions, size_t count,
+						 Arena &arena, size_t &encoded_size);
+
+/**
+ * Decodes the instruction at pc and moves pc past it. Branch offsets of the
+ * returned instruction are byte offsets within the encoded body, and the
+ * labels of a br_table are left in its jump table. The depths of branches are
+ * not kept, as branches are resolved to offsets. pc must not point to a
+ * superinstruction, see InstructionReader.
+ */
+Instruction read_instruction(const uint8_t *&pc);
+
+/**
+ * Stores the ops the given superinstruction fuses in parts, in the order they
+ * run, and returns true. Returns false if op is not a superinstruction.
+ */
+bool split_superinstruction(ByteOp op, ByteOp (&parts)[2]);
+
+/**
+ * Decodes an encoded body instruction by instruction, like read_instruction,
+ * but takes superinstructions apart into the instructions they fuse. Branch
+ * offsets are relative to the first instruction of a pair, which is where the
+ * encoded instruction starts.
+ */
+class InstructionReader {
+  public:
+	explicit InstructionReader(const uint8_t *pc) : pc(pc) {}
+
+	Instruction next();
+
+  private:
+	const uint8_t *pc;
+	// the second half of the superinstruction that was read last
+	std::optional<Instruction> pending;
+};
+
+/**
+ * Name of the op in the text format, e.g. "i32.add".
+ */
+const char *op_name(ByteOp op);
+
+} // namespace Treble
+
+#endif
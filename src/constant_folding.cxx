@@ -0,0 +1,258 @@
+#include "constant_folding.hxx"
+#include "bytecode.hxx"
+#include "execution_context.hxx"
+#include "instructions.hxx"
+#include "module.hxx"
+#include "numeric.hxx"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace Treble {
+
+static bool is_const(const Instruction &instr, ValueType type) {
+	switch (type) {
+	case ValueType::i32:
+		return instr.op_code == Instruction::OpCode::i32_const;
+	case ValueType::i64:
+		return instr.op_code == Instruction::OpCode::i64_const;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Value of an i32 or i64 constant, in the slot representation numeric.hxx
+ * works on.
+ */
+static uint64_t const_value(const Instruction &instr) {
+	return instr.op_code == Instruction::OpCode::i64_const ? instr.args.i64
+														   : instr.args.i32;
+}
+
+/**
+ * Turns instr into a constant of the given type. Only the fields a constant
+ * uses are written, rather than a whole new instruction.
+ */
+static void set_const(Instruction &instr, ValueType type, uint64_t value) {
+	if (type == ValueType::i64) {
+		instr.op_code = Instruction::OpCode::i64_const;
+		instr.args.i64 = value;
+	} else {
+		instr.op_code = Instruction::OpCode::i32_const;
+		instr.args.i32 = static_cast<uint32_t>(value);
+	}
+}
+
+/**
+ * Replaces the constant at the end of the first size instructions of folded
+ * with the result of the unary op on it, and returns the new number of folded
+ * instructions. Returns 0 if the operand is not a constant.
+ */
+static size_t fold_unary(Instruction *folded, size_t size, ByteOp op,
+						 NumericSignature signature) {
+	if (size < 1 || !is_const(folded[size - 1], signature.operand)) {
+		return 0;
+	}
+
+	const uint64_t c1 = const_value(folded[size - 1]);
+	set_const(folded[size - 1], signature.result, evaluate_unary(op, c1));
+	return size;
+}
+
+/**
+ * Replaces the two constants at the end of the first size instructions of
+ * folded with the result of the binary op on them, and returns the new number
+ * of folded instructions. Returns 0 if either operand is not a constant, or if
+ * the op traps on them, which is left for the function to do when it runs.
+ */
+static size_t fold_binary(Instruction *folded, size_t size, ByteOp op,
+						  NumericSignature signature) {
+	if (size < 2 || !is_const(folded[size - 2], signature.operand) ||
+		!is_const(folded[size - 1], signature.operand)) {
+		return 0;
+	}
+
+	const uint64_t c1 = const_value(folded[size - 2]);
+	const uint64_t c2 = const_value(folded[size - 1]);
+	if (binary_trap(op, c1, c2) != Trap::None) {
+		return 0;
+	}
+
+	set_const(folded[size - 2], signature.result, evaluate_binary(op, c1, c2));
+	return size - 1;
+}
+
+bool fold_constants(std::vector<Instruction> &instructions) {
+	// the folded instructions are written over the ones already read, as
+	// folding only ever takes instructions out. an instruction only ever
+	// folds with the ones right before it in folded. those run right before
+	// it, as the only instructions that are branched to come right after an
+	// if, an else, a loop or an end marker, or are end markers.
+	Instruction *const folded = instructions.data();
+	const size_t count = instructions.size();
+	size_t size = 0;
+	bool changed = false;
+
+	// branches count the blocks around them, so an if that is folded away
+	// has to leave a block behind if anything branches
+	const bool has_branches =
+		std::any_of(instructions.begin(), instructions.end(),
+					[](const Instruction &instr) {
+						return instr.op_code == Instruction::OpCode::br ||
+							   instr.op_code == Instruction::OpCode::br_if ||
+							   instr.op_code == Instruction::OpCode::br_table;
+					});
+
+	// for every block that is open at the current instruction, the position
+	// of its block, loop, if or else in folded, or nothing if the if was
+	// folded away
+	std::vector<std::optional<size_t>> blocks;
+
+	for (size_t i = 0; i < count; ++i) {
+		// only instructions before it are written to before it is folded
+		const Instruction &instr = folded[i];
+
+		switch (instr.op_code) {
+#define UNARY_FOLD_CASE(name, op_code, text)                                   \
+	case Instruction::OpCode::name: {                                          \
+		constexpr NumericSignature signature = numeric_signature(text);        \
+		if (const size_t folded_size =                                         \
+				fold_unary(folded, size, ByteOp::name, signature)) {           \
+			size = folded_size;                                                \
+			changed = true;                                                    \
+			continue;                                                          \
+		}                                                                      \
+		break;                                                                 \
+	}
+
+			TREBLE_FOREACH_UNARY_OPCODE(UNARY_FOLD_CASE)
+
+#undef UNARY_FOLD_CASE
+
+#define BINARY_FOLD_CASE(name, op_code, text)                                  \
+	case Instruction::OpCode::name: {                                          \
+		constexpr NumericSignature signature = numeric_signature(text);        \
+		if (const size_t folded_size =                                         \
+				fold_binary(folded, size, ByteOp::name, signature)) {          \
+			size = folded_size;                                                \
+			changed = true;                                                    \
+			continue;                                                          \
+		}                                                                      \
+		break;                                                                 \
+	}
+
+			TREBLE_FOREACH_BINARY_OPCODE(BINARY_FOLD_CASE)
+
+#undef BINARY_FOLD_CASE
+
+		case Instruction::OpCode::drop:
+			if (size > 0 &&
+				(folded[size - 1].op_code == Instruction::OpCode::i32_const ||
+				 folded[size - 1].op_code == Instruction::OpCode::i64_const ||
+				 folded[size - 1].op_code == Instruction::OpCode::f32_const)) {
+				size--;
+				changed = true;
+				continue;
+			}
+			break;
+
+		case Instruction::OpCode::block:
+		case Instruction::OpCode::loop:
+			blocks.push_back(size);
+			break;
+
+		case Instruction::OpCode::if_: {
+			if (size < 1 || !is_const(folded[size - 1], ValueType::i32)) {
+				blocks.push_back(size);
+				break;
+			}
+
+			const bool condition = folded[size - 1].args.i32 != 0;
+			size--;
+			changed = true;
+
+			// the first instruction of the else arm, or the end marker if
+			// there is none
+			const size_t target = i + instr.args.if_branch.instr_2_offset;
+			const bool has_else =
+				folded[target - 1].op_code == Instruction::OpCode::else_;
+			if (condition || has_else) {
+				if (has_branches) {
+					// the arm that is taken runs in a block instead, which
+					// keeps its end marker
+					const uint8_t block_type = instr.args.if_branch.block_type;
+					folded[size].op_code = Instruction::OpCode::block;
+					folded[size].args.block.block_type = block_type;
+					blocks.push_back(size++);
+				} else {
+					// the else and the end marker are dropped when they
+					// come up
+					blocks.push_back(std::nullopt);
+				}
+				if (!condition) {
+					i = target - 1;
+				}
+			} else {
+				// the whole if goes, end marker included
+				i = target;
+			}
+			continue;
+		}
+
+		case Instruction::OpCode::else_: {
+			const std::optional<size_t> begin = blocks.back();
+			if (!begin) {
+				// the first arm was taken, so the else arm goes, end marker
+				// included
+				blocks.pop_back();
+				i += instr.args.else_branch.end_marker_offset;
+				continue;
+			}
+			if (folded[*begin].op_code == Instruction::OpCode::block) {
+				// the first arm of an if that was turned into a block was
+				// taken, so the else arm goes, up to the end marker
+				i += instr.args.else_branch.end_marker_offset - 1;
+				continue;
+			}
+
+			folded[*begin].args.if_branch.instr_2_offset = size - *begin + 1;
+			blocks.back() = size;
+			break;
+		}
+
+		case Instruction::OpCode::end: {
+			if (blocks.empty()) {
+				// the end of the function
+				break;
+			}
+
+			const std::optional<size_t> begin = blocks.back();
+			blocks.pop_back();
+			if (!begin) {
+				continue;
+			}
+
+			Instruction &block = folded[*begin];
+			if (block.op_code == Instruction::OpCode::if_) {
+				block.args.if_branch.instr_2_offset = size - *begin;
+			} else if (block.op_code == Instruction::OpCode::else_) {
+				block.args.else_branch.end_marker_offset = size - *begin;
+			}
+			break;
+		}
+
+		default:
+			break;
+		}
+
+		folded[size++] = instr;
+	}
+
+	instructions.resize(size);
+	return changed;
+}
+
+} // namespace Treble
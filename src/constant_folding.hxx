@@ -0,0 +1,30 @@
+#ifndef __TREBLE__CONSTANT_FOLDING_HXX__
+#define __TREBLE__CONSTANT_FOLDING_HXX__
+
+#include "instructions.hxx"
+#include <vector>
+
+namespace Treble {
+
+/**
+ * Folds the decoded instructions of a valid function in place: numeric
+ * instructions whose operands are all constants become a constant of their
+ * result, constants that are dropped right away go, and an if whose condition
+ * is a constant is replaced by the arm it always takes, without the if, its
+ * else and its end marker. If the function has branches, the arm is kept in a
+ * block of the same type instead, so that the branches in it still count the
+ * same blocks around them. The branch offsets of the ifs and elses that are
+ * left are rewritten to match. Returns false if there was nothing to fold.
+ *
+ * Division and remainder are only folded when they cannot fault, and are left
+ * to fault at run time otherwise. The stack never gets higher for folding, so
+ * the maximum stack height of the function stays an upper bound.
+ *
+ * The arms that are dropped are never looked at, so the function has to have
+ * been validated beforehand.
+ */
+bool fold_constants(std::vector<Instruction> &instructions);
+
+} // namespace Treble
+
+#endif
@@ -0,0 +1,71 @@
+#include "execution_context.hxx"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+
+namespace Treble {
+
+ExecutionContext::ExecutionContext(size_t stack_size, size_t max_call_depth)
+	: max_slots(stack_size),
+	  frames(static_cast<Frame *>(std::malloc(max_call_depth * sizeof(Frame)))),
+	  frame_capacity(max_call_depth) {}
+
+ExecutionContext::~ExecutionContext() { release(); }
+
+ExecutionContext::ExecutionContext(ExecutionContext &&other)
+	: trap(other.trap),
+	  max_slots(std::exchange(other.max_slots, 0)),
+	  slot_buffer(std::exchange(other.slot_buffer, nullptr)),
+	  slot_capacity(std::exchange(other.slot_capacity, 0)),
+	  frames(std::exchange(other.frames, nullptr)),
+	  frame_capacity(std::exchange(other.frame_capacity, 0)),
+	  frame_count(std::exchange(other.frame_count, 0)) {}
+
+ExecutionContext &ExecutionContext::operator=(ExecutionContext &&other) {
+	if (this != &other) {
+		release();
+		trap = other.trap;
+		max_slots = std::exchange(other.max_slots, 0);
+		slot_buffer = std::exchange(other.slot_buffer, nullptr);
+		slot_capacity = std::exchange(other.slot_capacity, 0);
+		frames = std::exchange(other.frames, nullptr);
+		frame_capacity = std::exchange(other.frame_capacity, 0);
+		frame_count = std::exchange(other.frame_count, 0);
+	}
+	return *this;
+}
+
+void ExecutionContext::release() {
+	std::free(slot_buffer);
+	std::free(frames);
+}
+
+uint64_t *ExecutionContext::slots(size_t count) {
+	if (count > max_slots) {
+		trap = Trap::StackOverflow;
+		return nullptr;
+	}
+
+	// functions that need no slots at all still get a valid pointer
+	if (slot_buffer == nullptr || count > slot_capacity) {
+		std::free(slot_buffer);
+		slot_capacity = std::max<size_t>(count, 1);
+		slot_buffer = static_cast<uint64_t *>(
+			std::malloc(slot_capacity * sizeof(uint64_t)));
+	}
+	return slot_buffer;
+}
+
+void ExecutionContext::reset() {
+	trap = Trap::None;
+	frame_count = 0;
+}
+
+ExecutionContext &thread_execution_context() {
+	thread_local ExecutionContext context;
+	return context;
+}
+
+} // namespace Treble
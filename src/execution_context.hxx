@@ -0,0 +1,153 @@
+#ifndef __TREBLE__EXECUTION_CONTEXT_HXX__
+#define __TREBLE__EXECUTION_CONTEXT_HXX__
+
+#include "module.hxx"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace Treble {
+
+/**
+ * A function activation.
+ */
+struct Frame {
+	FunctionInstance *func;
+
+	/**
+	 * Index of the first slot that belongs to the function, which holds its
+	 * first parameter.
+	 */
+	size_t stack_base;
+
+	/**
+	 * The instruction the caller continues at once the function returns, or
+	 * nullptr if the host called it.
+	 */
+	const uint8_t *return_pc;
+};
+
+/**
+ * Why a call was aborted.
+ */
+enum class Trap : uint8_t {
+	None,
+	// the function needs more slots than the context can hold
+	StackOverflow,
+	// calls were nested deeper than the frame stack allows
+	CallStackExhausted,
+	// a load or store went past the end of the memory
+	OutOfBoundsMemoryAccess,
+	// an atomic access was not naturally aligned
+	UnalignedAtomic,
+	// memory.atomic.wait on a memory that is not shared, where nothing could
+	// ever notify it
+	WaitOnUnsharedMemory,
+	// call_indirect with an index past the end of the table
+	UndefinedElement,
+	// call_indirect with an index of an entry no element segment filled in
+	UninitializedElement,
+	// call_indirect found a function of another type than it expects
+	IndirectCallTypeMismatch,
+	// an integer division or remainder by zero
+	IntegerDivideByZero,
+	// a signed division of the most negative value by -1, whose quotient does
+	// not fit
+	IntegerOverflow,
+};
+
+/**
+ * Everything a call needs besides the module instance: the untagged slots the
+ * interpreters and native code keep their operands in, and the frame stack.
+ * All of it lives on the heap, so calls do not need a big native stack, and it
+ * is set up once and reused by every call made in the context. A context must
+ * only be used by one thread at a time; hosts keep one per worker thread, or
+ * pool them.
+ */
+class ExecutionContext {
+  public:
+	static constexpr size_t DEFAULT_STACK_SIZE = 64 * 1024;
+	static constexpr size_t DEFAULT_MAX_CALL_DEPTH = 1024;
+
+	/**
+	 * stack_size is the most slots a call may use, max_call_depth the number
+	 * of frames.
+	 */
+	explicit ExecutionContext(size_t stack_size = DEFAULT_STACK_SIZE,
+							  size_t max_call_depth = DEFAULT_MAX_CALL_DEPTH);
+	~ExecutionContext();
+
+	ExecutionContext(ExecutionContext &&other);
+	ExecutionContext &operator=(ExecutionContext &&other);
+
+	ExecutionContext(const ExecutionContext &) = delete;
+	ExecutionContext &operator=(const ExecutionContext &) = delete;
+
+	size_t stack_size() const { return max_slots; }
+
+	/**
+	 * Returns at least count untagged slots, or nullptr and sets trap if that
+	 * is more than stack_size. They are only grown between calls, when none of
+	 * them are in use, so their contents are not kept.
+	 */
+	uint64_t *slots(size_t count);
+
+	/**
+	 * Pushes a frame, or returns false and sets trap if the frame stack is
+	 * full.
+	 */
+	bool push_frame(const Frame &frame) {
+		if (frame_count == frame_capacity) {
+			trap = Trap::CallStackExhausted;
+			return false;
+		}
+		frames[frame_count] = frame;
+		// a signal handler walking the frames must never see the count before
+		// the frame it covers
+		std::atomic_signal_fence(std::memory_order_release);
+		frame_count++;
+		return true;
+	}
+
+	void pop_frame() { frame_count--; }
+	size_t call_depth() const { return frame_count; }
+
+	/**
+	 * The frames of the calls in progress, outermost first. Safe to read from
+	 * a signal handler that interrupted the thread using the context.
+	 */
+	std::span<const Frame> active_frames() const {
+		return {frames, frame_count};
+	}
+
+	/**
+	 * Clears whatever an aborted call left behind.
+	 */
+	void reset();
+
+	/**
+	 * Set when a call is aborted, and stays set until reset.
+	 */
+	Trap trap = Trap::None;
+
+  private:
+	void release();
+
+	size_t max_slots;
+	uint64_t *slot_buffer = nullptr;
+	size_t slot_capacity = 0;
+
+	Frame *frames;
+	size_t frame_capacity;
+	size_t frame_count = 0;
+};
+
+/**
+ * The context of the calling thread, created on first use.
+ */
+ExecutionContext &thread_execution_context();
+
+} // namespace Treble
+
+#endif
@@ -5,83 +5,670 @@
 #include <cstdint>
 
 /**
- * Represents a WASM instruction as defined in the specification.
+ * Invokes X(name, op code, text format name) for every numeric instruction that
+ * pops one operand off the stack and pushes one result.
+ */
+#define TREBLE_FOREACH_UNARY_OPCODE(X)                                         \
+	X(i32_eqz, 0x45, "i32.eqz")                                                \
+	X(i32_clz, 0x67, "i32.clz")                                                \
+	X(i32_ctz, 0x68, "i32.ctz")                                                \
+	X(i32_popcnt, 0x69, "i32.popcnt")                                          \
+                                                                               \
+	X(i64_eqz, 0x50, "i64.eqz")                                                \
+	X(i64_clz, 0x79, "i64.clz")                                                \
+	X(i64_ctz, 0x7A, "i64.ctz")                                                \
+	X(i64_popcnt, 0x7B, "i64.popcnt")                                          \
+                                                                               \
+	X(i32_wrap_i64, 0xA7, "i32.wrap_i64")
+
+/**
+ * Invokes X(name, op code, text format name) for every unary instruction that
+ * tests its operand for zero.
+ */
+#define TREBLE_FOREACH_TEST_OPCODE(X)                                          \
+	X(i32_eqz, 0x45, "i32.eqz")                                                \
+	X(i64_eqz, 0x50, "i64.eqz")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that
+ * compares two i32 operands and pushes 1 or 0.
+ */
+#define TREBLE_FOREACH_I32_COMPARE_OPCODE(X)                                   \
+	X(i32_eq, 0x46, "i32.eq")                                                  \
+	X(i32_ne, 0x47, "i32.ne")                                                  \
+	X(i32_lt_s, 0x48, "i32.lt_s")                                              \
+	X(i32_lt_u, 0x49, "i32.lt_u")                                              \
+	X(i32_gt_s, 0x4A, "i32.gt_s")                                              \
+	X(i32_gt_u, 0x4B, "i32.gt_u")                                              \
+	X(i32_le_s, 0x4C, "i32.le_s")                                              \
+	X(i32_le_u, 0x4D, "i32.le_u")                                              \
+	X(i32_ge_s, 0x4E, "i32.ge_s")                                              \
+	X(i32_ge_u, 0x4F, "i32.ge_u")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that
+ * compares two i64 operands and pushes 1 or 0.
+ */
+#define TREBLE_FOREACH_I64_COMPARE_OPCODE(X)                                   \
+	X(i64_eq, 0x51, "i64.eq")                                                  \
+	X(i64_ne, 0x52, "i64.ne")                                                  \
+	X(i64_lt_s, 0x53, "i64.lt_s")                                              \
+	X(i64_lt_u, 0x54, "i64.lt_u")                                              \
+	X(i64_gt_s, 0x55, "i64.gt_s")                                              \
+	X(i64_gt_u, 0x56, "i64.gt_u")                                              \
+	X(i64_le_s, 0x57, "i64.le_s")                                              \
+	X(i64_le_u, 0x58, "i64.le_u")                                              \
+	X(i64_ge_s, 0x59, "i64.ge_s")                                              \
+	X(i64_ge_u, 0x5A, "i64.ge_u")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that
+ * compares two integer operands.
+ */
+#define TREBLE_FOREACH_COMPARE_OPCODE(X)                                       \
+	TREBLE_FOREACH_I32_COMPARE_OPCODE(X)                                       \
+	TREBLE_FOREACH_I64_COMPARE_OPCODE(X)
+
+/**
+ * Invokes X(name, op code, text format name) for every i32 instruction that
+ * pops two operands off the stack and pushes an i32 computed from them.
+ */
+#define TREBLE_FOREACH_I32_ARITHMETIC_OPCODE(X)                                \
+	X(i32_add, 0x6A, "i32.add")                                                \
+	X(i32_sub, 0x6B, "i32.sub")                                                \
+	X(i32_mul, 0x6C, "i32.mul")                                                \
+	X(i32_div_s, 0x6D, "i32.div_s")                                            \
+	X(i32_div_u, 0x6E, "i32.div_u")                                            \
+	X(i32_rem_s, 0x6F, "i32.rem_s")                                            \
+	X(i32_rem_u, 0x70, "i32.rem_u")                                            \
+	X(i32_and, 0x71, "i32.and")                                                \
+	X(i32_or, 0x72, "i32.or")                                                  \
+	X(i32_xor, 0x73, "i32.xor")                                                \
+	X(i32_shl, 0x74, "i32.shl")                                                \
+	X(i32_shr_s, 0x75, "i32.shr_s")                                            \
+	X(i32_shr_u, 0x76, "i32.shr_u")                                            \
+	X(i32_rotl, 0x77, "i32.rotl")                                              \
+	X(i32_rotr, 0x78, "i32.rotr")
+
+/**
+ * Invokes X(name, op code, text format name) for every i64 instruction that
+ * pops two operands off the stack and pushes an i64 computed from them.
+ */
+#define TREBLE_FOREACH_I64_ARITHMETIC_OPCODE(X)                                \
+	X(i64_add, 0x7C, "i64.add")                                                \
+	X(i64_sub, 0x7D, "i64.sub")                                                \
+	X(i64_mul, 0x7E, "i64.mul")                                                \
+	X(i64_div_s, 0x7F, "i64.div_s")                                            \
+	X(i64_div_u, 0x80, "i64.div_u")                                            \
+	X(i64_rem_s, 0x81, "i64.rem_s")                                            \
+	X(i64_rem_u, 0x82, "i64.rem_u")                                            \
+	X(i64_and, 0x83, "i64.and")                                                \
+	X(i64_or, 0x84, "i64.or")                                                  \
+	X(i64_xor, 0x85, "i64.xor")                                                \
+	X(i64_shl, 0x86, "i64.shl")                                                \
+	X(i64_shr_s, 0x87, "i64.shr_s")                                            \
+	X(i64_shr_u, 0x88, "i64.shr_u")                                            \
+	X(i64_rotl, 0x89, "i64.rotl")                                              \
+	X(i64_rotr, 0x8A, "i64.rotr")
+
+/**
+ * Invokes X(name, op code, text format name) for every numeric instruction that
+ * pops two operands off the stack and pushes one result.
+ */
+#define TREBLE_FOREACH_BINARY_OPCODE(X)                                        \
+	TREBLE_FOREACH_COMPARE_OPCODE(X)                                           \
+	TREBLE_FOREACH_I32_ARITHMETIC_OPCODE(X)                                    \
+	TREBLE_FOREACH_I64_ARITHMETIC_OPCODE(X)
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that pops an
+ * address off the stack and pushes the value loaded from it. The name in the
+ * text format starts with the type of the value.
+ */
+#define TREBLE_FOREACH_LOAD_OPCODE(X)                                          \
+	X(i32_load, 0x28, "i32.load")                                              \
+	X(i64_load, 0x29, "i64.load")                                              \
+	X(i32_load8_s, 0x2C, "i32.load8_s")                                        \
+	X(i32_load8_u, 0x2D, "i32.load8_u")                                        \
+	X(i32_load16_s, 0x2E, "i32.load16_s")                                      \
+	X(i32_load16_u, 0x2F, "i32.load16_u")                                      \
+	X(i64_load8_s, 0x30, "i64.load8_s")                                        \
+	X(i64_load8_u, 0x31, "i64.load8_u")                                        \
+	X(i64_load16_s, 0x32, "i64.load16_s")                                      \
+	X(i64_load16_u, 0x33, "i64.load16_u")                                      \
+	X(i64_load32_s, 0x34, "i64.load32_s")                                      \
+	X(i64_load32_u, 0x35, "i64.load32_u")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that pops a
+ * value and an address off the stack and stores the value at the address. The
+ * name in the text format starts with the type of the value.
+ */
+#define TREBLE_FOREACH_STORE_OPCODE(X)                                         \
+	X(i32_store, 0x36, "i32.store")                                            \
+	X(i64_store, 0x37, "i64.store")                                            \
+	X(i32_store8, 0x3A, "i32.store8")                                          \
+	X(i32_store16, 0x3B, "i32.store16")                                        \
+	X(i64_store8, 0x3C, "i64.store8")                                          \
+	X(i64_store16, 0x3D, "i64.store16")                                        \
+	X(i64_store32, 0x3E, "i64.store32")
+
+/**
+ * Invokes X(name, op code, text format name) for every atomic load. Atomic
+ * instructions are prefixed with 0xFE in the binary, their op codes here are
+ * 0xFE00 plus the op code that follows the prefix.
+ */
+#define TREBLE_FOREACH_ATOMIC_LOAD_OPCODE(X)                                   \
+	X(i32_atomic_load, 0xFE10, "i32.atomic.load")                              \
+	X(i64_atomic_load, 0xFE11, "i64.atomic.load")                              \
+	X(i32_atomic_load8_u, 0xFE12, "i32.atomic.load8_u")                        \
+	X(i32_atomic_load16_u, 0xFE13, "i32.atomic.load16_u")                      \
+	X(i64_atomic_load8_u, 0xFE14, "i64.atomic.load8_u")                        \
+	X(i64_atomic_load16_u, 0xFE15, "i64.atomic.load16_u")                      \
+	X(i64_atomic_load32_u, 0xFE16, "i64.atomic.load32_u")
+
+/**
+ * Invokes X(name, op code, text format name) for every atomic store.
+ */
+#define TREBLE_FOREACH_ATOMIC_STORE_OPCODE(X)                                  \
+	X(i32_atomic_store, 0xFE17, "i32.atomic.store")                            \
+	X(i64_atomic_store, 0xFE18, "i64.atomic.store")                            \
+	X(i32_atomic_store8, 0xFE19, "i32.atomic.store8")                          \
+	X(i32_atomic_store16, 0xFE1A, "i32.atomic.store16")                        \
+	X(i64_atomic_store8, 0xFE1B, "i64.atomic.store8")                          \
+	X(i64_atomic_store16, 0xFE1C, "i64.atomic.store16")                        \
+	X(i64_atomic_store32, 0xFE1D, "i64.atomic.store32")
+
+/**
+ * Invokes X(name, op code, text format name) for every atomic read-modify-write
+ * instruction that pops an address and an operand off the stack and pushes the
+ * value the memory held before.
+ */
+#define TREBLE_FOREACH_ATOMIC_RMW_OPCODE(X)                                    \
+	X(i32_atomic_rmw_add, 0xFE1E, "i32.atomic.rmw.add")                        \
+	X(i64_atomic_rmw_add, 0xFE1F, "i64.atomic.rmw.add")                        \
+	X(i32_atomic_rmw8_add_u, 0xFE20, "i32.atomic.rmw8.add_u")                  \
+	X(i32_atomic_rmw16_add_u, 0xFE21, "i32.atomic.rmw16.add_u")                \
+	X(i64_atomic_rmw8_add_u, 0xFE22, "i64.atomic.rmw8.add_u")                  \
+	X(i64_atomic_rmw16_add_u, 0xFE23, "i64.atomic.rmw16.add_u")                \
+	X(i64_atomic_rmw32_add_u, 0xFE24, "i64.atomic.rmw32.add_u")                \
+	X(i32_atomic_rmw_sub, 0xFE25, "i32.atomic.rmw.sub")                        \
+	X(i64_atomic_rmw_sub, 0xFE26, "i64.atomic.rmw.sub")                        \
+	X(i32_atomic_rmw8_sub_u, 0xFE27, "i32.atomic.rmw8.sub_u")                  \
+	X(i32_atomic_rmw16_sub_u, 0xFE28, "i32.atomic.rmw16.sub_u")                \
+	X(i64_atomic_rmw8_sub_u, 0xFE29, "i64.atomic.rmw8.sub_u")                  \
+	X(i64_atomic_rmw16_sub_u, 0xFE2A, "i64.atomic.rmw16.sub_u")                \
+	X(i64_atomic_rmw32_sub_u, 0xFE2B, "i64.atomic.rmw32.sub_u")                \
+	X(i32_atomic_rmw_and, 0xFE2C, "i32.atomic.rmw.and")                        \
+	X(i64_atomic_rmw_and, 0xFE2D, "i64.atomic.rmw.and")                        \
+	X(i32_atomic_rmw8_and_u, 0xFE2E, "i32.atomic.rmw8.and_u")                  \
+	X(i32_atomic_rmw16_and_u, 0xFE2F, "i32.atomic.rmw16.and_u")                \
+	X(i64_atomic_rmw8_and_u, 0xFE30, "i64.atomic.rmw8.and_u")                  \
+	X(i64_atomic_rmw16_and_u, 0xFE31, "i64.atomic.rmw16.and_u")                \
+	X(i64_atomic_rmw32_and_u, 0xFE32, "i64.atomic.rmw32.and_u")                \
+	X(i32_atomic_rmw_or, 0xFE33, "i32.atomic.rmw.or")                          \
+	X(i64_atomic_rmw_or, 0xFE34, "i64.atomic.rmw.or")                          \
+	X(i32_atomic_rmw8_or_u, 0xFE35, "i32.atomic.rmw8.or_u")                    \
+	X(i32_atomic_rmw16_or_u, 0xFE36, "i32.atomic.rmw16.or_u")                  \
+	X(i64_atomic_rmw8_or_u, 0xFE37, "i64.atomic.rmw8.or_u")                    \
+	X(i64_atomic_rmw16_or_u, 0xFE38, "i64.atomic.rmw16.or_u")                  \
+	X(i64_atomic_rmw32_or_u, 0xFE39, "i64.atomic.rmw32.or_u")                  \
+	X(i32_atomic_rmw_xor, 0xFE3A, "i32.atomic.rmw.xor")                        \
+	X(i64_atomic_rmw_xor, 0xFE3B, "i64.atomic.rmw.xor")                        \
+	X(i32_atomic_rmw8_xor_u, 0xFE3C, "i32.atomic.rmw8.xor_u")                  \
+	X(i32_atomic_rmw16_xor_u, 0xFE3D, "i32.atomic.rmw16.xor_u")                \
+	X(i64_atomic_rmw8_xor_u, 0xFE3E, "i64.atomic.rmw8.xor_u")                  \
+	X(i64_atomic_rmw16_xor_u, 0xFE3F, "i64.atomic.rmw16.xor_u")                \
+	X(i64_atomic_rmw32_xor_u, 0xFE40, "i64.atomic.rmw32.xor_u")                \
+	X(i32_atomic_rmw_xchg, 0xFE41, "i32.atomic.rmw.xchg")                      \
+	X(i64_atomic_rmw_xchg, 0xFE42, "i64.atomic.rmw.xchg")                      \
+	X(i32_atomic_rmw8_xchg_u, 0xFE43, "i32.atomic.rmw8.xchg_u")                \
+	X(i32_atomic_rmw16_xchg_u, 0xFE44, "i32.atomic.rmw16.xchg_u")              \
+	X(i64_atomic_rmw8_xchg_u, 0xFE45, "i64.atomic.rmw8.xchg_u")                \
+	X(i64_atomic_rmw16_xchg_u, 0xFE46, "i64.atomic.rmw16.xchg_u")              \
+	X(i64_atomic_rmw32_xchg_u, 0xFE47, "i64.atomic.rmw32.xchg_u")
+
+/**
+ * Invokes X(name, op code, text format name) for every atomic compare exchange,
+ * which pops an address, an expected value and a replacement off the stack and
+ * pushes the value the memory held before.
+ */
+#define TREBLE_FOREACH_ATOMIC_CMPXCHG_OPCODE(X)                                \
+	X(i32_atomic_rmw_cmpxchg, 0xFE48, "i32.atomic.rmw.cmpxchg")                \
+	X(i64_atomic_rmw_cmpxchg, 0xFE49, "i64.atomic.rmw.cmpxchg")                \
+	X(i32_atomic_rmw8_cmpxchg_u, 0xFE4A, "i32.atomic.rmw8.cmpxchg_u")          \
+	X(i32_atomic_rmw16_cmpxchg_u, 0xFE4B, "i32.atomic.rmw16.cmpxchg_u")        \
+	X(i64_atomic_rmw8_cmpxchg_u, 0xFE4C, "i64.atomic.rmw8.cmpxchg_u")          \
+	X(i64_atomic_rmw16_cmpxchg_u, 0xFE4D, "i64.atomic.rmw16.cmpxchg_u")        \
+	X(i64_atomic_rmw32_cmpxchg_u, 0xFE4E, "i64.atomic.rmw32.cmpxchg_u")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction of the SIMD
+ * proposal that pops an address off the stack and pushes the v128 loaded from
+ * it. SIMD instructions are prefixed with 0xFD in the binary, their op codes
+ * here are 0xFD00 plus the op code that follows the prefix.
+ */
+#define TREBLE_FOREACH_SIMD_LOAD_OPCODE(X)                                     \
+	X(v128_load, 0xFD00, "v128.load")                                          \
+	X(v128_load8x8_s, 0xFD01, "v128.load8x8_s")                                \
+	X(v128_load8x8_u, 0xFD02, "v128.load8x8_u")                                \
+	X(v128_load16x4_s, 0xFD03, "v128.load16x4_s")                              \
+	X(v128_load16x4_u, 0xFD04, "v128.load16x4_u")                              \
+	X(v128_load32x2_s, 0xFD05, "v128.load32x2_s")                              \
+	X(v128_load32x2_u, 0xFD06, "v128.load32x2_u")                              \
+	X(v128_load8_splat, 0xFD07, "v128.load8_splat")                            \
+	X(v128_load16_splat, 0xFD08, "v128.load16_splat")                          \
+	X(v128_load32_splat, 0xFD09, "v128.load32_splat")                          \
+	X(v128_load64_splat, 0xFD0A, "v128.load64_splat")                          \
+	X(v128_load32_zero, 0xFD5C, "v128.load32_zero")                            \
+	X(v128_load64_zero, 0xFD5D, "v128.load64_zero")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that pops
+ * a v128 and an address off the stack, and pushes the v128 with one of its
+ * lanes loaded from the address. They take a memarg and a lane index.
+ */
+#define TREBLE_FOREACH_SIMD_LOAD_LANE_OPCODE(X)                                \
+	X(v128_load8_lane, 0xFD54, "v128.load8_lane")                              \
+	X(v128_load16_lane, 0xFD55, "v128.load16_lane")                            \
+	X(v128_load32_lane, 0xFD56, "v128.load32_lane")                            \
+	X(v128_load64_lane, 0xFD57, "v128.load64_lane")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that pops
+ * a v128 and an address off the stack, and stores one of the lanes of the v128
+ * at the address. They take a memarg and a lane index.
+ */
+#define TREBLE_FOREACH_SIMD_STORE_LANE_OPCODE(X)                               \
+	X(v128_store8_lane, 0xFD58, "v128.store8_lane")                            \
+	X(v128_store16_lane, 0xFD59, "v128.store16_lane")                          \
+	X(v128_store32_lane, 0xFD5A, "v128.store32_lane")                          \
+	X(v128_store64_lane, 0xFD5B, "v128.store64_lane")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that pops
+ * a scalar off the stack and pushes a v128 with the scalar in every lane. The
+ * name in the text format starts with the shape of the v128.
+ */
+#define TREBLE_FOREACH_SIMD_SPLAT_OPCODE(X)                                    \
+	X(i8x16_splat, 0xFD0F, "i8x16.splat")                                      \
+	X(i16x8_splat, 0xFD10, "i16x8.splat")                                      \
+	X(i32x4_splat, 0xFD11, "i32x4.splat")                                      \
+	X(i64x2_splat, 0xFD12, "i64x2.splat")                                      \
+	X(f32x4_splat, 0xFD13, "f32x4.splat")                                      \
+	X(f64x2_splat, 0xFD14, "f64x2.splat")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that pops
+ * a v128 off the stack and pushes one of its lanes as a scalar. They take a
+ * lane index.
+ */
+#define TREBLE_FOREACH_SIMD_EXTRACT_LANE_OPCODE(X)                             \
+	X(i8x16_extract_lane_s, 0xFD15, "i8x16.extract_lane_s")                    \
+	X(i8x16_extract_lane_u, 0xFD16, "i8x16.extract_lane_u")                    \
+	X(i16x8_extract_lane_s, 0xFD18, "i16x8.extract_lane_s")                    \
+	X(i16x8_extract_lane_u, 0xFD19, "i16x8.extract_lane_u")                    \
+	X(i32x4_extract_lane, 0xFD1B, "i32x4.extract_lane")                        \
+	X(i64x2_extract_lane, 0xFD1D, "i64x2.extract_lane")                        \
+	X(f32x4_extract_lane, 0xFD1F, "f32x4.extract_lane")                        \
+	X(f64x2_extract_lane, 0xFD21, "f64x2.extract_lane")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that pops
+ * a v128 and a scalar off the stack and pushes the v128 with one of its lanes
+ * replaced by the scalar. They take a lane index.
+ */
+#define TREBLE_FOREACH_SIMD_REPLACE_LANE_OPCODE(X)                             \
+	X(i8x16_replace_lane, 0xFD17, "i8x16.replace_lane")                        \
+	X(i16x8_replace_lane, 0xFD1A, "i16x8.replace_lane")                        \
+	X(i32x4_replace_lane, 0xFD1C, "i32x4.replace_lane")                        \
+	X(i64x2_replace_lane, 0xFD1E, "i64x2.replace_lane")                        \
+	X(f32x4_replace_lane, 0xFD20, "f32x4.replace_lane")                        \
+	X(f64x2_replace_lane, 0xFD22, "f64x2.replace_lane")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that pops a
+ * v128 off the stack and pushes a v128 computed from it.
+ */
+#define TREBLE_FOREACH_SIMD_UNARY_OPCODE(X)                                    \
+	X(v128_not, 0xFD4D, "v128.not")                                            \
+	X(f32x4_demote_f64x2_zero, 0xFD5E, "f32x4.demote_f64x2_zero")              \
+	X(f64x2_promote_low_f32x4, 0xFD5F, "f64x2.promote_low_f32x4")              \
+	X(i8x16_abs, 0xFD60, "i8x16.abs")                                          \
+	X(i8x16_neg, 0xFD61, "i8x16.neg")                                          \
+	X(i8x16_popcnt, 0xFD62, "i8x16.popcnt")                                    \
+	X(f32x4_ceil, 0xFD67, "f32x4.ceil")                                        \
+	X(f32x4_floor, 0xFD68, "f32x4.floor")                                      \
+	X(f32x4_trunc, 0xFD69, "f32x4.trunc")                                      \
+	X(f32x4_nearest, 0xFD6A, "f32x4.nearest")                                  \
+	X(f64x2_ceil, 0xFD74, "f64x2.ceil")                                        \
+	X(f64x2_floor, 0xFD75, "f64x2.floor")                                      \
+	X(f64x2_trunc, 0xFD7A, "f64x2.trunc")                                      \
+	X(i16x8_extadd_pairwise_i8x16_s, 0xFD7C, "i16x8.extadd_pairwise_i8x16_s")  \
+	X(i16x8_extadd_pairwise_i8x16_u, 0xFD7D, "i16x8.extadd_pairwise_i8x16_u")  \
+	X(i32x4_extadd_pairwise_i16x8_s, 0xFD7E, "i32x4.extadd_pairwise_i16x8_s")  \
+	X(i32x4_extadd_pairwise_i16x8_u, 0xFD7F, "i32x4.extadd_pairwise_i16x8_u")  \
+	X(i16x8_abs, 0xFD80, "i16x8.abs")                                          \
+	X(i16x8_neg, 0xFD81, "i16x8.neg")                                          \
+	X(i16x8_extend_low_i8x16_s, 0xFD87, "i16x8.extend_low_i8x16_s")            \
+	X(i16x8_extend_high_i8x16_s, 0xFD88, "i16x8.extend_high_i8x16_s")          \
+	X(i16x8_extend_low_i8x16_u, 0xFD89, "i16x8.extend_low_i8x16_u")            \
+	X(i16x8_extend_high_i8x16_u, 0xFD8A, "i16x8.extend_high_i8x16_u")          \
+	X(f64x2_nearest, 0xFD94, "f64x2.nearest")                                  \
+	X(i32x4_abs, 0xFDA0, "i32x4.abs")                                          \
+	X(i32x4_neg, 0xFDA1, "i32x4.neg")                                          \
+	X(i32x4_extend_low_i16x8_s, 0xFDA7, "i32x4.extend_low_i16x8_s")            \
+	X(i32x4_extend_high_i16x8_s, 0xFDA8, "i32x4.extend_high_i16x8_s")          \
+	X(i32x4_extend_low_i16x8_u, 0xFDA9, "i32x4.extend_low_i16x8_u")            \
+	X(i32x4_extend_high_i16x8_u, 0xFDAA, "i32x4.extend_high_i16x8_u")          \
+	X(i64x2_abs, 0xFDC0, "i64x2.abs")                                          \
+	X(i64x2_neg, 0xFDC1, "i64x2.neg")                                          \
+	X(i64x2_extend_low_i32x4_s, 0xFDC7, "i64x2.extend_low_i32x4_s")            \
+	X(i64x2_extend_high_i32x4_s, 0xFDC8, "i64x2.extend_high_i32x4_s")          \
+	X(i64x2_extend_low_i32x4_u, 0xFDC9, "i64x2.extend_low_i32x4_u")            \
+	X(i64x2_extend_high_i32x4_u, 0xFDCA, "i64x2.extend_high_i32x4_u")          \
+	X(f32x4_abs, 0xFDE0, "f32x4.abs")                                          \
+	X(f32x4_neg, 0xFDE1, "f32x4.neg")                                          \
+	X(f32x4_sqrt, 0xFDE3, "f32x4.sqrt")                                        \
+	X(f64x2_abs, 0xFDEC, "f64x2.abs")                                          \
+	X(f64x2_neg, 0xFDED, "f64x2.neg")                                          \
+	X(f64x2_sqrt, 0xFDEF, "f64x2.sqrt")                                        \
+	X(i32x4_trunc_sat_f32x4_s, 0xFDF8, "i32x4.trunc_sat_f32x4_s")              \
+	X(i32x4_trunc_sat_f32x4_u, 0xFDF9, "i32x4.trunc_sat_f32x4_u")              \
+	X(f32x4_convert_i32x4_s, 0xFDFA, "f32x4.convert_i32x4_s")                  \
+	X(f32x4_convert_i32x4_u, 0xFDFB, "f32x4.convert_i32x4_u")                  \
+	X(i32x4_trunc_sat_f64x2_s_zero, 0xFDFC, "i32x4.trunc_sat_f64x2_s_zero")    \
+	X(i32x4_trunc_sat_f64x2_u_zero, 0xFDFD, "i32x4.trunc_sat_f64x2_u_zero")    \
+	X(f64x2_convert_low_i32x4_s, 0xFDFE, "f64x2.convert_low_i32x4_s")          \
+	X(f64x2_convert_low_i32x4_u, 0xFDFF, "f64x2.convert_low_i32x4_u")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that
+ * compares two v128 operands lane by lane, and pushes a v128 whose lanes are
+ * all ones where the comparison holds and all zeros elsewhere.
+ */
+#define TREBLE_FOREACH_SIMD_COMPARE_OPCODE(X)                                  \
+	X(i8x16_eq, 0xFD23, "i8x16.eq")                                            \
+	X(i8x16_ne, 0xFD24, "i8x16.ne")                                            \
+	X(i8x16_lt_s, 0xFD25, "i8x16.lt_s")                                        \
+	X(i8x16_lt_u, 0xFD26, "i8x16.lt_u")                                        \
+	X(i8x16_gt_s, 0xFD27, "i8x16.gt_s")                                        \
+	X(i8x16_gt_u, 0xFD28, "i8x16.gt_u")                                        \
+	X(i8x16_le_s, 0xFD29, "i8x16.le_s")                                        \
+	X(i8x16_le_u, 0xFD2A, "i8x16.le_u")                                        \
+	X(i8x16_ge_s, 0xFD2B, "i8x16.ge_s")                                        \
+	X(i8x16_ge_u, 0xFD2C, "i8x16.ge_u")                                        \
+	X(i16x8_eq, 0xFD2D, "i16x8.eq")                                            \
+	X(i16x8_ne, 0xFD2E, "i16x8.ne")                                            \
+	X(i16x8_lt_s, 0xFD2F, "i16x8.lt_s")                                        \
+	X(i16x8_lt_u, 0xFD30, "i16x8.lt_u")                                        \
+	X(i16x8_gt_s, 0xFD31, "i16x8.gt_s")                                        \
+	X(i16x8_gt_u, 0xFD32, "i16x8.gt_u")                                        \
+	X(i16x8_le_s, 0xFD33, "i16x8.le_s")                                        \
+	X(i16x8_le_u, 0xFD34, "i16x8.le_u")                                        \
+	X(i16x8_ge_s, 0xFD35, "i16x8.ge_s")                                        \
+	X(i16x8_ge_u, 0xFD36, "i16x8.ge_u")                                        \
+	X(i32x4_eq, 0xFD37, "i32x4.eq")                                            \
+	X(i32x4_ne, 0xFD38, "i32x4.ne")                                            \
+	X(i32x4_lt_s, 0xFD39, "i32x4.lt_s")                                        \
+	X(i32x4_lt_u, 0xFD3A, "i32x4.lt_u")                                        \
+	X(i32x4_gt_s, 0xFD3B, "i32x4.gt_s")                                        \
+	X(i32x4_gt_u, 0xFD3C, "i32x4.gt_u")                                        \
+	X(i32x4_le_s, 0xFD3D, "i32x4.le_s")                                        \
+	X(i32x4_le_u, 0xFD3E, "i32x4.le_u")                                        \
+	X(i32x4_ge_s, 0xFD3F, "i32x4.ge_s")                                        \
+	X(i32x4_ge_u, 0xFD40, "i32x4.ge_u")                                        \
+	X(i64x2_eq, 0xFDD6, "i64x2.eq")                                            \
+	X(i64x2_ne, 0xFDD7, "i64x2.ne")                                            \
+	X(i64x2_lt_s, 0xFDD8, "i64x2.lt_s")                                        \
+	X(i64x2_gt_s, 0xFDD9, "i64x2.gt_s")                                        \
+	X(i64x2_le_s, 0xFDDA, "i64x2.le_s")                                        \
+	X(i64x2_ge_s, 0xFDDB, "i64x2.ge_s")                                        \
+	X(f32x4_eq, 0xFD41, "f32x4.eq")                                            \
+	X(f32x4_ne, 0xFD42, "f32x4.ne")                                            \
+	X(f32x4_lt, 0xFD43, "f32x4.lt")                                            \
+	X(f32x4_gt, 0xFD44, "f32x4.gt")                                            \
+	X(f32x4_le, 0xFD45, "f32x4.le")                                            \
+	X(f32x4_ge, 0xFD46, "f32x4.ge")                                            \
+	X(f64x2_eq, 0xFD47, "f64x2.eq")                                            \
+	X(f64x2_ne, 0xFD48, "f64x2.ne")                                            \
+	X(f64x2_lt, 0xFD49, "f64x2.lt")                                            \
+	X(f64x2_gt, 0xFD4A, "f64x2.gt")                                            \
+	X(f64x2_le, 0xFD4B, "f64x2.le")                                            \
+	X(f64x2_ge, 0xFD4C, "f64x2.ge")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that pops
+ * two v128 operands off the stack and pushes a v128 computed from them.
+ */
+#define TREBLE_FOREACH_SIMD_BINARY_OPCODE(X)                                   \
+	TREBLE_FOREACH_SIMD_COMPARE_OPCODE(X)                                      \
+	X(i8x16_swizzle, 0xFD0E, "i8x16.swizzle")                                  \
+	X(v128_and, 0xFD4E, "v128.and")                                            \
+	X(v128_andnot, 0xFD4F, "v128.andnot")                                      \
+	X(v128_or, 0xFD50, "v128.or")                                              \
+	X(v128_xor, 0xFD51, "v128.xor")                                            \
+	X(i8x16_narrow_i16x8_s, 0xFD65, "i8x16.narrow_i16x8_s")                    \
+	X(i8x16_narrow_i16x8_u, 0xFD66, "i8x16.narrow_i16x8_u")                    \
+	X(i8x16_add, 0xFD6E, "i8x16.add")                                          \
+	X(i8x16_add_sat_s, 0xFD6F, "i8x16.add_sat_s")                              \
+	X(i8x16_add_sat_u, 0xFD70, "i8x16.add_sat_u")                              \
+	X(i8x16_sub, 0xFD71, "i8x16.sub")                                          \
+	X(i8x16_sub_sat_s, 0xFD72, "i8x16.sub_sat_s")                              \
+	X(i8x16_sub_sat_u, 0xFD73, "i8x16.sub_sat_u")                              \
+	X(i8x16_min_s, 0xFD76, "i8x16.min_s")                                      \
+	X(i8x16_min_u, 0xFD77, "i8x16.min_u")                                      \
+	X(i8x16_max_s, 0xFD78, "i8x16.max_s")                                      \
+	X(i8x16_max_u, 0xFD79, "i8x16.max_u")                                      \
+	X(i8x16_avgr_u, 0xFD7B, "i8x16.avgr_u")                                    \
+	X(i16x8_q15mulr_sat_s, 0xFD82, "i16x8.q15mulr_sat_s")                      \
+	X(i16x8_narrow_i32x4_s, 0xFD85, "i16x8.narrow_i32x4_s")                    \
+	X(i16x8_narrow_i32x4_u, 0xFD86, "i16x8.narrow_i32x4_u")                    \
+	X(i16x8_add, 0xFD8E, "i16x8.add")                                          \
+	X(i16x8_add_sat_s, 0xFD8F, "i16x8.add_sat_s")                              \
+	X(i16x8_add_sat_u, 0xFD90, "i16x8.add_sat_u")                              \
+	X(i16x8_sub, 0xFD91, "i16x8.sub")                                          \
+	X(i16x8_sub_sat_s, 0xFD92, "i16x8.sub_sat_s")                              \
+	X(i16x8_sub_sat_u, 0xFD93, "i16x8.sub_sat_u")                              \
+	X(i16x8_mul, 0xFD95, "i16x8.mul")                                          \
+	X(i16x8_min_s, 0xFD96, "i16x8.min_s")                                      \
+	X(i16x8_min_u, 0xFD97, "i16x8.min_u")                                      \
+	X(i16x8_max_s, 0xFD98, "i16x8.max_s")                                      \
+	X(i16x8_max_u, 0xFD99, "i16x8.max_u")                                      \
+	X(i16x8_avgr_u, 0xFD9B, "i16x8.avgr_u")                                    \
+	X(i16x8_extmul_low_i8x16_s, 0xFD9C, "i16x8.extmul_low_i8x16_s")            \
+	X(i16x8_extmul_high_i8x16_s, 0xFD9D, "i16x8.extmul_high_i8x16_s")          \
+	X(i16x8_extmul_low_i8x16_u, 0xFD9E, "i16x8.extmul_low_i8x16_u")            \
+	X(i16x8_extmul_high_i8x16_u, 0xFD9F, "i16x8.extmul_high_i8x16_u")          \
+	X(i32x4_add, 0xFDAE, "i32x4.add")                                          \
+	X(i32x4_sub, 0xFDB1, "i32x4.sub")                                          \
+	X(i32x4_mul, 0xFDB5, "i32x4.mul")                                          \
+	X(i32x4_min_s, 0xFDB6, "i32x4.min_s")                                      \
+	X(i32x4_min_u, 0xFDB7, "i32x4.min_u")                                      \
+	X(i32x4_max_s, 0xFDB8, "i32x4.max_s")                                      \
+	X(i32x4_max_u, 0xFDB9, "i32x4.max_u")                                      \
+	X(i32x4_dot_i16x8_s, 0xFDBA, "i32x4.dot_i16x8_s")                          \
+	X(i32x4_extmul_low_i16x8_s, 0xFDBC, "i32x4.extmul_low_i16x8_s")            \
+	X(i32x4_extmul_high_i16x8_s, 0xFDBD, "i32x4.extmul_high_i16x8_s")          \
+	X(i32x4_extmul_low_i16x8_u, 0xFDBE, "i32x4.extmul_low_i16x8_u")            \
+	X(i32x4_extmul_high_i16x8_u, 0xFDBF, "i32x4.extmul_high_i16x8_u")          \
+	X(i64x2_add, 0xFDCE, "i64x2.add")                                          \
+	X(i64x2_sub, 0xFDD1, "i64x2.sub")                                          \
+	X(i64x2_mul, 0xFDD5, "i64x2.mul")                                          \
+	X(i64x2_extmul_low_i32x4_s, 0xFDDC, "i64x2.extmul_low_i32x4_s")            \
+	X(i64x2_extmul_high_i32x4_s, 0xFDDD, "i64x2.extmul_high_i32x4_s")          \
+	X(i64x2_extmul_low_i32x4_u, 0xFDDE, "i64x2.extmul_low_i32x4_u")            \
+	X(i64x2_extmul_high_i32x4_u, 0xFDDF, "i64x2.extmul_high_i32x4_u")          \
+	X(f32x4_add, 0xFDE4, "f32x4.add")                                          \
+	X(f32x4_sub, 0xFDE5, "f32x4.sub")                                          \
+	X(f32x4_mul, 0xFDE6, "f32x4.mul")                                          \
+	X(f32x4_div, 0xFDE7, "f32x4.div")                                          \
+	X(f32x4_min, 0xFDE8, "f32x4.min")                                          \
+	X(f32x4_max, 0xFDE9, "f32x4.max")                                          \
+	X(f32x4_pmin, 0xFDEA, "f32x4.pmin")                                        \
+	X(f32x4_pmax, 0xFDEB, "f32x4.pmax")                                        \
+	X(f64x2_add, 0xFDF0, "f64x2.add")                                          \
+	X(f64x2_sub, 0xFDF1, "f64x2.sub")                                          \
+	X(f64x2_mul, 0xFDF2, "f64x2.mul")                                          \
+	X(f64x2_div, 0xFDF3, "f64x2.div")                                          \
+	X(f64x2_min, 0xFDF4, "f64x2.min")                                          \
+	X(f64x2_max, 0xFDF5, "f64x2.max")                                          \
+	X(f64x2_pmin, 0xFDF6, "f64x2.pmin")                                        \
+	X(f64x2_pmax, 0xFDF7, "f64x2.pmax")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that pops
+ * an i32 shift count and a v128 off the stack, and pushes the v128 with every
+ * lane shifted by the count, modulo the width of a lane.
+ */
+#define TREBLE_FOREACH_SIMD_SHIFT_OPCODE(X)                                    \
+	X(i8x16_shl, 0xFD6B, "i8x16.shl")                                          \
+	X(i8x16_shr_s, 0xFD6C, "i8x16.shr_s")                                      \
+	X(i8x16_shr_u, 0xFD6D, "i8x16.shr_u")                                      \
+	X(i16x8_shl, 0xFD8B, "i16x8.shl")                                          \
+	X(i16x8_shr_s, 0xFD8C, "i16x8.shr_s")                                      \
+	X(i16x8_shr_u, 0xFD8D, "i16x8.shr_u")                                      \
+	X(i32x4_shl, 0xFDAB, "i32x4.shl")                                          \
+	X(i32x4_shr_s, 0xFDAC, "i32x4.shr_s")                                      \
+	X(i32x4_shr_u, 0xFDAD, "i32x4.shr_u")                                      \
+	X(i64x2_shl, 0xFDCB, "i64x2.shl")                                          \
+	X(i64x2_shr_s, 0xFDCC, "i64x2.shr_s")                                      \
+	X(i64x2_shr_u, 0xFDCD, "i64x2.shr_u")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that pops a
+ * v128 off the stack and pushes an i32 computed from all of its lanes.
+ */
+#define TREBLE_FOREACH_SIMD_TEST_OPCODE(X)                                     \
+	X(v128_any_true, 0xFD53, "v128.any_true")                                  \
+	X(i8x16_all_true, 0xFD63, "i8x16.all_true")                                \
+	X(i8x16_bitmask, 0xFD64, "i8x16.bitmask")                                  \
+	X(i16x8_all_true, 0xFD83, "i16x8.all_true")                                \
+	X(i16x8_bitmask, 0xFD84, "i16x8.bitmask")                                  \
+	X(i32x4_all_true, 0xFDA3, "i32x4.all_true")                                \
+	X(i32x4_bitmask, 0xFDA4, "i32x4.bitmask")                                  \
+	X(i64x2_all_true, 0xFDC3, "i64x2.all_true")                                \
+	X(i64x2_bitmask, 0xFDC4, "i64x2.bitmask")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction of the SIMD
+ * proposal.
+ */
+#define TREBLE_FOREACH_SIMD_OPCODE(X)                                          \
+	TREBLE_FOREACH_SIMD_LOAD_OPCODE(X)                                         \
+	X(v128_store, 0xFD0B, "v128.store")                                        \
+	TREBLE_FOREACH_SIMD_LOAD_LANE_OPCODE(X)                                    \
+	TREBLE_FOREACH_SIMD_STORE_LANE_OPCODE(X)                                   \
+	X(v128_const, 0xFD0C, "v128.const")                                        \
+	X(i8x16_shuffle, 0xFD0D, "i8x16.shuffle")                                  \
+	TREBLE_FOREACH_SIMD_SPLAT_OPCODE(X)                                        \
+	TREBLE_FOREACH_SIMD_EXTRACT_LANE_OPCODE(X)                                 \
+	TREBLE_FOREACH_SIMD_REPLACE_LANE_OPCODE(X)                                 \
+	X(v128_bitselect, 0xFD52, "v128.bitselect")                                \
+	TREBLE_FOREACH_SIMD_UNARY_OPCODE(X)                                        \
+	TREBLE_FOREACH_SIMD_BINARY_OPCODE(X)                                       \
+	TREBLE_FOREACH_SIMD_SHIFT_OPCODE(X)                                        \
+	TREBLE_FOREACH_SIMD_TEST_OPCODE(X)
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that takes
+ * a memarg immediate.
+ */
+#define TREBLE_FOREACH_MEMARG_OPCODE(X)                                        \
+	TREBLE_FOREACH_LOAD_OPCODE(X)                                              \
+	TREBLE_FOREACH_STORE_OPCODE(X)                                             \
+	TREBLE_FOREACH_ATOMIC_LOAD_OPCODE(X)                                       \
+	TREBLE_FOREACH_ATOMIC_STORE_OPCODE(X)                                      \
+	TREBLE_FOREACH_ATOMIC_RMW_OPCODE(X)                                        \
+	TREBLE_FOREACH_ATOMIC_CMPXCHG_OPCODE(X)                                    \
+	X(memory_atomic_notify, 0xFE00, "memory.atomic.notify")                    \
+	X(memory_atomic_wait32, 0xFE01, "memory.atomic.wait32")                    \
+	X(memory_atomic_wait64, 0xFE02, "memory.atomic.wait64")                    \
+	TREBLE_FOREACH_SIMD_LOAD_OPCODE(X)                                         \
+	X(v128_store, 0xFD0B, "v128.store")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that
+ * accesses a local of the function, which includes its parameters.
+ */
+#define TREBLE_FOREACH_LOCAL_OPCODE(X)                                         \
+	X(local_get, 0x20, "local.get")                                            \
+	X(local_set, 0x21, "local.set")                                            \
+	X(local_tee, 0x22, "local.tee")
+
+/**
+ * Invokes X(name, op code, text format name) for every instruction that treble
+ * understands. This is the single source of truth for op codes; anything that
+ * needs a per-instruction table (the enum below, the dispatch table of the
+ * interpreter...) should be generated from it.
+ */
+#define TREBLE_FOREACH_OPCODE(X)                                               \
+	X(block, 0x02, "block")                                                    \
+	X(loop, 0x03, "loop")                                                      \
+	X(if_, 0x04, "if")                                                         \
+	X(else_, 0x05, "else")                                                     \
+	X(br, 0x0C, "br")                                                          \
+	X(br_if, 0x0D, "br_if")                                                    \
+	X(br_table, 0x0E, "br_table")                                              \
+	X(return_, 0x0F, "return")                                                 \
+	X(call, 0x10, "call")                                                      \
+	X(call_indirect, 0x11, "call_indirect")                                    \
+                                                                               \
+	X(drop, 0x1A, "drop")                                                      \
+	X(end, 0x0B, "end")                                                        \
+                                                                               \
+	TREBLE_FOREACH_LOCAL_OPCODE(X)                                             \
+                                                                               \
+	X(i32_const, 0x41, "i32.const")                                            \
+	X(i64_const, 0x42, "i64.const")                                            \
+	X(f32_const, 0x43, "f32.const")                                            \
+                                                                               \
+	TREBLE_FOREACH_LOAD_OPCODE(X)                                              \
+	TREBLE_FOREACH_STORE_OPCODE(X)                                             \
+	X(memory_size, 0x3F, "memory.size")                                        \
+	X(memory_grow, 0x40, "memory.grow")                                        \
+                                                                               \
+	TREBLE_FOREACH_ATOMIC_LOAD_OPCODE(X)                                       \
+	TREBLE_FOREACH_ATOMIC_STORE_OPCODE(X)                                      \
+	TREBLE_FOREACH_ATOMIC_RMW_OPCODE(X)                                        \
+	TREBLE_FOREACH_ATOMIC_CMPXCHG_OPCODE(X)                                    \
+	X(memory_atomic_notify, 0xFE00, "memory.atomic.notify")                    \
+	X(memory_atomic_wait32, 0xFE01, "memory.atomic.wait32")                    \
+	X(memory_atomic_wait64, 0xFE02, "memory.atomic.wait64")                    \
+	X(atomic_fence, 0xFE03, "atomic.fence")                                    \
+                                                                               \
+	TREBLE_FOREACH_UNARY_OPCODE(X)                                             \
+	TREBLE_FOREACH_BINARY_OPCODE(X)                                            \
+                                                                               \
+	TREBLE_FOREACH_SIMD_OPCODE(X)
+
+/**
+ * A label a br_table can pick.
+ */
+struct BranchLabel {
+	/**
+	 * Index of the block the label belongs to, like the depth of a br.
+	 */
+	uint32_t depth;
+
+	/**
+	 * Number of stack slots the branch takes off the stack below the values
+	 * it takes along. Only known once the function has been validated, see
+	 * validate_function.
+	 */
+	uint32_t drop;
+};
+
+/**
+ * Represents a WASM instruction as defined in the specification. This is the
+ * form the decoder works with; function bodies are stored in the compact
+ * encoding from bytecode.hxx once they are decoded.
  */
 struct Instruction {
 	enum class OpCode {
-		if_ = 0x04,
-		else_ = 0x05,
-
-		drop = 0x1A,
-		end = 0x0B,
-
-		i32_const = 0x41,
-		i64_const = 0x42,
-		f32_const = 0x43,
-
-		i32_eqz = 0x45,
-		i32_eq = 0x46,
-		i32_ne = 0x47,
-		i32_lt_s = 0x48,
-		i32_lt_u = 0x49,
-		i32_gt_s = 0x4A,
-		i32_gt_u = 0x4B,
-		i32_le_s = 0x4C,
-		i32_le_u = 0x4D,
-		i32_ge_s = 0x4E,
-		i32_ge_u = 0x4F,
-
-		i64_eqz = 0x50,
-		i64_eq = 0x51,
-		i64_ne = 0x52,
-		i64_lt_s = 0x53,
-		i64_lt_u = 0x54,
-		i64_gt_s = 0x55,
-		i64_gt_u = 0x56,
-		i64_le_s = 0x57,
-		i64_le_u = 0x58,
-		i64_ge_s = 0x59,
-		i64_ge_u = 0x5A,
-
-		i32_clz = 0x67,
-		i32_ctz = 0x68,
-		i32_popcnt = 0x69,
-		i32_add = 0x6A,
-		i32_sub = 0x6B,
-		i32_mul = 0x6C,
-		i32_div_s = 0x6D,
-		i32_div_u = 0x6E,
-		i32_rem_s = 0x6F,
-		i32_rem_u = 0x70,
-		i32_and = 0x71,
-		i32_or = 0x72,
-		i32_xor = 0x73,
-		i32_shl = 0x74,
-		i32_shr_s = 0x75,
-		i32_shr_u = 0x76,
-		i32_rotl = 0x77,
-		i32_rotr = 0x78,
-
-		i64_clz = 0x79,
-		i64_ctz = 0x7A,
-		i64_popcnt = 0x7B,
-		i64_add = 0x7C,
-		i64_sub = 0x7D,
-		i64_mul = 0x7E,
-		i64_div_s = 0x7F,
-		i64_div_u = 0x80,
-		i64_rem_s = 0x81,
-		i64_rem_u = 0x82,
-		i64_and = 0x83,
-		i64_or = 0x84,
-		i64_xor = 0x85,
-		i64_shl = 0x86,
-		i64_shr_s = 0x87,
-		i64_shr_u = 0x88,
-		i64_rotl = 0x89,
-		i64_rotr = 0x8A,
-
-		i32_wrap_i64 = 0xA7,
+#define OPCODE_ENUM_ENTRY(name, op_code, text) name = op_code,
+		TREBLE_FOREACH_OPCODE(OPCODE_ENUM_ENTRY)
+#undef OPCODE_ENUM_ENTRY
 	};
 
 	OpCode op_code;
@@ -97,12 +684,134 @@ struct Instruction {
 		// f32.const
 		float f32;
 
+		// v128.const, and the lane indices of i8x16.shuffle
+		uint8_t v128[16];
+
+		// extract and replace lane
+		uint8_t lane;
+
+		// loads and stores
+		struct {
+			/**
+			 * log2 of the alignment the access promises, which may not be more
+			 * than the width of the access, and for atomic accesses has to be
+			 * exactly that. Only a hint, and not kept in the compact encoding.
+			 */
+			uint32_t align;
+
+			/**
+			 * Added to the address popped off the stack
+			 */
+			uint32_t offset;
+
+			/**
+			 * Index of the lane that is loaded or stored, for the accesses to
+			 * a single lane of a v128
+			 */
+			uint8_t lane;
+		} memarg;
+
+		// local.get, local.set and local.tee
+		struct {
+			/**
+			 * Index of the first stack slot of the local in the frame of the
+			 * function, which starts with the parameters and then has the
+			 * locals the function declares, in order.
+			 */
+			uint32_t slot;
+
+			/**
+			 * Whether the local is a v128, which takes two slots.
+			 */
+			bool v128;
+		} local;
+
+		// call
+		struct {
+			uint32_t func_index;
+		} call;
+
+		// call_indirect
+		struct {
+			/**
+			 * Index of the type the callee has to have
+			 */
+			uint32_t type_index;
+
+			/**
+			 * Index of the call among the call_indirect instructions of the
+			 * function, which picks its entry in the signature cache, see
+			 * FunctionInstance::signature_cache.
+			 */
+			uint32_t site;
+		} call_indirect;
+
+		// drop
+		struct {
+			/**
+			 * Whether the dropped value is a v128, which takes two slots on
+			 * the stack. Only known once the function has been validated, see
+			 * validate_function.
+			 */
+			bool v128;
+		} drop;
+
+		// block and loop
+		struct {
+			/**
+			 * EMPTY_BLOCK_TYPE, or the value type of the value the block
+			 * yields
+			 */
+			uint8_t block_type;
+		} block;
+
+		// br and br_if
+		struct {
+			/**
+			 * Index of the block whose label the branch targets, counting
+			 * outwards from the innermost one. The body of the function is
+			 * the outermost block. Not kept in the compact encoding.
+			 */
+			uint32_t depth;
+
+			/**
+			 * Number of stack slots the values the branch takes along to its
+			 * target take
+			 */
+			uint32_t arity;
+
+			/**
+			 * Number of stack slots the branch takes off the stack below
+			 * those values. Only known once the function has been validated,
+			 * see validate_function.
+			 */
+			uint32_t drop;
+		} branch;
+
+		// br_table
+		struct {
+			/**
+			 * count labels the operand picks from, followed by the one it
+			 * takes when it is out of range. Allocated from the arena of the
+			 * module, and nullptr when read back from the compact encoding,
+			 * which keeps them in the jump table of the instruction.
+			 */
+			BranchLabel *labels;
+			uint32_t count;
+
+			/**
+			 * Number of stack slots the values the branch takes along take,
+			 * which is the same for every label
+			 */
+			uint32_t arity;
+		} branch_table;
+
 		// if
 		struct {
 			/**
-			 * Unused for now
+			 * EMPTY_BLOCK_TYPE, or the value type of the value the if yields
 			 */
-			void *block_type;
+			uint8_t block_type;
 
 			/**
 			 * Stores the offset from the current if instruction to reach the
@@ -0,0 +1,498 @@
+#include "jit.hxx"
+#include "bytecode.hxx"
+#include "execution_context.hxx"
+#include "instructions.hxx"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <stack>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+namespace Treble {
+
+#if defined(__x86_64__)
+
+/**
+ * General purpose registers, numbered the way x86 encodes them. The JIT only
+ * uses caller-saved registers, so compiled functions need no prologue.
+ */
+enum class Reg : uint8_t {
+	// first operand and result
+	rax = 0,
+	// second operand, shift count
+	rcx = 1,
+	// scratch, remainder of divisions
+	rdx = 2,
+	// base address of the operand stack
+	rdi = 7,
+};
+
+/**
+ * Emits x86-64 machine code into a growable buffer. Values on the operand
+ * stack live in 8 byte slots relative to rdi; operations load their operands
+ * into rax and rcx, and write their result back from rax.
+ */
+struct Assembler {
+	std::vector<uint8_t> code;
+
+	void emit(std::initializer_list<uint8_t> bytes) {
+		code.insert(code.end(), bytes);
+	}
+
+	void imm32(uint32_t value) {
+		const size_t pos = code.size();
+		code.resize(pos + sizeof(value));
+		std::memcpy(&code[pos], &value, sizeof(value));
+	}
+
+	void imm64(uint64_t value) {
+		const size_t pos = code.size();
+		code.resize(pos + sizeof(value));
+		std::memcpy(&code[pos], &value, sizeof(value));
+	}
+
+	// REX prefix selecting 64 bit operands
+	void rex(bool wide) {
+		if (wide) {
+			emit({0x48});
+		}
+	}
+
+	// ModRM + disp32 addressing [rdi + slot * 8]
+	void slot_operand(Reg reg, size_t slot) {
+		emit({static_cast<uint8_t>(0x80 | static_cast<uint8_t>(reg) << 3 |
+								   static_cast<uint8_t>(Reg::rdi))});
+		imm32(slot * 8);
+	}
+
+	// ModRM addressing a register directly
+	void reg_operand(uint8_t reg, Reg rm) {
+		emit({static_cast<uint8_t>(0xC0 | reg << 3 |
+								   static_cast<uint8_t>(rm))});
+	}
+
+	// mov reg, [rdi + slot * 8]
+	void load(bool wide, Reg reg, size_t slot) {
+		rex(wide);
+		emit({0x8B});
+		slot_operand(reg, slot);
+	}
+
+	// mov [rdi + slot * 8], reg
+	// always stores all 64 bits, 32 bit results are zero extended already.
+	void store(Reg reg, size_t slot) {
+		rex(true);
+		emit({0x89});
+		slot_operand(reg, slot);
+	}
+
+	// op rax, rcx for the "op r/m, r" family (add, sub, and, or, xor, cmp)
+	void alu(bool wide, uint8_t op_code) {
+		rex(wide);
+		emit({op_code});
+		reg_operand(static_cast<uint8_t>(Reg::rcx), Reg::rax);
+	}
+
+	// setcc al; movzx eax, al
+	void set_condition(uint8_t condition_code) {
+		emit({0x0F, condition_code, 0xC0});
+		emit({0x0F, 0xB6, 0xC0});
+	}
+
+	// jcc rel32 / jmp rel32 with a placeholder target. Returns the position of
+	// the displacement so that it can be patched later. condition_code is the
+	// setcc code of the condition, see ConditionCode.
+	size_t jump_if(uint8_t condition_code) {
+		emit({0x0F, static_cast<uint8_t>(condition_code - 0x10)});
+		imm32(0);
+		return code.size() - 4;
+	}
+
+	size_t jump() {
+		emit({0xE9});
+		imm32(0);
+		return code.size() - 4;
+	}
+
+	// points the jump whose displacement is at pos to the current position
+	void patch_jump(size_t pos) {
+		const int32_t displacement = code.size() - (pos + 4);
+		std::memcpy(&code[pos], &displacement, sizeof(displacement));
+	}
+
+	// mov eax, trap; ret
+	void return_trap(Trap trap) {
+		emit({0xB8});
+		imm32(static_cast<uint32_t>(trap));
+		emit({0xC3});
+	}
+};
+
+struct JitBlock {
+	/**
+	 * height of the operand stack when the block was entered
+	 */
+	size_t stack_height;
+
+	/**
+	 * displacement of the jump that still needs to point at the end of the
+	 * current arm of the if
+	 */
+	size_t pending_jump;
+};
+
+/**
+ * A jump to the exit of a trap, which is only emitted once the rest of the
+ * function has been.
+ */
+struct TrapJump {
+	size_t pos;
+	Trap trap;
+};
+
+// x86 condition codes for setcc/jcc
+enum ConditionCode : uint8_t {
+	CC_O = 0x90,
+	CC_B = 0x92,
+	CC_AE = 0x93,
+	CC_E = 0x94,
+	CC_NE = 0x95,
+	CC_BE = 0x96,
+	CC_A = 0x97,
+	CC_L = 0x9C,
+	CC_GE = 0x9D,
+	CC_LE = 0x9E,
+	CC_G = 0x9F,
+};
+
+#define ALU_CASE(instr_name, wide, op_code)                                    \
+	case Instruction::OpCode::instr_name:                                      \
+		binary_operands(wide);                                                 \
+		as.alu(wide, op_code);                                                 \
+		push_result();                                                         \
+		break;
+
+#define COMPARE_CASE(instr_name, wide, condition_code)                         \
+	case Instruction::OpCode::instr_name:                                      \
+		binary_operands(wide);                                                 \
+		as.alu(wide, 0x39);                                                    \
+		as.set_condition(condition_code);                                      \
+		push_result();                                                         \
+		break;
+
+// shl/shr/sar/rol/ror rax, cl. x86 masks the count the same way wasm does.
+#define SHIFT_CASE(instr_name, wide, extension)                                \
+	case Instruction::OpCode::instr_name:                                      \
+		binary_operands(wide);                                                 \
+		as.rex(wide);                                                          \
+		as.emit({0xD3});                                                       \
+		as.reg_operand(extension, Reg::rax);                                   \
+		push_result();                                                         \
+		break;
+
+#define DIVISION_CASE(instr_name, wide, is_signed, result)                     \
+	case Instruction::OpCode::instr_name:                                      \
+		divide(wide, is_signed, result);                                       \
+		break;
+
+#define INTEGER_CASES(dtype, wide, bit_width)                                  \
+	case Instruction::OpCode::dtype##_eqz:                                     \
+		unary_operand(wide);                                                   \
+		as.rex(wide);                                                          \
+		as.emit({0x85, 0xC0});                                                 \
+		as.set_condition(CC_E);                                                \
+		push_result();                                                         \
+		break;                                                                 \
+                                                                               \
+		COMPARE_CASE(dtype##_eq, wide, CC_E)                                   \
+		COMPARE_CASE(dtype##_ne, wide, CC_NE)                                  \
+		COMPARE_CASE(dtype##_lt_s, wide, CC_L)                                 \
+		COMPARE_CASE(dtype##_lt_u, wide, CC_B)                                 \
+		COMPARE_CASE(dtype##_gt_s, wide, CC_G)                                 \
+		COMPARE_CASE(dtype##_gt_u, wide, CC_A)                                 \
+		COMPARE_CASE(dtype##_le_s, wide, CC_LE)                                \
+		COMPARE_CASE(dtype##_le_u, wide, CC_BE)                                \
+		COMPARE_CASE(dtype##_ge_s, wide, CC_GE)                                \
+		COMPARE_CASE(dtype##_ge_u, wide, CC_AE)                                \
+                                                                               \
+		ALU_CASE(dtype##_add, wide, 0x01)                                      \
+		ALU_CASE(dtype##_sub, wide, 0x29)                                      \
+		ALU_CASE(dtype##_and, wide, 0x21)                                      \
+		ALU_CASE(dtype##_or, wide, 0x09)                                       \
+		ALU_CASE(dtype##_xor, wide, 0x31)                                      \
+                                                                               \
+	case Instruction::OpCode::dtype##_mul:                                     \
+		binary_operands(wide);                                                 \
+		as.rex(wide);                                                          \
+		as.emit({0x0F, 0xAF, 0xC1});                                           \
+		push_result();                                                         \
+		break;                                                                 \
+                                                                               \
+		DIVISION_CASE(dtype##_div_s, wide, true, Reg::rax)                     \
+		DIVISION_CASE(dtype##_div_u, wide, false, Reg::rax)                    \
+		DIVISION_CASE(dtype##_rem_s, wide, true, Reg::rdx)                     \
+		DIVISION_CASE(dtype##_rem_u, wide, false, Reg::rdx)                    \
+                                                                               \
+		SHIFT_CASE(dtype##_shl, wide, 4)                                       \
+		SHIFT_CASE(dtype##_shr_s, wide, 7)                                     \
+		SHIFT_CASE(dtype##_shr_u, wide, 5)                                     \
+		SHIFT_CASE(dtype##_rotl, wide, 0)                                      \
+		SHIFT_CASE(dtype##_rotr, wide, 1)                                      \
+                                                                               \
+	/* bsr leaves its destination alone and sets ZF for a zero input, so    */ \
+	/* the result is patched to -1 with cmovz before it is flipped around.  */ \
+	case Instruction::OpCode::dtype##_clz:                                     \
+		unary_operand(wide);                                                   \
+		as.rex(wide);                                                          \
+		as.emit({0xC7, 0xC2});                                                 \
+		as.imm32(-1);                                                          \
+		as.rex(wide);                                                          \
+		as.emit({0x0F, 0xBD, 0xC0});                                           \
+		as.rex(wide);                                                          \
+		as.emit({0x0F, 0x44, 0xC2});                                           \
+		as.emit({0xB9});                                                       \
+		as.imm32(bit_width - 1);                                               \
+		as.rex(wide);                                                          \
+		as.emit({0x29, 0xC1});                                                 \
+		as.rex(wide);                                                          \
+		as.emit({0x89, 0xC8});                                                 \
+		push_result();                                                         \
+		break;                                                                 \
+                                                                               \
+	case Instruction::OpCode::dtype##_ctz:                                     \
+		unary_operand(wide);                                                   \
+		as.emit({0xBA});                                                       \
+		as.imm32(bit_width);                                                   \
+		as.rex(wide);                                                          \
+		as.emit({0x0F, 0xBC, 0xC0});                                           \
+		as.rex(wide);                                                          \
+		as.emit({0x0F, 0x44, 0xC2});                                           \
+		push_result();                                                         \
+		break;                                                                 \
+                                                                               \
+	case Instruction::OpCode::dtype##_popcnt:                                  \
+		if (!__builtin_cpu_supports("popcnt")) {                               \
+			return nullptr;                                                    \
+		}                                                                      \
+		unary_operand(wide);                                                   \
+		as.emit({0xF3});                                                       \
+		as.rex(wide);                                                          \
+		as.emit({0x0F, 0xB8, 0xC0});                                           \
+		push_result();                                                         \
+		break;
+
+JitFunction *compile_function(const Function &func) {
+	Assembler as;
+	std::stack<JitBlock> blocks;
+	std::vector<TrapJump> trap_jumps;
+	// height of the operand stack, which is always known statically
+	size_t height = 0;
+	size_t max_height = 0;
+
+	const auto unary_operand = [&](bool wide) {
+		height--;
+		as.load(wide, Reg::rax, height);
+	};
+
+	const auto binary_operands = [&](bool wide) {
+		height -= 2;
+		as.load(wide, Reg::rax, height);
+		as.load(wide, Reg::rcx, height + 1);
+	};
+
+	const auto push_result = [&]() {
+		as.store(Reg::rax, height);
+		height++;
+	};
+
+	// div/idiv rcx, leaving the quotient in rax and the remainder in rdx.
+	// dividing by zero traps, and so does the one signed division whose
+	// quotient does not fit, that of the most negative value by -1. signed
+	// divisions by -1 negate instead, which overflows just for that value and
+	// leaves the remainder at 0, rather than faulting like idiv does.
+	const auto divide = [&](bool wide, bool is_signed, Reg result) {
+		binary_operands(wide);
+		// test rcx, rcx
+		as.rex(wide);
+		as.emit({0x85, 0xC9});
+		trap_jumps.push_back({as.jump_if(CC_E), Trap::IntegerDivideByZero});
+
+		std::optional<size_t> done_jump;
+		if (is_signed) {
+			// cmp rcx, -1
+			as.rex(wide);
+			as.emit({0x83, 0xF9, 0xFF});
+			const size_t divide_jump = as.jump_if(CC_NE);
+			if (result == Reg::rax) {
+				// neg rax
+				as.rex(wide);
+				as.emit({0xF7, 0xD8});
+				trap_jumps.push_back({as.jump_if(CC_O), Trap::IntegerOverflow});
+			} else {
+				// xor edx, edx
+				as.emit({0x31, 0xD2});
+			}
+			done_jump = as.jump();
+			as.patch_jump(divide_jump);
+			// cdq/cqo
+			as.rex(wide);
+			as.emit({0x99});
+		} else {
+			// xor edx, edx
+			as.emit({0x31, 0xD2});
+		}
+		as.rex(wide);
+		as.emit({0xF7});
+		as.reg_operand(is_signed ? 7 : 6, Reg::rcx);
+		if (done_jump) {
+			as.patch_jump(*done_jump);
+		}
+
+		as.store(result, height);
+		height++;
+	};
+
+	for (InstructionReader reader(func.body);;) {
+		const Instruction instr = reader.next();
+		switch (instr.op_code) {
+		case Instruction::OpCode::i32_const:
+			// mov eax, imm32 (zero extends)
+			as.emit({0xB8});
+			as.imm32(instr.args.i32);
+			push_result();
+			break;
+
+		case Instruction::OpCode::i64_const:
+			// mov rax, imm64
+			as.emit({0x48, 0xB8});
+			as.imm64(instr.args.i64);
+			push_result();
+			break;
+
+		case Instruction::OpCode::f32_const: {
+			uint32_t bits;
+			std::memcpy(&bits, &instr.args.f32, sizeof(bits));
+			as.emit({0xB8});
+			as.imm32(bits);
+			push_result();
+			break;
+		}
+
+		case Instruction::OpCode::drop:
+			height--;
+			break;
+
+		case Instruction::OpCode::i32_wrap_i64:
+			unary_operand(false);
+			push_result();
+			break;
+
+			INTEGER_CASES(i32, false, 32)
+			INTEGER_CASES(i64, true, 64)
+
+		case Instruction::OpCode::if_:
+			unary_operand(false);
+			// test eax, eax
+			as.emit({0x85, 0xC0});
+			blocks.push({
+				.stack_height = height,
+				.pending_jump = as.jump_if(CC_E),
+			});
+			break;
+
+		case Instruction::OpCode::else_: {
+			JitBlock &block = blocks.top();
+			const size_t end_jump = as.jump();
+			as.patch_jump(block.pending_jump);
+			block.pending_jump = end_jump;
+			// the else arm starts from the same stack as the true arm did
+			height = block.stack_height;
+			break;
+		}
+
+		case Instruction::OpCode::end:
+			if (blocks.empty()) {
+				as.return_trap(Trap::None);
+				goto compiled;
+			}
+
+			as.patch_jump(blocks.top().pending_jump);
+			blocks.pop();
+			break;
+
+		default:
+			return nullptr;
+		}
+
+		max_height = std::max(max_height, height);
+	}
+
+compiled:
+	// every trap gets a single exit after the code of the function, which all
+	// the jumps to it share
+	for (const Trap trap : {Trap::IntegerDivideByZero, Trap::IntegerOverflow}) {
+		bool used = false;
+		for (const TrapJump &jump : trap_jumps) {
+			if (jump.trap == trap) {
+				as.patch_jump(jump.pos);
+				used = true;
+			}
+		}
+		if (used) {
+			as.return_trap(trap);
+		}
+	}
+
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+	const size_t mapping_size =
+		(as.code.size() + page_size - 1) / page_size * page_size;
+
+	void *code = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+					  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED) {
+		return nullptr;
+	}
+
+	std::memcpy(code, as.code.data(), as.code.size());
+	if (mprotect(code, mapping_size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(code, mapping_size);
+		return nullptr;
+	}
+
+	auto *compiled =
+		static_cast<JitFunction *>(std::malloc(sizeof(JitFunction)));
+	if (compiled == nullptr) {
+		munmap(code, mapping_size);
+		return nullptr;
+	}
+	compiled->entry = reinterpret_cast<Trap (*)(uint64_t *)>(code);
+	compiled->code = code;
+	compiled->code_size = mapping_size;
+	compiled->max_stack_height = max_height;
+	compiled->result_count = height;
+
+	return compiled;
+}
+
+void free_jit_function(JitFunction *func) {
+	if (func == nullptr) {
+		return;
+	}
+	munmap(func->code, func->code_size);
+	std::free(func);
+}
+
+#else
+
+JitFunction *compile_function(const Function &func) { return nullptr; }
+
+void free_jit_function(JitFunction *func) {}
+
+#endif
+
+} // namespace Treble
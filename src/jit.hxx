@@ -0,0 +1,55 @@
+#ifndef __TREBLE__JIT_HXX__
+#define __TREBLE__JIT_HXX__
+
+#include "execution_context.hxx"
+#include "module.hxx"
+#include <cstddef>
+#include <cstdint>
+
+namespace Treble {
+
+/**
+ * A function compiled to native code by the baseline JIT.
+ */
+struct JitFunction {
+	/**
+	 * Entry point of the native code. It receives the operand stack of the
+	 * function, one 8 byte slot per stack entry, and leaves its results in the
+	 * first result_count slots. Returns the trap that cut the function short,
+	 * or Trap::None.
+	 */
+	Trap (*entry)(uint64_t *stack);
+
+	/**
+	 * The executable mapping that holds the native code.
+	 */
+	void *code;
+	size_t code_size;
+
+	/**
+	 * Number of stack slots the function needs.
+	 */
+	size_t max_stack_height;
+
+	/**
+	 * Number of values left on the operand stack when the function returns.
+	 */
+	size_t result_count;
+};
+
+/**
+ * Compiles the body of the given function to native code in a single pass.
+ * Returns nullptr if the function uses an instruction the JIT does not
+ * support, or if the host is not x86-64.
+ */
+JitFunction *compile_function(const Function &func);
+
+/**
+ * Unmaps the native code of a function compiled by compile_function and frees
+ * it. Does nothing if func is nullptr.
+ */
+void free_jit_function(JitFunction *func);
+
+} // namespace Treble
+
+#endif
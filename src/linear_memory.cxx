@@ -0,0 +1,125 @@
+#include "linear_memory.hxx"
+#include <atomic>
+#include <csetjmp>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <sys/mman.h>
+#include <utility>
+
+namespace Treble {
+
+/**
+ * Address space reserved for every memory: the highest address an access can
+ * reach is a 32 bit address plus a 32 bit offset plus the 16 bytes of the
+ * widest access, which the extra page covers.
+ */
+static constexpr size_t RESERVATION_SIZE = (size_t{1} << 33) + WASM_PAGE_SIZE;
+
+std::optional<LinearMemory> LinearMemory::create(uint32_t min_pages,
+												 uint32_t max_pages,
+												 bool shared) {
+	if (min_pages > max_pages || max_pages > MAX_MEMORY_PAGES) {
+		return std::nullopt;
+	}
+
+	install_memory_trap_handler();
+
+	void *reservation =
+		mmap(nullptr, RESERVATION_SIZE, PROT_NONE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (reservation == MAP_FAILED) {
+		return std::nullopt;
+	}
+
+	LinearMemory memory(static_cast<uint8_t *>(reservation), 0, max_pages,
+						shared);
+	if (memory.grow(min_pages) != 0) {
+		return std::nullopt;
+	}
+	return std::move(memory);
+}
+
+LinearMemory::LinearMemory(LinearMemory &&other)
+	: base(std::exchange(other.base, nullptr)),
+	  pages(std::exchange(other.pages, 0)),
+	  max_pages(std::exchange(other.max_pages, 0)),
+	  shared(std::exchange(other.shared, false)) {}
+
+LinearMemory &LinearMemory::operator=(LinearMemory &&other) {
+	std::swap(base, other.base);
+	std::swap(pages, other.pages);
+	std::swap(max_pages, other.max_pages);
+	std::swap(shared, other.shared);
+	return *this;
+}
+
+LinearMemory::~LinearMemory() {
+	if (base != nullptr) {
+		munmap(base, RESERVATION_SIZE);
+	}
+}
+
+int32_t LinearMemory::grow(uint32_t delta) {
+	// growing is rare, so one lock for all memories will do. the page count
+	// is only published once the new pages are accessible.
+	static std::mutex grow_lock;
+	std::lock_guard guard(grow_lock);
+
+	const uint32_t old_pages = page_count();
+	if (delta > max_pages - old_pages) {
+		return -1;
+	}
+
+	if (delta > 0 &&
+		mprotect(base + size(), static_cast<size_t>(delta) * WASM_PAGE_SIZE,
+				 PROT_READ | PROT_WRITE) != 0) {
+		return -1;
+	}
+
+	std::atomic_ref(pages).store(old_pages + delta, std::memory_order_release);
+	return static_cast<int32_t>(old_pages);
+}
+
+bool LinearMemory::reserves(const void *address) const {
+	const auto *byte = static_cast<const uint8_t *>(address);
+	return base != nullptr && byte >= base && byte < base + RESERVATION_SIZE;
+}
+
+MemoryTrapLanding *&memory_trap_landing() {
+	thread_local MemoryTrapLanding *landing = nullptr;
+	return landing;
+}
+
+static struct sigaction previous_segv_action;
+
+static void handle_segv(int signal, siginfo_t *info, void *ucontext) {
+	MemoryTrapLanding *landing = memory_trap_landing();
+	if (landing != nullptr && landing->memory != nullptr &&
+		landing->memory->reserves(info->si_addr)) {
+		siglongjmp(landing->jump_buffer, 1);
+	}
+
+	// not ours. hand the fault to whoever handled it before, or let it crash
+	// the process when the faulting instruction runs again.
+	if (previous_segv_action.sa_flags & SA_SIGINFO) {
+		previous_segv_action.sa_sigaction(signal, info, ucontext);
+		return;
+	}
+	sigaction(SIGSEGV, &previous_segv_action, nullptr);
+}
+
+void install_memory_trap_handler() {
+	static std::once_flag installed;
+	std::call_once(installed, [] {
+		struct sigaction action = {};
+		action.sa_sigaction = handle_segv;
+		action.sa_flags = SA_SIGINFO | SA_NODEFER | SA_ONSTACK;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGSEGV, &action, &previous_segv_action);
+	});
+}
+
+} // namespace Treble
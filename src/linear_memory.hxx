@@ -0,0 +1,134 @@
+#ifndef __TREBLE__LINEAR_MEMORY_HXX__
+#define __TREBLE__LINEAR_MEMORY_HXX__
+
+#include <atomic>
+#include <csetjmp>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace Treble {
+
+static constexpr size_t WASM_PAGE_SIZE = 64 * 1024;
+
+/**
+ * Most pages a linear memory can have, which makes for 4 GiB.
+ */
+static constexpr uint32_t MAX_MEMORY_PAGES = 65536;
+
+/**
+ * The linear memory of a module instance.
+ *
+ * Every memory reserves enough address space up front that no access can
+ * reach past it: a 32 bit address plus a 32 bit offset stays below 8 GiB. Only
+ * the pages that the memory actually has are accessible, the rest of the
+ * reservation is mapped PROT_NONE. Loads and stores therefore do no bounds
+ * checks at all; an access out of bounds faults, and the fault is turned into
+ * a trap, see run_with_memory_traps. Growing the memory makes more of the
+ * reservation accessible, so the memory never moves.
+ *
+ * A shared memory can be used by instances on several threads at once, which
+ * is why the page count is only ever accessed atomically and growing is
+ * serialized.
+ */
+class LinearMemory {
+  public:
+	/**
+	 * Reserves a memory and makes its first min_pages pages accessible.
+	 * Returns nothing if the address space or the pages cannot be had.
+	 */
+	static std::optional<LinearMemory> create(uint32_t min_pages,
+											  uint32_t max_pages,
+											  bool shared = false);
+
+	LinearMemory(LinearMemory &&other);
+	LinearMemory &operator=(LinearMemory &&other);
+	~LinearMemory();
+
+	LinearMemory(const LinearMemory &) = delete;
+	LinearMemory &operator=(const LinearMemory &) = delete;
+
+	uint8_t *data() const { return base; }
+	uint32_t max_page_count() const { return max_pages; }
+	bool is_shared() const { return shared; }
+
+	uint32_t page_count() const {
+		return std::atomic_ref(pages).load(std::memory_order_acquire);
+	}
+	size_t size() const {
+		return static_cast<size_t>(page_count()) * WASM_PAGE_SIZE;
+	}
+
+	/**
+	 * Grows the memory by delta pages, the way memory.grow does. Returns the
+	 * old number of pages, or -1 if the memory cannot grow that much.
+	 */
+	int32_t grow(uint32_t delta);
+
+	/**
+	 * Whether the address lies within the reservation of the memory.
+	 */
+	bool reserves(const void *address) const;
+
+  private:
+	LinearMemory(uint8_t *base, uint32_t pages, uint32_t max_pages,
+				 bool shared)
+		: base(base), pages(pages), max_pages(max_pages), shared(shared) {}
+
+	uint8_t *base;
+	// mutable so that page_count can read it through an atomic_ref
+	mutable uint32_t pages;
+	uint32_t max_pages;
+	bool shared;
+};
+
+/**
+ * Where faults go while run_with_memory_traps runs on the calling thread.
+ */
+struct MemoryTrapLanding {
+	sigjmp_buf jump_buffer;
+	const LinearMemory *memory;
+	MemoryTrapLanding *previous;
+};
+
+/**
+ * The innermost landing of the calling thread, or nullptr.
+ */
+MemoryTrapLanding *&memory_trap_landing();
+
+/**
+ * Installs the SIGSEGV handler that turns faults on linear memories into
+ * traps. Only the first call does anything.
+ */
+void install_memory_trap_handler();
+
+/**
+ * Calls fn(), during which a fault on the reservation of the given memory,
+ * which may be nullptr, jumps straight back here. Returns false if fn was cut
+ * short that way.
+ *
+ * The jump skips the destructors of whatever fn has on the stack at the time
+ * of the fault, so fn must not have anything there that needs one.
+ */
+template <typename Fn>
+bool run_with_memory_traps(const LinearMemory *memory, Fn &&fn) {
+	MemoryTrapLanding landing{.memory = memory};
+	MemoryTrapLanding *&current = memory_trap_landing();
+	landing.previous = current;
+
+	// the handler runs with SA_NODEFER, so jumping out of it leaves no signal
+	// blocked and the mask does not need to be saved
+	if (sigsetjmp(landing.jump_buffer, 0) != 0) {
+		current = landing.previous;
+		return false;
+	}
+
+	current = &landing;
+	fn();
+	current = landing.previous;
+	return true;
+}
+
+} // namespace Treble
+
+#endif
@@ -1,34 +1,256 @@
+#include "mapped_file.hxx"
 #include "module.hxx"
+#include "module_cache.hxx"
+#include "perf_map.hxx"
+#include "profiler.hxx"
 #include "runtime.hxx"
+#include "sampler.hxx"
+#include "scheduler.hxx"
+#include "simd.hxx"
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
+#include <future>
 #include <ios>
 #include <iostream>
-#include <iterator>
+#include <memory>
 #include <optional>
+#include <span>
+#include <string>
+#include <string_view>
 #include <sys/types.h>
 #include <vector>
 
+/**
+ * Decodes the module at the given path straight out of a mapping of the file,
+ * or loads it from the cache if the cache has seen it before. Files that
+ * cannot be mapped, such as pipes, are streamed into the decoder chunk by
+ * chunk instead, and bypass the cache.
+ */
+static std::optional<Treble::Module>
+load_module(const char *path, const Treble::DecodeConfig &config,
+			Treble::ModuleCache *cache,
+			std::optional<Treble::MappedFile> &mapping) {
+	mapping = Treble::MappedFile::open(path);
+	if (mapping) {
+		const std::span<const uint8_t> binary = mapping->bytes();
+		if (cache == nullptr) {
+			return Treble::parse_binary(binary, config);
+		}
+
+		const uint64_t key = Treble::ModuleCache::key_of(binary, config);
+		if (std::optional<Treble::Module> module = cache->load(key, binary)) {
+			return module;
+		}
+
+		std::optional<Treble::Module> module =
+			Treble::parse_binary(binary, config);
+		if (module && !cache->store(key, binary, *module)) {
+			std::cerr << "failed to write the module to the cache"
+					  << std::endl;
+		}
+		return module;
+	}
+
+	std::ifstream f(path, std::ios::binary);
+
+	Treble::ModuleDecoder decoder(config);
+	char chunk[64 * 1024];
+	while (f.read(chunk, sizeof(chunk)) || f.gcount() > 0) {
+		const std::span<const uint8_t> bytes(
+			reinterpret_cast<const uint8_t *>(chunk), f.gcount());
+		if (!decoder.feed(bytes)) {
+			break;
+		}
+	}
+
+	return decoder.finish();
+}
+
+/**
+ * Writes the profile of every thread to the given path, as CSV if the path
+ * ends in .csv and as JSON otherwise.
+ */
+static void write_profile(const std::string &path) {
+	std::ofstream out(path);
+	const Treble::Profile profile = Treble::collect_profile();
+	if (path.ends_with(".csv")) {
+		Treble::write_profile_csv(profile, out);
+	} else {
+		Treble::write_profile_json(profile, out);
+	}
+
+	if (!out) {
+		std::cerr << "failed to write the profile to " << path << std::endl;
+	}
+}
+
+/**
+ * Stops the sampler and writes the samples it took to the given path, as
+ * folded stacks.
+ */
+static void write_samples(const std::string &path) {
+	Treble::stop_sampling();
+
+	std::ofstream out(path);
+	Treble::write_folded_stacks(out);
+	if (!out) {
+		std::cerr << "failed to write the samples to " << path << std::endl;
+	}
+}
+
 int main(int argc, char *argv[]) {
-	if (argc < 2) {
+	Treble::RuntimeConfig config;
+	Treble::DecodeConfig decode_config;
+	std::optional<Treble::ModuleCache> cache;
+	unsigned thread_count = 1;
+	std::optional<std::string> profile_path;
+	std::optional<std::string> samples_path;
+	uint32_t sample_frequency = 997;
+	const char *path = nullptr;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string_view arg = argv[i];
+		if (arg == "--stack-interpreter") {
+			config.use_register_ir = false;
+			config.use_jit = false;
+		} else if (arg == "--no-jit") {
+			config.use_jit = false;
+		} else if (arg == "--verify-jit") {
+			config.verify_jit = true;
+		} else if (arg.starts_with("--tier-up-threshold=")) {
+			config.tier_up_threshold =
+				std::stoul(std::string(arg.substr(arg.find('=') + 1)));
+		} else if (arg == "--no-background-compile") {
+			config.background_compile = false;
+		} else if (arg.starts_with("--cache-dir=")) {
+			cache.emplace(std::string(arg.substr(arg.find('=') + 1)));
+		} else if (arg.starts_with("--decode-threads=")) {
+			decode_config.decode_threads =
+				std::stoul(std::string(arg.substr(arg.find('=') + 1)));
+		} else if (arg == "--no-fold") {
+			decode_config.fold_constants = false;
+		} else if (arg.starts_with("--threads=")) {
+			thread_count =
+				std::stoul(std::string(arg.substr(arg.find('=') + 1)));
+		} else if (arg == "--profile") {
+			config.profile = true;
+			profile_path = "treble-profile.json";
+		} else if (arg.starts_with("--profile=")) {
+			config.profile = true;
+			profile_path = arg.substr(arg.find('=') + 1);
+		} else if (arg == "--sample") {
+			samples_path = "treble-samples.folded";
+		} else if (arg.starts_with("--sample=")) {
+			samples_path = arg.substr(arg.find('=') + 1);
+		} else if (arg.starts_with("--sample-frequency=")) {
+			sample_frequency =
+				std::stoul(std::string(arg.substr(arg.find('=') + 1)));
+		} else if (arg.starts_with("--simd=")) {
+			const std::optional<Treble::SimdLevel> level =
+				Treble::simd_level_named(arg.substr(arg.find('=') + 1));
+			if (!level || !Treble::set_simd_level(*level)) {
+				std::cerr << "SIMD level " << arg.substr(arg.find('=') + 1)
+						  << " is not supported, using "
+						  << Treble::simd_level_name(
+								 Treble::detect_simd_level())
+						  << std::endl;
+			}
+		} else if (arg == "--perf-map") {
+			if (!Treble::open_perf_map()) {
+				std::cerr << "failed to create the perf map" << std::endl;
+			}
+		} else {
+			path = argv[i];
+		}
+	}
+
+	if (path == nullptr) {
 		std::cerr << "please pass in at least one executable wasm binary."
 				  << std::endl;
 		return -1;
 	}
 
-	std::ifstream f(argv[1], std::ios::binary);
-	std::vector<uint8_t> bin(std::istreambuf_iterator<char>(f), {});
+	// decoding counts towards the samples as well, as host time
+	if (samples_path && !Treble::start_sampling(sample_frequency)) {
+		std::cerr << "failed to start the sampler" << std::endl;
+		samples_path.reset();
+	}
 
-	std::optional<Treble::Module> module = Treble::parse_binary(bin);
+	// the module may point into the mapping and into the cache, so both have
+	// to stay around for as long as the module does
+	std::optional<Treble::MappedFile> mapping;
+	std::optional<Treble::Module> module = load_module(
+		path, decode_config, cache ? &*cache : nullptr, mapping);
+	if (!module) {
+		std::cerr << "failed to parse " << path << std::endl;
+		return -1;
+	}
 
 	std::cout << "binary parsed" << std::endl;
 
 	Treble::describe_module(*module);
-	Treble::ModuleInstance module_instance = instantiate_module(*module);
+	Treble::ModuleInstance module_instance{};
+	if (!instantiate_module(module_instance, *module)) {
+		std::cerr << "failed to instantiate " << path << std::endl;
+		return -1;
+	}
 
 	std::cout << "module instantiated. executing" << std::endl;
 
-	execute_module_instance(module_instance);
+	if (thread_count <= 1) {
+		execute_module_instance(module_instance, config);
+		if (profile_path) {
+			write_profile(*profile_path);
+		}
+		if (samples_path) {
+			write_samples(*samples_path);
+		}
+		return 0;
+	}
+
+	// every worker runs the start function on an instance of its own. if the
+	// memory of the module is shared, all of them use the memory of the first
+	// instance.
+	const bool shared = module->memory != nullptr && module->memory->shared;
+	std::vector<std::unique_ptr<Treble::ModuleInstance>> instances;
+	for (unsigned i = 1; i < thread_count; ++i) {
+		auto &instance =
+			instances.emplace_back(std::make_unique<Treble::ModuleInstance>());
+		if (!instantiate_module(*instance, *module, {},
+								shared ? module_instance.memory : nullptr)) {
+			std::cerr << "failed to instantiate " << path << std::endl;
+			return -1;
+		}
+	}
+
+	// without a start function there is nothing to run, but the profile and
+	// the samples of the decoding are still written
+	if (module->start != nullptr) {
+		Treble::Scheduler scheduler(thread_count, config);
+		const uint32_t start = module->start->func_index;
+		std::vector<std::future<Treble::CallResult>> calls;
+		calls.push_back(scheduler.submit(module_instance.store.funcs[start]));
+		for (auto &instance : instances) {
+			calls.push_back(scheduler.submit(instance->store.funcs[start]));
+		}
+
+		for (std::future<Treble::CallResult> &call : calls) {
+			const Treble::CallResult result = call.get();
+			if (result.trap != Treble::Trap::None) {
+				std::cerr << "trap: " << Treble::trap_message(result.trap)
+						  << std::endl;
+				continue;
+			}
+			Treble::print_results(result.values);
+		}
+	}
+
+	if (profile_path) {
+		write_profile(*profile_path);
+	}
+	if (samples_path) {
+		write_samples(*samples_path);
+	}
 }
@@ -0,0 +1,56 @@
+#include "mapped_file.hxx"
+#include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
+#include <optional>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace Treble {
+
+std::optional<MappedFile> MappedFile::open(const char *path) {
+	const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return std::nullopt;
+	}
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode) ||
+		file_stat.st_size == 0) {
+		close(fd);
+		return std::nullopt;
+	}
+
+	const size_t size = file_stat.st_size;
+	void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping keeps the file alive on its own
+	close(fd);
+	if (data == MAP_FAILED) {
+		return std::nullopt;
+	}
+
+	// modules are decoded front to back
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	return MappedFile(static_cast<const uint8_t *>(data), size);
+}
+
+MappedFile::MappedFile(MappedFile &&other)
+	: data(std::exchange(other.data, nullptr)),
+	  size(std::exchange(other.size, 0)) {}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) {
+	std::swap(data, other.data);
+	std::swap(size, other.size);
+	return *this;
+}
+
+MappedFile::~MappedFile() {
+	if (data != nullptr) {
+		munmap(const_cast<uint8_t *>(data), size);
+	}
+}
+
+} // namespace Treble
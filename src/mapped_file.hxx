@@ -0,0 +1,42 @@
+#ifndef __TREBLE__MAPPED_FILE_HXX__
+#define __TREBLE__MAPPED_FILE_HXX__
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+namespace Treble {
+
+/**
+ * A file mapped read-only into memory. The pages are shared with the page
+ * cache, so they are only read in once they are touched, and processes that
+ * map the same file share them.
+ */
+class MappedFile {
+  public:
+	/**
+	 * Maps the file at the given path. Returns nothing if it cannot be mapped,
+	 * e.g. because it does not exist, is empty or is a pipe.
+	 */
+	static std::optional<MappedFile> open(const char *path);
+
+	MappedFile(MappedFile &&other);
+	MappedFile &operator=(MappedFile &&other);
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	std::span<const uint8_t> bytes() const { return {data, size}; }
+
+  private:
+	MappedFile(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+	const uint8_t *data;
+	size_t size;
+};
+
+} // namespace Treble
+
+#endif
@@ -1,16 +1,55 @@
 #include "module.hxx"
+#include "arena.hxx"
+#include "bytecode.hxx"
+#include "constant_folding.hxx"
 #include "instructions.hxx"
+#include "jit.hxx"
+#include "register_ir.hxx"
+#include "thread_pool.hxx"
+#include "tiering.hxx"
+#include "validator.hxx"
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <optional>
+#include <span>
 #include <stack>
+#include <string_view>
 #include <sys/types.h>
+#include <thread>
 #include <vector>
 
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
 namespace Treble {
 
+static constexpr uint8_t WASM_MAGIC[] = {0x00, 0x61, 0x73, 0x6D};
+
+/**
+ * Prefix of the instructions from the threads proposal, which is followed by
+ * the actual op code as a u32.
+ */
+static constexpr uint32_t ATOMIC_PREFIX = 0xFE;
+
+/**
+ * Prefix of the instructions from the SIMD proposal, which is followed by the
+ * actual op code as a u32.
+ */
+static constexpr uint32_t SIMD_PREFIX = 0xFD;
+
+/**
+ * The most locals a function may have, parameters included. Every one of them
+ * takes a stack slot, or two, in every frame of the function.
+ */
+static constexpr size_t MAX_FUNCTION_LOCALS = 50000;
+
 struct BlockBegin {
 	/**
 	 * the index of the instruction that started this code block
@@ -18,25 +57,91 @@ struct BlockBegin {
 	size_t instr_pos;
 };
 
-size_t varint_size(const std::vector<uint8_t> &bin, size_t header) {
-	size_t size = 0;
-	size_t i = header;
-	while (true) {
-		const auto b = bin[i++];
-		size++;
-		if ((b & 0b10000000) == 0) {
-			break;
+/**
+ * Most LEB128 numbers are short, so they are decoded from a single 64 bit load
+ * whenever bin has 8 bytes left at the number: a number of up to 8 bytes, and
+ * up to 56 bits, which covers every u32 and s32, is then decoded without a
+ * loop. Longer numbers and the last bytes of bin take the byte by byte path.
+ */
+static bool load_word(std::span<const uint8_t> bin, size_t header,
+					  uint64_t &word) {
+	if (header > bin.size() || bin.size() - header < sizeof(word)) {
+		return false;
+	}
+	std::memcpy(&word, bin.data() + header, sizeof(word));
+	return true;
+}
+
+/**
+ * Returns the number of bytes taken by the LEB128 number at the start of word,
+ * or 0 if it takes more than the 8 bytes of word.
+ */
+static size_t word_varint_size(uint64_t word) {
+	// the continuation bits that are clear mark the bytes that end a number
+	const uint64_t ends = ~word & 0x8080808080808080;
+	return ends == 0 ? 0 : std::countr_zero(ends) / 8 + 1;
+}
+
+/**
+ * Packs the payload bits of the first size bytes of word together, where size
+ * is between 1 and 8.
+ */
+static uint64_t word_varint_value(uint64_t word, size_t size) {
+	const uint64_t payload =
+		0x7F7F7F7F7F7F7F7F & (~static_cast<uint64_t>(0) >> (64 - 8 * size));
+#if defined(__BMI2__)
+	return _pext_u64(word, payload);
+#else
+	// closes the gaps between the 7 bit groups, doubling their width each step
+	uint64_t value = word & payload;
+	value = (value & 0x007F007F007F007F) | ((value & 0x7F007F007F007F00) >> 1);
+	value = (value & 0x00003FFF00003FFF) | ((value & 0x3FFF00003FFF0000) >> 2);
+	return (value & 0x000000000FFFFFFF) | ((value & 0x0FFFFFFF00000000) >> 4);
+#endif
+}
+
+/**
+ * Returns the number of bytes taken by the LEB128 number at the start of bin,
+ * or 0 if the number does not end within bin.
+ */
+static size_t varint_size(std::span<const uint8_t> bin) {
+	uint64_t word;
+	size_t i = 0;
+	if (load_word(bin, 0, word)) {
+		if (const size_t size = word_varint_size(word); size != 0) {
+			return size;
+		}
+		i = sizeof(word);
+	}
+	for (; i < bin.size(); ++i) {
+		if ((bin[i] & 0b10000000) == 0) {
+			return i + 1;
 		}
 	}
-	return size;
+	return 0;
 }
 
-uint32_t decode_u32(const std::vector<uint8_t> &bin, size_t &header) {
-	uint32_t result = 0;
+/**
+ * The decode_* functions read a LEB128 number from bin at header. If the
+ * number runs past the end of bin, header is moved past the end, so that
+ * callers only need to check header once they are done with a section or
+ * function body.
+ */
+
+static uint64_t decode_u64_slow(std::span<const uint8_t> bin, size_t &header) {
+	const size_t end = bin.size();
+	uint64_t result = 0;
 	size_t shift = 0;
 	while (true) {
+		if (header >= end) {
+			header = end + 1;
+			return 0;
+		}
+
 		const auto b = bin[header++];
-		result |= ((b & 0b01111111) << shift);
+		if (shift < 64) {
+			result |= static_cast<uint64_t>(b & 0b01111111) << shift;
+		}
 		if ((b & 0b10000000) == 0) {
 			break;
 		}
@@ -45,288 +150,1109 @@ uint32_t decode_u32(const std::vector<uint8_t> &bin, size_t &header) {
 	return result;
 }
 
-uint64_t decode_u64(const std::vector<uint8_t> &bin, size_t &header) {
+uint64_t decode_u64(std::span<const uint8_t> bin, size_t &header) {
+	if (header < bin.size() && (bin[header] & 0b10000000) == 0) {
+		return bin[header++];
+	}
+
+	uint64_t word;
+	if (load_word(bin, header, word)) {
+		if (const size_t size = word_varint_size(word); size != 0) {
+			header += size;
+			return word_varint_value(word, size);
+		}
+	}
+	return decode_u64_slow(bin, header);
+}
+
+uint32_t decode_u32(std::span<const uint8_t> bin, size_t &header) {
+	return static_cast<uint32_t>(decode_u64(bin, header));
+}
+
+static int64_t decode_s64_slow(std::span<const uint8_t> bin, size_t &header) {
+	const size_t end = bin.size();
 	uint64_t result = 0;
 	size_t shift = 0;
 	while (true) {
+		if (header >= end) {
+			header = end + 1;
+			return 0;
+		}
+
 		const auto b = bin[header++];
-		result |= ((b & 0b01111111) << shift);
+		if (shift < 64) {
+			result |= static_cast<uint64_t>(b & 0b01111111) << shift;
+		}
+		shift += 7;
 		if ((b & 0b10000000) == 0) {
+			// the last byte carries the sign in its second highest bit
+			if (shift < 64 && (b & 0b01000000) != 0) {
+				result |= ~static_cast<uint64_t>(0) << shift;
+			}
 			break;
 		}
-		shift += 7;
 	}
-	return result;
+	return static_cast<int64_t>(result);
 }
 
-void read_code_section(Treble::Module &module, const std::vector<uint8_t> &bin,
-					   size_t &header) {
-	uint32_t section_size = decode_u32(bin, header);
-	uint32_t num_functions = decode_u32(bin, header);
+int64_t decode_s64(std::span<const uint8_t> bin, size_t &header) {
+	if (header < bin.size() && (bin[header] & 0b10000000) == 0) {
+		// a single byte holds a 7 bit number, sign extended from bit 6
+		return static_cast<int8_t>(bin[header++] << 1) >> 1;
+	}
 
-	for (size_t i = 0; i < num_functions; ++i) {
-		Treble::Function &func = module.funcs[i];
+	uint64_t word;
+	if (load_word(bin, header, word)) {
+		if (const size_t size = word_varint_size(word); size != 0) {
+			header += size;
+			// moves the sign to the top bit and shifts it back down
+			const size_t unused = 64 - 7 * size;
+			const uint64_t value = word_varint_value(word, size) << unused;
+			return static_cast<int64_t>(value) >> unused;
+		}
+	}
+	return decode_s64_slow(bin, header);
+}
 
-		uint32_t func_body_size = decode_u32(bin, header);
-		uint32_t local_decl_count = decode_u32(bin, header);
-
-		uint8_t op_code = bin[header];
-		size_t op_count = 0;
-
-		// first, count the number of instructions in this code setion.
-
-		uint block_level = 0;
-		// this is used for counting, pointing to which instruction we are at
-		size_t count_ptr = header;
-		bool end_reached = false;
-		while (!end_reached) {
-			switch (static_cast<Instruction::OpCode>(op_code)) {
-			case Instruction::OpCode::i64_const:
-			case Instruction::OpCode::i32_const:
-				op_count++;
-				count_ptr++;
-				count_ptr += varint_size(bin, count_ptr);
-				op_code = bin[count_ptr];
-				break;
+int32_t decode_s32(std::span<const uint8_t> bin, size_t &header) {
+	return static_cast<int32_t>(decode_s64(bin, header));
+}
 
-			case Instruction::OpCode::f32_const:
-				op_count++;
-				count_ptr += 5;
-				op_code = bin[count_ptr];
-				break;
+/**
+ * Decodes a single function body in one pass, and stores it in the compact
+ * encoding, folded if fold is set. instructions is scratch space that is
+ * reused across bodies.
+ */
+static bool read_function_body(Function &func, const Module &module,
+							   std::span<const uint8_t> bin,
+							   std::vector<Instruction> &instructions,
+							   Arena &arena, bool fold) {
+	const size_t end = bin.size();
+	size_t header = 0;
+
+	if (func.type_index >= module.type_count) {
+		return false;
+	}
+	const FunctionType &type = module.types[func.type_index];
+
+	// the parameters come first among the locals, followed by the locals the
+	// function declares, which come in runs of a count and a type
+	std::vector<ValueType> locals(type.param_types,
+								  type.param_types + type.param_count);
+	const uint32_t local_decl_count = decode_u32(bin, header);
+	for (size_t i = 0; i < local_decl_count && header < end; ++i) {
+		const uint32_t count = decode_u32(bin, header);
+		if (header >= end || !is_value_type(bin[header]) ||
+			locals.size() + count > MAX_FUNCTION_LOCALS) {
+			return false;
+		}
+		locals.insert(locals.end(), count, static_cast<ValueType>(bin[header]));
+		header++;
+	}
 
-			case Instruction::OpCode::if_:
-				block_level++;
-				op_count++;
-				count_ptr += 2;
-				op_code = bin[count_ptr];
-				break;
+	// the first slot of every local in the frame
+	std::vector<uint32_t> local_slots(locals.size());
+	for (size_t i = 1; i < locals.size(); ++i) {
+		local_slots[i] = local_slots[i - 1] + slot_count(&locals[i - 1], 1);
+	}
 
-			case Instruction::OpCode::end:
-				op_count++;
-				if (block_level == 0) {
-					end_reached = true;
-				} else {
-					block_level--;
-				}
-				break;
+	func.param_slots = slot_count(type.param_types, type.param_count);
+	func.local_slots =
+		slot_count(locals.data(), locals.size()) - func.param_slots;
+	func.result_slots = slot_count(type.result_types, type.result_count);
+	func.indirect_call_count = 0;
 
-			default:
-				op_count++;
-				op_code = bin[++count_ptr];
-				break;
+	instructions.clear();
+
+	// this is used to keep track of block nesting
+	std::stack<BlockBegin> block_stack;
+
+	bool end_reached = false;
+	while (!end_reached) {
+		if (header >= end) {
+			return false;
+		}
+
+		const size_t j = instructions.size();
+		Instruction &instr = instructions.emplace_back();
+
+		const uint8_t op_byte = bin[header++];
+		auto op_code = static_cast<Instruction::OpCode>(op_byte);
+		if (op_byte == ATOMIC_PREFIX || op_byte == SIMD_PREFIX) {
+			const uint32_t prefixed_op_code = decode_u32(bin, header);
+			if (prefixed_op_code > 0xFF) {
+				return false;
 			}
+			op_code = static_cast<Instruction::OpCode>(op_byte << 8 |
+													   prefixed_op_code);
 		}
+		instr.op_code = op_code;
+		switch (op_code) {
+		case Instruction::OpCode::i32_const:
+			instr.args.i32 = decode_s32(bin, header);
+			break;
+
+		case Instruction::OpCode::i64_const:
+			instr.args.i64 = decode_s64(bin, header);
+			break;
 
-		func.body = static_cast<Instruction *>(
-			std::malloc((op_count) * sizeof(Instruction)));
+		case Instruction::OpCode::f32_const:
+			if (end - header < 4) {
+				return false;
+			}
+			std::memcpy(&instr.args.f32, &bin[header], 4);
+			header += 4;
+			break;
 
-		// this is used to keep track of block nesting
-		std::stack<BlockBegin> block_stack;
+#define MEMARG_CASE(name, op_code, text)                                       \
+	case Instruction::OpCode::name:
 
-		for (size_t j = 0; j < op_count; ++j) {
-			Instruction &instr = func.body[j];
+			TREBLE_FOREACH_MEMARG_OPCODE(MEMARG_CASE)
 
-			auto op_code = static_cast<Instruction::OpCode>(bin[header++]);
-			instr.op_code = op_code;
-			switch (op_code) {
-			case Instruction::OpCode::i32_const:
-				instr.args.i32 = decode_u32(bin, header);
-				break;
+#undef MEMARG_CASE
+			instr.args.memarg.align = decode_u32(bin, header);
+			instr.args.memarg.offset = decode_u32(bin, header);
+			break;
 
-			case Instruction::OpCode::i64_const:
-				instr.args.i64 = decode_u64(bin, header);
-				break;
+#define LANE_ACCESS_CASE(name, op_code, text)                                  \
+	case Instruction::OpCode::name:
 
-			case Instruction::OpCode::f32_const:
-				std::memcpy(&instr.args.f32, &bin[header], 4);
-				header += 4;
-				break;
+			TREBLE_FOREACH_SIMD_LOAD_LANE_OPCODE(LANE_ACCESS_CASE)
+			TREBLE_FOREACH_SIMD_STORE_LANE_OPCODE(LANE_ACCESS_CASE)
 
-			case Instruction::OpCode::if_:
-				instr.args.if_branch.block_type = nullptr;
+#undef LANE_ACCESS_CASE
+			instr.args.memarg.align = decode_u32(bin, header);
+			instr.args.memarg.offset = decode_u32(bin, header);
+			if (header >= end) {
+				return false;
+			}
+			instr.args.memarg.lane = bin[header++];
+			break;
 
-				// TODO: add support for blocktype
-				// skip over the blocktype byte, not handling blocktype rn
-				header++;
+#define LANE_CASE(name, op_code, text) case Instruction::OpCode::name:
 
-				func.body[j].args.if_branch.instr_1_offset = 1;
-				block_stack.push({.instr_pos = j});
-				break;
+			TREBLE_FOREACH_SIMD_EXTRACT_LANE_OPCODE(LANE_CASE)
+			TREBLE_FOREACH_SIMD_REPLACE_LANE_OPCODE(LANE_CASE)
 
-			case Instruction::OpCode::else_: {
-				auto &block_begin = block_stack.top();
+#undef LANE_CASE
+			if (header >= end) {
+				return false;
+			}
+			instr.args.lane = bin[header++];
+			break;
 
-				func.body[block_begin.instr_pos].args.if_branch.instr_2_offset =
-					j - block_begin.instr_pos + 1;
+		case Instruction::OpCode::v128_const:
+		case Instruction::OpCode::i8x16_shuffle:
+			if (end - header < 16) {
+				return false;
+			}
+			std::memcpy(instr.args.v128, &bin[header], 16);
+			header += 16;
+			break;
 
-				block_begin.instr_pos = j;
+#define LOCAL_CASE(name, op_code, text) case Instruction::OpCode::name:
 
-				break;
+			TREBLE_FOREACH_LOCAL_OPCODE(LOCAL_CASE)
+
+#undef LOCAL_CASE
+		{
+			const uint32_t index = decode_u32(bin, header);
+			if (index >= locals.size()) {
+				return false;
 			}
+			instr.args.local.slot = local_slots[index];
+			instr.args.local.v128 = locals[index] == ValueType::v128;
+			break;
+		}
 
-			case Instruction::OpCode::end: {
-				if (block_stack.empty()) {
-					break;
+		case Instruction::OpCode::call:
+			instr.args.call.func_index = decode_u32(bin, header);
+			break;
+
+		case Instruction::OpCode::call_indirect:
+			instr.args.call_indirect.type_index = decode_u32(bin, header);
+			instr.args.call_indirect.site = func.indirect_call_count++;
+			// the index of the table, which can only be 0 for now
+			if (decode_u32(bin, header) != 0) {
+				return false;
+			}
+			break;
+
+		case Instruction::OpCode::memory_size:
+		case Instruction::OpCode::memory_grow:
+		case Instruction::OpCode::atomic_fence:
+			// the index of the memory, which can only be 0 for now, and the
+			// ordering of a fence, which can only be sequentially consistent
+			if (header >= end || bin[header++] != 0) {
+				return false;
+			}
+			break;
+
+		case Instruction::OpCode::block:
+		case Instruction::OpCode::loop:
+			if (header >= end || (bin[header] != EMPTY_BLOCK_TYPE &&
+								  !is_value_type(bin[header]))) {
+				return false;
+			}
+			instr.args.block.block_type = bin[header++];
+			block_stack.push({.instr_pos = j});
+			break;
+
+		case Instruction::OpCode::br:
+		case Instruction::OpCode::br_if:
+			instr.args.branch.depth = decode_u32(bin, header);
+			// the function body itself is the outermost label
+			if (instr.args.branch.depth > block_stack.size()) {
+				return false;
+			}
+			instr.args.branch.arity = 0;
+			instr.args.branch.drop = 0;
+			break;
+
+		case Instruction::OpCode::br_table: {
+			const uint32_t count = decode_u32(bin, header);
+			// every label takes at least a byte, which keeps a bogus count
+			// from allocating more than the body could hold
+			if (header > end || count > end - header) {
+				return false;
+			}
+
+			auto *labels = arena.allocate_array<BranchLabel>(count + 1);
+			for (size_t k = 0; k <= count; ++k) {
+				labels[k].depth = decode_u32(bin, header);
+				labels[k].drop = 0;
+				if (labels[k].depth > block_stack.size()) {
+					return false;
 				}
+			}
 
-				auto block_begin = block_stack.top();
+			instr.args.branch_table.labels = labels;
+			instr.args.branch_table.count = count;
+			instr.args.branch_table.arity = 0;
+			break;
+		}
 
-				func.body[block_begin.instr_pos]
-					.args.else_branch.end_marker_offset =
-					j - block_begin.instr_pos;
+		case Instruction::OpCode::if_:
+			// TODO: add support for blocktypes that refer to a function type
+			if (header >= end || (bin[header] != EMPTY_BLOCK_TYPE &&
+								  !is_value_type(bin[header]))) {
+				return false;
+			}
+			instr.args.if_branch.block_type = bin[header++];
 
-				block_stack.pop();
+			instr.args.if_branch.instr_1_offset = 1;
+			block_stack.push({.instr_pos = j});
+			break;
 
-				break;
+		case Instruction::OpCode::else_: {
+			if (block_stack.empty()) {
+				return false;
 			}
 
-			default:
+			auto &block_begin = block_stack.top();
+			Instruction &begin = instructions[block_begin.instr_pos];
+			if (begin.op_code != Instruction::OpCode::if_) {
+				return false;
+			}
+
+			begin.args.if_branch.instr_2_offset = j - block_begin.instr_pos + 1;
+
+			block_begin.instr_pos = j;
+
+			break;
+		}
+
+		case Instruction::OpCode::end: {
+			if (block_stack.empty()) {
+				end_reached = true;
 				break;
 			}
+
+			auto block_begin = block_stack.top();
+			Instruction &begin = instructions[block_begin.instr_pos];
+
+			if (begin.op_code == Instruction::OpCode::if_) {
+				// there is no else arm, so a false condition skips
+				// straight to the end marker
+				begin.args.if_branch.instr_2_offset = j - block_begin.instr_pos;
+			} else if (begin.op_code == Instruction::OpCode::else_) {
+				begin.args.else_branch.end_marker_offset =
+					j - block_begin.instr_pos;
+			}
+
+			block_stack.pop();
+
+			break;
+		}
+
+		default:
+			break;
 		}
 	}
+
+	if (header != end) {
+		return false;
+	}
+
+	std::vector<size_t> v128_drops;
+	std::vector<BranchUnwind> branch_unwinds;
+	const std::optional<uint32_t> max_stack_height = validate_function(
+		func, instructions, module, locals, &v128_drops, &branch_unwinds);
+	if (!max_stack_height) {
+		return false;
+	}
+	func.max_stack_height = *max_stack_height;
+
+	for (const size_t i : v128_drops) {
+		instructions[i].args.drop.v128 = true;
+	}
+	for (const BranchUnwind &unwind : branch_unwinds) {
+		Instruction &instr = instructions[unwind.index];
+		if (instr.op_code == Instruction::OpCode::br_table) {
+			instr.args.branch_table.arity = unwind.arity;
+			instr.args.branch_table.labels[unwind.label].drop = unwind.drop;
+		} else {
+			instr.args.branch.arity = unwind.arity;
+			instr.args.branch.drop = unwind.drop;
+		}
+	}
+
+	// only once the function is known to be valid, as folding drops arms
+	// without looking at them.
+	if (fold) {
+		fold_constants(instructions);
+	}
+	func.body = encode_function(instructions.data(), instructions.size(), arena,
+								func.body_size);
+
+	return true;
 }
 
-void read_start_section(Treble::Module &module, const std::vector<uint8_t> &bin,
-						size_t &header) {
-	uint32_t section_size = decode_u32(bin, header);
+/**
+ * Decodes a complete code section. A first, cheap pass only records where
+ * every function body starts; the bodies are then decoded in parallel on the
+ * pool.
+ */
+bool read_code_section(Treble::Module &module, std::span<const uint8_t> bin,
+					   ThreadPool &pool, bool fold) {
+	struct BodyRange {
+		size_t begin;
+		size_t size;
+	};
 
-	module.start =
-		static_cast<Treble::Start *>(std::malloc(sizeof(Treble::Start)));
+	const size_t end = bin.size();
+	size_t header = 0;
+	uint32_t num_functions = decode_u32(bin, header);
+	if (num_functions != module.func_count) {
+		return false;
+	}
+
+	std::vector<BodyRange> bodies(num_functions);
+	for (size_t i = 0; i < num_functions; ++i) {
+		uint32_t func_body_size = decode_u32(bin, header);
+		if (header > end || end - header < func_body_size) {
+			return false;
+		}
+
+		bodies[i] = {.begin = header, .size = func_body_size};
+		header += func_body_size;
+	}
+
+	if (header != end) {
+		return false;
+	}
+
+	// every worker decodes into scratch space and an arena of its own. the
+	// arenas are handed over to the module once all bodies are done.
+	std::vector<std::vector<Instruction>> scratch(pool.worker_count());
+	std::vector<Arena> arenas;
+	for (size_t i = 0; i < pool.worker_count(); ++i) {
+		arenas.emplace_back(module.arena.backing());
+	}
+	std::atomic<bool> failed = false;
+
+	pool.parallel_for(num_functions, [&](size_t i, size_t worker) {
+		const BodyRange &body = bodies[i];
+		if (!read_function_body(module.funcs[i], module,
+								bin.subspan(body.begin, body.size),
+								scratch[worker], arenas[worker], fold)) {
+			failed.store(true, std::memory_order_relaxed);
+		}
+	});
+
+	for (Arena &arena : arenas) {
+		module.arena.adopt(arena);
+	}
+
+	return !failed.load(std::memory_order_relaxed);
+}
+
+bool read_start_section(Treble::Module &module,
+						std::span<const uint8_t> bin) {
+	const size_t end = bin.size();
+	size_t header = 0;
+
+	module.start = module.arena.allocate_array<Treble::Start>(1);
 	module.start->func_index = decode_u32(bin, header);
+
+	return header == end;
+}
+
+bool read_memory_section(Treble::Module &module,
+						 std::span<const uint8_t> bin) {
+	const size_t end = bin.size();
+	size_t header = 0;
+	uint32_t num_memories = decode_u32(bin, header);
+
+	// a module has at most one memory
+	if (num_memories == 0) {
+		return header == end;
+	}
+	if (num_memories > 1 || module.memory != nullptr || header >= end) {
+		return false;
+	}
+
+	// limits: flags that say whether there is a maximum and whether the
+	// memory is shared, then the minimum. shared memories need a maximum.
+	const uint8_t flags = bin[header++];
+	if (flags > 3 || flags == 2) {
+		return false;
+	}
+
+	module.memory = module.arena.allocate_array<MemoryType>(1);
+	module.memory->min_pages = decode_u32(bin, header);
+	module.memory->max_pages =
+		flags & 1 ? decode_u32(bin, header) : MAX_MEMORY_PAGES;
+	module.memory->shared = flags & 2;
+
+	if (module.memory->min_pages > module.memory->max_pages ||
+		module.memory->max_pages > MAX_MEMORY_PAGES) {
+		return false;
+	}
+
+	return header == end;
 }
 
-void read_function_section(Treble::Module &module,
-						   const std::vector<uint8_t> &bin, size_t &header) {
-	uint32_t section_size = decode_u32(bin, header);
+/**
+ * Reads the offset of an active segment, which is a constant expression.
+ * Without globals, that can only be an i32.const.
+ */
+static bool read_segment_offset(std::span<const uint8_t> bin, size_t &header,
+								uint32_t &offset) {
+	const size_t end = bin.size();
+	if (header >= end ||
+		bin[header++] != static_cast<uint8_t>(Instruction::OpCode::i32_const)) {
+		return false;
+	}
+	offset = decode_s32(bin, header);
+	return header < end && bin[header++] == END_MARKER;
+}
+
+bool read_table_section(Treble::Module &module, std::span<const uint8_t> bin) {
+	const size_t end = bin.size();
+	size_t header = 0;
+	uint32_t num_tables = decode_u32(bin, header);
+
+	// a module has at most one table, which holds functions
+	if (num_tables == 0) {
+		return header == end;
+	}
+	if (num_tables > 1 || module.table != nullptr || header >= end ||
+		bin[header++] != FUNCREF_TYPE || header >= end) {
+		return false;
+	}
+
+	// limits: flags that say whether there is a maximum, then the minimum
+	const uint8_t flags = bin[header++];
+	if (flags > 1) {
+		return false;
+	}
+
+	module.table = module.arena.allocate_array<TableType>(1);
+	module.table->min_size = decode_u32(bin, header);
+	module.table->max_size = flags & 1 ? decode_u32(bin, header) : UINT32_MAX;
+
+	if (module.table->min_size > module.table->max_size ||
+		module.table->min_size > MAX_TABLE_SIZE) {
+		return false;
+	}
+
+	return header == end;
+}
+
+/**
+ * Reads the element segments, and copies the function indices of the active
+ * ones, as the section may not outlive decoding.
+ */
+bool read_element_section(Treble::Module &module,
+						  std::span<const uint8_t> bin) {
+	const size_t end = bin.size();
+	size_t header = 0;
+	uint32_t num_segments = decode_u32(bin, header);
+	if (header > end || end - header < num_segments) {
+		return false;
+	}
+
+	module.element_segments =
+		module.arena.allocate_array<ElementSegment>(num_segments);
+	module.element_segment_count = 0;
+
+	for (size_t i = 0; i < num_segments; ++i) {
+		// 0: active in table 0, 1: passive, 2: active in the given table,
+		// 3: declarative. the other kinds hold expressions instead of
+		// function indices, which treble does not support.
+		const uint32_t kind = decode_u32(bin, header);
+		if (kind > 3) {
+			return false;
+		}
+		if (kind == 2 && decode_u32(bin, header) != 0) {
+			return false;
+		}
+
+		const bool active = kind == 0 || kind == 2;
+		uint32_t offset = 0;
+		if (active && !read_segment_offset(bin, header, offset)) {
+			return false;
+		}
+
+		// all but the first kind say what kind of element they hold, which
+		// can only be a function
+		if (kind != 0 && (header >= end || bin[header++] != 0)) {
+			return false;
+		}
+
+		const uint32_t size = decode_u32(bin, header);
+		if (header > end || end - header < size) {
+			return false;
+		}
+
+		auto *func_indices =
+			active ? module.arena.allocate_array<uint32_t>(size) : nullptr;
+		for (size_t j = 0; j < size; ++j) {
+			const uint32_t func_index = decode_u32(bin, header);
+			if (func_index >= module.func_count) {
+				return false;
+			}
+			if (active) {
+				func_indices[j] = func_index;
+			}
+		}
+
+		if (active) {
+			// the table never grows, so a segment that does not fit now never
+			// does
+			if (module.table == nullptr ||
+				static_cast<uint64_t>(offset) + size > module.table->min_size) {
+				return false;
+			}
+
+			module.element_segments[module.element_segment_count++] = {
+				.offset = offset,
+				.func_indices = func_indices,
+				.size = size,
+			};
+		}
+	}
+
+	return header == end;
+}
+
+/**
+ * Reads the data segments, and copies the bytes of the active ones, as the
+ * section may not outlive decoding.
+ */
+bool read_data_section(Treble::Module &module, std::span<const uint8_t> bin) {
+	const size_t end = bin.size();
+	size_t header = 0;
+	uint32_t num_segments = decode_u32(bin, header);
+	if (header > end || end - header < num_segments) {
+		return false;
+	}
+
+	module.data_segments =
+		module.arena.allocate_array<DataSegment>(num_segments);
+	module.data_segment_count = 0;
+
+	for (size_t i = 0; i < num_segments; ++i) {
+		// 0: active in memory 0, 1: passive, 2: active in the given memory
+		const uint32_t mode = decode_u32(bin, header);
+		if (mode > 2) {
+			return false;
+		}
+		if (mode == 2 && decode_u32(bin, header) != 0) {
+			return false;
+		}
+
+		uint32_t offset = 0;
+		if (mode != 1 && !read_segment_offset(bin, header, offset)) {
+			return false;
+		}
+
+		const uint32_t size = decode_u32(bin, header);
+		if (header > end || end - header < size) {
+			return false;
+		}
+
+		if (mode != 1) {
+			// the memory never starts out any bigger than its minimum, so a
+			// segment that does not fit now never does
+			if (module.memory == nullptr ||
+				static_cast<uint64_t>(offset) + size >
+					static_cast<uint64_t>(module.memory->min_pages) *
+						WASM_PAGE_SIZE) {
+				return false;
+			}
+
+			auto *bytes = module.arena.allocate_array<uint8_t>(size);
+			std::memcpy(bytes, bin.data() + header, size);
+			module.data_segments[module.data_segment_count++] = {
+				.offset = offset,
+				.bytes = bytes,
+				.size = size,
+			};
+		}
+
+		header += size;
+	}
+
+	return header == end;
+}
+
+bool read_function_section(Treble::Module &module,
+						   std::span<const uint8_t> bin) {
+	const size_t end = bin.size();
+	size_t header = 0;
 	uint32_t num_functions = decode_u32(bin, header);
 
 	module.func_count = num_functions;
 
 	if (num_functions <= 0) {
-		return;
+		return header == end;
 	}
 
-	module.funcs =
-		static_cast<Function *>(std::malloc(num_functions * sizeof(Function)));
+	module.funcs = module.arena.allocate_array<Function>(num_functions);
 
 	for (size_t i = 0; i < num_functions; ++i) {
 		module.funcs[i].type_index = decode_u32(bin, header);
+		module.funcs[i].body = nullptr;
+		module.funcs[i].body_size = 0;
+		module.funcs[i].max_stack_height = 0;
+		module.funcs[i].param_slots = 0;
+		module.funcs[i].local_slots = 0;
+		module.funcs[i].result_slots = 0;
+		module.funcs[i].indirect_call_count = 0;
 	}
+
+	return header == end;
 }
 
-void read_type_section(Treble::Module &module, const std::vector<uint8_t> &bin,
-					   size_t &header) {
-	uint32_t section_size = decode_u32(bin, header);
+bool read_type_section(Treble::Module &module,
+					   std::span<const uint8_t> bin) {
+	const size_t end = bin.size();
+	size_t header = 0;
 	uint32_t num_types = decode_u32(bin, header);
 
 	if (num_types <= 0) {
-		return;
+		return header == end;
 	}
 
-	module.types = static_cast<FunctionType *>(
-		std::malloc(num_types * sizeof(FunctionType)));
+	module.types = module.arena.allocate_array<FunctionType>(num_types);
 	module.type_count = num_types;
 
 	for (size_t i = 0; i < num_types; ++i) {
 		FunctionType &current_type = module.types[i];
 
-		if (bin[header++] !=
-			static_cast<std::underlying_type_t<TypeId>>(TypeId::Function)) {
-			continue;
+		if (header >= end ||
+			bin[header++] !=
+				static_cast<std::underlying_type_t<TypeId>>(TypeId::Function)) {
+			return false;
 		}
 
 		uint32_t num_params = decode_u32(bin, header);
 		current_type.param_count = num_params;
+		current_type.param_types = nullptr;
 		if (num_params > 0) {
-			current_type.param_types = static_cast<ValueType *>(
-				std::malloc(num_params * sizeof(ValueType)));
+			if (header > end || end - header < num_params) {
+				return false;
+			}
+			auto *param_types =
+				module.arena.allocate_array<ValueType>(num_params);
 			for (size_t j = 0; j < num_params; ++j) {
-				current_type.param_types[j] =
-					static_cast<ValueType>(bin[header++]);
+				if (!is_value_type(bin[header])) {
+					return false;
+				}
+				param_types[j] = static_cast<ValueType>(bin[header++]);
 			}
+			current_type.param_types = param_types;
 		}
 
 		uint32_t num_rettype = decode_u32(bin, header);
 		current_type.result_count = num_rettype;
+		current_type.result_types = nullptr;
 		if (num_rettype > 0) {
-			current_type.param_types = static_cast<ValueType *>(
-				std::malloc(num_rettype * sizeof(ValueType)));
+			if (header > end || end - header < num_rettype) {
+				return false;
+			}
+			auto *result_types =
+				module.arena.allocate_array<ValueType>(num_rettype);
 			for (size_t j = 0; j < num_rettype; ++j) {
-				current_type.param_types[j] =
-					static_cast<ValueType>(bin[header++]);
+				if (!is_value_type(bin[header])) {
+					return false;
+				}
+				result_types[j] = static_cast<ValueType>(bin[header++]);
 			}
+			current_type.result_types = result_types;
 		}
 	}
+
+	return header == end;
 }
 
-void read_custom_section(Module &module, const std::vector<uint8_t> &bin,
-						 size_t &header) {
-	uint32_t section_size = decode_u32(bin, header);
-	header += section_size;
+/**
+ * Records a view of a custom section. Neither its name nor its contents are
+ * copied, so bin has to outlive the module.
+ */
+bool read_custom_section(Treble::Module &module,
+						 std::span<const uint8_t> bin) {
+	const size_t end = bin.size();
+	size_t header = 0;
+	uint32_t name_size = decode_u32(bin, header);
+	if (header > end || end - header < name_size) {
+		return false;
+	}
+
+	module.custom_sections.push_back({
+		.name = std::string_view(
+			reinterpret_cast<const char *>(bin.data() + header), name_size),
+		.contents = bin.subspan(header + name_size),
+	});
+
+	return true;
 }
 
-std::optional<Treble::Module> parse_binary(const std::vector<uint8_t> &bin) {
-	// check wasm header
-	if (bin[0] != 0 || bin[1] != 0x61 || bin[2] != 0x73 || bin[3] != 0x6D) {
-		return std::nullopt;
+ModuleDecoder::ModuleDecoder(const DecodeConfig &config)
+	: fold_constants(config.fold_constants),
+	  decode_threads(config.decode_threads) {
+	module.arena = Arena(config.allocator);
+
+	if (decode_threads == 0) {
+		decode_threads = std::max(std::thread::hardware_concurrency(), 1u);
 	}
+}
+
+size_t ModuleDecoder::decode(std::span<const uint8_t> bin) {
+	size_t header = 0;
+
+	while (state != State::Failed) {
+		const std::span<const uint8_t> unit = bin.subspan(header);
+		const size_t available = unit.size();
+
+		switch (state) {
+		case State::Header:
+			if (available < 8) {
+				return header;
+			}
+			if (std::memcmp(unit.data(), WASM_MAGIC, sizeof(WASM_MAGIC)) != 0) {
+				state = State::Failed;
+				break;
+			}
+			header += 8;
+			state = State::SectionHeader;
+			break;
 
-	auto module = std::make_optional<Treble::Module>();
+		case State::SectionHeader: {
+			const size_t size_length =
+				available > 0 ? varint_size(unit.subspan(1)) : 0;
+			if (size_length == 0) {
+				return header;
+			}
 
-	size_t header = 8;
-	size_t end = bin.size();
-	while (header < end) {
-		auto byte = bin[header];
-		switch (static_cast<SectionType>(byte)) {
-		case SectionType::Custom:
-			read_custom_section(*module, bin, ++header);
+			size_t section_header = 1;
+			section_type = static_cast<SectionType>(unit[0]);
+			section_size = decode_u32(unit, section_header);
+			header += section_header;
+
+			// unless it is decoded in parallel, the code section is not
+			// buffered as a whole. every function body in it is decoded as
+			// soon as it is complete instead.
+			state = section_type == SectionType::Code && decode_threads == 1
+						? State::FunctionCount
+						: State::SectionPayload;
 			break;
+		}
+
+		case State::SectionPayload: {
+			if (available < section_size) {
+				return header;
+			}
+
+			bool ok = true;
+			switch (section_type) {
+			case SectionType::Type:
+				ok = read_type_section(module, unit.first(section_size));
+				break;
+
+			case SectionType::Function:
+				ok = read_function_section(module, unit.first(section_size));
+				break;
+
+			case SectionType::Start:
+				ok = read_start_section(module, unit.first(section_size));
+				break;
+
+			case SectionType::Table:
+				ok = read_table_section(module, unit.first(section_size));
+				break;
+
+			case SectionType::Memory:
+				ok = read_memory_section(module, unit.first(section_size));
+				break;
 
-		case SectionType::Type:
-			read_type_section(*module, bin, ++header);
+			case SectionType::Element:
+				ok = read_element_section(module, unit.first(section_size));
+				break;
+
+			case SectionType::Data:
+				ok = read_data_section(module, unit.first(section_size));
+				break;
+
+			case SectionType::Custom:
+				if (keep_custom_sections) {
+					ok = read_custom_section(module, unit.first(section_size));
+				}
+				break;
+
+			case SectionType::Code:
+				if (!pool) {
+					pool = std::make_unique<ThreadPool>(decode_threads);
+				}
+				ok = read_code_section(module, unit.first(section_size), *pool,
+									   fold_constants);
+				next_body = module.func_count;
+				break;
+
+			default:
+				// sections treble does not understand yet are skipped over
+				break;
+			}
+
+			header += section_size;
+			state = ok ? State::SectionHeader : State::Failed;
 			break;
+		}
+
+		case State::FunctionCount: {
+			const size_t length = varint_size(unit);
+			if (length == 0) {
+				return header;
+			}
+
+			size_t count_header = 0;
+			const uint32_t count = decode_u32(unit.first(length), count_header);
+			if (count != module.func_count || length > section_size) {
+				state = State::Failed;
+				break;
+			}
 
-		case SectionType::Function:
-			read_function_section(*module, bin, ++header);
+			header += length;
+			section_size -= length;
+			next_body = 0;
+			state = count > 0 ? State::BodySize : State::SectionHeader;
 			break;
+		}
 
-		case SectionType::Start:
-			read_start_section(*module, bin, ++header);
+		case State::BodySize: {
+			const size_t length = varint_size(unit);
+			if (length == 0) {
+				return header;
+			}
+
+			size_t size_header = 0;
+			body_size = decode_u32(unit.first(length), size_header);
+			if (length + body_size > section_size) {
+				state = State::Failed;
+				break;
+			}
+
+			header += length;
+			section_size -= length;
+			state = State::Body;
 			break;
+		}
+
+		case State::Body: {
+			if (available < body_size) {
+				return header;
+			}
 
-		case SectionType::Code:
-			read_code_section(*module, bin, ++header);
+			if (!read_function_body(module.funcs[next_body], module,
+									unit.first(body_size), instructions,
+									module.arena, fold_constants)) {
+				state = State::Failed;
+				break;
+			}
+
+			header += body_size;
+			section_size -= body_size;
+			next_body++;
+
+			if (next_body < module.func_count) {
+				state = State::BodySize;
+			} else {
+				state = section_size == 0 ? State::SectionHeader
+										  : State::Failed;
+			}
 			break;
+		}
 
-		default:
+		case State::Failed:
 			break;
 		}
 	}
 
-	return module;
+	return header;
 }
 
-ModuleInstance instantiate_module(const Module &module) {
-	ModuleInstance instance{
-		.module = &module,
-		.types = module.types,
-		.type_count = module.type_count,
-	};
+bool ModuleDecoder::feed(std::span<const uint8_t> bin) {
+	if (buffer.empty()) {
+		// decode straight out of the caller's chunk, and only keep whatever
+		// is left of an incomplete section or function body
+		const size_t consumed = decode(bin);
+		buffer.assign(bin.begin() + consumed, bin.end());
+	} else {
+		buffer.insert(buffer.end(), bin.begin(), bin.end());
+		const size_t consumed = decode(buffer);
+		buffer.erase(buffer.begin(), buffer.begin() + consumed);
+	}
 
-	instance.store.funcs = static_cast<FunctionInstance *>(
-		std::malloc(module.func_count * sizeof(FunctionInstance)));
+	return state != State::Failed;
+}
+
+std::optional<Module> ModuleDecoder::finish() {
+	// anything but a clean section boundary means the binary was cut short
+	if (state != State::SectionHeader || !buffer.empty() ||
+		next_body != module.func_count) {
+		return std::nullopt;
+	}
+
+	// the start function is called without arguments
+	if (module.start != nullptr &&
+		(module.start->func_index >= module.func_count ||
+		 module.funcs[module.start->func_index].param_slots != 0)) {
+		return std::nullopt;
+	}
+
+	return std::move(module);
+}
+
+std::optional<Treble::Module> parse_binary(std::span<const uint8_t> bin,
+										   const DecodeConfig &config) {
+	ModuleDecoder decoder(config);
+	// the whole binary is fed at once, so every section is decoded straight
+	// out of bin, and custom sections can point into it
+	decoder.keep_custom_sections = true;
+	decoder.feed(bin);
+	return decoder.finish();
+}
+
+const CustomSection *find_custom_section(const Module &module,
+										 std::string_view name) {
+	for (const CustomSection &section : module.custom_sections) {
+		if (section.name == name) {
+			return &section;
+		}
+	}
+	return nullptr;
+}
+
+bool instantiate_module(ModuleInstance &instance, const Module &module,
+						const BackingAllocator &allocator,
+						std::shared_ptr<LinearMemory> shared_memory) {
+	instance.module = &module;
+	instance.types = module.types;
+	instance.type_count = module.type_count;
+	instance.arena = Arena(allocator);
+
+	if (module.memory != nullptr) {
+		const MemoryType &type = *module.memory;
+		if (shared_memory != nullptr) {
+			if (!type.shared || !shared_memory->is_shared() ||
+				shared_memory->page_count() < type.min_pages ||
+				shared_memory->max_page_count() > type.max_pages) {
+				return false;
+			}
+			instance.memory = std::move(shared_memory);
+		} else {
+			std::optional<LinearMemory> memory = LinearMemory::create(
+				type.min_pages, type.max_pages, type.shared);
+			if (!memory) {
+				return false;
+			}
+			instance.memory =
+				std::make_shared<LinearMemory>(std::move(*memory));
+		}
+
+		// the decoder made sure that every segment fits
+		for (size_t i = 0; i < module.data_segment_count; ++i) {
+			const DataSegment &segment = module.data_segments[i];
+			std::memcpy(instance.memory->data() + segment.offset,
+						segment.bytes, segment.size);
+		}
+	}
+
+	instance.store.funcs =
+		instance.arena.allocate_array<FunctionInstance>(module.func_count);
+	instance.store.func_count = module.func_count;
 	for (size_t i = 0; i < module.func_count; ++i) {
 		Function &func = module.funcs[i];
 		FunctionInstance &func_instance = instance.store.funcs[i];
 		func_instance.module = &instance;
 		func_instance.code = func;
 		func_instance.type = module.types[func.type_index];
+		func_instance.call_count = 0;
+		func_instance.back_edge_count = 0;
+		func_instance.tier = Tier::Interpreted;
+		func_instance.register_code = nullptr;
+		func_instance.jit_code = nullptr;
+
+		func_instance.signature_cache =
+			instance.arena.allocate_array<uint32_t>(func.indirect_call_count);
+		std::fill_n(func_instance.signature_cache, func.indirect_call_count,
+					UINT32_MAX);
 	}
 
-	return instance;
-};
+	instance.table = nullptr;
+	instance.table_size = 0;
+	if (module.table != nullptr) {
+		instance.table_size = module.table->min_size;
+		instance.table = instance.arena.allocate_array<FunctionInstance *>(
+			instance.table_size);
+		std::fill_n(instance.table, instance.table_size, nullptr);
+
+		// the decoder made sure that every segment fits
+		for (size_t i = 0; i < module.element_segment_count; ++i) {
+			const ElementSegment &segment = module.element_segments[i];
+			for (size_t j = 0; j < segment.size; ++j) {
+				instance.table[segment.offset + j] =
+					&instance.store.funcs[segment.func_indices[j]];
+			}
+		}
+	}
+
+	return true;
+}
+
+ModuleInstance::~ModuleInstance() {
+	cancel_tier_ups(*this);
+	for (size_t i = 0; i < store.func_count; ++i) {
+		free_jit_function(store.funcs[i].jit_code);
+		free_register_function(store.funcs[i].register_code);
+	}
+}
+
+uint32_t function_index(const FunctionInstance &func) {
+	return static_cast<uint32_t>(&func - func.module->store.funcs);
+}
 
 void describe_module(const Module &module) {
 	std::cout << "========== wasm module description ==========" << std::endl;
@@ -346,6 +1272,25 @@ void describe_module(const Module &module) {
 		std::cout << "start index: " << module.start->func_index << std::endl;
 	}
 
+	if (module.table) {
+		std::cout << "table size: " << module.table->min_size << std::endl;
+		std::cout << "element segments: " << module.element_segment_count
+				  << std::endl;
+	}
+
+	if (module.memory) {
+		std::cout << "memory pages: " << module.memory->min_pages << " to "
+				  << module.memory->max_pages
+				  << (module.memory->shared ? ", shared" : "") << std::endl;
+		std::cout << "data segments: " << module.data_segment_count
+				  << std::endl;
+	}
+
+	for (const CustomSection &section : module.custom_sections) {
+		std::cout << "custom section: " << section.name << " ("
+				  << section.contents.size() << " bytes)" << std::endl;
+	}
+
 	std::cout << "========== wasm module description ==========" << std::endl;
 }
 
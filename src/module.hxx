@@ -1,11 +1,17 @@
 #ifndef __TREBLE__MODULE_HXX__
 #define __TREBLE__MODULE_HXX__
 
+#include "arena.hxx"
 #include "instructions.hxx"
+#include "linear_memory.hxx"
+#include "thread_pool.hxx"
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <memory>
 #include <optional>
+#include <span>
+#include <string_view>
 #include <vector>
 
 namespace Treble {
@@ -18,55 +24,245 @@ enum class SectionType {
 	Custom = 0,
 	Type = 1,
 	Function = 3,
+	Table = 4,
+	Memory = 5,
 	Start = 8,
-	Code = 10
+	Element = 9,
+	Code = 10,
+	Data = 11,
 };
 
-enum class ValueType {
-	i32,
-	i64,
-	f32,
-	f64,
+/**
+ * Value types, numbered the way the binary format encodes them.
+ */
+enum class ValueType : uint8_t {
+	i32 = 0x7F,
+	i64 = 0x7E,
+	f32 = 0x7D,
+	f64 = 0x7C,
+	// the 128 bit vectors of the SIMD proposal
+	v128 = 0x7B,
 };
 
+/**
+ * The block type of a block that yields no value. Any other block type is the
+ * value type of the value the block yields.
+ */
+#define EMPTY_BLOCK_TYPE 0x40
+
+inline bool is_value_type(uint8_t byte) {
+	return byte >= static_cast<uint8_t>(ValueType::v128) &&
+		   byte <= static_cast<uint8_t>(ValueType::i32);
+}
+
+/**
+ * Number of stack slots that values of the given types take, a v128 taking
+ * two.
+ */
+inline uint32_t slot_count(const ValueType *types, size_t count) {
+	uint32_t slots = 0;
+	for (size_t i = 0; i < count; ++i) {
+		slots += types[i] == ValueType::v128 ? 2 : 1;
+	}
+	return slots;
+}
+
 enum class TypeId : uint8_t {
 	Function = 0x60,
 };
 
+/**
+ * The only kind of element tables hold, references to functions.
+ */
+#define FUNCREF_TYPE 0x70
+
 struct ModuleInstance;
+struct RegisterFunction;
+struct JitFunction;
 
 struct Function {
 	uint32_t type_index;
-	Instruction *body;
+
+	/**
+	 * The body of the function in the compact encoding, see bytecode.hxx.
+	 */
+	const uint8_t *body;
+	size_t body_size;
+
+	/**
+	 * The most operands the function ever has on its stack at once, as found
+	 * by the validator.
+	 */
+	uint32_t max_stack_height;
+
+	/**
+	 * Number of stack slots its parameters, the locals it declares and its
+	 * results take. A frame of the function holds the parameters, then the
+	 * locals, then the operands.
+	 */
+	uint32_t param_slots;
+	uint32_t local_slots;
+	uint32_t result_slots;
+
+	/**
+	 * Number of call_indirect instructions in the function.
+	 */
+	uint32_t indirect_call_count;
 };
 
 struct FunctionType {
-	ValueType *param_types;
+	const ValueType *param_types;
 	size_t param_count;
-	ValueType *result_types;
+	const ValueType *result_types;
 	size_t result_count;
 };
 
+/**
+ * How far a function is on its way from the stack interpreter to an optimized
+ * tier.
+ */
+enum class Tier : uint8_t {
+	// runs on the stack interpreter
+	Interpreted,
+	// an optimized tier is being compiled, possibly on another thread
+	Compiling,
+	// compilation is done. whatever code it produced is published in
+	// register_code/jit_code; if there is none, the function stays
+	// interpreted for good.
+	Optimized,
+};
+
 struct FunctionInstance {
 	FunctionType type;
 	ModuleInstance *module;
 	Function code;
+
+	/**
+	 * Hotness counters. call_count is bumped by every call from the host, and
+	 * by every call from the stack interpreter until the function has been
+	 * promoted. back_edge_count is bumped by every backward branch the stack
+	 * interpreter takes.
+	 * Once their sum crosses RuntimeConfig::tier_up_threshold at a call, the
+	 * function is promoted to an optimized tier. They are updated without
+	 * synchronization, so concurrent callers may lose the odd increment.
+	 */
+	uint32_t call_count;
+	uint32_t back_edge_count;
+
+	/**
+	 * Only ever moves forward, see Tier. Accessed atomically.
+	 */
+	Tier tier;
+
+	/**
+	 * The function lowered to the register IR, or nullptr if it has not been
+	 * lowered (yet). Published atomically once tier is Optimized.
+	 */
+	RegisterFunction *register_code;
+
+	/**
+	 * The function compiled to native code, or nullptr if it has not been
+	 * compiled (yet). Published atomically once tier is Optimized.
+	 */
+	JitFunction *jit_code;
+
+	/**
+	 * For every call_indirect of the function, the type index of the last
+	 * callee that passed its signature check, or UINT32_MAX. Callees of that
+	 * type pass without comparing their signature again. Accessed atomically,
+	 * as calls on several threads may share the instance; whichever entry
+	 * wins is the type of a callee that did pass.
+	 */
+	uint32_t *signature_cache;
 };
 
 struct ModuleStore {
 	FunctionInstance *funcs;
+	size_t func_count;
 };
 
 struct Start {
 	uint32_t func_index;
 };
 
+struct MemoryType {
+	uint32_t min_pages;
+	// MAX_MEMORY_PAGES if the module sets no maximum
+	uint32_t max_pages;
+	// whether several instances, on several threads, can use the memory at once
+	bool shared;
+};
+
+/**
+ * The most entries a table may start out with. Instantiating a module
+ * allocates all of them.
+ */
+static constexpr uint32_t MAX_TABLE_SIZE = 10000000;
+
+struct TableType {
+	uint32_t min_size;
+	// UINT32_MAX if the module sets no maximum
+	uint32_t max_size;
+};
+
+/**
+ * An active element segment, which puts the given functions into the table
+ * when the module is instantiated. Passive and declarative segments are not
+ * kept, as treble has no instructions that use them.
+ */
+struct ElementSegment {
+	uint32_t offset;
+	const uint32_t *func_indices;
+	size_t size;
+};
+
+/**
+ * An active data segment, copied into the memory when the module is
+ * instantiated. Passive segments are not kept, as treble has no instructions
+ * that use them.
+ */
+struct DataSegment {
+	uint32_t offset;
+	const uint8_t *bytes;
+	size_t size;
+};
+
+/**
+ * A custom section, such as the name section. Both fields are views into the
+ * binary the module was parsed from; custom sections are never copied.
+ */
+struct CustomSection {
+	std::string_view name;
+	std::span<const uint8_t> contents;
+};
+
 struct Module {
 	FunctionType *types;
 	size_t type_count;
 	Function *funcs;
 	size_t func_count;
 	Start *start;
+	// nullptr if the module has no table
+	TableType *table;
+	ElementSegment *element_segments;
+	size_t element_segment_count;
+	// nullptr if the module has no memory
+	MemoryType *memory;
+	DataSegment *data_segments;
+	size_t data_segment_count;
+
+	/**
+	 * Only filled in by parse_binary. Modules decoded chunk by chunk with
+	 * ModuleDecoder skip their custom sections, because the chunks are gone
+	 * by the time anyone would look at them.
+	 */
+	std::vector<CustomSection> custom_sections;
+
+	/**
+	 * Owns the types, functions and function bodies of the module, which all
+	 * go away together with it.
+	 */
+	Arena arena;
 };
 
 struct ModuleInstance {
@@ -76,11 +272,155 @@ struct ModuleInstance {
 	size_t type_count;
 	Address *funcaddrs;
 	size_t funcaddr_count;
+	// the functions call_indirect looks up, nullptr where the element segments
+	// left an entry empty
+	FunctionInstance **table;
+	size_t table_size;
+	// shared with other instances if the memory of the module is shared
+	std::shared_ptr<LinearMemory> memory;
+
+	/**
+	 * Owns the function instances of the store.
+	 */
+	Arena arena;
+
+	/**
+	 * Cancels the background tier-ups of the functions of the instance, see
+	 * cancel_tier_ups, and frees the optimized code they were promoted to.
+	 */
+	~ModuleInstance();
+};
+
+/**
+ * Controls how modules are decoded.
+ */
+struct DecodeConfig {
+	/**
+	 * Number of threads the function bodies are decoded on. With 1, every body
+	 * is decoded on the calling thread as soon as it comes in. With more, the
+	 * code section is buffered until it is complete, and its bodies are then
+	 * decoded in parallel. 0 uses one thread per core.
+	 */
+	unsigned decode_threads = 1;
+
+	/**
+	 * Whether constant expressions are folded and ifs with a constant
+	 * condition are replaced by the arm they take, see constant_folding.hxx.
+	 */
+	bool fold_constants = true;
+
+	/**
+	 * Where the memory of the decoded module comes from.
+	 */
+	BackingAllocator allocator;
+};
+
+/**
+ * Decodes a module incrementally, as its bytes come in. Every section is
+ * decoded as soon as all of it has been fed, and every function body of the
+ * code section as soon as the body itself is complete, so decoding overlaps
+ * with reading the binary. Only an incomplete section or body is buffered.
+ */
+class ModuleDecoder {
+  public:
+	explicit ModuleDecoder(const DecodeConfig &config = {});
+
+	/**
+	 * Feeds the next chunk of the binary. Returns false once the binary turned
+	 * out to be malformed, after which the rest of it can be dropped.
+	 */
+	bool feed(std::span<const uint8_t> bin);
+
+	/**
+	 * Called after the last chunk has been fed. Returns the decoded module, or
+	 * nothing if the binary was malformed or cut short.
+	 */
+	std::optional<Module> finish();
+
+  private:
+	friend std::optional<Module> parse_binary(std::span<const uint8_t> bin,
+											  const DecodeConfig &config);
+
+	enum class State {
+		// waiting for the magic number and version
+		Header,
+		// waiting for the id and size of the next section
+		SectionHeader,
+		// waiting for all of a section other than the code section
+		SectionPayload,
+		// waiting for the number of function bodies in the code section
+		FunctionCount,
+		// waiting for the size of the next function body
+		BodySize,
+		// waiting for all of the next function body
+		Body,
+		Failed,
+	};
+
+	/**
+	 * Decodes as much of bin as is complete, and returns the number of bytes
+	 * consumed.
+	 */
+	size_t decode(std::span<const uint8_t> bin);
+
+	Module module{};
+	State state = State::Header;
+
+	// whether custom sections are recorded as views into the fed chunks
+	bool keep_custom_sections = false;
+	bool fold_constants;
+
+	// only set up when the code section is decoded in parallel
+	unsigned decode_threads;
+	std::unique_ptr<ThreadPool> pool;
+
+	SectionType section_type;
+	// bytes left in the current section
+	uint32_t section_size = 0;
+	uint32_t body_size = 0;
+	size_t next_body = 0;
+
+	// bytes of an incomplete section or function body carried over from the
+	// previous chunk
+	std::vector<uint8_t> buffer;
+	// scratch space the function bodies are decoded into before encoding
+	std::vector<Instruction> instructions;
 };
 
-std::optional<Module> parse_binary(const std::vector<uint8_t> &bin);
+/**
+ * Decodes a module that is already in memory as a whole, e.g. a mapped file.
+ * The module keeps views of its custom sections into bin, so bin has to
+ * outlive it.
+ */
+std::optional<Module> parse_binary(std::span<const uint8_t> bin,
+								   const DecodeConfig &config = {});
+
+/**
+ * Returns the custom section with the given name, or nullptr if the module
+ * has none.
+ */
+const CustomSection *find_custom_section(const Module &module,
+										 std::string_view name);
+
+/**
+ * Instantiates the module into the given instance, which the function
+ * instances point back to and which therefore must not move afterwards. The
+ * table is filled in from the element segments. Returns false if the memory
+ * of the instance cannot be set up.
+ *
+ * If the module has a shared memory, the instance can be given the memory of
+ * another instance to use instead of a new one, so that functions of both can
+ * run on separate threads against the same memory. That memory has to be
+ * shared and satisfy the limits of the module.
+ */
+bool instantiate_module(ModuleInstance &instance, const Module &module,
+						const BackingAllocator &allocator = {},
+						std::shared_ptr<LinearMemory> shared_memory = nullptr);
 
-ModuleInstance instantiate_module(const Module &module);
+/**
+ * Index of the function in the module it was instantiated from.
+ */
+uint32_t function_index(const FunctionInstance &func);
 
 void describe_module(const Module &module);
 
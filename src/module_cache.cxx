@@ -0,0 +1,554 @@
+#include "module_cache.hxx"
+#include "mapped_file.hxx"
+#include "module.hxx"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace Treble {
+
+/**
+ * Bump this whenever the compact encoding of function bodies or the layout of
+ * cache entries changes, so that stale entries stop matching.
+ */
+static constexpr uint64_t CACHE_FORMAT_VERSION = 10;
+
+static constexpr char CACHE_MAGIC[8] = {'t', 'r', 'e', 'b', 'l', 'e', 'm', 'c'};
+
+/**
+ * A cache entry starts with this header, followed by type_count CachedType,
+ * func_count CachedFunction, custom_section_count CachedCustomSection,
+ * data_segment_count CachedDataSegment and element_segment_count
+ * CachedElementSegment records. After those come the function indices of the
+ * element segments, the value types that the types refer to, the function
+ * bodies and the bytes of the data segments. Every offset is in bytes from the
+ * start of the entry, except those of custom sections, which point into the
+ * module binary.
+ */
+struct CacheHeader {
+	char magic[8];
+	uint64_t format_version;
+	uint64_t key;
+	uint64_t binary_size;
+	uint64_t type_count;
+	uint64_t func_count;
+	uint64_t custom_section_count;
+	// UINT64_MAX if the module has no start function
+	uint64_t start_func_index;
+	// UINT64_MAX if the module has no memory
+	uint64_t memory_min_pages;
+	uint64_t memory_max_pages;
+	uint64_t memory_shared;
+	uint64_t data_segment_count;
+	// UINT64_MAX if the module has no table
+	uint64_t table_min_size;
+	uint64_t table_max_size;
+	uint64_t element_segment_count;
+	uint64_t func_indices_offset;
+	uint64_t func_index_count;
+	uint64_t value_types_offset;
+	uint64_t value_type_count;
+	uint64_t bodies_offset;
+	uint64_t bodies_size;
+	uint64_t data_offset;
+	uint64_t data_size;
+};
+
+struct CachedType {
+	// indices into the value types of the entry
+	uint64_t params_begin;
+	uint64_t param_count;
+	uint64_t results_begin;
+	uint64_t result_count;
+};
+
+struct CachedFunction {
+	uint64_t type_index;
+	// offset from the start of the bodies
+	uint64_t body_offset;
+	uint64_t body_size;
+	uint64_t max_stack_height;
+	uint64_t local_slots;
+	uint64_t indirect_call_count;
+};
+
+struct CachedCustomSection {
+	uint64_t name_offset;
+	uint64_t name_size;
+	uint64_t contents_offset;
+	uint64_t contents_size;
+};
+
+struct CachedDataSegment {
+	uint64_t memory_offset;
+	// offset from the start of the data
+	uint64_t bytes_offset;
+	uint64_t size;
+};
+
+struct CachedElementSegment {
+	uint64_t table_offset;
+	// index into the function indices of the entry
+	uint64_t indices_begin;
+	uint64_t size;
+};
+
+static uint64_t mix(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EB;
+	x ^= x >> 31;
+	return x;
+}
+
+uint64_t ModuleCache::key_of(std::span<const uint8_t> binary,
+							 const DecodeConfig &config) {
+	// not a cryptographic hash: whoever can write to the cache directory can
+	// make treble run anything anyway.
+	const uint64_t decode_flags = config.fold_constants ? 1 : 0;
+	uint64_t hash = mix(mix(CACHE_FORMAT_VERSION ^ binary.size()) ^
+						decode_flags);
+
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= binary.size(); i += sizeof(uint64_t)) {
+		uint64_t word;
+		std::memcpy(&word, binary.data() + i, sizeof(word));
+		hash = mix(hash ^ word);
+	}
+
+	uint64_t tail = 0;
+	std::memcpy(&tail, binary.data() + i, binary.size() - i);
+	return mix(hash ^ tail);
+}
+
+ModuleCache::ModuleCache(std::string directory,
+						 const BackingAllocator &allocator)
+	: directory(std::move(directory)), allocator(allocator) {}
+
+std::string ModuleCache::entry_path(uint64_t key) const {
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.tmc",
+				  static_cast<unsigned long long>(key));
+	return directory + "/" + name;
+}
+
+/**
+ * Whether count items of the given size starting at offset lie within size
+ * bytes.
+ */
+static bool in_bounds(uint64_t offset, uint64_t count, uint64_t item_size,
+					  uint64_t size) {
+	return offset <= size && count <= (size - offset) / item_size;
+}
+
+std::optional<Module> ModuleCache::load(uint64_t key,
+										std::span<const uint8_t> binary) {
+	std::optional<MappedFile> mapping =
+		MappedFile::open(entry_path(key).c_str());
+	if (!mapping) {
+		return std::nullopt;
+	}
+
+	const std::span<const uint8_t> entry = mapping->bytes();
+	CacheHeader header;
+	if (entry.size() < sizeof(header)) {
+		return std::nullopt;
+	}
+	std::memcpy(&header, entry.data(), sizeof(header));
+
+	if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+		header.format_version != CACHE_FORMAT_VERSION || header.key != key ||
+		header.binary_size != binary.size()) {
+		return std::nullopt;
+	}
+
+	const uint64_t types_offset = sizeof(CacheHeader);
+	const uint64_t funcs_offset =
+		types_offset + header.type_count * sizeof(CachedType);
+	const uint64_t custom_sections_offset =
+		funcs_offset + header.func_count * sizeof(CachedFunction);
+	const uint64_t data_segments_offset =
+		custom_sections_offset +
+		header.custom_section_count * sizeof(CachedCustomSection);
+	const uint64_t element_segments_offset =
+		data_segments_offset +
+		header.data_segment_count * sizeof(CachedDataSegment);
+
+	if (!in_bounds(types_offset, header.type_count, sizeof(CachedType),
+				   entry.size()) ||
+		!in_bounds(funcs_offset, header.func_count, sizeof(CachedFunction),
+				   entry.size()) ||
+		!in_bounds(custom_sections_offset, header.custom_section_count,
+				   sizeof(CachedCustomSection), entry.size()) ||
+		!in_bounds(data_segments_offset, header.data_segment_count,
+				   sizeof(CachedDataSegment), entry.size()) ||
+		!in_bounds(element_segments_offset, header.element_segment_count,
+				   sizeof(CachedElementSegment), entry.size()) ||
+		!in_bounds(header.func_indices_offset, header.func_index_count,
+				   sizeof(uint32_t), entry.size()) ||
+		header.func_indices_offset % alignof(uint32_t) != 0 ||
+		!in_bounds(header.value_types_offset, header.value_type_count,
+				   sizeof(ValueType), entry.size()) ||
+		header.value_types_offset % alignof(ValueType) != 0 ||
+		!in_bounds(header.bodies_offset, header.bodies_size, 1,
+				   entry.size()) ||
+		!in_bounds(header.data_offset, header.data_size, 1, entry.size())) {
+		return std::nullopt;
+	}
+
+	const auto *types = reinterpret_cast<const CachedType *>(
+		entry.data() + types_offset);
+	const auto *funcs = reinterpret_cast<const CachedFunction *>(
+		entry.data() + funcs_offset);
+	const auto *custom_sections =
+		reinterpret_cast<const CachedCustomSection *>(entry.data() +
+													  custom_sections_offset);
+	const auto *value_types = reinterpret_cast<const ValueType *>(
+		entry.data() + header.value_types_offset);
+	const uint8_t *bodies = entry.data() + header.bodies_offset;
+	const auto *data_segments = reinterpret_cast<const CachedDataSegment *>(
+		entry.data() + data_segments_offset);
+	const uint8_t *data = entry.data() + header.data_offset;
+	const auto *element_segments =
+		reinterpret_cast<const CachedElementSegment *>(
+			entry.data() + element_segments_offset);
+	const auto *func_indices = reinterpret_cast<const uint32_t *>(
+		entry.data() + header.func_indices_offset);
+
+	Module module{.arena = Arena(allocator)};
+
+	if (header.type_count > 0) {
+		module.types =
+			module.arena.allocate_array<FunctionType>(header.type_count);
+		module.type_count = header.type_count;
+	}
+	for (size_t i = 0; i < header.type_count; ++i) {
+		const CachedType &cached = types[i];
+		if (!in_bounds(cached.params_begin, cached.param_count, 1,
+					   header.value_type_count) ||
+			!in_bounds(cached.results_begin, cached.result_count, 1,
+					   header.value_type_count)) {
+			return std::nullopt;
+		}
+
+		module.types[i] = {
+			.param_types = value_types + cached.params_begin,
+			.param_count = cached.param_count,
+			.result_types = value_types + cached.results_begin,
+			.result_count = cached.result_count,
+		};
+	}
+
+	if (header.func_count > 0) {
+		module.funcs = module.arena.allocate_array<Function>(header.func_count);
+		module.func_count = header.func_count;
+	}
+	for (size_t i = 0; i < header.func_count; ++i) {
+		const CachedFunction &cached = funcs[i];
+		if (cached.type_index >= header.type_count ||
+			!in_bounds(cached.body_offset, cached.body_size, 1,
+					   header.bodies_size)) {
+			return std::nullopt;
+		}
+
+		// the slots of the parameters and results follow from the type
+		const FunctionType &type = module.types[cached.type_index];
+		module.funcs[i] = {
+			.type_index = static_cast<uint32_t>(cached.type_index),
+			.body = bodies + cached.body_offset,
+			.body_size = cached.body_size,
+			.max_stack_height = static_cast<uint32_t>(cached.max_stack_height),
+			.param_slots = slot_count(type.param_types, type.param_count),
+			.local_slots = static_cast<uint32_t>(cached.local_slots),
+			.result_slots = slot_count(type.result_types, type.result_count),
+			.indirect_call_count =
+				static_cast<uint32_t>(cached.indirect_call_count),
+		};
+	}
+
+	for (size_t i = 0; i < header.custom_section_count; ++i) {
+		const CachedCustomSection &cached = custom_sections[i];
+		if (!in_bounds(cached.name_offset, cached.name_size, 1,
+					   binary.size()) ||
+			!in_bounds(cached.contents_offset, cached.contents_size, 1,
+					   binary.size())) {
+			return std::nullopt;
+		}
+
+		module.custom_sections.push_back({
+			.name = std::string_view(reinterpret_cast<const char *>(
+										 binary.data() + cached.name_offset),
+									 cached.name_size),
+			.contents =
+				binary.subspan(cached.contents_offset, cached.contents_size),
+		});
+	}
+
+	if (header.start_func_index != UINT64_MAX) {
+		if (header.start_func_index >= header.func_count ||
+			module.funcs[header.start_func_index].param_slots != 0) {
+			return std::nullopt;
+		}
+
+		module.start = module.arena.allocate_array<Treble::Start>(1);
+		module.start->func_index = header.start_func_index;
+	}
+
+	if (header.memory_min_pages != UINT64_MAX) {
+		if (header.memory_min_pages > header.memory_max_pages ||
+			header.memory_max_pages > MAX_MEMORY_PAGES) {
+			return std::nullopt;
+		}
+
+		module.memory = module.arena.allocate_array<MemoryType>(1);
+		module.memory->min_pages = header.memory_min_pages;
+		module.memory->max_pages = header.memory_max_pages;
+		module.memory->shared = header.memory_shared != 0;
+	}
+
+	if (header.data_segment_count > 0) {
+		if (module.memory == nullptr) {
+			return std::nullopt;
+		}
+		module.data_segments =
+			module.arena.allocate_array<DataSegment>(header.data_segment_count);
+		module.data_segment_count = header.data_segment_count;
+	}
+	for (size_t i = 0; i < header.data_segment_count; ++i) {
+		// the segments are copied into the memory without further checks
+		const CachedDataSegment &cached = data_segments[i];
+		if (!in_bounds(cached.bytes_offset, cached.size, 1, header.data_size) ||
+			!in_bounds(cached.memory_offset, cached.size, 1,
+					   uint64_t{module.memory->min_pages} * WASM_PAGE_SIZE)) {
+			return std::nullopt;
+		}
+
+		module.data_segments[i] = {
+			.offset = static_cast<uint32_t>(cached.memory_offset),
+			.bytes = data + cached.bytes_offset,
+			.size = cached.size,
+		};
+	}
+
+	if (header.table_min_size != UINT64_MAX) {
+		if (header.table_min_size > header.table_max_size ||
+			header.table_min_size > MAX_TABLE_SIZE ||
+			header.table_max_size > UINT32_MAX) {
+			return std::nullopt;
+		}
+
+		module.table = module.arena.allocate_array<TableType>(1);
+		module.table->min_size = header.table_min_size;
+		module.table->max_size = header.table_max_size;
+	}
+
+	if (header.element_segment_count > 0) {
+		if (module.table == nullptr) {
+			return std::nullopt;
+		}
+		module.element_segments = module.arena.allocate_array<ElementSegment>(
+			header.element_segment_count);
+		module.element_segment_count = header.element_segment_count;
+	}
+	for (size_t i = 0; i < header.element_segment_count; ++i) {
+		// the segments are copied into the table without further checks
+		const CachedElementSegment &cached = element_segments[i];
+		if (!in_bounds(cached.indices_begin, cached.size, 1,
+					   header.func_index_count) ||
+			!in_bounds(cached.table_offset, cached.size, 1,
+					   module.table->min_size)) {
+			return std::nullopt;
+		}
+		const uint32_t *indices = func_indices + cached.indices_begin;
+		for (size_t j = 0; j < cached.size; ++j) {
+			if (indices[j] >= header.func_count) {
+				return std::nullopt;
+			}
+		}
+
+		module.element_segments[i] = {
+			.offset = static_cast<uint32_t>(cached.table_offset),
+			.func_indices = indices,
+			.size = cached.size,
+		};
+	}
+
+	// the module points into the entry from now on
+	mappings.push_back(std::move(*mapping));
+
+	return std::move(module);
+}
+
+bool ModuleCache::store(uint64_t key, std::span<const uint8_t> binary,
+						const Module &module) {
+	std::vector<CachedType> types;
+	std::vector<ValueType> value_types;
+	for (size_t i = 0; i < module.type_count; ++i) {
+		const FunctionType &type = module.types[i];
+		types.push_back({
+			.params_begin = value_types.size(),
+			.param_count = type.param_count,
+		});
+		value_types.insert(value_types.end(), type.param_types,
+						   type.param_types + type.param_count);
+
+		types.back().results_begin = value_types.size();
+		types.back().result_count = type.result_count;
+		value_types.insert(value_types.end(), type.result_types,
+						   type.result_types + type.result_count);
+	}
+
+	std::vector<CachedFunction> funcs;
+	uint64_t bodies_size = 0;
+	for (size_t i = 0; i < module.func_count; ++i) {
+		const Function &func = module.funcs[i];
+		funcs.push_back({
+			.type_index = func.type_index,
+			.body_offset = bodies_size,
+			.body_size = func.body_size,
+			.max_stack_height = func.max_stack_height,
+			.local_slots = func.local_slots,
+			.indirect_call_count = func.indirect_call_count,
+		});
+		bodies_size += func.body_size;
+	}
+
+	// custom sections are views into the binary, and are stored as offsets
+	// into it. views into anything else cannot be restored.
+	std::vector<CachedCustomSection> custom_sections;
+	const auto *binary_begin = reinterpret_cast<const char *>(binary.data());
+	for (const CustomSection &section : module.custom_sections) {
+		const auto *contents_begin =
+			reinterpret_cast<const char *>(section.contents.data());
+		if (section.name.data() < binary_begin ||
+			section.name.data() + section.name.size() >
+				binary_begin + binary.size() ||
+			contents_begin < binary_begin ||
+			contents_begin + section.contents.size() >
+				binary_begin + binary.size()) {
+			continue;
+		}
+
+		custom_sections.push_back({
+			.name_offset = static_cast<uint64_t>(section.name.data() -
+												 binary_begin),
+			.name_size = section.name.size(),
+			.contents_offset =
+				static_cast<uint64_t>(contents_begin - binary_begin),
+			.contents_size = section.contents.size(),
+		});
+	}
+
+	std::vector<CachedDataSegment> data_segments;
+	uint64_t data_size = 0;
+	for (size_t i = 0; i < module.data_segment_count; ++i) {
+		const DataSegment &segment = module.data_segments[i];
+		data_segments.push_back({
+			.memory_offset = segment.offset,
+			.bytes_offset = data_size,
+			.size = segment.size,
+		});
+		data_size += segment.size;
+	}
+
+	std::vector<CachedElementSegment> element_segments;
+	std::vector<uint32_t> func_indices;
+	for (size_t i = 0; i < module.element_segment_count; ++i) {
+		const ElementSegment &segment = module.element_segments[i];
+		element_segments.push_back({
+			.table_offset = segment.offset,
+			.indices_begin = func_indices.size(),
+			.size = segment.size,
+		});
+		func_indices.insert(func_indices.end(), segment.func_indices,
+							segment.func_indices + segment.size);
+	}
+
+	CacheHeader header{
+		.format_version = CACHE_FORMAT_VERSION,
+		.key = key,
+		.binary_size = binary.size(),
+		.type_count = types.size(),
+		.func_count = funcs.size(),
+		.custom_section_count = custom_sections.size(),
+		.start_func_index =
+			module.start ? module.start->func_index : UINT64_MAX,
+		.memory_min_pages =
+			module.memory ? module.memory->min_pages : UINT64_MAX,
+		.memory_max_pages =
+			module.memory ? module.memory->max_pages : UINT64_MAX,
+		.memory_shared = module.memory && module.memory->shared,
+		.data_segment_count = data_segments.size(),
+		.table_min_size = module.table ? module.table->min_size : UINT64_MAX,
+		.table_max_size = module.table ? module.table->max_size : UINT64_MAX,
+		.element_segment_count = element_segments.size(),
+		.func_index_count = func_indices.size(),
+		.value_type_count = value_types.size(),
+		.bodies_size = bodies_size,
+		.data_size = data_size,
+	};
+	std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.func_indices_offset =
+		sizeof(header) + types.size() * sizeof(CachedType) +
+		funcs.size() * sizeof(CachedFunction) +
+		custom_sections.size() * sizeof(CachedCustomSection) +
+		data_segments.size() * sizeof(CachedDataSegment) +
+		element_segments.size() * sizeof(CachedElementSegment);
+	header.value_types_offset =
+		header.func_indices_offset + func_indices.size() * sizeof(uint32_t);
+	header.bodies_offset =
+		header.value_types_offset + value_types.size() * sizeof(ValueType);
+	header.data_offset = header.bodies_offset + bodies_size;
+
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+
+	// write to a file of our own first, so that a process loading the entry
+	// at the same time never sees half of it
+	const std::string path = entry_path(key);
+	const std::string temporary_path = path + "." + std::to_string(getpid());
+
+	std::ofstream f(temporary_path, std::ios::binary | std::ios::trunc);
+	const auto write = [&](const void *data, size_t size) {
+		f.write(static_cast<const char *>(data), size);
+	};
+
+	write(&header, sizeof(header));
+	write(types.data(), types.size() * sizeof(CachedType));
+	write(funcs.data(), funcs.size() * sizeof(CachedFunction));
+	write(custom_sections.data(),
+		  custom_sections.size() * sizeof(CachedCustomSection));
+	write(data_segments.data(),
+		  data_segments.size() * sizeof(CachedDataSegment));
+	write(element_segments.data(),
+		  element_segments.size() * sizeof(CachedElementSegment));
+	write(func_indices.data(), func_indices.size() * sizeof(uint32_t));
+	write(value_types.data(), value_types.size() * sizeof(ValueType));
+	for (size_t i = 0; i < module.func_count; ++i) {
+		write(module.funcs[i].body, module.funcs[i].body_size);
+	}
+	for (size_t i = 0; i < module.data_segment_count; ++i) {
+		write(module.data_segments[i].bytes, module.data_segments[i].size);
+	}
+
+	f.close();
+	if (!f || std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+		std::remove(temporary_path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+} // namespace Treble
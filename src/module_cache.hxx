@@ -0,0 +1,66 @@
+#ifndef __TREBLE__MODULE_CACHE_HXX__
+#define __TREBLE__MODULE_CACHE_HXX__
+
+#include "arena.hxx"
+#include "mapped_file.hxx"
+#include "module.hxx"
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace Treble {
+
+/**
+ * An on-disk cache of decoded modules, one file per module in the cache
+ * directory. An entry holds everything parse_binary produces from a binary:
+ * the function types, the functions, and their bodies in the compact encoding.
+ * Loading an entry takes a single mmap. The bodies and type lists are then
+ * used straight out of the mapping, so the only work left is to fill in the
+ * pointers of the type and function arrays.
+ */
+class ModuleCache {
+  public:
+	/**
+	 * Modules loaded from the cache take their memory from the given
+	 * allocator.
+	 */
+	explicit ModuleCache(std::string directory,
+						 const BackingAllocator &allocator = {});
+
+	/**
+	 * The key of the cache entry of the given binary, decoded with the given
+	 * config. It hashes the binary together with the version of the cache
+	 * format and the decode options that change the bodies, so entries
+	 * written by a treble that encodes modules differently, or decoded with
+	 * other options, are never picked up.
+	 */
+	static uint64_t key_of(std::span<const uint8_t> binary,
+						   const DecodeConfig &config);
+
+	/**
+	 * Looks up the decoded form of the given binary. The module points into a
+	 * mapping owned by the cache, and its custom sections into binary, so both
+	 * have to outlive it. Returns nothing if the cache has no valid entry.
+	 */
+	std::optional<Module> load(uint64_t key, std::span<const uint8_t> binary);
+
+	/**
+	 * Writes the decoded form of binary to the cache. Returns false if the
+	 * entry could not be written.
+	 */
+	bool store(uint64_t key, std::span<const uint8_t> binary,
+			   const Module &module);
+
+  private:
+	std::string entry_path(uint64_t key) const;
+
+	std::string directory;
+	BackingAllocator allocator;
+	std::vector<MappedFile> mappings;
+};
+
+} // namespace Treble
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef __TREBLE__NUMERIC_HXX__
+#define __TREBLE__NUMERIC_HXX__
+
+#include "bytecode.hxx"
+#include "execution_context.hxx"
+#include "instructions.hxx"
+#include "module.hxx"
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+
+/**
+ * Types and semantics of the numeric instructions, shared by the validator,
+ * both interpreters and the constant folding of the decoder. Operands and
+ * results are the 64 bit slots the interpreters keep values in, with i32 values
+ * zero-extended, the way native code keeps them.
+ */
+
+namespace Treble {
+
+/**
+ * The operand and result types of a numeric instruction.
+ */
+struct NumericSignature {
+	ValueType operand;
+	ValueType result;
+};
+
+constexpr ValueType value_type_named(std::string_view name) {
+	if (name == "i64") {
+		return ValueType::i64;
+	}
+	if (name == "f32") {
+		return ValueType::f32;
+	}
+	return ValueType::i32;
+}
+
+/**
+ * Works out the signature of a numeric instruction from its name in the text
+ * format, which always starts with the type of its result, e.g. i64.add, and
+ * ends with the type of its operand if that is a different one, e.g.
+ * i32.wrap_i64. Comparisons are the exception and produce an i32.
+ */
+constexpr NumericSignature numeric_signature(std::string_view text) {
+	const ValueType type = value_type_named(text.substr(0, 3));
+	const std::string_view op = text.substr(4);
+
+	if (op.size() > 4 && op[op.size() - 4] == '_') {
+		return {
+			.operand = value_type_named(op.substr(op.size() - 3)),
+			.result = type,
+		};
+	}
+
+	constexpr std::string_view comparisons[] = {
+		"eqz",	"eq",	"ne",	"lt_s", "lt_u", "gt_s",
+		"gt_u", "le_s", "le_u", "ge_s", "ge_u",
+	};
+	for (const std::string_view comparison : comparisons) {
+		if (op == comparison) {
+			return {.operand = type, .result = ValueType::i32};
+		}
+	}
+
+	return {.operand = type, .result = type};
+}
+
+/**
+ * Result of the given op of TREBLE_FOREACH_UNARY_OPCODE on the operand c1.
+ */
+[[gnu::always_inline]] constexpr uint64_t evaluate_unary(ByteOp op,
+														 uint64_t c1) {
+	switch (op) {
+#define UNARY_CASES(dtype, operand_type)                                       \
+	case ByteOp::dtype##_eqz:                                                  \
+		return static_cast<operand_type>(c1) == 0 ? 1 : 0;                     \
+	case ByteOp::dtype##_clz:                                                  \
+		return std::countl_zero(static_cast<operand_type>(c1));                \
+	case ByteOp::dtype##_ctz:                                                  \
+		return std::countr_zero(static_cast<operand_type>(c1));                \
+	case ByteOp::dtype##_popcnt:                                               \
+		return std::popcount(static_cast<operand_type>(c1));
+
+		UNARY_CASES(i32, uint32_t)
+		UNARY_CASES(i64, uint64_t)
+
+#undef UNARY_CASES
+
+	case ByteOp::i32_wrap_i64:
+		return static_cast<uint32_t>(c1);
+
+	default:
+		return 0;
+	}
+}
+
+/**
+ * The trap the given op of TREBLE_FOREACH_BINARY_OPCODE raises on the operands
+ * c1 and c2, c2 being the one that was on top of the stack, or Trap::None if
+ * it has a result. Only divisions and remainders ever trap, so for a constant
+ * op this folds away to nothing for everything else.
+ */
+[[gnu::always_inline]] constexpr Trap binary_trap(ByteOp op, uint64_t c1,
+												  uint64_t c2) {
+	switch (op) {
+	case ByteOp::i32_div_s:
+		// the quotient of the most negative value and -1 is one past the
+		// largest
+		if (static_cast<int32_t>(c1) == std::numeric_limits<int32_t>::min() &&
+			static_cast<int32_t>(c2) == -1) {
+			return Trap::IntegerOverflow;
+		}
+		[[fallthrough]];
+	case ByteOp::i32_div_u:
+	case ByteOp::i32_rem_s:
+	case ByteOp::i32_rem_u:
+		return static_cast<uint32_t>(c2) == 0 ? Trap::IntegerDivideByZero
+											  : Trap::None;
+
+	case ByteOp::i64_div_s:
+		if (static_cast<int64_t>(c1) == std::numeric_limits<int64_t>::min() &&
+			static_cast<int64_t>(c2) == -1) {
+			return Trap::IntegerOverflow;
+		}
+		[[fallthrough]];
+	case ByteOp::i64_div_u:
+	case ByteOp::i64_rem_s:
+	case ByteOp::i64_rem_u:
+		return c2 == 0 ? Trap::IntegerDivideByZero : Trap::None;
+
+	default:
+		return Trap::None;
+	}
+}
+
+/**
+ * evaluate_binary for the ops whose operands are of the given type.
+ */
+template <typename operand_type, typename signed_type, int bit_width>
+[[gnu::always_inline]] constexpr uint64_t
+evaluate_integer_binary(ByteOp op, operand_type c1, operand_type c2) {
+	const auto s1 = static_cast<signed_type>(c1);
+	const auto s2 = static_cast<signed_type>(c2);
+	// shifts and rotates only look at as many bits of c2 as address a bit
+	const auto k = c2 % bit_width;
+
+	switch (op) {
+#define BINARY_CASES(dtype)                                                    \
+	case ByteOp::dtype##_eq:                                                   \
+		return c1 == c2 ? 1 : 0;                                               \
+	case ByteOp::dtype##_ne:                                                   \
+		return c1 != c2 ? 1 : 0;                                               \
+	case ByteOp::dtype##_lt_s:                                                 \
+		return s1 < s2 ? 1 : 0;                                                \
+	case ByteOp::dtype##_lt_u:                                                 \
+		return c1 < c2 ? 1 : 0;                                                \
+	case ByteOp::dtype##_gt_s:                                                 \
+		return s1 > s2 ? 1 : 0;                                                \
+	case ByteOp::dtype##_gt_u:                                                 \
+		return c1 > c2 ? 1 : 0;                                                \
+	case ByteOp::dtype##_le_s:                                                 \
+		return s1 <= s2 ? 1 : 0;                                               \
+	case ByteOp::dtype##_le_u:                                                 \
+		return c1 <= c2 ? 1 : 0;                                               \
+	case ByteOp::dtype##_ge_s:                                                 \
+		return s1 >= s2 ? 1 : 0;                                               \
+	case ByteOp::dtype##_ge_u:                                                 \
+		return c1 >= c2 ? 1 : 0;                                               \
+                                                                               \
+	case ByteOp::dtype##_add:                                                  \
+		return static_cast<operand_type>(c1 + c2);                             \
+	case ByteOp::dtype##_sub:                                                  \
+		return static_cast<operand_type>(c1 - c2);                             \
+	case ByteOp::dtype##_mul:                                                  \
+		return static_cast<operand_type>(c1 * c2);                             \
+	case ByteOp::dtype##_div_s:                                                \
+		return static_cast<operand_type>(s1 / s2);                             \
+	case ByteOp::dtype##_div_u:                                                \
+		return c1 / c2;                                                        \
+	case ByteOp::dtype##_rem_s:                                                \
+		/* the remainder of a division by -1 is 0, even where the quotient  */ \
+		/* overflows                                                        */ \
+		return s2 == -1 ? 0 : static_cast<operand_type>(s1 % s2);              \
+	case ByteOp::dtype##_rem_u:                                                \
+		return c1 % c2;                                                        \
+	case ByteOp::dtype##_and:                                                  \
+		return c1 & c2;                                                        \
+	case ByteOp::dtype##_or:                                                   \
+		return c1 | c2;                                                        \
+	case ByteOp::dtype##_xor:                                                  \
+		return c1 ^ c2;                                                        \
+	case ByteOp::dtype##_shl:                                                  \
+		return static_cast<operand_type>(c1 << k);                             \
+	case ByteOp::dtype##_shr_s:                                                \
+		return static_cast<operand_type>(s1 >> k);                             \
+	case ByteOp::dtype##_shr_u:                                                \
+		return c1 >> k;                                                        \
+	case ByteOp::dtype##_rotl:                                                 \
+		return std::rotl(c1, static_cast<int>(k));                             \
+	case ByteOp::dtype##_rotr:                                                 \
+		return std::rotr(c1, static_cast<int>(k));
+
+		BINARY_CASES(i32)
+		BINARY_CASES(i64)
+
+#undef BINARY_CASES
+
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Result of the given op of TREBLE_FOREACH_BINARY_OPCODE on the operands c1
+ * and c2, c2 being the one that was on top of the stack. Operands the op traps
+ * on, as binary_trap tells, have to be ruled out first.
+ */
+[[gnu::always_inline]] constexpr uint64_t
+evaluate_binary(ByteOp op, uint64_t c1, uint64_t c2) {
+	switch (op) {
+#define I32_CASE(name, op_code, text) case ByteOp::name:
+		TREBLE_FOREACH_I32_COMPARE_OPCODE(I32_CASE)
+		TREBLE_FOREACH_I32_ARITHMETIC_OPCODE(I32_CASE)
+#undef I32_CASE
+		return evaluate_integer_binary<uint32_t, int32_t, 32>(op, c1, c2);
+
+	default:
+		return evaluate_integer_binary<uint64_t, int64_t, 64>(op, c1, c2);
+	}
+}
+
+} // namespace Treble
+
+#endif
@@ -0,0 +1,46 @@
+#include "perf_map.hxx"
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <unistd.h>
+
+namespace Treble {
+
+static std::mutex perf_map_lock;
+static std::atomic<FILE *> perf_map = nullptr;
+
+bool open_perf_map() {
+	std::lock_guard guard(perf_map_lock);
+	if (perf_map.load() != nullptr) {
+		return true;
+	}
+
+	char path[64];
+	std::snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+	FILE *file = std::fopen(path, "w");
+	if (file == nullptr) {
+		return false;
+	}
+
+	perf_map.store(file);
+	return true;
+}
+
+void record_perf_map(const void *code, size_t size, uint32_t func_index) {
+	if (perf_map.load(std::memory_order_relaxed) == nullptr) {
+		return;
+	}
+
+	// perf reads the file only once the process is gone, but a line must
+	// never be interleaved with another
+	std::lock_guard guard(perf_map_lock);
+	FILE *file = perf_map.load();
+	std::fprintf(file, "%" PRIxPTR " %zx wasm_func_%" PRIu32 "\n",
+				 reinterpret_cast<uintptr_t>(code), size, func_index);
+	std::fflush(file);
+}
+
+} // namespace Treble
@@ -0,0 +1,25 @@
+#ifndef __TREBLE__PERF_MAP_HXX__
+#define __TREBLE__PERF_MAP_HXX__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Treble {
+
+/**
+ * Creates /tmp/perf-<pid>.map, where Linux perf looks for the symbols of code
+ * that is not backed by any ELF file. Every function the JIT compiles from
+ * then on is listed in it as wasm_func_<index>, so that perf record/report
+ * can tell them apart. Returns false if the file cannot be created.
+ */
+bool open_perf_map();
+
+/**
+ * Lists the native code of the function with the given index in the perf map,
+ * if it is open. Can be called from any thread.
+ */
+void record_perf_map(const void *code, size_t size, uint32_t func_index);
+
+} // namespace Treble
+
+#endif
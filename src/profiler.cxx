@@ -0,0 +1,187 @@
+#include "profiler.hxx"
+#include "bytecode.hxx"
+#include "module.hxx"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace Treble {
+
+// every thread profile ever created, so that they can be merged
+static std::mutex registry_lock;
+static std::vector<std::shared_ptr<ThreadProfile>> registry;
+
+static uint64_t load(const uint64_t &counter) {
+	return std::atomic_ref(const_cast<uint64_t &>(counter))
+		.load(std::memory_order_relaxed);
+}
+
+void ThreadProfile::enter(const FunctionInstance &func) {
+	const Key key{
+		.module = func.module->module,
+		.func_index = function_index(func),
+	};
+
+	auto found = functions.find(key);
+	if (found == functions.end()) {
+		std::lock_guard guard(functions_lock);
+		found = functions
+					.emplace(key,
+							 FunctionState{
+								 .counters =
+									 {
+										 .module = key.module,
+										 .func_index = key.func_index,
+										 .calls = 0,
+										 .inclusive_instructions = 0,
+										 .exclusive_instructions = 0,
+										 .inclusive_cycles = 0,
+										 .exclusive_cycles = 0,
+									 },
+								 .active_depth = 0,
+							 })
+					.first;
+	}
+
+	add(found->second.counters.calls, 1);
+	found->second.active_depth++;
+	active_calls.push_back({
+		.function = &found->second,
+		.start_instructions = instructions,
+		.start_cycles = read_cycle_counter(),
+		.child_instructions = 0,
+		.child_cycles = 0,
+	});
+}
+
+void ThreadProfile::exit() {
+	// a call that trapped never got to charge its last op
+	stop_instructions();
+
+	const ActiveCall call = active_calls.back();
+	active_calls.pop_back();
+
+	const uint64_t inclusive_instructions =
+		instructions - call.start_instructions;
+	const uint64_t inclusive_cycles = read_cycle_counter() - call.start_cycles;
+
+	FunctionProfile &counters = call.function->counters;
+	// a recursive call is already part of the inclusive counts of the
+	// outermost call of the function
+	if (--call.function->active_depth == 0) {
+		add(counters.inclusive_instructions, inclusive_instructions);
+		add(counters.inclusive_cycles, inclusive_cycles);
+	}
+	add(counters.exclusive_instructions,
+		inclusive_instructions - call.child_instructions);
+	add(counters.exclusive_cycles, inclusive_cycles - call.child_cycles);
+
+	if (!active_calls.empty()) {
+		active_calls.back().child_instructions += inclusive_instructions;
+		active_calls.back().child_cycles += inclusive_cycles;
+	}
+}
+
+ThreadProfile &thread_profile() {
+	thread_local const std::shared_ptr<ThreadProfile> profile = [] {
+		auto profile = std::make_shared<ThreadProfile>();
+		std::lock_guard guard(registry_lock);
+		registry.push_back(profile);
+		return profile;
+	}();
+	return *profile;
+}
+
+Profile collect_profile() {
+	Profile profile{.opcodes = std::vector<OpcodeProfile>(BYTE_OP_COUNT),
+					.functions = {}};
+	std::map<std::pair<uint32_t, const Module *>, FunctionProfile> functions;
+
+	std::lock_guard registry_guard(registry_lock);
+	for (const std::shared_ptr<ThreadProfile> &thread : registry) {
+		for (size_t i = 0; i < BYTE_OP_COUNT; ++i) {
+			profile.opcodes[i].count += load(thread->opcodes[i].count);
+			profile.opcodes[i].cycles += load(thread->opcodes[i].cycles);
+		}
+
+		std::lock_guard functions_guard(thread->functions_lock);
+		for (const auto &[key, function] : thread->functions) {
+			const FunctionProfile &counters = function.counters;
+			FunctionProfile &merged =
+				functions
+					.try_emplace({key.func_index, key.module},
+								 FunctionProfile{.module = key.module,
+												 .func_index = key.func_index})
+					.first->second;
+			merged.calls += load(counters.calls);
+			merged.inclusive_instructions +=
+				load(counters.inclusive_instructions);
+			merged.exclusive_instructions +=
+				load(counters.exclusive_instructions);
+			merged.inclusive_cycles += load(counters.inclusive_cycles);
+			merged.exclusive_cycles += load(counters.exclusive_cycles);
+		}
+	}
+
+	for (const auto &[key, counters] : functions) {
+		profile.functions.push_back(counters);
+	}
+	return profile;
+}
+
+void write_profile_json(const Profile &profile, std::ostream &out) {
+	out << "{\n  \"opcodes\": [";
+	const char *separator = "\n";
+	for (size_t i = 0; i < profile.opcodes.size(); ++i) {
+		const OpcodeProfile &op = profile.opcodes[i];
+		if (op.count == 0) {
+			continue;
+		}
+		out << separator << "    {\"name\": \""
+			<< op_name(static_cast<ByteOp>(i)) << "\", \"count\": " << op.count
+			<< ", \"cycles\": " << op.cycles << "}";
+		separator = ",\n";
+	}
+
+	out << "\n  ],\n  \"functions\": [";
+	separator = "\n";
+	for (const FunctionProfile &func : profile.functions) {
+		out << separator << "    {\"index\": " << func.func_index
+			<< ", \"calls\": " << func.calls
+			<< ", \"inclusive_instructions\": " << func.inclusive_instructions
+			<< ", \"exclusive_instructions\": " << func.exclusive_instructions
+			<< ", \"inclusive_cycles\": " << func.inclusive_cycles
+			<< ", \"exclusive_cycles\": " << func.exclusive_cycles << "}";
+		separator = ",\n";
+	}
+	out << "\n  ]\n}\n";
+}
+
+void write_profile_csv(const Profile &profile, std::ostream &out) {
+	// ops fill in count and cycles, functions the rest
+	out << "kind,name,count,cycles,calls,inclusive_instructions,"
+		   "exclusive_instructions,inclusive_cycles,exclusive_cycles\n";
+	for (size_t i = 0; i < profile.opcodes.size(); ++i) {
+		const OpcodeProfile &op = profile.opcodes[i];
+		if (op.count == 0) {
+			continue;
+		}
+		out << "opcode," << op_name(static_cast<ByteOp>(i)) << ',' << op.count
+			<< ',' << op.cycles << ",,,,,\n";
+	}
+	for (const FunctionProfile &func : profile.functions) {
+		out << "function," << func.func_index << ",,," << func.calls << ','
+			<< func.inclusive_instructions << ','
+			<< func.exclusive_instructions << ',' << func.inclusive_cycles
+			<< ',' << func.exclusive_cycles << '\n';
+	}
+}
+
+} // namespace Treble
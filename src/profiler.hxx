@@ -0,0 +1,190 @@
+#ifndef __TREBLE__PROFILER_HXX__
+#define __TREBLE__PROFILER_HXX__
+
+#include "bytecode.hxx"
+#include "module.hxx"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace Treble {
+
+/**
+ * Number of distinct ops of the compact encoding, unknown included.
+ */
+static constexpr size_t BYTE_OP_COUNT =
+	static_cast<size_t>(ByteOp::unknown) + 1;
+
+/**
+ * A cheap, monotonic timestamp: the time stamp counter where there is one,
+ * nanoseconds elsewhere. Only differences between two readings on the same
+ * thread mean anything.
+ */
+inline uint64_t read_cycle_counter() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+struct OpcodeProfile {
+	uint64_t count;
+	// from dispatching the op until dispatching the next one
+	uint64_t cycles;
+};
+
+struct FunctionProfile {
+	const Module *module;
+	uint32_t func_index;
+	uint64_t calls;
+	// instructions and cycles of the function, with and without those of the
+	// functions it called
+	uint64_t inclusive_instructions;
+	uint64_t exclusive_instructions;
+	uint64_t inclusive_cycles;
+	uint64_t exclusive_cycles;
+};
+
+/**
+ * Counters of all threads, merged.
+ */
+struct Profile {
+	// indexed by ByteOp
+	std::vector<OpcodeProfile> opcodes;
+	// in the order of their function indices
+	std::vector<FunctionProfile> functions;
+};
+
+/**
+ * The counters of one thread. Only the thread itself writes to them, with
+ * plain loads and stores, so counting costs no more than it would without
+ * threads. They are still read and written through atomic_ref, so that
+ * collect_profile can merge them while the thread keeps running.
+ */
+class ThreadProfile {
+  public:
+	ThreadProfile() : opcodes(BYTE_OP_COUNT + 1) {}
+
+	/**
+	 * Starts a call of the given function, on top of the calls that are
+	 * already running on the thread.
+	 */
+	void enter(const FunctionInstance &func);
+
+	/**
+	 * Ends the innermost call.
+	 */
+	void exit();
+
+	/**
+	 * Counts the op that is about to run, and charges the cycles since the
+	 * previous one to that.
+	 */
+	void count_instruction(ByteOp op) {
+		const uint64_t now = read_cycle_counter();
+		add(opcodes[current_op].cycles, now - last_cycles);
+		add(opcodes[static_cast<size_t>(op)].count, 1);
+		instructions++;
+		current_op = static_cast<size_t>(op);
+		last_cycles = now;
+	}
+
+	/**
+	 * Charges the cycles since the last op to it, once the function returns.
+	 */
+	void stop_instructions() {
+		add(opcodes[current_op].cycles, read_cycle_counter() - last_cycles);
+		current_op = NO_OP;
+	}
+
+  private:
+	friend Profile collect_profile();
+
+	struct Key {
+		const Module *module;
+		uint32_t func_index;
+
+		bool operator==(const Key &other) const = default;
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key &key) const {
+			return std::hash<const Module *>()(key.module) ^ key.func_index;
+		}
+	};
+
+	// the counters of a function, and how many of its calls are running on
+	// the thread. Only the outermost of them charges its inclusive counts, as
+	// those of the calls inside it are already part of its own.
+	struct FunctionState {
+		FunctionProfile counters;
+		size_t active_depth;
+	};
+
+	struct ActiveCall {
+		FunctionState *function;
+		uint64_t start_instructions;
+		uint64_t start_cycles;
+		uint64_t child_instructions;
+		uint64_t child_cycles;
+	};
+
+	// charged with the cycles that pass while no op is running
+	static constexpr size_t NO_OP = BYTE_OP_COUNT;
+
+	static void add(uint64_t &counter, uint64_t delta) {
+		std::atomic_ref ref(counter);
+		ref.store(ref.load(std::memory_order_relaxed) + delta,
+				  std::memory_order_relaxed);
+	}
+
+	std::vector<OpcodeProfile> opcodes;
+	size_t current_op = NO_OP;
+	uint64_t last_cycles = 0;
+	// number of instructions run on the thread so far
+	uint64_t instructions = 0;
+
+	// only the thread adds functions, under the lock. collect_profile holds
+	// the lock while it reads them.
+	std::mutex functions_lock;
+	std::unordered_map<Key, FunctionState, KeyHash> functions;
+
+	std::vector<ActiveCall> active_calls;
+};
+
+/**
+ * The counters of the calling thread, created on first use. They stay around
+ * after the thread exits, so that they can still be collected.
+ */
+ThreadProfile &thread_profile();
+
+/**
+ * Merges the counters of every thread that has profiled anything.
+ */
+Profile collect_profile();
+
+/**
+ * Writes the profile as a JSON object with an "opcodes" and a "functions"
+ * array. Ops that never ran are left out.
+ */
+void write_profile_json(const Profile &profile, std::ostream &out);
+
+/**
+ * Writes the profile as CSV, one row per op that ran and per function, told
+ * apart by the first column.
+ */
+void write_profile_csv(const Profile &profile, std::ostream &out);
+
+} // namespace Treble
+
+#endif
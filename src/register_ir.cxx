@@ -0,0 +1,391 @@
+#include "register_ir.hxx"
+#include "bytecode.hxx"
+#include "execution_context.hxx"
+#include "instructions.hxx"
+#include "numeric.hxx"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <stack>
+#include <unordered_map>
+#include <vector>
+
+#ifdef TREBLE_SWITCH_DISPATCH
+
+#define HANDLER(instr_name) case RegisterInstruction::OpCode::instr_name:
+#define DISPATCH() continue;
+
+#else
+
+// register instructions are too small to carry a handler address, so each
+// handler looks the next one up in the dispatch table instead.
+#define HANDLER(instr_name) op_##instr_name:
+#define DISPATCH() goto *dispatch_table[static_cast<size_t>(ip->op_code)];
+
+#endif
+
+// moves on to the next instruction
+#define NEXT()                                                                 \
+	{                                                                          \
+		ip++;                                                                  \
+		DISPATCH();                                                            \
+	}
+
+// continues at the instruction with the given index
+#define JUMP(target)                                                           \
+	{                                                                          \
+		ip = func.code + target;                                               \
+		DISPATCH();                                                            \
+	}
+
+// the semantics of the ops are those of numeric.hxx, which the stack
+// interpreter and constant folding share, so that the tiers always agree
+#define UNARY_OPERATION(instr_name, op_code, text)                             \
+	HANDLER(instr_name) {                                                      \
+		registers[ip->dst] =                                                   \
+			evaluate_unary(ByteOp::instr_name, registers[ip->a]);              \
+		NEXT();                                                                \
+	}
+
+// only divisions and remainders ever trap, the check compiles to nothing for
+// every other op
+#define BINARY_OPERATION(instr_name, op_code, text)                            \
+	HANDLER(instr_name) {                                                      \
+		const uint64_t a = registers[ip->a];                                   \
+		const uint64_t b = registers[ip->b];                                   \
+		if (const Trap trap = binary_trap(ByteOp::instr_name, a, b);           \
+			trap != Trap::None) {                                              \
+			return trap;                                                       \
+		}                                                                      \
+		registers[ip->dst] = evaluate_binary(ByteOp::instr_name, a, b);        \
+		NEXT();                                                                \
+	}
+
+namespace Treble {
+
+/**
+ * While lowering, constants are numbered separately from stack registers.
+ * Operands with this bit set refer to a constant; they are moved to their
+ * final place in the register file once the function is fully lowered.
+ */
+static constexpr Operand CONSTANT_OPERAND = 0x8000;
+
+struct LoweringBlock {
+	/**
+	 * height of the operand stack when the block was entered
+	 */
+	size_t stack_height;
+
+	/**
+	 * index of the jump_if_zero emitted for the if instruction
+	 */
+	size_t branch_pos;
+
+	/**
+	 * index of the jump emitted for the else instruction, if there is one
+	 */
+	std::optional<size_t> else_jump_pos;
+};
+
+static RegisterInstruction::OpCode register_op_code(Instruction::OpCode op) {
+	switch (op) {
+#define REGISTER_OPCODE_CASE(name, op_code, text)                              \
+	case Instruction::OpCode::name:                                            \
+		return RegisterInstruction::OpCode::name;
+
+		TREBLE_FOREACH_UNARY_OPCODE(REGISTER_OPCODE_CASE)
+		TREBLE_FOREACH_BINARY_OPCODE(REGISTER_OPCODE_CASE)
+
+#undef REGISTER_OPCODE_CASE
+
+	default:
+		return RegisterInstruction::OpCode::return_;
+	}
+}
+
+RegisterFunction *lower_function(const Function &func) {
+	std::vector<RegisterInstruction> code;
+	std::vector<uint64_t> constants;
+	std::unordered_map<uint64_t, Operand> constant_operands;
+	// the operand holding each value that is currently on the wasm stack.
+	// a value at height h is either a constant or lives in stack register h.
+	std::vector<Operand> stack;
+	std::stack<LoweringBlock> blocks;
+	size_t max_stack_height = 0;
+
+	const auto constant = [&](uint64_t value) -> Operand {
+		const auto [it, inserted] = constant_operands.try_emplace(
+			value, CONSTANT_OPERAND | constants.size());
+		if (inserted) {
+			constants.push_back(value);
+		}
+		return it->second;
+	};
+
+	const auto push_result = [&]() -> Operand {
+		const Operand dst = stack.size();
+		stack.push_back(dst);
+		max_stack_height = std::max(max_stack_height, stack.size());
+		return dst;
+	};
+
+	// control flow merges expect every value above the given height to be in
+	// its stack register, so pending constants have to be moved there first.
+	const auto materialize = [&](size_t height) {
+		for (size_t i = height; i < stack.size(); ++i) {
+			if (stack[i] != i) {
+				code.push_back({
+					.op_code = RegisterInstruction::OpCode::move,
+					.dst = static_cast<Operand>(i),
+					.a = stack[i],
+				});
+				stack[i] = i;
+			}
+		}
+		max_stack_height = std::max(max_stack_height, stack.size());
+	};
+
+	for (InstructionReader reader(func.body);;) {
+		const Instruction instr = reader.next();
+		switch (instr.op_code) {
+		case Instruction::OpCode::i32_const:
+			stack.push_back(constant(instr.args.i32));
+			break;
+
+		case Instruction::OpCode::i64_const:
+			stack.push_back(constant(instr.args.i64));
+			break;
+
+		case Instruction::OpCode::f32_const: {
+			uint32_t bits;
+			std::memcpy(&bits, &instr.args.f32, sizeof(bits));
+			stack.push_back(constant(bits));
+			break;
+		}
+
+		case Instruction::OpCode::drop:
+			stack.pop_back();
+			break;
+
+		case Instruction::OpCode::if_: {
+			const Operand condition = stack.back();
+			stack.pop_back();
+
+			blocks.push({
+				.stack_height = stack.size(),
+				.branch_pos = code.size(),
+			});
+			code.push_back({
+				.op_code = RegisterInstruction::OpCode::jump_if_zero,
+				.a = condition,
+			});
+			break;
+		}
+
+		case Instruction::OpCode::else_: {
+			LoweringBlock &block = blocks.top();
+			materialize(block.stack_height);
+			// the else arm starts from the same stack as the true arm did
+			stack.resize(block.stack_height);
+
+			block.else_jump_pos = code.size();
+			code.push_back({.op_code = RegisterInstruction::OpCode::jump});
+			code[block.branch_pos].b = code.size();
+			break;
+		}
+
+		case Instruction::OpCode::end: {
+			if (blocks.empty()) {
+				materialize(0);
+				code.push_back(
+					{.op_code = RegisterInstruction::OpCode::return_});
+				goto lowered;
+			}
+
+			const LoweringBlock block = blocks.top();
+			blocks.pop();
+			materialize(block.stack_height);
+
+			if (block.else_jump_pos) {
+				code[*block.else_jump_pos].b = code.size();
+			} else {
+				code[block.branch_pos].b = code.size();
+			}
+			break;
+		}
+
+#define UNARY_CASE(name, op_code, text) case Instruction::OpCode::name:
+			TREBLE_FOREACH_UNARY_OPCODE(UNARY_CASE)
+#undef UNARY_CASE
+			{
+				const Operand a = stack.back();
+				stack.pop_back();
+				const Operand dst = push_result();
+				code.push_back({
+					.op_code = register_op_code(instr.op_code),
+					.dst = dst,
+					.a = a,
+				});
+				break;
+			}
+
+#define BINARY_CASE(name, op_code, text) case Instruction::OpCode::name:
+			TREBLE_FOREACH_BINARY_OPCODE(BINARY_CASE)
+#undef BINARY_CASE
+			{
+				const Operand b = stack.back();
+				stack.pop_back();
+				const Operand a = stack.back();
+				stack.pop_back();
+				const Operand dst = push_result();
+				code.push_back({
+					.op_code = register_op_code(instr.op_code),
+					.dst = dst,
+					.a = a,
+					.b = b,
+				});
+				break;
+			}
+
+		default:
+			return nullptr;
+		}
+	}
+
+lowered:
+	// operands are 16 bits wide, and so are jump targets
+	if (constants.size() >= CONSTANT_OPERAND ||
+		constants.size() + max_stack_height > UINT16_MAX ||
+		code.size() > UINT16_MAX) {
+		return nullptr;
+	}
+
+	// lay out the register file: constants first, stack registers after them
+	const auto relocate = [&](Operand &operand) {
+		if (operand & CONSTANT_OPERAND) {
+			operand &= ~CONSTANT_OPERAND;
+		} else {
+			operand += constants.size();
+		}
+	};
+	for (RegisterInstruction &instr : code) {
+		switch (instr.op_code) {
+		case RegisterInstruction::OpCode::jump:
+		case RegisterInstruction::OpCode::return_:
+			break;
+
+		case RegisterInstruction::OpCode::jump_if_zero:
+			relocate(instr.a);
+			break;
+
+		case RegisterInstruction::OpCode::move:
+#define UNARY_CASE(name, op_code, text) case RegisterInstruction::OpCode::name:
+			TREBLE_FOREACH_UNARY_OPCODE(UNARY_CASE)
+#undef UNARY_CASE
+			relocate(instr.dst);
+			relocate(instr.a);
+			break;
+
+		default:
+			relocate(instr.dst);
+			relocate(instr.a);
+			relocate(instr.b);
+			break;
+		}
+	}
+
+	auto *lowered = static_cast<RegisterFunction *>(
+		std::malloc(sizeof(RegisterFunction)));
+	if (lowered == nullptr) {
+		return nullptr;
+	}
+
+	// a function without constants still gets a valid pointer, so that a
+	// failed allocation is never mistaken for an empty one
+	lowered->code_size = code.size();
+	lowered->code = static_cast<RegisterInstruction *>(
+		std::malloc(code.size() * sizeof(RegisterInstruction)));
+	lowered->constant_count = constants.size();
+	lowered->constants = static_cast<uint64_t *>(
+		std::malloc(std::max<size_t>(constants.size(), 1) * sizeof(uint64_t)));
+	if (lowered->code == nullptr || lowered->constants == nullptr) {
+		free_register_function(lowered);
+		return nullptr;
+	}
+
+	std::memcpy(lowered->code, code.data(),
+				code.size() * sizeof(RegisterInstruction));
+	std::memcpy(lowered->constants, constants.data(),
+				constants.size() * sizeof(uint64_t));
+
+	lowered->register_count = constants.size() + max_stack_height;
+	lowered->result_count = stack.size();
+
+	return lowered;
+}
+
+void free_register_function(RegisterFunction *func) {
+	if (func == nullptr) {
+		return;
+	}
+	std::free(func->code);
+	std::free(func->constants);
+	std::free(func);
+}
+
+Trap execute_register_function(const RegisterFunction &func,
+							   uint64_t *registers) {
+	std::memcpy(registers, func.constants,
+				func.constant_count * sizeof(uint64_t));
+
+	const RegisterInstruction *ip = func.code;
+
+#ifdef TREBLE_SWITCH_DISPATCH
+	while (true) {
+		switch (ip->op_code) {
+#else
+	static const void *const dispatch_table[] = {
+		&&op_move,
+		&&op_jump,
+		&&op_jump_if_zero,
+		&&op_return_,
+#define DISPATCH_TABLE_ENTRY(name, op_code, text) &&op_##name,
+		TREBLE_FOREACH_UNARY_OPCODE(DISPATCH_TABLE_ENTRY)
+		TREBLE_FOREACH_BINARY_OPCODE(DISPATCH_TABLE_ENTRY)
+#undef DISPATCH_TABLE_ENTRY
+	};
+
+	DISPATCH();
+	{
+		{
+#endif
+			TREBLE_FOREACH_UNARY_OPCODE(UNARY_OPERATION)
+			TREBLE_FOREACH_BINARY_OPCODE(BINARY_OPERATION)
+
+		HANDLER(move) {
+			registers[ip->dst] = registers[ip->a];
+			NEXT();
+		}
+
+		HANDLER(jump) {
+			JUMP(ip->b);
+		}
+
+		HANDLER(jump_if_zero) {
+			if (static_cast<uint32_t>(registers[ip->a]) == 0) {
+				JUMP(ip->b);
+			}
+			NEXT();
+		}
+
+		HANDLER(return_) {
+			return Trap::None;
+		}
+		}
+	}
+}
+
+} // namespace Treble
@@ -0,0 +1,94 @@
+#ifndef __TREBLE__REGISTER_IR_HXX__
+#define __TREBLE__REGISTER_IR_HXX__
+
+#include "execution_context.hxx"
+#include "instructions.hxx"
+#include "module.hxx"
+#include <cstddef>
+#include <cstdint>
+
+namespace Treble {
+
+/**
+ * Names a slot in the register file of a function. The register file starts
+ * with the constants of the function, followed by one register for every
+ * operand stack slot the original WASM code uses.
+ */
+typedef uint16_t Operand;
+
+/**
+ * An instruction of the register IR. Every instruction names its operands and
+ * its destination explicitly, so nothing is ever pushed or popped at runtime.
+ */
+struct RegisterInstruction {
+	enum class OpCode : uint16_t {
+		// dst = a
+		move,
+		// continue at instruction b
+		jump,
+		// continue at instruction b if a is zero
+		jump_if_zero,
+		// the function is done, its results are in the first stack registers
+		return_,
+
+#define REGISTER_OPCODE_ENUM_ENTRY(name, op_code, text) name,
+		TREBLE_FOREACH_UNARY_OPCODE(REGISTER_OPCODE_ENUM_ENTRY)
+		TREBLE_FOREACH_BINARY_OPCODE(REGISTER_OPCODE_ENUM_ENTRY)
+#undef REGISTER_OPCODE_ENUM_ENTRY
+	};
+
+	OpCode op_code;
+	Operand dst;
+	Operand a;
+	Operand b;
+};
+
+/**
+ * A function lowered from WASM stack code to the register IR.
+ */
+struct RegisterFunction {
+	RegisterInstruction *code;
+	size_t code_size;
+
+	/**
+	 * Values of the constant registers, which come first in the register file.
+	 * They are copied into the register file every time the function runs.
+	 */
+	uint64_t *constants;
+	size_t constant_count;
+
+	/**
+	 * Total number of registers the function needs, constants included.
+	 */
+	size_t register_count;
+
+	/**
+	 * Number of values left on the operand stack when the function returns.
+	 * They end up in the registers right after the constants.
+	 */
+	size_t result_count;
+};
+
+/**
+ * Lowers the body of the given function to the register IR. Returns nullptr
+ * if the function uses something the register IR cannot express, in which case
+ * it has to keep running on the stack interpreter.
+ */
+RegisterFunction *lower_function(const Function &func);
+
+/**
+ * Frees a function lowered by lower_function. Does nothing if func is nullptr.
+ */
+void free_register_function(RegisterFunction *func);
+
+/**
+ * Runs a lowered function. registers must have room for
+ * func.register_count values. Returns the trap that cut the function short,
+ * or Trap::None once its results are in place.
+ */
+Trap execute_register_function(const RegisterFunction &func,
+							   uint64_t *registers);
+
+} // namespace Treble
+
+#endif
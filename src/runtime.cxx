@@ -1,437 +1,1233 @@
 #include "runtime.hxx"
+#include "atomic_wait.hxx"
+#include "bytecode.hxx"
+#include "execution_context.hxx"
 #include "instructions.hxx"
-#include <bit>
+#include "jit.hxx"
+#include "linear_memory.hxx"
+#include "numeric.hxx"
+#include "profiler.hxx"
+#include "register_ir.hxx"
+#include "sampler.hxx"
+#include "simd.hxx"
+#include "tiering.hxx"
+#include "trace.hxx"
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <optional>
+#include <span>
 
-#define BINARY_OPERATION(dtype, instr_name, stack_type, operator)              \
-	case Instruction::OpCode::instr_name: {                                    \
-		StackEntry &entry_c2 = stack[stack_ptr--];                             \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-		const auto result = entry_c1.value.dtype##_operand operator entry_c2   \
-								.value.dtype##_operand;                        \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::stack_type;                           \
-		entry_c.value.dtype##_operand = result;                                \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}
-
-#define SIGNED_BINARY_OPERATION(dtype, instr_name, signed_type,                \
-								stack_type, operator)                          \
-	case Instruction::OpCode::instr_name: {                                    \
-		StackEntry &entry_c2 = stack[stack_ptr--];                             \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-		const auto result =                                                    \
-			static_cast<signed_type>(entry_c1.value.dtype##_operand)           \
-			operator static_cast<signed_type>(entry_c2.value.dtype##_operand); \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::stack_type;                           \
-		entry_c.value.dtype##_operand = result;                                \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}
-
-#define INTEGER_INSTRUCTIONS(dtype, bit_width, signed_type, stack_type)        \
-	case Instruction::OpCode::dtype##_const: {                                 \
-		std::cout << #dtype ".const" << std::endl;                             \
-		StackEntry &entry = stack[++stack_ptr];                                \
-		entry.type = StackEntry::Type::stack_type;                             \
-		entry.value.dtype##_operand = instruction.args.dtype;                  \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-	case Instruction::OpCode::dtype##_eqz: {                                   \
-		std::cout << #dtype ".eqz" << std::endl;                               \
-		StackEntry &entry_c1 = stack[stack_ptr];                               \
-		entry_c1.type = StackEntry::Type::I32Value;                            \
-		entry_c1.value.i32_operand =                                           \
-			entry_c1.value.dtype##_operand == 0 ? 1 : 0;                       \
-		header++;                                                              \
-		break;                                                                 \
-	};                                                                         \
-	case Instruction::OpCode::dtype##_eq: {                                    \
-		std::cout << #dtype ".eq" << std::endl;                                \
-                                                                               \
-		StackEntry &entry_c2 = stack[stack_ptr--];                             \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::I32Value;                             \
-		entry_c.value.i32_operand =                                            \
-			entry_c1.value.dtype##_operand == entry_c2.value.dtype##_operand   \
-				? 1                                                            \
-				: 0;                                                           \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-	case Instruction::OpCode::dtype##_ne: {                                    \
-		std::cout << #dtype ".ne" << std::endl;                                \
-                                                                               \
-		StackEntry &entry_c2 = stack[stack_ptr--];                             \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::I32Value;                             \
-		entry_c.value.i32_operand =                                            \
-			entry_c1.value.dtype##_operand == entry_c2.value.dtype##_operand   \
-				? 0                                                            \
-				: 1;                                                           \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-	case Instruction::OpCode::dtype##_lt_u: {                                  \
-		std::cout << #dtype ".lt_u" << std::endl;                              \
-                                                                               \
-		StackEntry &entry_c2 = stack[stack_ptr--];                             \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::I32Value;                             \
-		entry_c.value.i32_operand =                                            \
-			entry_c1.value.dtype##_operand < entry_c2.value.dtype##_operand    \
-				? 1                                                            \
-				: 0;                                                           \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-	case Instruction::OpCode::dtype##_lt_s: {                                  \
-		std::cout << #dtype ".lt_u" << std::endl;                              \
-                                                                               \
-		StackEntry &entry_c2 = stack[stack_ptr--];                             \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::I32Value;                             \
-		entry_c.value.i32_operand =                                            \
-			static_cast<int32_t>(entry_c1.value.dtype##_operand) <             \
-					static_cast<int32_t>(entry_c2.value.dtype##_operand)       \
-				? 1                                                            \
-				: 0;                                                           \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-	case Instruction::OpCode::dtype##_gt_u: {                                  \
-		std::cout << #dtype ".gt_u" << std::endl;                              \
-                                                                               \
-		StackEntry &entry_c2 = stack[stack_ptr--];                             \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::I32Value;                             \
-		entry_c.value.i32_operand =                                            \
-			entry_c1.value.dtype##_operand > entry_c2.value.dtype##_operand    \
-				? 1                                                            \
-				: 0;                                                           \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-	case Instruction::OpCode::dtype##_gt_s: {                                  \
-		std::cout << #dtype ".gt_u" << std::endl;                              \
-                                                                               \
-		StackEntry &entry_c2 = stack[stack_ptr--];                             \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::I32Value;                             \
-		entry_c.value.i32_operand =                                            \
-			static_cast<signed_type>(entry_c1.value.dtype##_operand) >         \
-					static_cast<signed_type>(entry_c2.value.dtype##_operand)   \
-				? 1                                                            \
-				: 0;                                                           \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-	case Instruction::OpCode::dtype##_le_u: {                                  \
-		std::cout << #dtype ".le_u" << std::endl;                              \
-                                                                               \
-		StackEntry &entry_c2 = stack[stack_ptr--];                             \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::I32Value;                             \
-		entry_c.value.i32_operand =                                            \
-			entry_c1.value.dtype##_operand <= entry_c2.value.dtype##_operand   \
-				? 1                                                            \
-				: 0;                                                           \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-	case Instruction::OpCode::dtype##_ge_u: {                                  \
-		std::cout << #dtype ".ge_u" << std::endl;                              \
-                                                                               \
-		StackEntry &entry_c2 = stack[stack_ptr--];                             \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::I32Value;                             \
-		entry_c.value.i32_operand =                                            \
-			entry_c1.value.dtype##_operand >= entry_c2.value.dtype##_operand   \
-				? 1                                                            \
-				: 0;                                                           \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-	case Instruction::OpCode::dtype##_ge_s: {                                  \
-		std::cout << #dtype ".le_s" << std::endl;                              \
-                                                                               \
-		StackEntry &entry_c2 = stack[stack_ptr--];                             \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::I32Value;                             \
-		entry_c.value.i32_operand =                                            \
-			static_cast<signed_type>(entry_c1.value.dtype##_operand) >=        \
-					static_cast<signed_type>(entry_c2.value.dtype##_operand)   \
-				? 1                                                            \
-				: 0;                                                           \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-                                                                               \
-		BINARY_OPERATION(dtype, dtype##_add, stack_type, +)                    \
-		BINARY_OPERATION(dtype, dtype##_sub, stack_type, -)                    \
-		BINARY_OPERATION(dtype, dtype##_mul, stack_type, *)                    \
-                                                                               \
-		BINARY_OPERATION(dtype, dtype##_div_u, stack_type, /)                  \
-		SIGNED_BINARY_OPERATION(dtype, dtype##_div_s, signed_type, stack_type, \
-								/)                                             \
-                                                                               \
-		BINARY_OPERATION(dtype, dtype##_rem_u, stack_type, %)                  \
-		SIGNED_BINARY_OPERATION(dtype, dtype##_rem_s, int32_t, stack_type, %)  \
-                                                                               \
-		BINARY_OPERATION(dtype, dtype##_and, stack_type, &);                   \
-		BINARY_OPERATION(dtype, dtype##_or, stack_type, |);                    \
-		BINARY_OPERATION(dtype, dtype##_xor, stack_type, ^);                   \
-                                                                               \
-	case Instruction::OpCode::dtype##_shl: {                                   \
-		StackEntry &entry_c2 = stack[stack_ptr--];                             \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		const auto k = entry_c2.value.dtype##_operand % bit_width;             \
-		const auto result = (entry_c1.value.dtype##_operand << k) % bit_width; \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::stack_type;                           \
-		entry_c.value.dtype##_operand = result;                                \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-	case Instruction::OpCode::dtype##_shr_s:                                   \
-	case Instruction::OpCode::dtype##_shr_u: {                                 \
-		StackEntry &entry_c2 = stack[stack_ptr--];                             \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		const auto k = entry_c2.value.dtype##_operand % 32;                    \
-		const auto result = entry_c1.value.dtype##_operand >> k;               \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::stack_type;                           \
-		entry_c.value.dtype##_operand = result;                                \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-	case Instruction::OpCode::dtype##_rotl: {                                  \
-		StackEntry &entry_c2 = stack[stack_ptr--];                             \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		const auto k = entry_c2.value.dtype##_operand % bit_width;             \
-		const auto result =                                                    \
-			(entry_c1.value.dtype##_operand << k) |                            \
-			(entry_c1.value.dtype##_operand >> (bit_width - k));               \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::stack_type;                           \
-		entry_c.value.dtype##_operand = result;                                \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-	case Instruction::OpCode::dtype##_rotr: {                                  \
-		StackEntry &entry_c2 = stack[stack_ptr--];                             \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		const auto k = entry_c2.value.dtype##_operand % bit_width;             \
-		const auto result =                                                    \
-			(entry_c1.value.dtype##_operand << (bit_width - k)) |              \
-			(entry_c1.value.dtype##_operand >> (k));                           \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::stack_type;                           \
-		entry_c.value.dtype##_operand = result;                                \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-	case Instruction::OpCode::dtype##_clz: {                                   \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::I32Value;                             \
-		entry_c.value.dtype##_operand =                                        \
-			std::countr_zero(entry_c1.value.dtype##_operand);                  \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-	case Instruction::OpCode::dtype##_ctz: {                                   \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::I32Value;                             \
-		entry_c.value.dtype##_operand =                                        \
-			std::countl_zero(entry_c1.value.dtype##_operand);                  \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}                                                                          \
-	case Instruction::OpCode::dtype##_popcnt: {                                \
-		StackEntry &entry_c1 = stack[stack_ptr--];                             \
-                                                                               \
-		StackEntry &entry_c = stack[++stack_ptr];                              \
-		entry_c.type = StackEntry::Type::stack_type;                           \
-		entry_c.value.dtype##_operand =                                        \
-			std::popcount(entry_c1.value.dtype##_operand);                     \
-                                                                               \
-		header++;                                                              \
-		break;                                                                 \
-	}
-
-struct StackEntry {
-	enum class Type { I32Value, I64Value, F32Value, Label, Activations };
-	Type type;
-	union {
-		uint32_t i32_operand;
-		uint64_t i64_operand;
-		float f32_operand;
-	} value;
-};
+// records the instruction that is about to run
+#define TRACE_INSTRUCTION()                                                    \
+	TREBLE_TRACE_INSTRUCTION(op_name(read_byte_op(pc)), stack_ptr + 1,         \
+							 stack_ptr >= 0 ? stack[stack_ptr] : 0)
+
+// counts the instruction that is about to run when profiling, or shows the
+// sampler where the function is when sampling
+#define INSTRUMENT_INSTRUCTION()                                               \
+	if constexpr (instrumentation == Instrumentation::Profile) {               \
+		profile->count_instruction(read_byte_op(pc));                          \
+	} else if constexpr (instrumentation == Instrumentation::Sample) {         \
+		sample_site.pc.store(pc, std::memory_order_relaxed);                   \
+	}
+
+#ifdef TREBLE_SWITCH_DISPATCH
+
+// every instruction goes back through the central switch in
+// run_stack_interpreter
+#define HANDLER(instr_name) case ByteOp::instr_name:
+#define UNKNOWN_HANDLER default:
+#define DISPATCH() continue;
+
+#else
+
+// threaded code: each handler jumps straight to the handler of the next
+// instruction, looking it up in dispatch_table by its op code.
+#define HANDLER(instr_name) op_##instr_name:
+#define UNKNOWN_HANDLER op_unknown:
+#define DISPATCH()                                                             \
+	TRACE_INSTRUCTION();                                                       \
+	INSTRUMENT_INSTRUCTION();                                                  \
+	goto *dispatch_table[static_cast<size_t>(read_byte_op(pc))];
+
+#endif
+
+// moves on to the next instruction. only for instructions without immediates
+#define NEXT()                                                                 \
+	{                                                                          \
+		pc += sizeof(ByteOp);                                                  \
+		DISPATCH();                                                            \
+	}
+
+// moves forward by the given number of bytes
+#define JUMP(offset)                                                           \
+	{                                                                          \
+		pc += offset;                                                          \
+		DISPATCH();                                                            \
+	}
+
+// the address is the 32 bit operand plus the offset, which cannot overflow
+// 64 bits, nor reach past the reservation of the memory. anything out of
+// bounds faults.
+#define LOAD_OPERATION(instr_name, memory_type, operand_type)                  \
+	HANDLER(instr_name) {                                                      \
+		const uint64_t address = static_cast<uint32_t>(stack[stack_ptr]) +     \
+								 uint64_t{read_immediate<uint32_t>(pc)};       \
+		memory_type value;                                                     \
+		std::memcpy(&value, memory + address, sizeof(value));                  \
+		stack[stack_ptr] = static_cast<operand_type>(value);                   \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+#define STORE_OPERATION(instr_name, memory_type)                               \
+	HANDLER(instr_name) {                                                      \
+		const auto value = static_cast<memory_type>(stack[stack_ptr--]);       \
+		const uint64_t address = static_cast<uint32_t>(stack[stack_ptr--]) +   \
+								 uint64_t{read_immediate<uint32_t>(pc)};       \
+		std::memcpy(memory + address, &value, sizeof(value));                  \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+// declares the address of an atomic access, which traps unless it is
+// naturally aligned. that also keeps atomic accesses from straddling the end
+// of the memory, so anything out of bounds still faults.
+#define ATOMIC_ADDRESS(memory_type, address_operand)                           \
+	const uint64_t address = static_cast<uint32_t>(address_operand) +          \
+							 uint64_t{read_immediate<uint32_t>(pc)};           \
+	if (address % sizeof(memory_type) != 0) {                                  \
+		trap = Trap::UnalignedAtomic;                                          \
+		return -1;                                                             \
+	}
+
+#define ATOMIC_CELL(memory_type)                                               \
+	const std::atomic_ref cell(                                                \
+		*reinterpret_cast<memory_type *>(memory + address));
+
+#define ATOMIC_LOAD_OPERATION(instr_name, memory_type, operand_type)           \
+	HANDLER(instr_name) {                                                      \
+		ATOMIC_ADDRESS(memory_type, stack[stack_ptr])                          \
+		ATOMIC_CELL(memory_type)                                               \
+		stack[stack_ptr] = static_cast<operand_type>(cell.load());             \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+#define ATOMIC_STORE_OPERATION(instr_name, memory_type)                        \
+	HANDLER(instr_name) {                                                      \
+		const auto value = static_cast<memory_type>(stack[stack_ptr--]);       \
+		ATOMIC_ADDRESS(memory_type, stack[stack_ptr--])                        \
+		ATOMIC_CELL(memory_type)                                               \
+		cell.store(value);                                                     \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+// fn is the member of std::atomic_ref that does the operation
+#define ATOMIC_RMW_OPERATION(instr_name, memory_type, operand_type, fn)        \
+	HANDLER(instr_name) {                                                      \
+		const auto operand = static_cast<memory_type>(stack[stack_ptr--]);     \
+		ATOMIC_ADDRESS(memory_type, stack[stack_ptr])                          \
+		ATOMIC_CELL(memory_type)                                               \
+		stack[stack_ptr] = static_cast<operand_type>(cell.fn(operand));        \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+// every width of a read-modify-write operation
+#define ATOMIC_RMW_OPERATIONS(op, fn)                                          \
+	ATOMIC_RMW_OPERATION(i32_atomic_rmw_##op, uint32_t, uint32_t, fn)          \
+	ATOMIC_RMW_OPERATION(i64_atomic_rmw_##op, uint64_t, uint64_t, fn)          \
+	ATOMIC_RMW_OPERATION(i32_atomic_rmw8_##op##_u, uint8_t, uint32_t, fn)      \
+	ATOMIC_RMW_OPERATION(i32_atomic_rmw16_##op##_u, uint16_t, uint32_t, fn)    \
+	ATOMIC_RMW_OPERATION(i64_atomic_rmw8_##op##_u, uint8_t, uint64_t, fn)      \
+	ATOMIC_RMW_OPERATION(i64_atomic_rmw16_##op##_u, uint16_t, uint64_t, fn)    \
+	ATOMIC_RMW_OPERATION(i64_atomic_rmw32_##op##_u, uint32_t, uint64_t, fn)
+
+// pushes whatever the memory held, whether or not it was replaced
+#define ATOMIC_CMPXCHG_OPERATION(instr_name, memory_type, operand_type)        \
+	HANDLER(instr_name) {                                                      \
+		const auto replacement = static_cast<memory_type>(stack[stack_ptr--]); \
+		auto expected = static_cast<memory_type>(stack[stack_ptr--]);          \
+		ATOMIC_ADDRESS(memory_type, stack[stack_ptr])                          \
+		ATOMIC_CELL(memory_type)                                               \
+		cell.compare_exchange_strong(expected, replacement);                   \
+		stack[stack_ptr] = static_cast<operand_type>(expected);                \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+// a fault while waiting would jump out with the waiter still queued, so the
+// bounds of a wait are checked by hand instead of left to the guard pages
+#define ATOMIC_WAIT_OPERATION(instr_name, memory_type)                         \
+	HANDLER(instr_name) {                                                      \
+		const auto timeout = static_cast<int64_t>(stack[stack_ptr--]);         \
+		const auto expected = static_cast<memory_type>(stack[stack_ptr--]);    \
+		ATOMIC_ADDRESS(memory_type, stack[stack_ptr])                          \
+		if (!memory_instance->is_shared()) {                                   \
+			trap = Trap::WaitOnUnsharedMemory;                                 \
+			return -1;                                                         \
+		}                                                                      \
+		if (address + sizeof(memory_type) > memory_instance->size()) {         \
+			trap = Trap::OutOfBoundsMemoryAccess;                              \
+			return -1;                                                         \
+		}                                                                      \
+		stack[stack_ptr] = static_cast<uint32_t>(wait_for_notify(              \
+			memory + address, expected, sizeof(memory_type), timeout));        \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+// i32 values are kept zero-extended in their slots, the way the register
+// interpreter and native code keep them. see numeric.hxx.
+#define CONST_OPERATION(instr_name, operand_type)                              \
+	HANDLER(instr_name) {                                                      \
+		stack[++stack_ptr] = read_immediate<operand_type>(pc);                 \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+#define UNARY_OPERATION(instr_name, op_code, text)                             \
+	HANDLER(instr_name) {                                                      \
+		stack[stack_ptr] =                                                     \
+			evaluate_unary(ByteOp::instr_name, stack[stack_ptr]);              \
+		NEXT();                                                                \
+	}
+
+// aborts the call if the binary op traps on its operands. only divisions and
+// remainders ever do, so this compiles to nothing for every other op.
+#define CHECK_BINARY_TRAP(instr_name, c1, c2)                                  \
+	if (const Trap binary_op_trap = binary_trap(ByteOp::instr_name, c1, c2);   \
+		binary_op_trap != Trap::None) {                                        \
+		trap = binary_op_trap;                                                 \
+		return -1;                                                             \
+	}
+
+#define BINARY_OPERATION(instr_name, op_code, text)                            \
+	HANDLER(instr_name) {                                                      \
+		const uint64_t c2 = stack[stack_ptr--];                                \
+		CHECK_BINARY_TRAP(instr_name, stack[stack_ptr], c2)                    \
+		stack[stack_ptr] =                                                     \
+			evaluate_binary(ByteOp::instr_name, stack[stack_ptr], c2);         \
+		NEXT();                                                                \
+	}
+
+// a const followed by a binary op, with the const as the second operand
+#define BINARY_IMM_OPERATION(instr_name, op_code, text)                        \
+	HANDLER(instr_name##_imm) {                                                \
+		const uint64_t c2 =                                                    \
+			immediate_size(ByteOp::instr_name##_imm) == sizeof(uint32_t)       \
+				? read_immediate<uint32_t>(pc)                                 \
+				: read_immediate<uint64_t>(pc);                                \
+		CHECK_BINARY_TRAP(instr_name, stack[stack_ptr], c2)                    \
+		stack[stack_ptr] =                                                     \
+			evaluate_binary(ByteOp::instr_name, stack[stack_ptr], c2);         \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name##_imm));       \
+	}
+
+// branches like if_ on the outcome of the test
+#define TEST_IF_OPERATION(instr_name, op_code, text)                           \
+	HANDLER(instr_name##_if) {                                                 \
+		const uint64_t c =                                                     \
+			evaluate_unary(ByteOp::instr_name, stack[stack_ptr--]);            \
+		if (c) {                                                               \
+			JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name##_if));    \
+		} else {                                                               \
+			JUMP(read_immediate<int32_t>(pc));                                 \
+		}                                                                      \
+	}
+
+// branches like if_ on the outcome of the comparison
+#define COMPARE_IF_OPERATION(instr_name, op_code, text)                        \
+	HANDLER(instr_name##_if) {                                                 \
+		const uint64_t c2 = stack[stack_ptr--];                                \
+		const uint64_t c1 = stack[stack_ptr--];                                \
+		if (evaluate_binary(ByteOp::instr_name, c1, c2)) {                     \
+			JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name##_if));    \
+		} else {                                                               \
+			JUMP(read_immediate<int32_t>(pc));                                 \
+		}                                                                      \
+	}
+
+#define WRAP_OPERATION(instr_name, op_code, text)                              \
+	HANDLER(instr_name##_wrap) {                                               \
+		const uint64_t c2 = stack[stack_ptr--];                                \
+		CHECK_BINARY_TRAP(instr_name, stack[stack_ptr], c2)                    \
+		stack[stack_ptr] = static_cast<uint32_t>(                              \
+			evaluate_binary(ByteOp::instr_name, stack[stack_ptr], c2));        \
+		NEXT();                                                                \
+	}
+
+// a v128 takes two slots, its low half first, so the one on top of the stack
+// starts at stack_ptr - 1. see simd.hxx.
+#define SIMD_UNARY_OPERATION(instr_name, op_code, text)                        \
+	HANDLER(instr_name) {                                                      \
+		simd.instr_name(stack + stack_ptr - 1);                                \
+		NEXT();                                                                \
+	}
+
+#define SIMD_BINARY_OPERATION(instr_name, op_code, text)                       \
+	HANDLER(instr_name) {                                                      \
+		stack_ptr -= 2;                                                        \
+		simd.instr_name(stack + stack_ptr - 1);                                \
+		NEXT();                                                                \
+	}
+
+#define SIMD_SHIFT_OPERATION(instr_name, op_code, text)                        \
+	HANDLER(instr_name) {                                                      \
+		const auto count = static_cast<uint32_t>(stack[stack_ptr--]);          \
+		simd.instr_name(stack + stack_ptr - 1, count);                         \
+		NEXT();                                                                \
+	}
+
+#define SIMD_TEST_OPERATION(instr_name, op_code, text)                         \
+	HANDLER(instr_name) {                                                      \
+		const uint32_t c = simd.instr_name(stack + stack_ptr - 1);             \
+		stack[--stack_ptr] = c;                                                \
+		NEXT();                                                                \
+	}
+
+// lane_type is the type of the lanes, which the scalar is truncated to
+#define SIMD_SPLAT_OPERATION(instr_name, lane_type)                            \
+	HANDLER(instr_name) {                                                      \
+		const auto value = static_cast<lane_type>(stack[stack_ptr++]);         \
+		splat_lanes(stack + stack_ptr - 1, value);                             \
+		NEXT();                                                                \
+	}
+
+#define SIMD_EXTRACT_LANE_OPERATION(instr_name, lane_type, operand_type)       \
+	HANDLER(instr_name) {                                                      \
+		const auto value = extract_lane<lane_type>(                            \
+			stack + stack_ptr - 1, read_immediate<uint8_t>(pc));               \
+		stack[--stack_ptr] = static_cast<operand_type>(value);                 \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
 
-void print_stack(StackEntry *stack, int64_t ptr) {
-	if (ptr < 0) {
+#define SIMD_REPLACE_LANE_OPERATION(instr_name, lane_type)                     \
+	HANDLER(instr_name) {                                                      \
+		const auto value = static_cast<lane_type>(stack[stack_ptr--]);         \
+		replace_lane(stack + stack_ptr - 1, read_immediate<uint8_t>(pc),       \
+					 value);                                                   \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+// declares the address of a SIMD access, like LOAD_OPERATION works it out
+#define SIMD_ADDRESS(address_operand)                                          \
+	const uint64_t address = static_cast<uint32_t>(address_operand) +          \
+							 uint64_t{read_immediate<uint32_t>(pc)};
+
+// loads 8 bytes into the low half of the v128, and widens their lanes with
+// the extend kernel
+#define SIMD_EXTEND_LOAD_OPERATION(instr_name, kernel)                         \
+	HANDLER(instr_name) {                                                      \
+		SIMD_ADDRESS(stack[stack_ptr++])                                       \
+		std::memcpy(stack + stack_ptr - 1, memory + address, 8);               \
+		simd.kernel(stack + stack_ptr - 1);                                    \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+#define SIMD_SPLAT_LOAD_OPERATION(instr_name, memory_type)                     \
+	HANDLER(instr_name) {                                                      \
+		SIMD_ADDRESS(stack[stack_ptr++])                                       \
+		memory_type value;                                                     \
+		std::memcpy(&value, memory + address, sizeof(value));                  \
+		splat_lanes(stack + stack_ptr - 1, value);                             \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+#define SIMD_ZERO_LOAD_OPERATION(instr_name, memory_type)                      \
+	HANDLER(instr_name) {                                                      \
+		SIMD_ADDRESS(stack[stack_ptr])                                         \
+		memory_type value;                                                     \
+		std::memcpy(&value, memory + address, sizeof(value));                  \
+		stack[stack_ptr] = value;                                              \
+		stack[++stack_ptr] = 0;                                                \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+// the address sits below the v128, which moves down into its slot
+#define SIMD_LOAD_LANE_OPERATION(instr_name, memory_type)                      \
+	HANDLER(instr_name) {                                                      \
+		stack_ptr -= 2;                                                        \
+		SIMD_ADDRESS(stack[stack_ptr])                                         \
+		uint64_t *const v = stack + stack_ptr++;                               \
+		v[0] = v[1];                                                           \
+		v[1] = v[2];                                                           \
+		memory_type value;                                                     \
+		std::memcpy(&value, memory + address, sizeof(value));                  \
+		replace_lane(v, read_immediate<uint8_t>(pc, sizeof(uint32_t)), value); \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+#define SIMD_STORE_LANE_OPERATION(instr_name, memory_type)                     \
+	HANDLER(instr_name) {                                                      \
+		const auto value = extract_lane<memory_type>(                          \
+			stack + stack_ptr - 1,                                             \
+			read_immediate<uint8_t>(pc, sizeof(uint32_t)));                    \
+		stack_ptr -= 2;                                                        \
+		SIMD_ADDRESS(stack[stack_ptr--])                                       \
+		std::memcpy(memory + address, &value, sizeof(value));                  \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+// moves a local of the given number of slots onto the stack
+#define LOCAL_GET_OPERATION(instr_name, slot_count)                            \
+	HANDLER(instr_name) {                                                      \
+		const uint64_t *const local = stack + read_immediate<uint32_t>(pc);    \
+		for (size_t i = 0; i < slot_count; ++i) {                              \
+			stack[++stack_ptr] = local[i];                                     \
+		}                                                                      \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+// moves the top-most operand into a local of the given number of slots, and
+// takes it off the stack unless keep is set
+#define LOCAL_SET_OPERATION(instr_name, slot_count, keep)                      \
+	HANDLER(instr_name) {                                                      \
+		uint64_t *const local = stack + read_immediate<uint32_t>(pc);          \
+		for (size_t i = 0; i < slot_count; ++i) {                              \
+			local[i] = stack[stack_ptr + 1 - slot_count + i];                  \
+		}                                                                      \
+		if (!keep) {                                                           \
+			stack_ptr -= slot_count;                                           \
+		}                                                                      \
+		JUMP(sizeof(ByteOp) + immediate_size(ByteOp::instr_name));             \
+	}
+
+// starts the given function, whose arguments are the top-most operands. they
+// become the first locals of its frame, which starts right where they are, so
+// that nothing is copied. return_offset is the size of the call instruction.
+// a callee that has been promoted to an optimized tier runs there instead,
+// unless the call is profiled.
+#define CALL_FUNCTION(callee, return_offset)                                   \
+	{                                                                          \
+		const Function &code = (callee).code;                                  \
+		uint64_t *const frame = stack + stack_ptr + 1 - code.param_slots;      \
+		if constexpr (instrumentation != Instrumentation::Profile) {           \
+			if (tiering && call_optimized_tier((callee), frame, stack_end,     \
+											   config, trap)) {                \
+				if (trap != Trap::None) {                                      \
+					return -1;                                                 \
+				}                                                              \
+				stack_ptr = frame - stack + code.result_slots - 1;             \
+				JUMP(return_offset);                                           \
+			}                                                                  \
+		}                                                                      \
+		if (static_cast<size_t>(stack_end - frame) < frame_size(code)) {       \
+			trap = Trap::StackOverflow;                                        \
+			return -1;                                                         \
+		}                                                                      \
+		if (!context.push_frame({                                              \
+				.func = &(callee),                                             \
+				.stack_base = static_cast<size_t>(frame - slots),              \
+				.return_pc = pc + (return_offset),                             \
+			})) {                                                              \
+			return -1;                                                         \
+		}                                                                      \
+		if constexpr (instrumentation == Instrumentation::Profile) {           \
+			profile->enter(callee);                                            \
+		}                                                                      \
+		func = &(callee);                                                      \
+		stack = frame;                                                         \
+		stack_ptr = static_cast<int64_t>(code.param_slots) - 1;                \
+		for (uint32_t i = 0; i < code.local_slots; ++i) {                      \
+			stack[++stack_ptr] = 0;                                            \
+		}                                                                      \
+		pc = code.body;                                                        \
+		DISPATCH();                                                            \
+	}
+
+// returns from the running function, whose results are the top-most operands.
+// they are moved to the start of its frame, where the caller finds them in
+// place of the arguments it passed.
+#define RETURN()                                                               \
+	{                                                                          \
+		const uint32_t result_slots = func->code.result_slots;                 \
+		const uint64_t *const results = stack + stack_ptr + 1 - result_slots;  \
+		for (uint32_t i = 0; i < result_slots; ++i) {                          \
+			stack[i] = results[i];                                             \
+		}                                                                      \
+		if (context.call_depth() == entry_depth) {                             \
+			return static_cast<int64_t>(result_slots) - 1;                     \
+		}                                                                      \
+		if constexpr (instrumentation == Instrumentation::Profile) {           \
+			profile->exit();                                                   \
+		}                                                                      \
+		const Frame *const frames =                                            \
+			context.active_frames().data() + context.call_depth() - 2;         \
+		const Frame &caller = frames[0];                                       \
+		pc = frames[1].return_pc;                                              \
+		func = caller.func;                                                    \
+		stack = slots + caller.stack_base;                                     \
+		const size_t results_base = frames[1].stack_base - caller.stack_base;  \
+		stack_ptr = static_cast<int64_t>(results_base + result_slots) - 1;     \
+		context.pop_frame();                                                   \
+		DISPATCH();                                                            \
+	}
+
+// takes a branch that moves pc by offset. the values it takes along, the
+// top-most arity slots, are moved down over the drop slots below them. a
+// branch backwards starts a loop over, which counts towards tiering up.
+#define BRANCH(offset, arity, drop)                                            \
+	{                                                                          \
+		const int32_t branch_offset = (offset);                                \
+		const uint32_t branch_drop = (drop);                                   \
+		if (branch_drop != 0) {                                                \
+			const uint32_t branch_arity = (arity);                             \
+			uint64_t *const values = stack + stack_ptr + 1 - branch_arity;     \
+			for (uint32_t i = 0; i < branch_arity; ++i) {                      \
+				*(values - branch_drop + i) = values[i];                       \
+			}                                                                  \
+			stack_ptr -= branch_drop;                                          \
+		}                                                                      \
+		if (branch_offset < 0) {                                               \
+			std::atomic_ref back_edges(func->back_edge_count);                 \
+			back_edges.store(back_edges.load(std::memory_order_relaxed) + 1,   \
+							 std::memory_order_relaxed);                       \
+		}                                                                      \
+		JUMP(branch_offset);                                                   \
+	}
+
+void Treble::print_results(std::span<const uint64_t> results) {
+	if (results.empty()) {
 		std::cout << "stack is empty!" << std::endl;
 		return;
 	}
 
-	const StackEntry &entry = stack[ptr];
-	switch (entry.type) {
-	case StackEntry::Type::I32Value:
-		std::cout << "top of stack:" << std::endl;
-		std::cout << "    type: Value" << std::endl;
-		std::cout << "    operand: " << entry.value.i32_operand << std::endl;
-		break;
-	default:
-		break;
-	}
+	std::cout << "top of stack:" << std::endl;
+	std::cout << "    type: Value" << std::endl;
+	std::cout << "    operand: " << results.back() << std::endl;
 }
 
-void Treble::execute_module_instance(ModuleInstance &instance) {
-	if (instance.module->start == nullptr) {
-		return;
+/**
+ * Records the results of a call that has completed.
+ */
+static void trace_return(const uint64_t *results, size_t result_count) {
+	TREBLE_TRACE_CALL("return", result_count,
+					  result_count > 0 ? results[result_count - 1] : 0);
+}
+
+/**
+ * What the stack interpreter does besides running the function.
+ */
+enum class Instrumentation {
+	None,
+	// count every instruction, see profiler.hxx
+	Profile,
+	// keep the sampler up to date with the instruction about to run, see
+	// sampler.hxx
+	Sample,
+};
+
+/**
+ * Number of slots a frame of the function takes at most.
+ */
+static size_t frame_size(const Treble::Function &code) {
+	return size_t{code.param_slots} + code.local_slots + code.max_stack_height;
+}
+
+/**
+ * Records a call of the given function made by the stack interpreter, and
+ * runs it on the optimized tier it has been promoted to, if any. Its frame
+ * starts at frame and may take the slots up to stack_end; its results are left
+ * at the start of it. Returns false if the function has to run on the stack
+ * interpreter. A trap that cuts the optimized code short is left in trap.
+ */
+static bool call_optimized_tier(Treble::FunctionInstance &func,
+								uint64_t *frame, const uint64_t *stack_end,
+								const Treble::RuntimeConfig &config,
+								Treble::Trap &trap) {
+	using namespace Treble;
+
+	// functions that have been promoted need no counting anymore, and the
+	// others only run optimized if counting this call promoted them
+	std::atomic_ref tier(func.tier);
+	if (tier.load(std::memory_order_acquire) != Tier::Optimized) {
+		record_call(func, config);
+		if (tier.load(std::memory_order_acquire) != Tier::Optimized) {
+			return false;
+		}
 	}
 
-	// the main function for the wasm module
-	const Function &start_func =
-		instance.module->funcs[instance.module->start->func_index];
+	const size_t slot_count = stack_end - frame;
+
+	const JitFunction *jit_code =
+		std::atomic_ref(func.jit_code).load(std::memory_order_acquire);
+	if (config.use_jit && jit_code != nullptr &&
+		jit_code->max_stack_height <= slot_count) {
+		trap = jit_code->entry(frame);
+		return true;
+	}
+
+	const RegisterFunction *register_code =
+		std::atomic_ref(func.register_code).load(std::memory_order_acquire);
+	if (config.use_register_ir && register_code != nullptr &&
+		register_code->register_count <= slot_count) {
+		trap = execute_register_function(*register_code, frame);
+		const uint64_t *results = frame + register_code->constant_count;
+		std::copy_n(results, register_code->result_count, frame);
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Whether a function of one type can be called where the other is expected.
+ */
+static bool same_signature(const Treble::FunctionType &a,
+						   const Treble::FunctionType &b) {
+	return a.param_count == b.param_count &&
+		   a.result_count == b.result_count &&
+		   std::equal(a.param_types, a.param_types + a.param_count,
+					  b.param_types) &&
+		   std::equal(a.result_types, a.result_types + a.result_count,
+					  b.result_types);
+}
+
+/**
+ * Runs the validated function of the innermost frame of the context on the
+ * stack interpreter, along with every function it calls. The frames of the
+ * context index into slots, of which there are slot_count, and the frame of
+ * the function has to hold its arguments already. Returns the index of the
+ * top-most slot in use, counted from the start of the frame, once the
+ * function is done; its results are then at the start of the frame.
+ *
+ * Calls run on the same slots: the frame of the callee starts at the
+ * arguments the caller pushed, so that they become its first locals in place.
+ * Only the frames of the context record where each call returns to. Calls
+ * count towards tiering up the callee, and run on its optimized tier once it
+ * has one, as config says.
+ *
+ * Loads and stores are not bounds checked. Unless the function has no memory
+ * accesses, it has to run inside run_with_memory_traps. Any other trap is
+ * left in the context, and cuts the function short, leaving the frames of
+ * the calls it was in.
+ *
+ * The instrumentation is chosen at compile time, so that none of it is
+ * compiled into the plain interpreter.
+ */
+template <Instrumentation instrumentation>
+int64_t run_stack_interpreter(Treble::ExecutionContext &context,
+							  uint64_t *slots, size_t slot_count,
+							  const Treble::RuntimeConfig &config) {
+	using namespace Treble;
 
-	// the program stack
-	StackEntry stack[65536];
+	[[maybe_unused]] ThreadProfile *const profile =
+		instrumentation == Instrumentation::Profile ? &thread_profile()
+													: nullptr;
 
-	// points to the top-most entry in the current execution stack.
-	int64_t stack_ptr = -1;
+	Trap &trap = context.trap;
+	// calls return to the host once they are back at this depth
+	const size_t entry_depth = context.call_depth();
+	// no frame may reach past the end of the slots
+	const uint64_t *const stack_end = slots + slot_count;
+	// whether calls count towards promoting the callee to an optimized tier
+	const bool tiering = config.use_jit || config.use_register_ir;
+
+	// the function that is running
+	FunctionInstance *func = context.active_frames().back().func;
+	// the start of its frame: its parameters, then its locals, then its
+	// operands
+	uint64_t *stack = slots + context.active_frames().back().stack_base;
+	// points to the top-most entry in the current execution stack, relative
+	// to the frame. the locals are zeroed, like each call does for its own.
+	int64_t stack_ptr = static_cast<int64_t>(func->code.param_slots) - 1;
+	for (uint32_t i = 0; i < func->code.local_slots; ++i) {
+		stack[++stack_ptr] = 0;
+	}
 	// points to the current instruction being executed.
-	size_t header = 0;
-	// keep track of block nesting levels
-	uint block_level = 0;
-	// whether the execution is finished.
-	bool is_finished = false;
+	const uint8_t *pc = func->code.body;
+	// every function a call reaches belongs to the same instance, as treble
+	// has no imports
+	ModuleInstance &instance = *func->module;
+	// the memory of the module instance, if it has one. growing it never
+	// moves it, so its address can be kept around.
+	LinearMemory *memory_instance = instance.memory.get();
+	uint8_t *memory =
+		memory_instance != nullptr ? memory_instance->data() : nullptr;
+	// the kernels of the SIMD instructions that work on every lane
+	const SimdKernels &simd = simd_kernels();
+
+#ifdef TREBLE_SWITCH_DISPATCH
+	while (true) {
+		TRACE_INSTRUCTION();
+		INSTRUMENT_INSTRUCTION();
+		switch (read_byte_op(pc)) {
+#else
+	// in the order of ByteOp
+	static const void *const dispatch_table[] = {
+#define DISPATCH_TABLE_ENTRY(name, op_code, text) &&op_##name,
+		TREBLE_FOREACH_OPCODE(DISPATCH_TABLE_ENTRY)
+#undef DISPATCH_TABLE_ENTRY
+
+#define IMM_DISPATCH_TABLE_ENTRY(name, op_code, text) &&op_##name##_imm,
+		TREBLE_FOREACH_BINARY_OPCODE(IMM_DISPATCH_TABLE_ENTRY)
+#undef IMM_DISPATCH_TABLE_ENTRY
+
+#define IF_DISPATCH_TABLE_ENTRY(name, op_code, text) &&op_##name##_if,
+		TREBLE_FOREACH_TEST_OPCODE(IF_DISPATCH_TABLE_ENTRY)
+		TREBLE_FOREACH_COMPARE_OPCODE(IF_DISPATCH_TABLE_ENTRY)
+#undef IF_DISPATCH_TABLE_ENTRY
+
+#define WRAP_DISPATCH_TABLE_ENTRY(name, op_code, text) &&op_##name##_wrap,
+		TREBLE_FOREACH_I64_ARITHMETIC_OPCODE(WRAP_DISPATCH_TABLE_ENTRY)
+#undef WRAP_DISPATCH_TABLE_ENTRY
+
+		&&op_drop_v128,
+		&&op_local_get_v128,
+		&&op_local_set_v128,
+		&&op_local_tee_v128,
+		&&op_end_function,
+		&&op_unknown,
+	};
+
+	DISPATCH();
+	{
+		{
+#endif
+		CONST_OPERATION(i32_const, uint32_t)
+		CONST_OPERATION(i64_const, uint64_t)
+
+		TREBLE_FOREACH_UNARY_OPCODE(UNARY_OPERATION)
+		TREBLE_FOREACH_BINARY_OPCODE(BINARY_OPERATION)
+
+		TREBLE_FOREACH_BINARY_OPCODE(BINARY_IMM_OPERATION)
+		TREBLE_FOREACH_TEST_OPCODE(TEST_IF_OPERATION)
+		TREBLE_FOREACH_COMPARE_OPCODE(COMPARE_IF_OPERATION)
+		TREBLE_FOREACH_I64_ARITHMETIC_OPCODE(WRAP_OPERATION)
+
+		HANDLER(f32_const) {
+			// the bits of the float, like the immediate holds them
+			stack[++stack_ptr] = read_immediate<uint32_t>(pc);
+
+			JUMP(sizeof(ByteOp) + immediate_size(ByteOp::f32_const));
+		}
 
-	while (!is_finished) {
-		Instruction &instruction = start_func.body[header];
+		LOAD_OPERATION(i32_load, uint32_t, uint32_t)
+		LOAD_OPERATION(i64_load, uint64_t, uint64_t)
+		LOAD_OPERATION(i32_load8_s, int8_t, uint32_t)
+		LOAD_OPERATION(i32_load8_u, uint8_t, uint32_t)
+		LOAD_OPERATION(i32_load16_s, int16_t, uint32_t)
+		LOAD_OPERATION(i32_load16_u, uint16_t, uint32_t)
+		LOAD_OPERATION(i64_load8_s, int8_t, uint64_t)
+		LOAD_OPERATION(i64_load8_u, uint8_t, uint64_t)
+		LOAD_OPERATION(i64_load16_s, int16_t, uint64_t)
+		LOAD_OPERATION(i64_load16_u, uint16_t, uint64_t)
+		LOAD_OPERATION(i64_load32_s, int32_t, uint64_t)
+		LOAD_OPERATION(i64_load32_u, uint32_t, uint64_t)
 
-		switch (instruction.op_code) {
-			INTEGER_INSTRUCTIONS(i32, 32, int32_t, I32Value);
-			INTEGER_INSTRUCTIONS(i64, 64, int64_t, I64Value);
+		STORE_OPERATION(i32_store, uint32_t)
+		STORE_OPERATION(i64_store, uint64_t)
+		STORE_OPERATION(i32_store8, uint8_t)
+		STORE_OPERATION(i32_store16, uint16_t)
+		STORE_OPERATION(i64_store8, uint8_t)
+		STORE_OPERATION(i64_store16, uint16_t)
+		STORE_OPERATION(i64_store32, uint32_t)
 
-		case Instruction::OpCode::f32_const: {
-			std::cout << "f32.const" << std::endl;
-			StackEntry &entry = stack[++stack_ptr];
-			entry.type = StackEntry::Type::F32Value;
-			entry.value.f32_operand = instruction.args.f32;
+		HANDLER(memory_size) {
+			stack[++stack_ptr] = memory_instance->page_count();
+			NEXT();
+		}
 
-			header++;
-			break;
+		HANDLER(memory_grow) {
+			const int32_t old_pages =
+				memory_instance->grow(static_cast<uint32_t>(stack[stack_ptr]));
+			stack[stack_ptr] = static_cast<uint32_t>(old_pages);
+			NEXT();
 		}
 
-		case Instruction::OpCode::i32_wrap_i64: {
-			StackEntry &entry_c = stack[stack_ptr];
-			entry_c.type = StackEntry::Type::I32Value;
-			entry_c.value.i32_operand = entry_c.value.i64_operand % 4294967296;
-			header++;
-			break;
+		ATOMIC_LOAD_OPERATION(i32_atomic_load, uint32_t, uint32_t)
+		ATOMIC_LOAD_OPERATION(i64_atomic_load, uint64_t, uint64_t)
+		ATOMIC_LOAD_OPERATION(i32_atomic_load8_u, uint8_t, uint32_t)
+		ATOMIC_LOAD_OPERATION(i32_atomic_load16_u, uint16_t, uint32_t)
+		ATOMIC_LOAD_OPERATION(i64_atomic_load8_u, uint8_t, uint64_t)
+		ATOMIC_LOAD_OPERATION(i64_atomic_load16_u, uint16_t, uint64_t)
+		ATOMIC_LOAD_OPERATION(i64_atomic_load32_u, uint32_t, uint64_t)
+
+		ATOMIC_STORE_OPERATION(i32_atomic_store, uint32_t)
+		ATOMIC_STORE_OPERATION(i64_atomic_store, uint64_t)
+		ATOMIC_STORE_OPERATION(i32_atomic_store8, uint8_t)
+		ATOMIC_STORE_OPERATION(i32_atomic_store16, uint16_t)
+		ATOMIC_STORE_OPERATION(i64_atomic_store8, uint8_t)
+		ATOMIC_STORE_OPERATION(i64_atomic_store16, uint16_t)
+		ATOMIC_STORE_OPERATION(i64_atomic_store32, uint32_t)
+
+		ATOMIC_RMW_OPERATIONS(add, fetch_add)
+		ATOMIC_RMW_OPERATIONS(sub, fetch_sub)
+		ATOMIC_RMW_OPERATIONS(and, fetch_and)
+		ATOMIC_RMW_OPERATIONS(or, fetch_or)
+		ATOMIC_RMW_OPERATIONS(xor, fetch_xor)
+		ATOMIC_RMW_OPERATIONS(xchg, exchange)
+
+		ATOMIC_CMPXCHG_OPERATION(i32_atomic_rmw_cmpxchg, uint32_t, uint32_t)
+		ATOMIC_CMPXCHG_OPERATION(i64_atomic_rmw_cmpxchg, uint64_t, uint64_t)
+		ATOMIC_CMPXCHG_OPERATION(i32_atomic_rmw8_cmpxchg_u, uint8_t, uint32_t)
+		ATOMIC_CMPXCHG_OPERATION(i32_atomic_rmw16_cmpxchg_u, uint16_t, uint32_t)
+		ATOMIC_CMPXCHG_OPERATION(i64_atomic_rmw8_cmpxchg_u, uint8_t, uint64_t)
+		ATOMIC_CMPXCHG_OPERATION(i64_atomic_rmw16_cmpxchg_u, uint16_t, uint64_t)
+		ATOMIC_CMPXCHG_OPERATION(i64_atomic_rmw32_cmpxchg_u, uint32_t, uint64_t)
+
+		ATOMIC_WAIT_OPERATION(memory_atomic_wait32, uint32_t)
+		ATOMIC_WAIT_OPERATION(memory_atomic_wait64, uint64_t)
+
+		HANDLER(memory_atomic_notify) {
+			const auto count = static_cast<uint32_t>(stack[stack_ptr--]);
+			ATOMIC_ADDRESS(uint32_t, stack[stack_ptr])
+			if (address + sizeof(uint32_t) > memory_instance->size()) {
+				trap = Trap::OutOfBoundsMemoryAccess;
+				return -1;
+			}
+			stack[stack_ptr] = notify_waiters(memory + address, count);
+			JUMP(sizeof(ByteOp) + immediate_size(ByteOp::memory_atomic_notify));
 		}
 
-		case Instruction::OpCode::drop: {
-			std::cout << "i32.drop" << std::endl;
+		HANDLER(atomic_fence) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			NEXT();
+		}
+
+		HANDLER(drop) {
 			stack_ptr--;
-			header++;
-			break;
+			NEXT();
 		}
 
-		case Instruction::OpCode::if_: {
-			std::cout << "if" << std::endl;
-			StackEntry &c = stack[stack_ptr--];
-			if (c.value.i32_operand) {
-				header += instruction.args.if_branch.instr_1_offset;
-			} else {
-				header += instruction.args.if_branch.instr_2_offset;
+		HANDLER(drop_v128) {
+			stack_ptr -= 2;
+			NEXT();
+		}
+
+		LOCAL_GET_OPERATION(local_get, 1)
+		LOCAL_SET_OPERATION(local_set, 1, false)
+		LOCAL_SET_OPERATION(local_tee, 1, true)
+		LOCAL_GET_OPERATION(local_get_v128, 2)
+		LOCAL_SET_OPERATION(local_set_v128, 2, false)
+		LOCAL_SET_OPERATION(local_tee_v128, 2, true)
+
+		HANDLER(call) {
+			CALL_FUNCTION(instance.store.funcs[read_immediate<uint32_t>(pc)],
+						  sizeof(ByteOp) + immediate_size(ByteOp::call));
+		}
+
+		HANDLER(call_indirect) {
+			const auto element = static_cast<uint32_t>(stack[stack_ptr--]);
+			if (element >= instance.table_size) {
+				trap = Trap::UndefinedElement;
+				return -1;
+			}
+			FunctionInstance *const callee = instance.table[element];
+			if (callee == nullptr) {
+				trap = Trap::UninitializedElement;
+				return -1;
+			}
+
+			// a callee of the type that passed last time at this call site
+			// passes without comparing signatures
+			const uint32_t type_index = read_immediate<uint32_t>(pc);
+			const uint32_t site =
+				read_immediate<uint32_t>(pc, sizeof(uint32_t));
+			std::atomic_ref cached_type(func->signature_cache[site]);
+			if (callee->code.type_index !=
+				cached_type.load(std::memory_order_relaxed)) {
+				if (!same_signature(instance.types[type_index],
+									callee->type)) {
+					trap = Trap::IndirectCallTypeMismatch;
+					return -1;
+				}
+				cached_type.store(callee->code.type_index,
+								  std::memory_order_relaxed);
+			}
+
+			CALL_FUNCTION(*callee,
+						  sizeof(ByteOp) +
+							  immediate_size(ByteOp::call_indirect));
+		}
+
+		HANDLER(return_) {
+			RETURN();
+		}
+
+		TREBLE_FOREACH_SIMD_UNARY_OPCODE(SIMD_UNARY_OPERATION)
+		TREBLE_FOREACH_SIMD_BINARY_OPCODE(SIMD_BINARY_OPERATION)
+		TREBLE_FOREACH_SIMD_SHIFT_OPCODE(SIMD_SHIFT_OPERATION)
+		TREBLE_FOREACH_SIMD_TEST_OPCODE(SIMD_TEST_OPERATION)
+
+		SIMD_SPLAT_OPERATION(i8x16_splat, uint8_t)
+		SIMD_SPLAT_OPERATION(i16x8_splat, uint16_t)
+		SIMD_SPLAT_OPERATION(i32x4_splat, uint32_t)
+		SIMD_SPLAT_OPERATION(i64x2_splat, uint64_t)
+		SIMD_SPLAT_OPERATION(f32x4_splat, uint32_t)
+		SIMD_SPLAT_OPERATION(f64x2_splat, uint64_t)
+
+		SIMD_EXTRACT_LANE_OPERATION(i8x16_extract_lane_s, int8_t, uint32_t)
+		SIMD_EXTRACT_LANE_OPERATION(i8x16_extract_lane_u, uint8_t, uint32_t)
+		SIMD_EXTRACT_LANE_OPERATION(i16x8_extract_lane_s, int16_t, uint32_t)
+		SIMD_EXTRACT_LANE_OPERATION(i16x8_extract_lane_u, uint16_t, uint32_t)
+		SIMD_EXTRACT_LANE_OPERATION(i32x4_extract_lane, uint32_t, uint32_t)
+		SIMD_EXTRACT_LANE_OPERATION(i64x2_extract_lane, uint64_t, uint64_t)
+		SIMD_EXTRACT_LANE_OPERATION(f32x4_extract_lane, uint32_t, uint32_t)
+		SIMD_EXTRACT_LANE_OPERATION(f64x2_extract_lane, uint64_t, uint64_t)
+
+		SIMD_REPLACE_LANE_OPERATION(i8x16_replace_lane, uint8_t)
+		SIMD_REPLACE_LANE_OPERATION(i16x8_replace_lane, uint16_t)
+		SIMD_REPLACE_LANE_OPERATION(i32x4_replace_lane, uint32_t)
+		SIMD_REPLACE_LANE_OPERATION(i64x2_replace_lane, uint64_t)
+		SIMD_REPLACE_LANE_OPERATION(f32x4_replace_lane, uint32_t)
+		SIMD_REPLACE_LANE_OPERATION(f64x2_replace_lane, uint64_t)
+
+		HANDLER(v128_load) {
+			SIMD_ADDRESS(stack[stack_ptr++])
+			std::memcpy(stack + stack_ptr - 1, memory + address,
+						2 * sizeof(uint64_t));
+			JUMP(sizeof(ByteOp) + immediate_size(ByteOp::v128_load));
+		}
+
+		SIMD_EXTEND_LOAD_OPERATION(v128_load8x8_s, i16x8_extend_low_i8x16_s)
+		SIMD_EXTEND_LOAD_OPERATION(v128_load8x8_u, i16x8_extend_low_i8x16_u)
+		SIMD_EXTEND_LOAD_OPERATION(v128_load16x4_s, i32x4_extend_low_i16x8_s)
+		SIMD_EXTEND_LOAD_OPERATION(v128_load16x4_u, i32x4_extend_low_i16x8_u)
+		SIMD_EXTEND_LOAD_OPERATION(v128_load32x2_s, i64x2_extend_low_i32x4_s)
+		SIMD_EXTEND_LOAD_OPERATION(v128_load32x2_u, i64x2_extend_low_i32x4_u)
+
+		SIMD_SPLAT_LOAD_OPERATION(v128_load8_splat, uint8_t)
+		SIMD_SPLAT_LOAD_OPERATION(v128_load16_splat, uint16_t)
+		SIMD_SPLAT_LOAD_OPERATION(v128_load32_splat, uint32_t)
+		SIMD_SPLAT_LOAD_OPERATION(v128_load64_splat, uint64_t)
+
+		SIMD_ZERO_LOAD_OPERATION(v128_load32_zero, uint32_t)
+		SIMD_ZERO_LOAD_OPERATION(v128_load64_zero, uint64_t)
+
+		SIMD_LOAD_LANE_OPERATION(v128_load8_lane, uint8_t)
+		SIMD_LOAD_LANE_OPERATION(v128_load16_lane, uint16_t)
+		SIMD_LOAD_LANE_OPERATION(v128_load32_lane, uint32_t)
+		SIMD_LOAD_LANE_OPERATION(v128_load64_lane, uint64_t)
+
+		HANDLER(v128_store) {
+			SIMD_ADDRESS(stack[stack_ptr - 2])
+			std::memcpy(memory + address, stack + stack_ptr - 1,
+						2 * sizeof(uint64_t));
+			stack_ptr -= 3;
+			JUMP(sizeof(ByteOp) + immediate_size(ByteOp::v128_store));
+		}
+
+		SIMD_STORE_LANE_OPERATION(v128_store8_lane, uint8_t)
+		SIMD_STORE_LANE_OPERATION(v128_store16_lane, uint16_t)
+		SIMD_STORE_LANE_OPERATION(v128_store32_lane, uint32_t)
+		SIMD_STORE_LANE_OPERATION(v128_store64_lane, uint64_t)
+
+		HANDLER(v128_const) {
+			std::memcpy(stack + stack_ptr + 1, pc + sizeof(ByteOp),
+						2 * sizeof(uint64_t));
+			stack_ptr += 2;
+			JUMP(sizeof(ByteOp) + immediate_size(ByteOp::v128_const));
+		}
+
+		HANDLER(i8x16_shuffle) {
+			stack_ptr -= 2;
+			simd.i8x16_shuffle(stack + stack_ptr - 1, pc + sizeof(ByteOp));
+			JUMP(sizeof(ByteOp) + immediate_size(ByteOp::i8x16_shuffle));
+		}
+
+		HANDLER(v128_bitselect) {
+			// the bits of the first operand where the mask has ones, and of
+			// the second one elsewhere
+			stack_ptr -= 4;
+			uint64_t *const v = stack + stack_ptr - 1;
+			v[0] = (v[0] & v[4]) | (v[2] & ~v[4]);
+			v[1] = (v[1] & v[5]) | (v[3] & ~v[5]);
+			NEXT();
+		}
+
+		HANDLER(block) {
+			JUMP(sizeof(ByteOp) + immediate_size(ByteOp::block));
+		}
+
+		HANDLER(loop) {
+			JUMP(sizeof(ByteOp) + immediate_size(ByteOp::loop));
+		}
+
+		HANDLER(br) {
+			BRANCH(read_immediate<int32_t>(pc), read_immediate<uint32_t>(pc, 4),
+				   read_immediate<uint32_t>(pc, 8));
+		}
+
+		HANDLER(br_if) {
+			const uint32_t c = stack[stack_ptr--];
+			if (!c) {
+				JUMP(sizeof(ByteOp) + immediate_size(ByteOp::br_if));
 			}
-			block_level++;
-			break;
+			BRANCH(read_immediate<int32_t>(pc), read_immediate<uint32_t>(pc, 4),
+				   read_immediate<uint32_t>(pc, 8));
 		}
 
-		case Instruction::OpCode::else_: {
-			header += instruction.args.else_branch.end_marker_offset;
-			break;
+		HANDLER(br_table) {
+			// an index past the labels takes the default one, which comes
+			// last in the jump table
+			const uint32_t label = std::min(
+				static_cast<uint32_t>(stack[stack_ptr--]),
+				read_immediate<uint32_t>(pc));
+			const uint8_t *const entry = pc + read_immediate<uint32_t>(pc, 8) +
+										 label * JUMP_TABLE_ENTRY_SIZE;
+			int32_t offset;
+			uint32_t drop;
+			std::memcpy(&offset, entry, sizeof(offset));
+			std::memcpy(&drop, entry + sizeof(offset), sizeof(drop));
+			BRANCH(offset, read_immediate<uint32_t>(pc, 4), drop);
 		}
 
-		case Instruction::OpCode::end:
-			// end marker encountered
-			// if inside a block, exit the block
-			// otherwise (when block_level is 0) we are done
-			if (block_level == 0) {
-				is_finished = true;
+		HANDLER(if_) {
+			const uint32_t c = stack[stack_ptr--];
+			if (c) {
+				JUMP(sizeof(ByteOp) + immediate_size(ByteOp::if_));
 			} else {
-				block_level--;
+				JUMP(read_immediate<int32_t>(pc));
 			}
+		}
 
-			header++;
-			break;
+		HANDLER(else_) {
+			JUMP(read_immediate<int32_t>(pc));
+		}
+
+		HANDLER(end) {
+			// the end of an if or else arm, which falls through
+			NEXT();
+		}
 
-		default:
-			std::cout << "unknown op code: "
-					  << +static_cast<uint8_t>(instruction.op_code)
+		HANDLER(end_function) {
+			RETURN();
+		}
+
+		UNKNOWN_HANDLER {
+			// validation rejects functions with op codes that treble does not
+			// know, so this is never reached
+			return stack_ptr;
+		}
+		}
+	}
+}
+
+/**
+ * Runs the function of the innermost frame on the stack interpreter as well,
+ * on the given slots, and reports every result that differs from what its
+ * native code produced, and a trap that only one of them raised. jit_trap is
+ * what the native code returned; the trap of the interpreter is left in the
+ * context.
+ */
+bool verify_jit_results(Treble::ExecutionContext &context,
+						const Treble::JitFunction &jit, Treble::Trap jit_trap,
+						const uint64_t *results, uint64_t *stack,
+						size_t slot_count,
+						const Treble::RuntimeConfig &config) {
+	using namespace Treble;
+
+	const size_t result_count =
+		run_stack_interpreter<Instrumentation::None>(context, stack,
+													 slot_count, config) +
+		1;
+
+	if (context.trap != jit_trap) {
+		std::cerr << "jit mismatch: the interpreter ended with "
+				  << trap_message(context.trap) << ", native code with "
+				  << trap_message(jit_trap) << std::endl;
+		return false;
+	}
+	// a trap leaves no results to compare
+	if (jit_trap != Trap::None) {
+		return true;
+	}
+
+	if (result_count != jit.result_count) {
+		std::cerr << "jit mismatch: interpreter left " << result_count
+				  << " results, native code left " << jit.result_count
+				  << std::endl;
+		return false;
+	}
+
+	bool matches = true;
+	for (size_t i = 0; i < result_count; ++i) {
+		const uint64_t expected = stack[i];
+		if (results[i] != expected) {
+			std::cerr << "jit mismatch: result " << i << " is " << results[i]
+					  << " but the interpreter computed " << expected
 					  << std::endl;
+			matches = false;
+		}
+	}
 
-			header++;
-			break;
+	return matches;
+}
+
+const char *Treble::trap_message(Trap trap) {
+	switch (trap) {
+	case Trap::StackOverflow:
+		return "out of stack slots";
+	case Trap::OutOfBoundsMemoryAccess:
+		return "out of bounds memory access";
+	case Trap::CallStackExhausted:
+		return "call stack exhausted";
+	case Trap::UnalignedAtomic:
+		return "unaligned atomic";
+	case Trap::WaitOnUnsharedMemory:
+		return "expected shared memory";
+	case Trap::UndefinedElement:
+		return "undefined element";
+	case Trap::UninitializedElement:
+		return "uninitialized element";
+	case Trap::IndirectCallTypeMismatch:
+		return "indirect call type mismatch";
+	case Trap::IntegerDivideByZero:
+		return "integer divide by zero";
+	case Trap::IntegerOverflow:
+		return "integer overflow";
+	default:
+		return "no trap";
+	}
+}
+
+std::optional<std::span<const uint64_t>>
+Treble::invoke(ExecutionContext &context, FunctionInstance &func,
+			   std::span<const uint64_t> args, const RuntimeConfig &config) {
+	context.reset();
+	const SampledCall sampled(context);
+	if (!context.push_frame(
+			{.func = &func, .stack_base = 0, .return_pc = nullptr})) {
+		return std::nullopt;
+	}
+
+	TREBLE_TRACE_CALL("call", 0, 0);
+
+	// profiled calls neither count towards tiering up, nor run on a tier that
+	// could not count their instructions
+	if (!config.profile) {
+		record_call(func, config);
+	}
+
+	// run the optimized tier if the function has been promoted to one
+	const JitFunction *jit_code =
+		std::atomic_ref(func.jit_code).load(std::memory_order_acquire);
+	if (!config.profile && config.use_jit && jit_code != nullptr) {
+		// when verifying, the stack interpreter gets the slots past those of
+		// the native code. only functions without calls or locals are
+		// compiled, so it never needs more than a frame.
+		const size_t interpreter_slots =
+			config.verify_jit ? frame_size(func.code) : 0;
+		uint64_t *stack =
+			context.slots(jit_code->max_stack_height + interpreter_slots);
+		if (stack == nullptr) {
+			return std::nullopt;
+		}
+
+		const Trap trap = jit_code->entry(stack);
+		if (config.verify_jit) {
+			verify_jit_results(context, *jit_code, trap, stack,
+							   stack + jit_code->max_stack_height,
+							   interpreter_slots, config);
+		}
+		context.trap = trap;
+		if (trap != Trap::None) {
+			return std::nullopt;
 		}
+		trace_return(stack, jit_code->result_count);
 
-		print_stack(stack, stack_ptr);
+		context.pop_frame();
+		return std::span<const uint64_t>(stack, jit_code->result_count);
+	}
+
+	const RegisterFunction *register_code =
+		std::atomic_ref(func.register_code).load(std::memory_order_acquire);
+	if (!config.profile && config.use_register_ir &&
+		register_code != nullptr) {
+		uint64_t *registers = context.slots(register_code->register_count);
+		if (registers == nullptr) {
+			return std::nullopt;
+		}
+
+		context.trap = execute_register_function(*register_code, registers);
+		if (context.trap != Trap::None) {
+			return std::nullopt;
+		}
+		const uint64_t *results = registers + register_code->constant_count;
+		trace_return(results, register_code->result_count);
+
+		context.pop_frame();
+		return std::span<const uint64_t>(results, register_code->result_count);
+	}
+
+	// the calls the function makes get their frames on the same slots, so
+	// it gets all of them. validation guarantees that no function ever needs
+	// more than its frame, so each call only checks that the next one fits.
+	uint64_t *stack = context.slots(context.stack_size());
+	if (stack == nullptr) {
+		return std::nullopt;
+	}
+	if (frame_size(func.code) > context.stack_size()) {
+		context.trap = Trap::StackOverflow;
+		return std::nullopt;
+	}
+	// the arguments are the first locals of the frame; any that are missing
+	// are zero
+	const size_t arg_count =
+		std::min<size_t>(args.size(), func.code.param_slots);
+	std::copy_n(args.begin(), arg_count, stack);
+	std::fill(stack + arg_count, stack + func.code.param_slots, 0);
+
+	const LinearMemory *memory = func.module->memory.get();
+	size_t result_count = 0;
+	// the instrumented interpreters only ever run while profiling or sampling
+	int64_t (*interpreter)(ExecutionContext &, uint64_t *, size_t,
+						   const RuntimeConfig &) =
+		run_stack_interpreter<Instrumentation::None>;
+	if (config.profile) {
+		interpreter = run_stack_interpreter<Instrumentation::Profile>;
+		thread_profile().enter(func);
+	} else if (sampling_active()) {
+		interpreter = run_stack_interpreter<Instrumentation::Sample>;
+	}
+
+	const bool completed = run_with_memory_traps(memory, [&] {
+		result_count =
+			interpreter(context, stack, context.stack_size(), config) + 1;
+	});
+	if (config.profile) {
+		// a call that trapped leaves the frames of the calls it was in
+		for (size_t i = 0; i < context.call_depth(); ++i) {
+			thread_profile().exit();
+		}
+	}
+	if (!completed) {
+		context.trap = Trap::OutOfBoundsMemoryAccess;
+	}
+	if (context.trap != Trap::None) {
+		return std::nullopt;
+	}
+	trace_return(stack, result_count);
+
+	context.pop_frame();
+	return std::span<const uint64_t>(stack, result_count);
+}
+
+void Treble::execute_module_instance(ModuleInstance &instance,
+									 const RuntimeConfig &config) {
+	execute_module_instance(instance, thread_execution_context(), config);
+}
+
+void Treble::execute_module_instance(ModuleInstance &instance,
+									 ExecutionContext &context,
+									 const RuntimeConfig &config) {
+	if (instance.module->start == nullptr) {
+		return;
+	}
+
+	// the main function for the wasm module
+	FunctionInstance &start_func_instance =
+		instance.store.funcs[instance.module->start->func_index];
+
+	const std::optional<std::span<const uint64_t>> results =
+		invoke(context, start_func_instance, {}, config);
+
+#if TREBLE_TRACE_LEVEL > TREBLE_TRACE_OFF
+	thread_trace_ring().dump(std::cout);
+#endif
+
+	if (!results) {
+		std::cerr << "trap: " << trap_message(context.trap) << std::endl;
+		return;
 	}
+	print_results(*results);
 }
@@ -1,12 +1,91 @@
 #ifndef __TREBLE__RUNTIME_HXX__
 #define __TREBLE__RUNTIME_HXX__
 
+#include "execution_context.hxx"
 #include "instructions.hxx"
 #include "module.hxx"
+#include <cstdint>
+#include <optional>
+#include <span>
 
 namespace Treble {
 
-void execute_module_instance(ModuleInstance &instance);
+/**
+ * Controls how module instances are executed.
+ */
+struct RuntimeConfig {
+	/**
+	 * Lower functions to the register IR and run them on the register
+	 * interpreter. Functions that cannot be lowered, or all of them when this
+	 * is false, run on the stack interpreter.
+	 */
+	bool use_register_ir = true;
+
+	/**
+	 * Compile functions to native code with the baseline JIT. Functions the
+	 * JIT cannot compile fall back to the interpreters.
+	 */
+	bool use_jit = true;
+
+	/**
+	 * Run every function compiled by the JIT on the stack interpreter as well,
+	 * and report any result or trap that differs between the two on stderr.
+	 */
+	bool verify_jit = false;
+
+	/**
+	 * Number of calls plus backward branches after which a function is
+	 * promoted from the stack interpreter to native code or the register IR,
+	 * whichever it can be translated to. 0 promotes every function on its first
+	 * call.
+	 */
+	uint32_t tier_up_threshold = 1000;
+
+	/**
+	 * Compile optimized tiers on a background thread. The function keeps
+	 * running on the stack interpreter until its optimized code is ready.
+	 */
+	bool background_compile = true;
+
+	/**
+	 * Count the instructions, calls and cycles of every call into the profile
+	 * of the calling thread, see profiler.hxx. Profiled calls always run on
+	 * the stack interpreter, so that every instruction is counted.
+	 */
+	bool profile = false;
+};
+
+/**
+ * Calls the given function in the given context. args holds its arguments,
+ * one slot each and two for a v128; missing ones are zero. Returns the
+ * results of the function, which stay valid until the next call made in the
+ * same context, or nothing if the call trapped. The trap is left in the
+ * context.
+ */
+std::optional<std::span<const uint64_t>>
+invoke(ExecutionContext &context, FunctionInstance &func,
+	   std::span<const uint64_t> args = {}, const RuntimeConfig &config = {});
+
+/**
+ * Prints the top-most of the given results.
+ */
+void print_results(std::span<const uint64_t> results);
+
+/**
+ * Describes the trap the way it is reported to the user.
+ */
+const char *trap_message(Trap trap);
+
+/**
+ * Runs the start function of the instance, if it has one, in the execution
+ * context of the calling thread.
+ */
+void execute_module_instance(ModuleInstance &instance,
+							 const RuntimeConfig &config = {});
+
+void execute_module_instance(ModuleInstance &instance,
+							 ExecutionContext &context,
+							 const RuntimeConfig &config = {});
 
 } // namespace Treble
 
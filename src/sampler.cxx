@@ -0,0 +1,166 @@
+#include "sampler.hxx"
+#include "execution_context.hxx"
+#include "module.hxx"
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <string>
+#include <sys/time.h>
+
+namespace Treble {
+
+// calls nested deeper than this are cut off at the outermost end
+static constexpr size_t MAX_SAMPLE_DEPTH = 32;
+
+struct Sample {
+	// set once the handler is done with the sample
+	std::atomic<bool> complete;
+	// number of frames in funcs, outermost first
+	uint32_t depth;
+	bool truncated;
+	// offset of the instruction the innermost function was at, or -1 if it
+	// was not running on the stack interpreter
+	int64_t offset;
+	uint32_t funcs[MAX_SAMPLE_DEPTH];
+};
+
+thread_local constinit SampleSite sample_site = {nullptr, nullptr};
+
+static std::atomic<bool> active = false;
+static std::unique_ptr<Sample[]> samples;
+static size_t sample_capacity = 0;
+// number of samples ever taken, including those that did not fit
+static std::atomic<size_t> next_sample = 0;
+
+/**
+ * The SIGPROF handler. Only reads the thread it interrupted and writes its
+ * own slot of the buffer, so it is async-signal-safe.
+ */
+static void record_sample(int) {
+	if (!active.load(std::memory_order_relaxed)) {
+		return;
+	}
+
+	const size_t index = next_sample.fetch_add(1, std::memory_order_relaxed);
+	if (index >= sample_capacity) {
+		return;
+	}
+
+	Sample &sample = samples[index];
+	const ExecutionContext *context = sample_site.context;
+	const std::span<const Frame> frames = context != nullptr
+											  ? context->active_frames()
+											  : std::span<const Frame>();
+
+	const size_t first =
+		frames.size() > MAX_SAMPLE_DEPTH ? frames.size() - MAX_SAMPLE_DEPTH : 0;
+	sample.depth = frames.size() - first;
+	sample.truncated = first > 0;
+	for (size_t i = first; i < frames.size(); ++i) {
+		sample.funcs[i - first] = function_index(*frames[i].func);
+	}
+
+	sample.offset = -1;
+	if (!frames.empty()) {
+		const Function &code = frames.back().func->code;
+		const uint8_t *pc = sample_site.pc.load(std::memory_order_relaxed);
+		if (pc >= code.body && pc < code.body + code.body_size) {
+			sample.offset = pc - code.body;
+		}
+	}
+
+	sample.complete.store(true, std::memory_order_release);
+}
+
+bool sampling_active() { return active.load(std::memory_order_relaxed); }
+
+bool start_sampling(uint32_t frequency, size_t max_samples) {
+	if (frequency == 0 || active.load()) {
+		return false;
+	}
+
+	samples = std::make_unique<Sample[]>(max_samples);
+	sample_capacity = max_samples;
+	next_sample.store(0);
+
+	// the handler stays installed for good: a SIGPROF that is still pending
+	// when sampling stops would otherwise terminate the process
+	struct sigaction action = {};
+	action.sa_handler = record_sample;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGPROF, &action, nullptr) != 0) {
+		return false;
+	}
+
+	active.store(true);
+
+	const suseconds_t interval = 1000000 / frequency;
+	const itimerval timer = {
+		.it_interval = {.tv_sec = interval / 1000000,
+						.tv_usec = interval % 1000000},
+		.it_value = {.tv_sec = interval / 1000000,
+					 .tv_usec = interval % 1000000},
+	};
+	if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+		active.store(false);
+		return false;
+	}
+
+	return true;
+}
+
+void stop_sampling() {
+	const itimerval timer = {};
+	setitimer(ITIMER_PROF, &timer, nullptr);
+	active.store(false);
+}
+
+void write_folded_stacks(std::ostream &out, bool with_offsets) {
+	const size_t taken = next_sample.load();
+	const size_t recorded = std::min(taken, sample_capacity);
+
+	std::map<std::string, uint64_t> stacks;
+	for (size_t i = 0; i < recorded; ++i) {
+		const Sample &sample = samples[i];
+		if (!sample.complete.load(std::memory_order_acquire)) {
+			continue;
+		}
+
+		std::string stack = sample.truncated ? "[truncated];" : "";
+		if (sample.depth == 0) {
+			stack += "[host]";
+		}
+		for (uint32_t j = 0; j < sample.depth; ++j) {
+			if (j > 0) {
+				stack += ';';
+			}
+			stack += "wasm_func_" + std::to_string(sample.funcs[j]);
+		}
+		if (with_offsets && sample.offset >= 0) {
+			char offset[32];
+			std::snprintf(offset, sizeof(offset), "+0x%llx",
+						  static_cast<unsigned long long>(sample.offset));
+			stack += offset;
+		}
+		stacks[stack]++;
+	}
+
+	if (taken > recorded) {
+		stacks["[dropped]"] += taken - recorded;
+	}
+
+	for (const auto &[stack, count] : stacks) {
+		out << stack << ' ' << count << '\n';
+	}
+	out.flush();
+}
+
+} // namespace Treble
@@ -0,0 +1,80 @@
+#ifndef __TREBLE__SAMPLER_HXX__
+#define __TREBLE__SAMPLER_HXX__
+
+#include "execution_context.hxx"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace Treble {
+
+/**
+ * What a thread is running, as far as the sampler is concerned. invoke points
+ * context at the context of the call in progress, and while sampling, the
+ * stack interpreter keeps pc at the instruction it is about to run. Plain
+ * thread locals, so that the signal handler can read those of the thread it
+ * interrupted.
+ */
+struct SampleSite {
+	ExecutionContext *context;
+	std::atomic<const uint8_t *> pc;
+};
+
+extern thread_local constinit SampleSite sample_site;
+
+/**
+ * Points sample_site at the given context for as long as it is in scope.
+ */
+class SampledCall {
+  public:
+	explicit SampledCall(ExecutionContext &context)
+		: previous(sample_site.context) {
+		sample_site.pc.store(nullptr, std::memory_order_relaxed);
+		sample_site.context = &context;
+	}
+	~SampledCall() { sample_site.context = previous; }
+
+	SampledCall(const SampledCall &) = delete;
+	SampledCall &operator=(const SampledCall &) = delete;
+
+  private:
+	ExecutionContext *previous;
+};
+
+/**
+ * Whether start_sampling is in effect.
+ */
+bool sampling_active();
+
+/**
+ * Starts the statistical profiler: frequency times a second of CPU time, as
+ * counted by ITIMER_PROF across all threads, SIGPROF interrupts whichever
+ * thread is running and records the wasm call stack it is in the middle of.
+ * The handler only writes to a buffer of max_samples samples set aside up
+ * front; samples beyond that are dropped and counted. Returns false if the
+ * timer or the signal handler cannot be set up, or if sampling is already
+ * active.
+ */
+bool start_sampling(uint32_t frequency = 997, size_t max_samples = 1 << 16);
+
+/**
+ * Stops the timer. Samples are kept until the next start_sampling.
+ */
+void stop_sampling();
+
+/**
+ * Writes the samples in the folded stack format flame graph tools take: one
+ * line per distinct call stack, outermost function first, followed by the
+ * number of samples that hit it. Functions are named wasm_func_<index>.
+ * Samples taken outside of any wasm call are counted as [host].
+ *
+ * With with_offsets, the innermost function is further split up by the offset
+ * of the instruction the stack interpreter was at, as wasm_func_<index>+0x..,
+ * for calls that ran on it.
+ */
+void write_folded_stacks(std::ostream &out, bool with_offsets = false);
+
+} // namespace Treble
+
+#endif
@@ -0,0 +1,165 @@
+#include "scheduler.hxx"
+#include "execution_context.hxx"
+#include "module.hxx"
+#include "runtime.hxx"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Treble {
+
+Scheduler::Scheduler(size_t worker_count, const RuntimeConfig &config)
+	: config(config) {
+	if (worker_count == 0) {
+		worker_count = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// every worker has to exist before any of them goes looking for work
+	for (size_t i = 0; i < worker_count; ++i) {
+		workers.push_back(std::make_unique<Worker>());
+	}
+	for (size_t i = 0; i < worker_count; ++i) {
+		workers[i]->thread = std::thread(&Scheduler::run, this, i);
+	}
+}
+
+Scheduler::~Scheduler() {
+	stopping.store(true);
+	for (const std::unique_ptr<Worker> &worker : workers) {
+		wake(*worker);
+	}
+	for (const std::unique_ptr<Worker> &worker : workers) {
+		worker->thread.join();
+	}
+}
+
+std::future<CallResult> Scheduler::submit(FunctionInstance &func,
+										  std::vector<uint64_t> args) {
+	const ModuleInstance &instance = *func.module;
+	Task task{
+		.func = &func,
+		.args = std::move(args),
+		.promise = {},
+		.stealable =
+			instance.memory == nullptr || instance.memory->is_shared(),
+	};
+	std::future<CallResult> result = task.promise.get_future();
+	const bool stealable = task.stealable;
+
+	// counted before it is queued, so that the count never drops below the
+	// number of stealable calls a worker can actually find
+	if (stealable) {
+		stealable_count.fetch_add(1);
+	}
+
+	Worker &home = *workers[home_worker(instance)];
+	{
+		std::lock_guard guard(home.lock);
+		home.tasks.push_back(std::move(task));
+	}
+	home.wake.notify_one();
+
+	// in case the home worker is busy, get another one to come and steal it
+	if (stealable && workers.size() > 1) {
+		wake(*workers[next_thief.fetch_add(1) % workers.size()]);
+	}
+
+	return result;
+}
+
+size_t Scheduler::home_worker(const ModuleInstance &instance) const {
+	// fibonacci hashing, so that instances allocated close to each other
+	// still end up on different workers
+	const auto address = reinterpret_cast<uintptr_t>(&instance);
+	return ((uint64_t{address} * 0x9E3779B97F4A7C15) >> 32) % workers.size();
+}
+
+void Scheduler::run(size_t index) {
+	Worker &worker = *workers[index];
+	Task task;
+
+	while (true) {
+		if (take(worker, task) || steal(index, task)) {
+			execute(worker, task);
+			continue;
+		}
+
+		std::unique_lock lock(worker.lock);
+		worker.wake.wait(lock, [&] {
+			return !worker.tasks.empty() || stealable_count.load() > 0 ||
+				   stopping.load();
+		});
+
+		// calls that are left on other workers are run by those workers
+		if (worker.tasks.empty() && stopping.load()) {
+			return;
+		}
+	}
+}
+
+bool Scheduler::take(Worker &worker, Task &task) {
+	std::lock_guard guard(worker.lock);
+	if (worker.tasks.empty()) {
+		return false;
+	}
+
+	task = std::move(worker.tasks.front());
+	worker.tasks.pop_front();
+	if (task.stealable) {
+		stealable_count.fetch_sub(1);
+	}
+	return true;
+}
+
+bool Scheduler::steal(size_t thief, Task &task) {
+	for (size_t i = 1; i < workers.size(); ++i) {
+		if (stealable_count.load() == 0) {
+			return false;
+		}
+
+		Worker &victim = *workers[(thief + i) % workers.size()];
+		std::lock_guard guard(victim.lock);
+		const auto found = std::find_if(
+			victim.tasks.rbegin(), victim.tasks.rend(),
+			[](const Task &candidate) { return candidate.stealable; });
+		if (found == victim.tasks.rend()) {
+			continue;
+		}
+
+		task = std::move(*found);
+		victim.tasks.erase(std::next(found).base());
+		stealable_count.fetch_sub(1);
+		return true;
+	}
+
+	return false;
+}
+
+void Scheduler::execute(Worker &worker, Task &task) {
+	const std::optional<std::span<const uint64_t>> values =
+		invoke(worker.context, *task.func, task.args, config);
+
+	CallResult result{.trap = worker.context.trap, .values = {}};
+	if (values) {
+		result.values.assign(values->begin(), values->end());
+	}
+	task.promise.set_value(std::move(result));
+}
+
+void Scheduler::wake(Worker &worker) {
+	// taking the lock makes sure the worker is either still about to check for
+	// work, or already waiting for the notification
+	{ std::lock_guard guard(worker.lock); }
+	worker.wake.notify_one();
+}
+
+} // namespace Treble
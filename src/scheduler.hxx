@@ -0,0 +1,104 @@
+#ifndef __TREBLE__SCHEDULER_HXX__
+#define __TREBLE__SCHEDULER_HXX__
+
+#include "execution_context.hxx"
+#include "module.hxx"
+#include "runtime.hxx"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Treble {
+
+/**
+ * What a call made on the scheduler came to.
+ */
+struct CallResult {
+	// Trap::None if the call completed
+	Trap trap;
+	std::vector<uint64_t> values;
+};
+
+/**
+ * Runs calls on a fixed set of worker threads, each of which keeps an
+ * execution context that every call it runs reuses.
+ *
+ * Every module instance has a home worker, and its calls are queued there, so
+ * that the instance and the context stay in the caches of one core. A worker
+ * that runs out of calls steals from the others, but only calls that may run
+ * on any thread: those of instances without a memory or with a shared one.
+ * Calls on an instance with a memory of its own always run on its home
+ * worker, one after another, as nothing else may touch that memory at the
+ * same time.
+ */
+class Scheduler {
+  public:
+	/**
+	 * Starts worker_count workers, or one per core with 0.
+	 */
+	explicit Scheduler(size_t worker_count = 0,
+					   const RuntimeConfig &config = {});
+
+	/**
+	 * Runs every call that has been submitted before it stops the workers.
+	 */
+	~Scheduler();
+
+	Scheduler(const Scheduler &) = delete;
+	Scheduler &operator=(const Scheduler &) = delete;
+
+	size_t worker_count() const { return workers.size(); }
+
+	/**
+	 * Queues a call of the given function with the given arguments, see
+	 * invoke. The instance of the function has to outlive the call. Can be
+	 * called from any thread.
+	 */
+	std::future<CallResult> submit(FunctionInstance &func,
+								   std::vector<uint64_t> args = {});
+
+  private:
+	struct Task {
+		FunctionInstance *func;
+		std::vector<uint64_t> args;
+		std::promise<CallResult> promise;
+		bool stealable;
+	};
+
+	struct Worker {
+		std::mutex lock;
+		// new calls go to the back. the worker itself takes them from the
+		// front, thieves take them from the back.
+		std::deque<Task> tasks;
+		std::condition_variable wake;
+		ExecutionContext context;
+		std::thread thread;
+	};
+
+	size_t home_worker(const ModuleInstance &instance) const;
+	void run(size_t index);
+	bool take(Worker &worker, Task &task);
+	bool steal(size_t thief, Task &task);
+	void execute(Worker &worker, Task &task);
+	void wake(Worker &worker);
+
+	RuntimeConfig config;
+	std::vector<std::unique_ptr<Worker>> workers;
+
+	// number of queued calls that any worker may run
+	std::atomic<size_t> stealable_count = 0;
+	// worker to wake next when a stealable call comes in
+	std::atomic<size_t> next_thief = 0;
+	std::atomic<bool> stopping = false;
+};
+
+} // namespace Treble
+
+#endif
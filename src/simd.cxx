@@ -0,0 +1,1105 @@
+#include "simd.hxx"
+#include "instructions.hxx"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <string_view>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace Treble {
+
+template <typename Lane> using Lanes = std::array<Lane, 16 / sizeof(Lane)>;
+
+template <typename Lane> static Lanes<Lane> load_lanes(const uint64_t *v) {
+	Lanes<Lane> lanes;
+	std::memcpy(lanes.data(), v, sizeof(lanes));
+	return lanes;
+}
+
+template <typename Lane>
+static void store_lanes(uint64_t *v, const Lanes<Lane> &lanes) {
+	std::memcpy(v, lanes.data(), sizeof(lanes));
+}
+
+/**
+ * Replaces every lane of the operand with fn of it.
+ */
+template <typename Lane, typename Fn>
+static void map_lanes(uint64_t *v, Fn fn) {
+	Lanes<Lane> a = load_lanes<Lane>(v);
+	for (Lane &lane : a) {
+		lane = fn(lane);
+	}
+	store_lanes(v, a);
+}
+
+/**
+ * Replaces every lane of the first operand with fn of it and the same lane of
+ * the second operand.
+ */
+template <typename Lane, typename Fn>
+static void zip_lanes(uint64_t *v, Fn fn) {
+	Lanes<Lane> a = load_lanes<Lane>(v);
+	const Lanes<Lane> b = load_lanes<Lane>(v + 2);
+	for (size_t i = 0; i < a.size(); ++i) {
+		a[i] = fn(a[i], b[i]);
+	}
+	store_lanes(v, a);
+}
+
+/**
+ * Like zip_lanes, but the lanes of the result are Mask lanes of all ones where
+ * fn holds and of all zeros elsewhere.
+ */
+template <typename Lane, typename Mask, typename Fn>
+static void compare_lanes(uint64_t *v, Fn fn) {
+	const Lanes<Lane> a = load_lanes<Lane>(v);
+	const Lanes<Lane> b = load_lanes<Lane>(v + 2);
+	Lanes<Mask> result;
+	for (size_t i = 0; i < a.size(); ++i) {
+		result[i] = fn(a[i], b[i]) ? ~Mask{0} : Mask{0};
+	}
+	store_lanes(v, result);
+}
+
+/**
+ * Converts the lanes of the operand to To lanes, as many of them as both
+ * shapes have. Lanes of the result past those are zero.
+ */
+template <typename From, typename To, typename Fn>
+static void convert_lanes(uint64_t *v, Fn fn) {
+	const Lanes<From> a = load_lanes<From>(v);
+	Lanes<To> result = {};
+	for (size_t i = 0; i < std::min(a.size(), result.size()); ++i) {
+		result[i] = fn(a[i]);
+	}
+	store_lanes(v, result);
+}
+
+template <typename Narrow, typename Wide> static Narrow saturate(Wide value) {
+	return static_cast<Narrow>(std::clamp<Wide>(
+		value, std::numeric_limits<Narrow>::min(),
+		std::numeric_limits<Narrow>::max()));
+}
+
+/**
+ * Truncates value towards zero, saturating at the bounds of Int. NaN becomes
+ * zero.
+ */
+template <typename Int, typename Float>
+static Int truncate_saturated(Float value) {
+	if (std::isnan(value)) {
+		return 0;
+	}
+	if (value <= static_cast<Float>(std::numeric_limits<Int>::min())) {
+		return std::numeric_limits<Int>::min();
+	}
+	if (value >= static_cast<Float>(std::numeric_limits<Int>::max())) {
+		return std::numeric_limits<Int>::max();
+	}
+	return static_cast<Int>(value);
+}
+
+/**
+ * The minimum as WebAssembly defines it: NaN if either operand is NaN, and -0
+ * rather than +0.
+ */
+template <typename Float> static Float wasm_min(Float a, Float b) {
+	if (std::isnan(a) || std::isnan(b)) {
+		return a + b;
+	}
+	if (a == b) {
+		return std::signbit(a) ? a : b;
+	}
+	return a < b ? a : b;
+}
+
+/**
+ * The maximum as WebAssembly defines it: NaN if either operand is NaN, and +0
+ * rather than -0.
+ */
+template <typename Float> static Float wasm_max(Float a, Float b) {
+	if (std::isnan(a) || std::isnan(b)) {
+		return a + b;
+	}
+	if (a == b) {
+		return std::signbit(a) ? b : a;
+	}
+	return a > b ? a : b;
+}
+
+/**
+ * Widens the low or the high half of the lanes of the operand.
+ */
+template <typename Narrow, typename Wide, bool high>
+static void extend_lanes(uint64_t *v) {
+	const Lanes<Narrow> a = load_lanes<Narrow>(v);
+	Lanes<Wide> result;
+	for (size_t i = 0; i < result.size(); ++i) {
+		result[i] = a[i + (high ? result.size() : 0)];
+	}
+	store_lanes(v, result);
+}
+
+/**
+ * Adds up every pair of neighbouring lanes of the operand into a lane twice as
+ * wide.
+ */
+template <typename Narrow, typename Wide>
+static void extadd_pairwise_lanes(uint64_t *v) {
+	const Lanes<Narrow> a = load_lanes<Narrow>(v);
+	Lanes<Wide> result;
+	for (size_t i = 0; i < result.size(); ++i) {
+		result[i] = Wide{a[2 * i]} + Wide{a[2 * i + 1]};
+	}
+	store_lanes(v, result);
+}
+
+/**
+ * Multiplies the low or the high half of the lanes of both operands into lanes
+ * twice as wide.
+ */
+template <typename Narrow, typename Wide, bool high>
+static void extmul_lanes(uint64_t *v) {
+	const Lanes<Narrow> a = load_lanes<Narrow>(v);
+	const Lanes<Narrow> b = load_lanes<Narrow>(v + 2);
+	Lanes<Wide> result;
+	for (size_t i = 0; i < result.size(); ++i) {
+		const size_t lane = i + (high ? result.size() : 0);
+		result[i] = static_cast<Wide>(Wide{a[lane]} * Wide{b[lane]});
+	}
+	store_lanes(v, result);
+}
+
+/**
+ * Saturates the signed lanes of both operands into lanes half as wide, those
+ * of the first operand first.
+ */
+template <typename Wide, typename Narrow>
+static void narrow_lanes(uint64_t *v) {
+	const Lanes<Wide> a = load_lanes<Wide>(v);
+	const Lanes<Wide> b = load_lanes<Wide>(v + 2);
+	Lanes<Narrow> result;
+	for (size_t i = 0; i < a.size(); ++i) {
+		result[i] = saturate<Narrow>(a[i]);
+		result[i + a.size()] = saturate<Narrow>(b[i]);
+	}
+	store_lanes(v, result);
+}
+
+template <typename Lane> static uint32_t all_lanes_true(const uint64_t *v) {
+	const Lanes<Lane> a = load_lanes<Lane>(v);
+	return std::all_of(a.begin(), a.end(), [](Lane lane) { return lane != 0; });
+}
+
+/**
+ * Collects the top bit of every lane, that of lane 0 in bit 0.
+ */
+template <typename Lane> static uint32_t lane_bitmask(const uint64_t *v) {
+	const Lanes<Lane> a = load_lanes<Lane>(v);
+	uint32_t mask = 0;
+	for (size_t i = 0; i < a.size(); ++i) {
+		mask |= (a[i] < 0 ? 1u : 0u) << i;
+	}
+	return mask;
+}
+
+// the portable kernels, one lane at a time. signed arithmetic that can wrap is
+// done on unsigned lanes.
+
+#define SCALAR_UNARY(name, lane_type, expression)                              \
+	static void scalar_##name(uint64_t *v) {                                   \
+		map_lanes<lane_type>(                                                  \
+			v, [](lane_type a) -> lane_type { return expression; });           \
+	}
+
+#define SCALAR_BINARY(name, lane_type, expression)                             \
+	static void scalar_##name(uint64_t *v) {                                   \
+		zip_lanes<lane_type>(v, [](lane_type a, lane_type b) -> lane_type {    \
+			return expression;                                                 \
+		});                                                                    \
+	}
+
+#define SCALAR_COMPARE(name, lane_type, mask_type, expression)                 \
+	static void scalar_##name(uint64_t *v) {                                   \
+		compare_lanes<lane_type, mask_type>(                                   \
+			v, [](lane_type a, lane_type b) { return expression; });           \
+	}
+
+// k is the shift count modulo the width of a lane
+#define SCALAR_SHIFT(name, lane_type, expression)                              \
+	static void scalar_##name(uint64_t *v, uint32_t count) {                   \
+		const uint32_t k = count % (sizeof(lane_type) * 8);                    \
+		map_lanes<lane_type>(                                                  \
+			v, [k](lane_type a) -> lane_type { return expression; });          \
+	}
+
+// all six comparisons of a shape of integer lanes
+#define SCALAR_INTEGER_COMPARES(shape, signed_type, unsigned_type)             \
+	SCALAR_COMPARE(shape##_eq, unsigned_type, unsigned_type, a == b)           \
+	SCALAR_COMPARE(shape##_ne, unsigned_type, unsigned_type, a != b)           \
+	SCALAR_COMPARE(shape##_lt_s, signed_type, unsigned_type, a < b)            \
+	SCALAR_COMPARE(shape##_lt_u, unsigned_type, unsigned_type, a < b)          \
+	SCALAR_COMPARE(shape##_gt_s, signed_type, unsigned_type, a > b)            \
+	SCALAR_COMPARE(shape##_gt_u, unsigned_type, unsigned_type, a > b)          \
+	SCALAR_COMPARE(shape##_le_s, signed_type, unsigned_type, a <= b)           \
+	SCALAR_COMPARE(shape##_le_u, unsigned_type, unsigned_type, a <= b)         \
+	SCALAR_COMPARE(shape##_ge_s, signed_type, unsigned_type, a >= b)           \
+	SCALAR_COMPARE(shape##_ge_u, unsigned_type, unsigned_type, a >= b)
+
+#define SCALAR_FLOAT_COMPARES(shape, float_type, mask_type)                    \
+	SCALAR_COMPARE(shape##_eq, float_type, mask_type, a == b)                  \
+	SCALAR_COMPARE(shape##_ne, float_type, mask_type, a != b)                  \
+	SCALAR_COMPARE(shape##_lt, float_type, mask_type, a < b)                   \
+	SCALAR_COMPARE(shape##_gt, float_type, mask_type, a > b)                   \
+	SCALAR_COMPARE(shape##_le, float_type, mask_type, a <= b)                  \
+	SCALAR_COMPARE(shape##_ge, float_type, mask_type, a >= b)
+
+// the arithmetic both narrow shapes have
+#define SCALAR_NARROW_ARITHMETIC(shape, signed_type, unsigned_type)            \
+	SCALAR_BINARY(shape##_add, unsigned_type, a + b)                           \
+	SCALAR_BINARY(shape##_add_sat_s, signed_type,                              \
+				  saturate<signed_type>(int32_t{a} + b))                       \
+	SCALAR_BINARY(shape##_add_sat_u, unsigned_type,                            \
+				  saturate<unsigned_type>(int32_t{a} + b))                     \
+	SCALAR_BINARY(shape##_sub, unsigned_type, a - b)                           \
+	SCALAR_BINARY(shape##_sub_sat_s, signed_type,                              \
+				  saturate<signed_type>(int32_t{a} - b))                       \
+	SCALAR_BINARY(shape##_sub_sat_u, unsigned_type,                            \
+				  saturate<unsigned_type>(int32_t{a} - b))                     \
+	SCALAR_BINARY(shape##_min_s, signed_type, std::min(a, b))                  \
+	SCALAR_BINARY(shape##_min_u, unsigned_type, std::min(a, b))                \
+	SCALAR_BINARY(shape##_max_s, signed_type, std::max(a, b))                  \
+	SCALAR_BINARY(shape##_max_u, unsigned_type, std::max(a, b))                \
+	SCALAR_BINARY(shape##_avgr_u, unsigned_type, (uint32_t{a} + b + 1) / 2)
+
+#define SCALAR_FLOAT_ARITHMETIC(shape, float_type)                             \
+	SCALAR_UNARY(shape##_abs, float_type, std::fabs(a))                        \
+	SCALAR_UNARY(shape##_neg, float_type, -a)                                  \
+	SCALAR_UNARY(shape##_sqrt, float_type, std::sqrt(a))                       \
+	SCALAR_UNARY(shape##_ceil, float_type, std::ceil(a))                       \
+	SCALAR_UNARY(shape##_floor, float_type, std::floor(a))                     \
+	SCALAR_UNARY(shape##_trunc, float_type, std::trunc(a))                     \
+	SCALAR_UNARY(shape##_nearest, float_type, std::nearbyint(a))               \
+	SCALAR_BINARY(shape##_add, float_type, a + b)                              \
+	SCALAR_BINARY(shape##_sub, float_type, a - b)                              \
+	SCALAR_BINARY(shape##_mul, float_type, a * b)                              \
+	SCALAR_BINARY(shape##_div, float_type, a / b)                              \
+	SCALAR_BINARY(shape##_min, float_type, wasm_min(a, b))                     \
+	SCALAR_BINARY(shape##_max, float_type, wasm_max(a, b))                     \
+	SCALAR_BINARY(shape##_pmin, float_type, b < a ? b : a)                     \
+	SCALAR_BINARY(shape##_pmax, float_type, a < b ? b : a)
+
+// the shifts of a shape of integer lanes
+#define SCALAR_SHIFTS(shape, signed_type, unsigned_type)                       \
+	SCALAR_SHIFT(shape##_shl, unsigned_type, a << k)                           \
+	SCALAR_SHIFT(shape##_shr_s, signed_type, a >> k)                           \
+	SCALAR_SHIFT(shape##_shr_u, unsigned_type, a >> k)
+
+SCALAR_INTEGER_COMPARES(i8x16, int8_t, uint8_t)
+SCALAR_INTEGER_COMPARES(i16x8, int16_t, uint16_t)
+SCALAR_INTEGER_COMPARES(i32x4, int32_t, uint32_t)
+SCALAR_COMPARE(i64x2_eq, uint64_t, uint64_t, a == b)
+SCALAR_COMPARE(i64x2_ne, uint64_t, uint64_t, a != b)
+SCALAR_COMPARE(i64x2_lt_s, int64_t, uint64_t, a < b)
+SCALAR_COMPARE(i64x2_gt_s, int64_t, uint64_t, a > b)
+SCALAR_COMPARE(i64x2_le_s, int64_t, uint64_t, a <= b)
+SCALAR_COMPARE(i64x2_ge_s, int64_t, uint64_t, a >= b)
+SCALAR_FLOAT_COMPARES(f32x4, float, uint32_t)
+SCALAR_FLOAT_COMPARES(f64x2, double, uint64_t)
+
+SCALAR_UNARY(v128_not, uint64_t, ~a)
+SCALAR_BINARY(v128_and, uint64_t, a & b)
+SCALAR_BINARY(v128_andnot, uint64_t, a & ~b)
+SCALAR_BINARY(v128_or, uint64_t, a | b)
+SCALAR_BINARY(v128_xor, uint64_t, a ^ b)
+
+SCALAR_UNARY(i8x16_abs, int8_t, a < 0 ? -a : a)
+SCALAR_UNARY(i8x16_neg, uint8_t, -a)
+SCALAR_UNARY(i8x16_popcnt, uint8_t, std::popcount(a))
+SCALAR_NARROW_ARITHMETIC(i8x16, int8_t, uint8_t)
+
+SCALAR_UNARY(i16x8_abs, int16_t, a < 0 ? -a : a)
+SCALAR_UNARY(i16x8_neg, uint16_t, -a)
+SCALAR_NARROW_ARITHMETIC(i16x8, int16_t, uint16_t)
+SCALAR_BINARY(i16x8_mul, uint16_t, uint32_t{a} * b)
+SCALAR_BINARY(i16x8_q15mulr_sat_s, int16_t,
+			  saturate<int16_t>((int32_t{a} * b + 0x4000) >> 15))
+
+SCALAR_UNARY(i32x4_abs, uint32_t, static_cast<int32_t>(a) < 0 ? 0 - a : a)
+SCALAR_UNARY(i32x4_neg, uint32_t, 0 - a)
+SCALAR_BINARY(i32x4_add, uint32_t, a + b)
+SCALAR_BINARY(i32x4_sub, uint32_t, a - b)
+SCALAR_BINARY(i32x4_mul, uint32_t, a * b)
+SCALAR_BINARY(i32x4_min_s, int32_t, std::min(a, b))
+SCALAR_BINARY(i32x4_min_u, uint32_t, std::min(a, b))
+SCALAR_BINARY(i32x4_max_s, int32_t, std::max(a, b))
+SCALAR_BINARY(i32x4_max_u, uint32_t, std::max(a, b))
+
+SCALAR_UNARY(i64x2_abs, uint64_t, static_cast<int64_t>(a) < 0 ? 0 - a : a)
+SCALAR_UNARY(i64x2_neg, uint64_t, 0 - a)
+SCALAR_BINARY(i64x2_add, uint64_t, a + b)
+SCALAR_BINARY(i64x2_sub, uint64_t, a - b)
+SCALAR_BINARY(i64x2_mul, uint64_t, a * b)
+
+SCALAR_FLOAT_ARITHMETIC(f32x4, float)
+SCALAR_FLOAT_ARITHMETIC(f64x2, double)
+
+SCALAR_SHIFTS(i8x16, int8_t, uint8_t)
+SCALAR_SHIFTS(i16x8, int16_t, uint16_t)
+SCALAR_SHIFTS(i32x4, int32_t, uint32_t)
+SCALAR_SHIFTS(i64x2, int64_t, uint64_t)
+
+#undef SCALAR_UNARY
+#undef SCALAR_BINARY
+#undef SCALAR_COMPARE
+#undef SCALAR_SHIFT
+#undef SCALAR_INTEGER_COMPARES
+#undef SCALAR_FLOAT_COMPARES
+#undef SCALAR_NARROW_ARITHMETIC
+#undef SCALAR_FLOAT_ARITHMETIC
+#undef SCALAR_SHIFTS
+
+// the kernels that do not work lane by lane
+
+#define SCALAR_KERNEL(name, function)                                          \
+	static constexpr void (*scalar_##name)(uint64_t *) = function;
+
+SCALAR_KERNEL(i16x8_extend_low_i8x16_s, (extend_lanes<int8_t, int16_t, false>))
+SCALAR_KERNEL(i16x8_extend_high_i8x16_s, (extend_lanes<int8_t, int16_t, true>))
+SCALAR_KERNEL(i16x8_extend_low_i8x16_u,
+			  (extend_lanes<uint8_t, uint16_t, false>))
+SCALAR_KERNEL(i16x8_extend_high_i8x16_u,
+			  (extend_lanes<uint8_t, uint16_t, true>))
+SCALAR_KERNEL(i32x4_extend_low_i16x8_s,
+			  (extend_lanes<int16_t, int32_t, false>))
+SCALAR_KERNEL(i32x4_extend_high_i16x8_s,
+			  (extend_lanes<int16_t, int32_t, true>))
+SCALAR_KERNEL(i32x4_extend_low_i16x8_u,
+			  (extend_lanes<uint16_t, uint32_t, false>))
+SCALAR_KERNEL(i32x4_extend_high_i16x8_u,
+			  (extend_lanes<uint16_t, uint32_t, true>))
+SCALAR_KERNEL(i64x2_extend_low_i32x4_s,
+			  (extend_lanes<int32_t, int64_t, false>))
+SCALAR_KERNEL(i64x2_extend_high_i32x4_s,
+			  (extend_lanes<int32_t, int64_t, true>))
+SCALAR_KERNEL(i64x2_extend_low_i32x4_u,
+			  (extend_lanes<uint32_t, uint64_t, false>))
+SCALAR_KERNEL(i64x2_extend_high_i32x4_u,
+			  (extend_lanes<uint32_t, uint64_t, true>))
+
+SCALAR_KERNEL(i16x8_extadd_pairwise_i8x16_s,
+			  (extadd_pairwise_lanes<int8_t, int16_t>))
+SCALAR_KERNEL(i16x8_extadd_pairwise_i8x16_u,
+			  (extadd_pairwise_lanes<uint8_t, uint16_t>))
+SCALAR_KERNEL(i32x4_extadd_pairwise_i16x8_s,
+			  (extadd_pairwise_lanes<int16_t, int32_t>))
+SCALAR_KERNEL(i32x4_extadd_pairwise_i16x8_u,
+			  (extadd_pairwise_lanes<uint16_t, uint32_t>))
+
+SCALAR_KERNEL(i16x8_extmul_low_i8x16_s, (extmul_lanes<int8_t, int16_t, false>))
+SCALAR_KERNEL(i16x8_extmul_high_i8x16_s, (extmul_lanes<int8_t, int16_t, true>))
+SCALAR_KERNEL(i16x8_extmul_low_i8x16_u,
+			  (extmul_lanes<uint8_t, uint16_t, false>))
+SCALAR_KERNEL(i16x8_extmul_high_i8x16_u,
+			  (extmul_lanes<uint8_t, uint16_t, true>))
+SCALAR_KERNEL(i32x4_extmul_low_i16x8_s,
+			  (extmul_lanes<int16_t, int32_t, false>))
+SCALAR_KERNEL(i32x4_extmul_high_i16x8_s,
+			  (extmul_lanes<int16_t, int32_t, true>))
+SCALAR_KERNEL(i32x4_extmul_low_i16x8_u,
+			  (extmul_lanes<uint16_t, uint32_t, false>))
+SCALAR_KERNEL(i32x4_extmul_high_i16x8_u,
+			  (extmul_lanes<uint16_t, uint32_t, true>))
+SCALAR_KERNEL(i64x2_extmul_low_i32x4_s,
+			  (extmul_lanes<int32_t, int64_t, false>))
+SCALAR_KERNEL(i64x2_extmul_high_i32x4_s,
+			  (extmul_lanes<int32_t, int64_t, true>))
+SCALAR_KERNEL(i64x2_extmul_low_i32x4_u,
+			  (extmul_lanes<uint32_t, uint64_t, false>))
+SCALAR_KERNEL(i64x2_extmul_high_i32x4_u,
+			  (extmul_lanes<uint32_t, uint64_t, true>))
+
+SCALAR_KERNEL(i8x16_narrow_i16x8_s, (narrow_lanes<int16_t, int8_t>))
+SCALAR_KERNEL(i8x16_narrow_i16x8_u, (narrow_lanes<int16_t, uint8_t>))
+SCALAR_KERNEL(i16x8_narrow_i32x4_s, (narrow_lanes<int32_t, int16_t>))
+SCALAR_KERNEL(i16x8_narrow_i32x4_u, (narrow_lanes<int32_t, uint16_t>))
+
+#undef SCALAR_KERNEL
+
+static void scalar_i32x4_trunc_sat_f32x4_s(uint64_t *v) {
+	convert_lanes<float, int32_t>(v, truncate_saturated<int32_t, float>);
+}
+
+static void scalar_i32x4_trunc_sat_f32x4_u(uint64_t *v) {
+	convert_lanes<float, uint32_t>(v, truncate_saturated<uint32_t, float>);
+}
+
+static void scalar_i32x4_trunc_sat_f64x2_s_zero(uint64_t *v) {
+	convert_lanes<double, int32_t>(v, truncate_saturated<int32_t, double>);
+}
+
+static void scalar_i32x4_trunc_sat_f64x2_u_zero(uint64_t *v) {
+	convert_lanes<double, uint32_t>(v, truncate_saturated<uint32_t, double>);
+}
+
+static void scalar_f32x4_convert_i32x4_s(uint64_t *v) {
+	convert_lanes<int32_t, float>(
+		v, [](int32_t a) { return static_cast<float>(a); });
+}
+
+static void scalar_f32x4_convert_i32x4_u(uint64_t *v) {
+	convert_lanes<uint32_t, float>(
+		v, [](uint32_t a) { return static_cast<float>(a); });
+}
+
+static void scalar_f64x2_convert_low_i32x4_s(uint64_t *v) {
+	convert_lanes<int32_t, double>(
+		v, [](int32_t a) { return static_cast<double>(a); });
+}
+
+static void scalar_f64x2_convert_low_i32x4_u(uint64_t *v) {
+	convert_lanes<uint32_t, double>(
+		v, [](uint32_t a) { return static_cast<double>(a); });
+}
+
+static void scalar_f32x4_demote_f64x2_zero(uint64_t *v) {
+	convert_lanes<double, float>(
+		v, [](double a) { return static_cast<float>(a); });
+}
+
+static void scalar_f64x2_promote_low_f32x4(uint64_t *v) {
+	convert_lanes<float, double>(
+		v, [](float a) { return static_cast<double>(a); });
+}
+
+static void scalar_i32x4_dot_i16x8_s(uint64_t *v) {
+	const Lanes<int16_t> a = load_lanes<int16_t>(v);
+	const Lanes<int16_t> b = load_lanes<int16_t>(v + 2);
+	Lanes<uint32_t> result;
+	for (size_t i = 0; i < result.size(); ++i) {
+		// the sum of the two products can wrap
+		result[i] = static_cast<uint32_t>(int64_t{a[2 * i]} * b[2 * i] +
+										  int64_t{a[2 * i + 1]} * b[2 * i + 1]);
+	}
+	store_lanes(v, result);
+}
+
+static void scalar_i8x16_swizzle(uint64_t *v) {
+	const Lanes<uint8_t> a = load_lanes<uint8_t>(v);
+	const Lanes<uint8_t> b = load_lanes<uint8_t>(v + 2);
+	Lanes<uint8_t> result;
+	for (size_t i = 0; i < result.size(); ++i) {
+		result[i] = b[i] < a.size() ? a[b[i]] : 0;
+	}
+	store_lanes(v, result);
+}
+
+static void scalar_i8x16_shuffle(uint64_t *v, const uint8_t *lanes) {
+	// both operands, one after the other
+	uint8_t bytes[32];
+	std::memcpy(bytes, v, sizeof(bytes));
+	Lanes<uint8_t> result;
+	for (size_t i = 0; i < result.size(); ++i) {
+		result[i] = bytes[lanes[i]];
+	}
+	store_lanes(v, result);
+}
+
+static uint32_t scalar_v128_any_true(const uint64_t *v) {
+	return (v[0] | v[1]) != 0;
+}
+
+static constexpr uint32_t (*scalar_i8x16_all_true)(const uint64_t *) =
+	all_lanes_true<uint8_t>;
+static constexpr uint32_t (*scalar_i16x8_all_true)(const uint64_t *) =
+	all_lanes_true<uint16_t>;
+static constexpr uint32_t (*scalar_i32x4_all_true)(const uint64_t *) =
+	all_lanes_true<uint32_t>;
+static constexpr uint32_t (*scalar_i64x2_all_true)(const uint64_t *) =
+	all_lanes_true<uint64_t>;
+static constexpr uint32_t (*scalar_i8x16_bitmask)(const uint64_t *) =
+	lane_bitmask<int8_t>;
+static constexpr uint32_t (*scalar_i16x8_bitmask)(const uint64_t *) =
+	lane_bitmask<int16_t>;
+static constexpr uint32_t (*scalar_i32x4_bitmask)(const uint64_t *) =
+	lane_bitmask<int32_t>;
+static constexpr uint32_t (*scalar_i64x2_bitmask)(const uint64_t *) =
+	lane_bitmask<int64_t>;
+
+static constexpr SimdKernels SCALAR_KERNELS = {
+#define SCALAR_KERNEL_ENTRY(name, op_code, text) .name = scalar_##name,
+	TREBLE_FOREACH_SIMD_UNARY_OPCODE(SCALAR_KERNEL_ENTRY)
+	TREBLE_FOREACH_SIMD_BINARY_OPCODE(SCALAR_KERNEL_ENTRY)
+	TREBLE_FOREACH_SIMD_SHIFT_OPCODE(SCALAR_KERNEL_ENTRY)
+	TREBLE_FOREACH_SIMD_TEST_OPCODE(SCALAR_KERNEL_ENTRY)
+#undef SCALAR_KERNEL_ENTRY
+	.i8x16_shuffle = scalar_i8x16_shuffle,
+};
+
+#if defined(__x86_64__)
+
+// the kernels built on the intrinsics of the host. every kernel is an
+// expression of its operands a and b, or a and the shift count n, and is
+// compiled once for SSE4.1 and once for AVX2, where the same intrinsics get the
+// VEX encoding. kernels that are not listed keep their portable version.
+
+#define SSE41_HELPER [[gnu::target("sse4.1"), gnu::always_inline]] static inline
+
+static inline __m128i load_vector(const uint64_t *v) {
+	return _mm_loadu_si128(reinterpret_cast<const __m128i *>(v));
+}
+
+static inline void store_vector(uint64_t *v, __m128i vector) {
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(v), vector);
+}
+
+static inline __m128 ps(__m128i vector) { return _mm_castsi128_ps(vector); }
+static inline __m128d pd(__m128i vector) { return _mm_castsi128_pd(vector); }
+static inline __m128i si(__m128 vector) { return _mm_castps_si128(vector); }
+static inline __m128i si(__m128d vector) { return _mm_castpd_si128(vector); }
+
+static inline __m128i ones() { return _mm_set1_epi32(-1); }
+static inline __m128i not_si(__m128i a) { return _mm_xor_si128(a, ones()); }
+static inline __m128i high_half(__m128i a) { return _mm_srli_si128(a, 8); }
+
+static constexpr int ROUND_TRUNC = _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC;
+static constexpr int ROUND_NEAREST =
+	_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+
+// the 64 bit lanes filled with the sign bit of each of them
+static inline __m128i sign_epi64(__m128i a) {
+	return _mm_srai_epi32(_mm_shuffle_epi32(a, _MM_SHUFFLE(3, 3, 1, 1)), 31);
+}
+
+SSE41_HELPER __m128i popcnt_epi8(__m128i a) {
+	// the popcount of every nibble, looked up by pshufb
+	const __m128i table =
+		_mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	const __m128i low = _mm_shuffle_epi8(table, _mm_and_si128(a, nibble));
+	const __m128i high =
+		_mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(a, 4), nibble));
+	return _mm_add_epi8(low, high);
+}
+
+SSE41_HELPER __m128i q15mulr_sat_epi16(__m128i a, __m128i b) {
+	// pmulhrsw rounds the same way, but gives 0x8000 rather than 0x7FFF for
+	// 0x8000 * 0x8000, the only product that ever yields 0x8000
+	const __m128i product = _mm_mulhrs_epi16(a, b);
+	return _mm_xor_si128(product,
+						 _mm_cmpeq_epi16(product, _mm_set1_epi16(INT16_MIN)));
+}
+
+SSE41_HELPER __m128i extadd_pairwise_epu16(__m128i a) {
+	// flipped to signed, which pmaddwd takes, and back again
+	const __m128i flipped = _mm_xor_si128(a, _mm_set1_epi16(INT16_MIN));
+	return _mm_add_epi32(_mm_madd_epi16(flipped, _mm_set1_epi16(1)),
+						 _mm_set1_epi32(0x10000));
+}
+
+SSE41_HELPER __m128i mul_epi64(__m128i a, __m128i b) {
+	// the product of the low halves, plus the cross products moved into the
+	// high half
+	const __m128i low = _mm_mul_epu32(a, b);
+	const __m128i cross =
+		_mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b),
+					  _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+	return _mm_add_epi64(low, _mm_slli_epi64(cross, 32));
+}
+
+SSE41_HELPER __m128i abs_epi64(__m128i a) {
+	const __m128i sign = sign_epi64(a);
+	return _mm_sub_epi64(_mm_xor_si128(a, sign), sign);
+}
+
+SSE41_HELPER __m128i sra_epi64(__m128i a, __m128i n) {
+	const __m128i sign = sign_epi64(a);
+	return _mm_xor_si128(_mm_srl_epi64(_mm_xor_si128(a, sign), n), sign);
+}
+
+SSE41_HELPER __m128i sra_epi8(__m128i a, uint32_t k) {
+	// every byte doubled up into a 16 bit lane, shifted down past the copy
+	const __m128i n = _mm_cvtsi32_si128(k + 8);
+	return _mm_packs_epi16(_mm_sra_epi16(_mm_unpacklo_epi8(a, a), n),
+						   _mm_sra_epi16(_mm_unpackhi_epi8(a, a), n));
+}
+
+SSE41_HELPER __m128i min_ps(__m128i a, __m128i b) {
+	// minps returns its second operand if either is NaN or both are zero, so
+	// or-ing it both ways round gives -0 for +0 and -0, and NaNs become all
+	// ones
+	const __m128 x = ps(a);
+	const __m128 y = ps(b);
+	const __m128 min = _mm_or_ps(_mm_min_ps(x, y), _mm_min_ps(y, x));
+	return si(_mm_or_ps(min, _mm_cmpunord_ps(x, y)));
+}
+
+SSE41_HELPER __m128i max_ps(__m128i a, __m128i b) {
+	const __m128 x = ps(a);
+	const __m128 y = ps(b);
+	const __m128 max = _mm_and_ps(_mm_max_ps(x, y), _mm_max_ps(y, x));
+	return si(_mm_or_ps(max, _mm_cmpunord_ps(x, y)));
+}
+
+SSE41_HELPER __m128i min_pd(__m128i a, __m128i b) {
+	const __m128d x = pd(a);
+	const __m128d y = pd(b);
+	const __m128d min = _mm_or_pd(_mm_min_pd(x, y), _mm_min_pd(y, x));
+	return si(_mm_or_pd(min, _mm_cmpunord_pd(x, y)));
+}
+
+SSE41_HELPER __m128i max_pd(__m128i a, __m128i b) {
+	const __m128d x = pd(a);
+	const __m128d y = pd(b);
+	const __m128d max = _mm_and_pd(_mm_max_pd(x, y), _mm_max_pd(y, x));
+	return si(_mm_or_pd(max, _mm_cmpunord_pd(x, y)));
+}
+
+SSE41_HELPER __m128i trunc_sat_ps_epi32(__m128i a) {
+	// cvttps2dq gives INT32_MIN for NaN and anything out of range, which is
+	// only right for large negative lanes
+	const __m128 x = ps(a);
+	const __m128 ordered = _mm_and_ps(x, _mm_cmpeq_ps(x, x));
+	const __m128i too_large =
+		si(_mm_cmpge_ps(ordered, _mm_set1_ps(2147483648.0f)));
+	return _mm_xor_si128(_mm_cvttps_epi32(ordered), too_large);
+}
+
+SSE41_HELPER __m128i trunc_sat_pd_epi32(__m128i a) {
+	const __m128d x = pd(a);
+	const __m128d ordered = _mm_and_pd(x, _mm_cmpeq_pd(x, x));
+	return _mm_cvttpd_epi32(_mm_min_pd(ordered, _mm_set1_pd(2147483647.0)));
+}
+
+SSE41_HELPER __m128i convert_epu32_ps(__m128i a) {
+	// both 16 bit halves convert exactly, and are only rounded once added up
+	const __m128 high = _mm_cvtepi32_ps(_mm_srli_epi32(a, 16));
+	const __m128 low =
+		_mm_cvtepi32_ps(_mm_and_si128(a, _mm_set1_epi32(0xFFFF)));
+	return si(_mm_add_ps(_mm_mul_ps(high, _mm_set1_ps(65536.0f)), low));
+}
+
+SSE41_HELPER __m128i shuffle_epi8(__m128i a, __m128i b, __m128i lanes) {
+	// pshufb zeroes the lanes whose index has its top bit set, so each
+	// operand only fills in the lanes that index into it
+	const __m128i from_a =
+		_mm_or_si128(lanes, _mm_cmpgt_epi8(lanes, _mm_set1_epi8(15)));
+	const __m128i from_b = _mm_sub_epi8(lanes, _mm_set1_epi8(16));
+	return _mm_or_si128(_mm_shuffle_epi8(a, from_a),
+						_mm_shuffle_epi8(b, from_b));
+}
+
+// the comparisons of integer lanes. SSE only has eq and gt_s; the unsigned
+// ones compare against the minimum or maximum.
+#define SSE41_INTEGER_COMPARES(X, shape, bits, unsigned_bits)                  \
+	X(shape##_eq, _mm_cmpeq_epi##bits(a, b))                                   \
+	X(shape##_ne, not_si(_mm_cmpeq_epi##bits(a, b)))                           \
+	X(shape##_lt_s, _mm_cmpgt_epi##bits(b, a))                                 \
+	X(shape##_gt_s, _mm_cmpgt_epi##bits(a, b))                                 \
+	X(shape##_le_s, not_si(_mm_cmpgt_epi##bits(a, b)))                         \
+	X(shape##_ge_s, not_si(_mm_cmpgt_epi##bits(b, a)))                         \
+	X(shape##_lt_u,                                                            \
+	  not_si(_mm_cmpeq_epi##bits(_mm_max_##unsigned_bits(a, b), a)))           \
+	X(shape##_gt_u,                                                            \
+	  not_si(_mm_cmpeq_epi##bits(_mm_min_##unsigned_bits(a, b), a)))           \
+	X(shape##_le_u, _mm_cmpeq_epi##bits(_mm_min_##unsigned_bits(a, b), a))     \
+	X(shape##_ge_u, _mm_cmpeq_epi##bits(_mm_max_##unsigned_bits(a, b), a))
+
+#define SSE41_FLOAT_ARITHMETIC(X, shape, suffix)                               \
+	X(shape##_eq, si(_mm_cmpeq_##suffix(suffix(a), suffix(b))))                \
+	X(shape##_ne, si(_mm_cmpneq_##suffix(suffix(a), suffix(b))))               \
+	X(shape##_lt, si(_mm_cmplt_##suffix(suffix(a), suffix(b))))                \
+	X(shape##_gt, si(_mm_cmpgt_##suffix(suffix(a), suffix(b))))                \
+	X(shape##_le, si(_mm_cmple_##suffix(suffix(a), suffix(b))))                \
+	X(shape##_ge, si(_mm_cmpge_##suffix(suffix(a), suffix(b))))                \
+	X(shape##_add, si(_mm_add_##suffix(suffix(a), suffix(b))))                 \
+	X(shape##_sub, si(_mm_sub_##suffix(suffix(a), suffix(b))))                 \
+	X(shape##_mul, si(_mm_mul_##suffix(suffix(a), suffix(b))))                 \
+	X(shape##_div, si(_mm_div_##suffix(suffix(a), suffix(b))))                 \
+	X(shape##_min, min_##suffix(a, b))                                         \
+	X(shape##_max, max_##suffix(a, b))                                         \
+	X(shape##_pmin, si(_mm_min_##suffix(suffix(b), suffix(a))))                \
+	X(shape##_pmax, si(_mm_max_##suffix(suffix(b), suffix(a))))
+
+#define SSE41_BINARY_KERNELS(X)                                                \
+	SSE41_INTEGER_COMPARES(X, i8x16, 8, epu8)                                  \
+	SSE41_INTEGER_COMPARES(X, i16x8, 16, epu16)                                \
+	SSE41_INTEGER_COMPARES(X, i32x4, 32, epu32)                                \
+	X(i64x2_eq, _mm_cmpeq_epi64(a, b))                                         \
+	X(i64x2_ne, not_si(_mm_cmpeq_epi64(a, b)))                                 \
+	SSE41_FLOAT_ARITHMETIC(X, f32x4, ps)                                       \
+	SSE41_FLOAT_ARITHMETIC(X, f64x2, pd)                                       \
+                                                                               \
+	X(i8x16_swizzle,                                                           \
+	  _mm_shuffle_epi8(a, _mm_adds_epu8(b, _mm_set1_epi8(0x70))))              \
+	X(v128_and, _mm_and_si128(a, b))                                           \
+	X(v128_andnot, _mm_andnot_si128(b, a))                                     \
+	X(v128_or, _mm_or_si128(a, b))                                             \
+	X(v128_xor, _mm_xor_si128(a, b))                                           \
+                                                                               \
+	X(i8x16_narrow_i16x8_s, _mm_packs_epi16(a, b))                             \
+	X(i8x16_narrow_i16x8_u, _mm_packus_epi16(a, b))                            \
+	X(i8x16_add, _mm_add_epi8(a, b))                                           \
+	X(i8x16_add_sat_s, _mm_adds_epi8(a, b))                                    \
+	X(i8x16_add_sat_u, _mm_adds_epu8(a, b))                                    \
+	X(i8x16_sub, _mm_sub_epi8(a, b))                                           \
+	X(i8x16_sub_sat_s, _mm_subs_epi8(a, b))                                    \
+	X(i8x16_sub_sat_u, _mm_subs_epu8(a, b))                                    \
+	X(i8x16_min_s, _mm_min_epi8(a, b))                                         \
+	X(i8x16_min_u, _mm_min_epu8(a, b))                                         \
+	X(i8x16_max_s, _mm_max_epi8(a, b))                                         \
+	X(i8x16_max_u, _mm_max_epu8(a, b))                                         \
+	X(i8x16_avgr_u, _mm_avg_epu8(a, b))                                        \
+                                                                               \
+	X(i16x8_q15mulr_sat_s, q15mulr_sat_epi16(a, b))                            \
+	X(i16x8_narrow_i32x4_s, _mm_packs_epi32(a, b))                             \
+	X(i16x8_narrow_i32x4_u, _mm_packus_epi32(a, b))                            \
+	X(i16x8_add, _mm_add_epi16(a, b))                                          \
+	X(i16x8_add_sat_s, _mm_adds_epi16(a, b))                                   \
+	X(i16x8_add_sat_u, _mm_adds_epu16(a, b))                                   \
+	X(i16x8_sub, _mm_sub_epi16(a, b))                                          \
+	X(i16x8_sub_sat_s, _mm_subs_epi16(a, b))                                   \
+	X(i16x8_sub_sat_u, _mm_subs_epu16(a, b))                                   \
+	X(i16x8_mul, _mm_mullo_epi16(a, b))                                        \
+	X(i16x8_min_s, _mm_min_epi16(a, b))                                        \
+	X(i16x8_min_u, _mm_min_epu16(a, b))                                        \
+	X(i16x8_max_s, _mm_max_epi16(a, b))                                        \
+	X(i16x8_max_u, _mm_max_epu16(a, b))                                        \
+	X(i16x8_avgr_u, _mm_avg_epu16(a, b))                                       \
+	X(i16x8_extmul_low_i8x16_s,                                                \
+	  _mm_mullo_epi16(_mm_cvtepi8_epi16(a), _mm_cvtepi8_epi16(b)))             \
+	X(i16x8_extmul_high_i8x16_s,                                               \
+	  _mm_mullo_epi16(_mm_cvtepi8_epi16(high_half(a)),                         \
+					  _mm_cvtepi8_epi16(high_half(b))))                        \
+	X(i16x8_extmul_low_i8x16_u,                                                \
+	  _mm_mullo_epi16(_mm_cvtepu8_epi16(a), _mm_cvtepu8_epi16(b)))             \
+	X(i16x8_extmul_high_i8x16_u,                                               \
+	  _mm_mullo_epi16(_mm_cvtepu8_epi16(high_half(a)),                         \
+					  _mm_cvtepu8_epi16(high_half(b))))                        \
+                                                                               \
+	X(i32x4_add, _mm_add_epi32(a, b))                                          \
+	X(i32x4_sub, _mm_sub_epi32(a, b))                                          \
+	X(i32x4_mul, _mm_mullo_epi32(a, b))                                        \
+	X(i32x4_min_s, _mm_min_epi32(a, b))                                        \
+	X(i32x4_min_u, _mm_min_epu32(a, b))                                        \
+	X(i32x4_max_s, _mm_max_epi32(a, b))                                        \
+	X(i32x4_max_u, _mm_max_epu32(a, b))                                        \
+	X(i32x4_dot_i16x8_s, _mm_madd_epi16(a, b))                                 \
+	X(i32x4_extmul_low_i16x8_s,                                                \
+	  _mm_unpacklo_epi16(_mm_mullo_epi16(a, b), _mm_mulhi_epi16(a, b)))        \
+	X(i32x4_extmul_high_i16x8_s,                                               \
+	  _mm_unpackhi_epi16(_mm_mullo_epi16(a, b), _mm_mulhi_epi16(a, b)))        \
+	X(i32x4_extmul_low_i16x8_u,                                                \
+	  _mm_unpacklo_epi16(_mm_mullo_epi16(a, b), _mm_mulhi_epu16(a, b)))        \
+	X(i32x4_extmul_high_i16x8_u,                                               \
+	  _mm_unpackhi_epi16(_mm_mullo_epi16(a, b), _mm_mulhi_epu16(a, b)))        \
+                                                                               \
+	X(i64x2_add, _mm_add_epi64(a, b))                                          \
+	X(i64x2_sub, _mm_sub_epi64(a, b))                                          \
+	X(i64x2_mul, mul_epi64(a, b))                                              \
+	X(i64x2_extmul_low_i32x4_s,                                                \
+	  _mm_mul_epi32(_mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0)),             \
+					_mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0))))            \
+	X(i64x2_extmul_high_i32x4_s,                                               \
+	  _mm_mul_epi32(_mm_shuffle_epi32(a, _MM_SHUFFLE(1, 3, 0, 2)),             \
+					_mm_shuffle_epi32(b, _MM_SHUFFLE(1, 3, 0, 2))))            \
+	X(i64x2_extmul_low_i32x4_u,                                                \
+	  _mm_mul_epu32(_mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0)),             \
+					_mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0))))            \
+	X(i64x2_extmul_high_i32x4_u,                                               \
+	  _mm_mul_epu32(_mm_shuffle_epi32(a, _MM_SHUFFLE(1, 3, 0, 2)),             \
+					_mm_shuffle_epi32(b, _MM_SHUFFLE(1, 3, 0, 2))))
+
+#define SSE41_UNARY_KERNELS(X)                                                 \
+	X(v128_not, not_si(a))                                                     \
+	X(f32x4_demote_f64x2_zero, si(_mm_cvtpd_ps(pd(a))))                        \
+	X(f64x2_promote_low_f32x4, si(_mm_cvtps_pd(ps(a))))                        \
+                                                                               \
+	X(i8x16_abs, _mm_abs_epi8(a))                                              \
+	X(i8x16_neg, _mm_sub_epi8(_mm_setzero_si128(), a))                         \
+	X(i8x16_popcnt, popcnt_epi8(a))                                            \
+	X(i16x8_abs, _mm_abs_epi16(a))                                             \
+	X(i16x8_neg, _mm_sub_epi16(_mm_setzero_si128(), a))                        \
+	X(i32x4_abs, _mm_abs_epi32(a))                                             \
+	X(i32x4_neg, _mm_sub_epi32(_mm_setzero_si128(), a))                        \
+	X(i64x2_abs, abs_epi64(a))                                                 \
+	X(i64x2_neg, _mm_sub_epi64(_mm_setzero_si128(), a))                        \
+                                                                               \
+	X(i16x8_extadd_pairwise_i8x16_s, _mm_maddubs_epi16(_mm_set1_epi8(1), a))   \
+	X(i16x8_extadd_pairwise_i8x16_u, _mm_maddubs_epi16(a, _mm_set1_epi8(1)))   \
+	X(i32x4_extadd_pairwise_i16x8_s, _mm_madd_epi16(a, _mm_set1_epi16(1)))     \
+	X(i32x4_extadd_pairwise_i16x8_u, extadd_pairwise_epu16(a))                 \
+                                                                               \
+	X(i16x8_extend_low_i8x16_s, _mm_cvtepi8_epi16(a))                          \
+	X(i16x8_extend_high_i8x16_s, _mm_cvtepi8_epi16(high_half(a)))              \
+	X(i16x8_extend_low_i8x16_u, _mm_cvtepu8_epi16(a))                          \
+	X(i16x8_extend_high_i8x16_u, _mm_cvtepu8_epi16(high_half(a)))              \
+	X(i32x4_extend_low_i16x8_s, _mm_cvtepi16_epi32(a))                         \
+	X(i32x4_extend_high_i16x8_s, _mm_cvtepi16_epi32(high_half(a)))             \
+	X(i32x4_extend_low_i16x8_u, _mm_cvtepu16_epi32(a))                         \
+	X(i32x4_extend_high_i16x8_u, _mm_cvtepu16_epi32(high_half(a)))             \
+	X(i64x2_extend_low_i32x4_s, _mm_cvtepi32_epi64(a))                         \
+	X(i64x2_extend_high_i32x4_s, _mm_cvtepi32_epi64(high_half(a)))             \
+	X(i64x2_extend_low_i32x4_u, _mm_cvtepu32_epi64(a))                         \
+	X(i64x2_extend_high_i32x4_u, _mm_cvtepu32_epi64(high_half(a)))             \
+                                                                               \
+	X(f32x4_abs, _mm_and_si128(a, _mm_set1_epi32(INT32_MAX)))                  \
+	X(f32x4_neg, _mm_xor_si128(a, _mm_set1_epi32(INT32_MIN)))                  \
+	X(f32x4_sqrt, si(_mm_sqrt_ps(ps(a))))                                      \
+	X(f32x4_ceil, si(_mm_ceil_ps(ps(a))))                                      \
+	X(f32x4_floor, si(_mm_floor_ps(ps(a))))                                    \
+	X(f32x4_trunc, si(_mm_round_ps(ps(a), ROUND_TRUNC)))                       \
+	X(f32x4_nearest, si(_mm_round_ps(ps(a), ROUND_NEAREST)))                   \
+	X(f64x2_abs, _mm_and_si128(a, _mm_set1_epi64x(INT64_MAX)))                 \
+	X(f64x2_neg, _mm_xor_si128(a, _mm_set1_epi64x(INT64_MIN)))                 \
+	X(f64x2_sqrt, si(_mm_sqrt_pd(pd(a))))                                      \
+	X(f64x2_ceil, si(_mm_ceil_pd(pd(a))))                                      \
+	X(f64x2_floor, si(_mm_floor_pd(pd(a))))                                    \
+	X(f64x2_trunc, si(_mm_round_pd(pd(a), ROUND_TRUNC)))                       \
+	X(f64x2_nearest, si(_mm_round_pd(pd(a), ROUND_NEAREST)))                   \
+                                                                               \
+	X(i32x4_trunc_sat_f32x4_s, trunc_sat_ps_epi32(a))                          \
+	X(f32x4_convert_i32x4_s, si(_mm_cvtepi32_ps(a)))                           \
+	X(f32x4_convert_i32x4_u, convert_epu32_ps(a))                              \
+	X(i32x4_trunc_sat_f64x2_s_zero, trunc_sat_pd_epi32(a))                     \
+	X(f64x2_convert_low_i32x4_s, si(_mm_cvtepi32_pd(a)))
+
+// n is the shift count modulo the width of a lane, in the low 64 bits of a
+// vector. bytes are shifted as 16 bit lanes, and the bits that crossed over
+// into the neighbouring byte are masked off.
+#define SSE41_SHIFT_KERNELS(X)                                                 \
+	X(i8x16_shl, 8,                                                            \
+	  _mm_and_si128(_mm_sll_epi16(a, n),                                       \
+					_mm_set1_epi8(static_cast<int8_t>(0xFF << k))))            \
+	X(i8x16_shr_s, 8, sra_epi8(a, k))                                          \
+	X(i8x16_shr_u, 8,                                                          \
+	  _mm_and_si128(_mm_srl_epi16(a, n), _mm_set1_epi8(0xFF >> k)))            \
+	X(i16x8_shl, 16, _mm_sll_epi16(a, n))                                      \
+	X(i16x8_shr_s, 16, _mm_sra_epi16(a, n))                                    \
+	X(i16x8_shr_u, 16, _mm_srl_epi16(a, n))                                    \
+	X(i32x4_shl, 32, _mm_sll_epi32(a, n))                                      \
+	X(i32x4_shr_s, 32, _mm_sra_epi32(a, n))                                    \
+	X(i32x4_shr_u, 32, _mm_srl_epi32(a, n))                                    \
+	X(i64x2_shl, 64, _mm_sll_epi64(a, n))                                      \
+	X(i64x2_shr_s, 64, sra_epi64(a, n))                                        \
+	X(i64x2_shr_u, 64, _mm_srl_epi64(a, n))
+
+#define SSE41_TEST_KERNELS(X)                                                  \
+	X(v128_any_true, !_mm_testz_si128(a, a))                                   \
+	X(i8x16_all_true,                                                          \
+	  _mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_setzero_si128())) == 0)          \
+	X(i16x8_all_true,                                                          \
+	  _mm_movemask_epi8(_mm_cmpeq_epi16(a, _mm_setzero_si128())) == 0)         \
+	X(i32x4_all_true,                                                          \
+	  _mm_movemask_epi8(_mm_cmpeq_epi32(a, _mm_setzero_si128())) == 0)         \
+	X(i64x2_all_true,                                                          \
+	  _mm_movemask_epi8(_mm_cmpeq_epi64(a, _mm_setzero_si128())) == 0)         \
+	X(i8x16_bitmask, _mm_movemask_epi8(a))                                     \
+	X(i16x8_bitmask,                                                           \
+	  _mm_movemask_epi8(_mm_packs_epi16(a, _mm_setzero_si128())))              \
+	X(i32x4_bitmask, _mm_movemask_ps(ps(a)))                                   \
+	X(i64x2_bitmask, _mm_movemask_pd(pd(a)))
+
+// pcmpgtq is SSE4.2, which every AVX2 host has
+#define AVX2_BINARY_KERNELS(X)                                                 \
+	X(i64x2_lt_s, _mm_cmpgt_epi64(b, a))                                       \
+	X(i64x2_gt_s, _mm_cmpgt_epi64(a, b))                                       \
+	X(i64x2_le_s, not_si(_mm_cmpgt_epi64(a, b)))                               \
+	X(i64x2_ge_s, not_si(_mm_cmpgt_epi64(b, a)))
+
+#define UNARY_KERNEL(level, isa, name, expression)                             \
+	[[gnu::target(isa)]] static void level##_##name(uint64_t *v) {             \
+		const __m128i a = load_vector(v);                                      \
+		store_vector(v, expression);                                           \
+	}
+
+#define BINARY_KERNEL(level, isa, name, expression)                            \
+	[[gnu::target(isa)]] static void level##_##name(uint64_t *v) {             \
+		const __m128i a = load_vector(v);                                      \
+		const __m128i b = load_vector(v + 2);                                  \
+		store_vector(v, expression);                                           \
+	}
+
+#define SHIFT_KERNEL(level, isa, name, bits, expression)                       \
+	[[gnu::target(isa)]] static void level##_##name(uint64_t *v,               \
+													   uint32_t count) {       \
+		const uint32_t k = count % bits;                                       \
+		[[maybe_unused]] const __m128i n = _mm_cvtsi32_si128(k);               \
+		const __m128i a = load_vector(v);                                      \
+		store_vector(v, expression);                                           \
+	}
+
+#define TEST_KERNEL(level, isa, name, expression)                              \
+	[[gnu::target(isa)]] static uint32_t level##_##name(                       \
+		const uint64_t *v) {                                                   \
+		const __m128i a = load_vector(v);                                      \
+		return expression;                                                     \
+	}
+
+#define SSE41_UNARY_KERNEL(name, expression)                                   \
+	UNARY_KERNEL(sse41, "sse4.1", name, expression)                            \
+	UNARY_KERNEL(avx2, "avx2", name, expression)
+#define SSE41_BINARY_KERNEL(name, expression)                                  \
+	BINARY_KERNEL(sse41, "sse4.1", name, expression)                           \
+	BINARY_KERNEL(avx2, "avx2", name, expression)
+#define SSE41_SHIFT_KERNEL(name, bits, expression)                             \
+	SHIFT_KERNEL(sse41, "sse4.1", name, bits, expression)                      \
+	SHIFT_KERNEL(avx2, "avx2", name, bits, expression)
+#define SSE41_TEST_KERNEL(name, expression)                                    \
+	TEST_KERNEL(sse41, "sse4.1", name, expression)                             \
+	TEST_KERNEL(avx2, "avx2", name, expression)
+#define AVX2_BINARY_KERNEL(name, expression)                                   \
+	BINARY_KERNEL(avx2, "avx2", name, expression)
+
+SSE41_UNARY_KERNELS(SSE41_UNARY_KERNEL)
+SSE41_BINARY_KERNELS(SSE41_BINARY_KERNEL)
+SSE41_SHIFT_KERNELS(SSE41_SHIFT_KERNEL)
+SSE41_TEST_KERNELS(SSE41_TEST_KERNEL)
+AVX2_BINARY_KERNELS(AVX2_BINARY_KERNEL)
+
+#undef SSE41_UNARY_KERNEL
+#undef SSE41_BINARY_KERNEL
+#undef SSE41_SHIFT_KERNEL
+#undef SSE41_TEST_KERNEL
+#undef AVX2_BINARY_KERNEL
+#undef UNARY_KERNEL
+#undef BINARY_KERNEL
+#undef SHIFT_KERNEL
+#undef TEST_KERNEL
+
+[[gnu::target("sse4.1")]] static void
+sse41_i8x16_shuffle(uint64_t *v, const uint8_t *lanes) {
+	const __m128i indices =
+		_mm_loadu_si128(reinterpret_cast<const __m128i *>(lanes));
+	store_vector(v, shuffle_epi8(load_vector(v), load_vector(v + 2), indices));
+}
+
+[[gnu::target("avx2")]] static void
+avx2_i8x16_shuffle(uint64_t *v, const uint8_t *lanes) {
+	const __m128i indices =
+		_mm_loadu_si128(reinterpret_cast<const __m128i *>(lanes));
+	store_vector(v, shuffle_epi8(load_vector(v), load_vector(v + 2), indices));
+}
+
+/**
+ * The portable kernels, with those of the given level in place of the ones it
+ * has.
+ */
+static SimdKernels x86_kernels(SimdLevel level) {
+	SimdKernels kernels = SCALAR_KERNELS;
+	const bool avx2 = level == SimdLevel::Avx2;
+
+#define KERNEL_ENTRY(name, ...)                                                \
+	kernels.name = avx2 ? avx2_##name : sse41_##name;
+
+	SSE41_UNARY_KERNELS(KERNEL_ENTRY)
+	SSE41_BINARY_KERNELS(KERNEL_ENTRY)
+	SSE41_SHIFT_KERNELS(KERNEL_ENTRY)
+	SSE41_TEST_KERNELS(KERNEL_ENTRY)
+	KERNEL_ENTRY(i8x16_shuffle)
+
+#undef KERNEL_ENTRY
+
+	if (avx2) {
+#define AVX2_KERNEL_ENTRY(name, expression) kernels.name = avx2_##name;
+		AVX2_BINARY_KERNELS(AVX2_KERNEL_ENTRY)
+#undef AVX2_KERNEL_ENTRY
+	}
+
+	return kernels;
+}
+
+#undef SSE41_INTEGER_COMPARES
+#undef SSE41_FLOAT_ARITHMETIC
+#undef SSE41_BINARY_KERNELS
+#undef SSE41_UNARY_KERNELS
+#undef SSE41_SHIFT_KERNELS
+#undef SSE41_TEST_KERNELS
+#undef AVX2_BINARY_KERNELS
+#undef SSE41_HELPER
+
+#endif
+
+static const SimdKernels &kernels_of(SimdLevel level) {
+#if defined(__x86_64__)
+	static const SimdKernels sse41 = x86_kernels(SimdLevel::Sse41);
+	static const SimdKernels avx2 = x86_kernels(SimdLevel::Avx2);
+	switch (level) {
+	case SimdLevel::Sse41:
+		return sse41;
+	case SimdLevel::Avx2:
+		return avx2;
+	default:
+		break;
+	}
+#endif
+	return SCALAR_KERNELS;
+}
+
+// nullptr until a level has been set, or the kernels are first needed
+static std::atomic<const SimdKernels *> active_kernels = nullptr;
+
+SimdLevel detect_simd_level() {
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		return SimdLevel::Avx2;
+	}
+	if (__builtin_cpu_supports("sse4.1")) {
+		return SimdLevel::Sse41;
+	}
+#endif
+	return SimdLevel::Scalar;
+}
+
+bool set_simd_level(SimdLevel level) {
+	if (level > detect_simd_level()) {
+		return false;
+	}
+	active_kernels.store(&kernels_of(level), std::memory_order_release);
+	return true;
+}
+
+const SimdKernels &simd_kernels() {
+	const SimdKernels *kernels =
+		active_kernels.load(std::memory_order_acquire);
+	if (kernels == nullptr) {
+		// racing threads all pick the same level
+		set_simd_level(detect_simd_level());
+		kernels = active_kernels.load(std::memory_order_acquire);
+	}
+	return *kernels;
+}
+
+std::optional<SimdLevel> simd_level_named(std::string_view name) {
+	for (const SimdLevel level :
+		 {SimdLevel::Scalar, SimdLevel::Sse41, SimdLevel::Avx2}) {
+		if (name == simd_level_name(level)) {
+			return level;
+		}
+	}
+	return std::nullopt;
+}
+
+const char *simd_level_name(SimdLevel level) {
+	switch (level) {
+	case SimdLevel::Sse41:
+		return "sse4.1";
+	case SimdLevel::Avx2:
+		return "avx2";
+	default:
+		return "scalar";
+	}
+}
+
+} // namespace Treble
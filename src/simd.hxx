@@ -0,0 +1,167 @@
+#ifndef __TREBLE__SIMD_HXX__
+#define __TREBLE__SIMD_HXX__
+
+#include "instructions.hxx"
+#include "module.hxx"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string_view>
+
+/**
+ * Types and semantics of the instructions of the SIMD proposal. A v128 takes
+ * two of the 64 bit slots the stack interpreter keeps values in, its low half
+ * first, with its lanes in little endian order.
+ *
+ * The instructions that do arithmetic on every lane run kernels, which come in
+ * a portable version and in versions built on the SSE4.1 and AVX2 intrinsics
+ * of the host. The best version the host supports is chosen the first time
+ * the kernels are needed.
+ */
+
+namespace Treble {
+
+/**
+ * The instruction sets the SIMD kernels can be built on. Every level includes
+ * the ones before it.
+ */
+enum class SimdLevel : uint8_t {
+	// plain C++, one lane at a time
+	Scalar,
+	Sse41,
+	// the SSE4.1 kernels in their VEX encoding, plus the few 128 bit
+	// instructions that need more than SSE4.1
+	Avx2,
+};
+
+/**
+ * Kernels of the SIMD instructions, one per instruction. They work in place on
+ * the stack slots of their operands.
+ */
+struct SimdKernels {
+	// v points to the operand, which is replaced by the result
+#define SIMD_UNARY_KERNEL(name, op_code, text) void (*name)(uint64_t *v);
+	TREBLE_FOREACH_SIMD_UNARY_OPCODE(SIMD_UNARY_KERNEL)
+#undef SIMD_UNARY_KERNEL
+
+	// v points to the first operand, which is followed by the second one and
+	// replaced by the result
+#define SIMD_BINARY_KERNEL(name, op_code, text) void (*name)(uint64_t *v);
+	TREBLE_FOREACH_SIMD_BINARY_OPCODE(SIMD_BINARY_KERNEL)
+#undef SIMD_BINARY_KERNEL
+
+	// v points to the operand, which is replaced by the result
+#define SIMD_SHIFT_KERNEL(name, op_code, text)                                 \
+	void (*name)(uint64_t *v, uint32_t count);
+	TREBLE_FOREACH_SIMD_SHIFT_OPCODE(SIMD_SHIFT_KERNEL)
+#undef SIMD_SHIFT_KERNEL
+
+#define SIMD_TEST_KERNEL(name, op_code, text)                                  \
+	uint32_t (*name)(const uint64_t *v);
+	TREBLE_FOREACH_SIMD_TEST_OPCODE(SIMD_TEST_KERNEL)
+#undef SIMD_TEST_KERNEL
+
+	// like a binary kernel, with the lane indices of the instruction
+	void (*i8x16_shuffle)(uint64_t *v, const uint8_t *lanes);
+};
+
+/**
+ * The best level the host supports.
+ */
+SimdLevel detect_simd_level();
+
+/**
+ * Makes the kernels of the given level the ones simd_kernels returns, unless
+ * the host does not support it. Only meant to be called before any SIMD code
+ * runs, e.g. to compare the levels against each other.
+ */
+bool set_simd_level(SimdLevel level);
+
+/**
+ * The kernels of the level that was set, or of detect_simd_level if none was.
+ */
+const SimdKernels &simd_kernels();
+
+/**
+ * Parses the name of a level, as simd_level_name returns it.
+ */
+std::optional<SimdLevel> simd_level_named(std::string_view name);
+
+const char *simd_level_name(SimdLevel level);
+
+/**
+ * Number of lanes of the shape the name of an instruction in the text format
+ * starts with, e.g. 4 for i32x4.add.
+ */
+constexpr size_t simd_lane_count(std::string_view text) {
+	const std::string_view shape = text.substr(0, text.find('.'));
+	return shape.ends_with("x16")  ? 16
+		   : shape.ends_with("x8") ? 8
+		   : shape.ends_with("x4") ? 4
+								   : 2;
+}
+
+/**
+ * Type of the scalars in the lanes of the shape the name of an instruction in
+ * the text format starts with. Lanes narrower than 32 bits are i32 scalars.
+ */
+constexpr ValueType simd_lane_type(std::string_view text) {
+	if (text.starts_with("i64")) {
+		return ValueType::i64;
+	}
+	if (text.starts_with("f32")) {
+		return ValueType::f32;
+	}
+	if (text.starts_with("f64")) {
+		return ValueType::f64;
+	}
+	return ValueType::i32;
+}
+
+/**
+ * Number of lanes of a v128 that a load or store of a single lane, such as
+ * v128.load16_lane, picks its lane from.
+ */
+constexpr size_t simd_access_lane_count(std::string_view text) {
+	const std::string_view bits =
+		text.substr(text.find_first_of("0123456789", sizeof("v128")));
+	return bits.starts_with("8")	? 16
+		   : bits.starts_with("16") ? 8
+		   : bits.starts_with("32") ? 4
+									: 2;
+}
+
+/**
+ * Reads the given lane of the v128 at v.
+ */
+template <typename Lane>
+inline Lane extract_lane(const uint64_t *v, size_t lane) {
+	Lane value;
+	std::memcpy(&value,
+				reinterpret_cast<const uint8_t *>(v) + lane * sizeof(Lane),
+				sizeof(value));
+	return value;
+}
+
+/**
+ * Writes the given lane of the v128 at v.
+ */
+template <typename Lane>
+inline void replace_lane(uint64_t *v, size_t lane, Lane value) {
+	std::memcpy(reinterpret_cast<uint8_t *>(v) + lane * sizeof(Lane), &value,
+				sizeof(value));
+}
+
+/**
+ * Writes value to every lane of the v128 at v.
+ */
+template <typename Lane> inline void splat_lanes(uint64_t *v, Lane value) {
+	for (size_t i = 0; i < 16 / sizeof(Lane); ++i) {
+		replace_lane(v, i, value);
+	}
+}
+
+} // namespace Treble
+
+#endif
@@ -0,0 +1,81 @@
+#include "thread_pool.hxx"
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace Treble {
+
+ThreadPool::ThreadPool(size_t worker_count) {
+	for (size_t i = 1; i < worker_count; ++i) {
+		threads.emplace_back(&ThreadPool::run, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+	}
+	work_available.notify_all();
+
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+}
+
+void ThreadPool::parallel_for(size_t count,
+							  const std::function<void(size_t, size_t)> &task) {
+	{
+		std::lock_guard lock(mutex);
+		this->task = &task;
+		task_count = count;
+		next_index.store(0, std::memory_order_relaxed);
+		busy_workers = threads.size();
+		generation++;
+	}
+	work_available.notify_all();
+
+	// the calling thread works through the loop as worker 0
+	work(0);
+
+	std::unique_lock lock(mutex);
+	done.wait(lock, [this] { return busy_workers == 0; });
+	this->task = nullptr;
+}
+
+void ThreadPool::run(size_t worker) {
+	size_t seen_generation = 0;
+
+	std::unique_lock lock(mutex);
+	while (true) {
+		work_available.wait(lock, [&] {
+			return stopping || generation != seen_generation;
+		});
+		if (stopping) {
+			return;
+		}
+		seen_generation = generation;
+
+		lock.unlock();
+		work(worker);
+		lock.lock();
+
+		if (--busy_workers == 0) {
+			done.notify_one();
+		}
+	}
+}
+
+void ThreadPool::work(size_t worker) {
+	while (true) {
+		const size_t index = next_index.fetch_add(1, std::memory_order_relaxed);
+		if (index >= task_count) {
+			return;
+		}
+		(*task)(index, worker);
+	}
+}
+
+} // namespace Treble
@@ -0,0 +1,63 @@
+#ifndef __TREBLE__THREAD_POOL_HXX__
+#define __TREBLE__THREAD_POOL_HXX__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Treble {
+
+/**
+ * A fixed set of worker threads that split loops over independent items
+ * between them, such as decoding the function bodies of a module.
+ */
+class ThreadPool {
+  public:
+	/**
+	 * Creates a pool of worker_count workers. The thread that calls
+	 * parallel_for is one of them, so worker_count - 1 threads are started.
+	 */
+	explicit ThreadPool(size_t worker_count);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	size_t worker_count() const { return threads.size() + 1; }
+
+	/**
+	 * Calls task(index, worker) for every index below count, and returns once
+	 * all calls are done. worker identifies the worker the call runs on, and
+	 * is below worker_count(). Must not be called from more than one thread at
+	 * a time.
+	 */
+	void parallel_for(size_t count,
+					  const std::function<void(size_t, size_t)> &task);
+
+  private:
+	void run(size_t worker);
+	void work(size_t worker);
+
+	std::vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::condition_variable done;
+	// bumped for every parallel_for, so that workers can tell new work apart
+	// from a spurious wake up
+	size_t generation = 0;
+	size_t busy_workers = 0;
+	bool stopping = false;
+
+	const std::function<void(size_t, size_t)> *task = nullptr;
+	size_t task_count = 0;
+	std::atomic<size_t> next_index = 0;
+};
+
+} // namespace Treble
+
+#endif
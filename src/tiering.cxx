@@ -0,0 +1,181 @@
+#include "tiering.hxx"
+#include "jit.hxx"
+#include "perf_map.hxx"
+#include "register_ir.hxx"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace Treble {
+
+struct CompileJob {
+	FunctionInstance *func;
+	bool use_jit;
+	bool use_register_ir;
+};
+
+/**
+ * Compiles the best optimized tier the function can be translated to and
+ * publishes it. The function must already be in Tier::Compiling.
+ */
+static void compile_optimized_tier(const CompileJob &job) {
+	FunctionInstance &func = *job.func;
+
+	JitFunction *jit_code = job.use_jit ? compile_function(func.code) : nullptr;
+	if (jit_code != nullptr) {
+		record_perf_map(jit_code->code, jit_code->code_size,
+						function_index(func));
+		std::atomic_ref(func.jit_code).store(jit_code, std::memory_order_release);
+	} else if (job.use_register_ir) {
+		std::atomic_ref(func.register_code)
+			.store(lower_function(func.code), std::memory_order_release);
+	}
+
+	std::atomic_ref(func.tier).store(Tier::Optimized, std::memory_order_release);
+}
+
+/**
+ * Owns the thread that compiles optimized tiers in the background, so that
+ * the interpreter never has to wait for the compiler.
+ */
+class BackgroundCompiler {
+  public:
+	~BackgroundCompiler() {
+		{
+			std::lock_guard lock(mutex);
+			stopping = true;
+		}
+		work_available.notify_all();
+
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
+
+	void enqueue(const CompileJob &job) {
+		{
+			std::lock_guard lock(mutex);
+			jobs.push_back(job);
+			// the thread is only started once there is something to compile
+			if (!thread.joinable()) {
+				thread = std::thread(&BackgroundCompiler::run, this);
+			}
+		}
+		work_available.notify_one();
+	}
+
+	/**
+	 * Drops the jobs for functions of the given instance, and waits for the
+	 * one that is being compiled if it is one of them.
+	 */
+	void cancel(const ModuleInstance &instance) {
+		std::unique_lock lock(mutex);
+		std::erase_if(jobs, [&](const CompileJob &job) {
+			return job.func->module == &instance;
+		});
+		job_finished.wait(lock, [&] { return compiling != &instance; });
+	}
+
+  private:
+	void run() {
+		std::unique_lock lock(mutex);
+		while (true) {
+			work_available.wait(lock,
+								[this] { return stopping || !jobs.empty(); });
+			if (stopping) {
+				return;
+			}
+
+			const CompileJob job = jobs.front();
+			jobs.pop_front();
+			compiling = job.func->module;
+
+			lock.unlock();
+			compile_optimized_tier(job);
+			lock.lock();
+
+			compiling = nullptr;
+			job_finished.notify_all();
+		}
+	}
+
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::condition_variable job_finished;
+	std::deque<CompileJob> jobs;
+	// the instance of the function that is being compiled, if any
+	const ModuleInstance *compiling = nullptr;
+	bool stopping = false;
+	std::thread thread;
+};
+
+static BackgroundCompiler &background_compiler() {
+	static BackgroundCompiler compiler;
+	return compiler;
+}
+
+/**
+ * Moves the function to Tier::Compiling. Returns false if some other caller
+ * already started promoting it.
+ */
+static bool start_tier_up(FunctionInstance &func) {
+	std::atomic_ref tier(func.tier);
+	if (tier.load(std::memory_order_relaxed) != Tier::Interpreted) {
+		return false;
+	}
+
+	Tier expected = Tier::Interpreted;
+	return tier.compare_exchange_strong(expected, Tier::Compiling,
+										std::memory_order_acq_rel);
+}
+
+void record_call(FunctionInstance &func, const RuntimeConfig &config) {
+	// a plain load and store is much cheaper than an atomic increment, and the
+	// counter does not need to be exact.
+	std::atomic_ref call_count(func.call_count);
+	const uint32_t calls = call_count.load(std::memory_order_relaxed) + 1;
+	call_count.store(calls, std::memory_order_relaxed);
+
+	const uint32_t hotness =
+		calls +
+		std::atomic_ref(func.back_edge_count).load(std::memory_order_relaxed);
+	if (hotness < config.tier_up_threshold) {
+		return;
+	}
+
+	if (!config.use_jit && !config.use_register_ir) {
+		return;
+	}
+
+	if (!config.background_compile) {
+		tier_up(func, config);
+		return;
+	}
+
+	if (start_tier_up(func)) {
+		background_compiler().enqueue({
+			.func = &func,
+			.use_jit = config.use_jit,
+			.use_register_ir = config.use_register_ir,
+		});
+	}
+}
+
+void tier_up(FunctionInstance &func, const RuntimeConfig &config) {
+	if (start_tier_up(func)) {
+		compile_optimized_tier({
+			.func = &func,
+			.use_jit = config.use_jit,
+			.use_register_ir = config.use_register_ir,
+		});
+	}
+}
+
+void cancel_tier_ups(const ModuleInstance &instance) {
+	background_compiler().cancel(instance);
+}
+
+} // namespace Treble
@@ -0,0 +1,32 @@
+#ifndef __TREBLE__TIERING_HXX__
+#define __TREBLE__TIERING_HXX__
+
+#include "module.hxx"
+#include "runtime.hxx"
+
+namespace Treble {
+
+/**
+ * Records a call of the given function, and starts promoting it to an
+ * optimized tier if it just became hot. Depending on the config, the optimized
+ * code is compiled right away or on the background compile thread.
+ */
+void record_call(FunctionInstance &func, const RuntimeConfig &config);
+
+/**
+ * Compiles the optimized tier of the given function on the calling thread and
+ * publishes it, unless another thread already got to it first.
+ */
+void tier_up(FunctionInstance &func, const RuntimeConfig &config);
+
+/**
+ * Drops the background tier-ups of functions of the given instance that have
+ * not started yet, and waits for the one that is being compiled if it belongs
+ * to the instance. Must be called before the instance goes away, as the
+ * background compile thread writes to the functions it compiles.
+ */
+void cancel_tier_ups(const ModuleInstance &instance);
+
+} // namespace Treble
+
+#endif
@@ -0,0 +1,31 @@
+#include "trace.hxx"
+#include <cstdint>
+#include <ostream>
+
+namespace Treble {
+
+void TraceRing::dump(std::ostream &out) {
+	const uint64_t first = next > CAPACITY ? next - CAPACITY : 0;
+	if (first > 0) {
+		out << "(" << first << " older events dropped)\n";
+	}
+
+	for (uint64_t i = first; i < next; ++i) {
+		const TraceEvent &event = events[i % CAPACITY];
+		out << event.label << " [height " << event.stack_height;
+		if (event.stack_height > 0) {
+			out << ", top " << event.top;
+		}
+		out << "]\n";
+	}
+	out.flush();
+
+	next = 0;
+}
+
+TraceRing &thread_trace_ring() {
+	thread_local TraceRing ring;
+	return ring;
+}
+
+} // namespace Treble
@@ -0,0 +1,94 @@
+#ifndef __TREBLE__TRACE_HXX__
+#define __TREBLE__TRACE_HXX__
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/**
+ * Tracing is chosen at compile time by defining TREBLE_TRACE_LEVEL as one of
+ * the levels below. Every level includes the ones before it. Trace points
+ * above the chosen level expand to nothing, so a build without tracing carries
+ * no tracing code at all. Debug builds trace every instruction by default,
+ * other builds trace nothing.
+ */
+#define TREBLE_TRACE_OFF 0
+// every call made through invoke, and the results it returned
+#define TREBLE_TRACE_CALLS 1
+// every instruction the stack interpreter runs
+#define TREBLE_TRACE_INSTRUCTIONS 2
+
+#ifndef TREBLE_TRACE_LEVEL
+#ifdef DEBUG
+#define TREBLE_TRACE_LEVEL TREBLE_TRACE_INSTRUCTIONS
+#else
+#define TREBLE_TRACE_LEVEL TREBLE_TRACE_OFF
+#endif
+#endif
+
+namespace Treble {
+
+struct TraceEvent {
+	// what happened, e.g. the name of the instruction about to run. always
+	// points to a string literal.
+	const char *label;
+	// number of operands on the stack at the time, and the top-most of them
+	int64_t stack_height;
+	uint64_t top;
+};
+
+/**
+ * The most recent events recorded on one thread. Only the thread itself ever
+ * touches its ring, so recording an event takes neither a lock nor an atomic
+ * operation, and never does any I/O. Once the ring is full, every new event
+ * replaces the oldest one.
+ */
+class TraceRing {
+  public:
+	static constexpr size_t CAPACITY = 4096;
+
+	TraceRing() : events(CAPACITY) {}
+
+	void record(const char *label, int64_t stack_height, uint64_t top) {
+		events[next % CAPACITY] = {
+			.label = label,
+			.stack_height = stack_height,
+			.top = top,
+		};
+		next++;
+	}
+
+	/**
+	 * Writes the events in the ring to out, oldest first, and empties it.
+	 */
+	void dump(std::ostream &out);
+
+  private:
+	std::vector<TraceEvent> events;
+	// number of events ever recorded
+	uint64_t next = 0;
+};
+
+/**
+ * The ring of the calling thread.
+ */
+TraceRing &thread_trace_ring();
+
+} // namespace Treble
+
+#if TREBLE_TRACE_LEVEL >= TREBLE_TRACE_CALLS
+#define TREBLE_TRACE_CALL(label, stack_height, top)                            \
+	::Treble::thread_trace_ring().record(label, stack_height, top)
+#else
+#define TREBLE_TRACE_CALL(label, stack_height, top) ((void)0)
+#endif
+
+#if TREBLE_TRACE_LEVEL >= TREBLE_TRACE_INSTRUCTIONS
+#define TREBLE_TRACE_INSTRUCTION(label, stack_height, top)                     \
+	::Treble::thread_trace_ring().record(label, stack_height, top)
+#else
+#define TREBLE_TRACE_INSTRUCTION(label, stack_height, top) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,784 @@
+#include "validator.hxx"
+#include "bytecode.hxx"
+#include "instructions.hxx"
+#include "module.hxx"
+#include "numeric.hxx"
+#include "simd.hxx"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace Treble {
+
+/**
+ * A block, loop or if, or the body of the function, that is being validated.
+ */
+struct ControlFrame {
+	// ByteOp::block or ByteOp::loop, ByteOp::if_ while in the first arm of an
+	// if and ByteOp::else_ after the else, and ByteOp::end_function for the
+	// body of the function
+	ByteOp op;
+	// number of operands on the stack when the block was entered, which the
+	// block can not take off it
+	size_t height;
+	// number of stack slots those operands take
+	size_t slot_height;
+	// EMPTY_BLOCK_TYPE, or the type of the value the block yields
+	uint8_t block_type;
+	// whether the rest of the block can never run, as it comes after a return.
+	// the stack is then empty down to height, and operands are taken off it
+	// that are not there, of whatever type they need to be.
+	bool unreachable;
+};
+
+/**
+ * log2 of the number of bytes the memory access of the instruction with the
+ * given name in the text format reads or writes, which is the most alignment
+ * its memarg may promise. The width is in the name, e.g. i64.load16_s or
+ * i32.atomic.rmw8.add_u, or else it is that of the type the name starts with.
+ */
+static constexpr uint32_t natural_alignment(std::string_view text) {
+	const std::string_view access = text.substr(text.find('.') + 1);
+	const size_t digits = access.find_first_of("0123456789");
+	if (digits == std::string_view::npos) {
+		// memory.atomic.notify counts the waiters on an i32
+		if (text.starts_with("v128")) {
+			return 4;
+		}
+		return text.substr(1, 2) == "64" ? 3 : 2;
+	}
+
+	const std::string_view bits = access.substr(digits);
+	// v128.load8x8_s and its kind widen 64 bits into the lanes of a v128
+	const size_t shape = bits.find_first_not_of("0123456789");
+	if (shape != std::string_view::npos && bits[shape] == 'x') {
+		return 3;
+	}
+	return bits.starts_with("8")	? 0
+		   : bits.starts_with("16") ? 1
+		   : bits.starts_with("32") ? 2
+									: 3;
+}
+
+/**
+ * Whether the instruction with the given name in the text format may promise
+ * the given alignment. Atomic accesses have to promise exactly their natural
+ * alignment, the others anything up to it.
+ */
+static constexpr bool alignment_valid(std::string_view text, uint32_t align) {
+	if (text.find(".atomic.") != std::string_view::npos) {
+		return align == natural_alignment(text);
+	}
+	return align <= natural_alignment(text);
+}
+
+class Validator {
+  public:
+	std::optional<uint32_t>
+	validate(const Function &func, std::span<const Instruction> instructions,
+			 const Module &module, std::span<const ValueType> locals,
+			 std::vector<size_t> *v128_drops,
+			 std::vector<BranchUnwind> *branch_unwinds) {
+		const FunctionType &type = module.types[func.type_index];
+		const bool has_memory = module.memory != nullptr;
+
+		this->locals = locals;
+		for (size_t i = 0; i < locals.size(); ++i) {
+			slot_locals.push_back(i);
+			if (locals[i] == ValueType::v128) {
+				slot_locals.push_back(NO_LOCAL);
+			}
+		}
+
+		results = std::span(type.result_types, type.result_count);
+		frames.push_back({
+			.op = ByteOp::end_function,
+			.height = 0,
+			.slot_height = 0,
+			.block_type = EMPTY_BLOCK_TYPE,
+			.unreachable = false,
+		});
+		for (size_t i = 0; i < instructions.size(); ++i) {
+			const Instruction &instr = instructions[i];
+			const ByteOp op = byte_op(instr);
+			switch (op) {
+#define UNARY_CASE(name, op_code, text)                                        \
+	case ByteOp::name: {                                                       \
+		constexpr NumericSignature signature = numeric_signature(text);        \
+		if (!pop(signature.operand)) {                                         \
+			return std::nullopt;                                               \
+		}                                                                      \
+		push(signature.result);                                                \
+		break;                                                                 \
+	}
+
+				TREBLE_FOREACH_UNARY_OPCODE(UNARY_CASE)
+
+#undef UNARY_CASE
+
+#define BINARY_CASE(name, op_code, text)                                       \
+	case ByteOp::name: {                                                       \
+		constexpr NumericSignature signature = numeric_signature(text);        \
+		if (!pop(signature.operand) || !pop(signature.operand)) {              \
+			return std::nullopt;                                               \
+		}                                                                      \
+		push(signature.result);                                                \
+		break;                                                                 \
+	}
+
+				TREBLE_FOREACH_BINARY_OPCODE(BINARY_CASE)
+
+#undef BINARY_CASE
+
+#define LOAD_CASE(name, op_code, text)                                         \
+	case ByteOp::name:                                                         \
+		if (!has_memory ||                                                     \
+			!alignment_valid(text, instr.args.memarg.align) ||                 \
+			!pop(ValueType::i32)) {                                            \
+			return std::nullopt;                                               \
+		}                                                                      \
+		push(value_type_named(std::string_view(text).substr(0, 3)));           \
+		break;
+
+				TREBLE_FOREACH_LOAD_OPCODE(LOAD_CASE)
+				TREBLE_FOREACH_ATOMIC_LOAD_OPCODE(LOAD_CASE)
+
+#undef LOAD_CASE
+
+#define STORE_CASE(name, op_code, text)                                        \
+	case ByteOp::name:                                                         \
+		if (!has_memory ||                                                     \
+			!alignment_valid(text, instr.args.memarg.align) ||                 \
+			!pop(value_type_named(std::string_view(text).substr(0, 3))) ||     \
+			!pop(ValueType::i32)) {                                            \
+			return std::nullopt;                                               \
+		}                                                                      \
+		break;
+
+				TREBLE_FOREACH_STORE_OPCODE(STORE_CASE)
+				TREBLE_FOREACH_ATOMIC_STORE_OPCODE(STORE_CASE)
+
+#undef STORE_CASE
+
+#define RMW_CASE(name, op_code, text)                                          \
+	case ByteOp::name: {                                                       \
+		constexpr ValueType type =                                             \
+			value_type_named(std::string_view(text).substr(0, 3));             \
+		if (!has_memory || !alignment_valid(text, instr.args.memarg.align) ||  \
+			!pop(type) || !pop(ValueType::i32)) {                              \
+			return std::nullopt;                                               \
+		}                                                                      \
+		push(type);                                                            \
+		break;                                                                 \
+	}
+
+				TREBLE_FOREACH_ATOMIC_RMW_OPCODE(RMW_CASE)
+
+#undef RMW_CASE
+
+#define CMPXCHG_CASE(name, op_code, text)                                      \
+	case ByteOp::name: {                                                       \
+		constexpr ValueType type =                                             \
+			value_type_named(std::string_view(text).substr(0, 3));             \
+		if (!has_memory || !alignment_valid(text, instr.args.memarg.align) ||  \
+			!pop(type) || !pop(type) || !pop(ValueType::i32)) {                \
+			return std::nullopt;                                               \
+		}                                                                      \
+		push(type);                                                            \
+		break;                                                                 \
+	}
+
+				TREBLE_FOREACH_ATOMIC_CMPXCHG_OPCODE(CMPXCHG_CASE)
+
+#undef CMPXCHG_CASE
+
+			case ByteOp::memory_atomic_notify:
+				if (!has_memory ||
+					!alignment_valid("memory.atomic.notify",
+									 instr.args.memarg.align) ||
+					!pop(ValueType::i32) || !pop(ValueType::i32)) {
+					return std::nullopt;
+				}
+				push(ValueType::i32);
+				break;
+
+			case ByteOp::memory_atomic_wait32:
+			case ByteOp::memory_atomic_wait64:
+				if (!has_memory ||
+					!alignment_valid(op == ByteOp::memory_atomic_wait32
+										 ? "memory.atomic.wait32"
+										 : "memory.atomic.wait64",
+									 instr.args.memarg.align) ||
+					!pop(ValueType::i64) ||
+					!pop(op == ByteOp::memory_atomic_wait32 ? ValueType::i32
+															: ValueType::i64) ||
+					!pop(ValueType::i32)) {
+					return std::nullopt;
+				}
+				push(ValueType::i32);
+				break;
+
+			case ByteOp::atomic_fence:
+				break;
+
+			case ByteOp::memory_size:
+				if (!has_memory) {
+					return std::nullopt;
+				}
+				push(ValueType::i32);
+				break;
+
+			case ByteOp::memory_grow:
+				if (!has_memory || !pop(ValueType::i32)) {
+					return std::nullopt;
+				}
+				push(ValueType::i32);
+				break;
+
+			case ByteOp::i32_const:
+				push(ValueType::i32);
+				break;
+
+			case ByteOp::i64_const:
+				push(ValueType::i64);
+				break;
+
+			case ByteOp::f32_const:
+				push(ValueType::f32);
+				break;
+
+			case ByteOp::drop:
+				if (operands.size() <= floor()) {
+					if (!frames.back().unreachable) {
+						return std::nullopt;
+					}
+					break;
+				}
+				if (operands.back() == ValueType::v128 && v128_drops) {
+					v128_drops->push_back(i);
+				}
+				pop(operands.back());
+				break;
+
+#define SIMD_LOAD_CASE(name, op_code, text)                                    \
+	case ByteOp::name:                                                         \
+		if (!has_memory ||                                                     \
+			!alignment_valid(text, instr.args.memarg.align) ||                 \
+			!pop(ValueType::i32)) {                                            \
+			return std::nullopt;                                               \
+		}                                                                      \
+		push(ValueType::v128);                                                 \
+		break;
+
+				TREBLE_FOREACH_SIMD_LOAD_OPCODE(SIMD_LOAD_CASE)
+
+#undef SIMD_LOAD_CASE
+
+			case ByteOp::v128_store:
+				if (!has_memory ||
+					!alignment_valid("v128.store", instr.args.memarg.align) ||
+					!pop(ValueType::v128) || !pop(ValueType::i32)) {
+					return std::nullopt;
+				}
+				break;
+
+#define SIMD_LANE_ACCESS_CHECK(text)                                           \
+	if (!has_memory ||                                                         \
+		!alignment_valid(text, instr.args.memarg.align) ||                     \
+		instr.args.memarg.lane >= simd_access_lane_count(text) ||              \
+		!pop(ValueType::v128) || !pop(ValueType::i32)) {                       \
+		return std::nullopt;                                                   \
+	}
+
+#define SIMD_LOAD_LANE_CASE(name, op_code, text)                               \
+	case ByteOp::name:                                                         \
+		SIMD_LANE_ACCESS_CHECK(text)                                           \
+		push(ValueType::v128);                                                 \
+		break;
+
+				TREBLE_FOREACH_SIMD_LOAD_LANE_OPCODE(SIMD_LOAD_LANE_CASE)
+
+#undef SIMD_LOAD_LANE_CASE
+
+#define SIMD_STORE_LANE_CASE(name, op_code, text)                              \
+	case ByteOp::name:                                                         \
+		SIMD_LANE_ACCESS_CHECK(text)                                           \
+		break;
+
+				TREBLE_FOREACH_SIMD_STORE_LANE_OPCODE(SIMD_STORE_LANE_CASE)
+
+#undef SIMD_STORE_LANE_CASE
+#undef SIMD_LANE_ACCESS_CHECK
+
+			case ByteOp::v128_const:
+				push(ValueType::v128);
+				break;
+
+			case ByteOp::i8x16_shuffle:
+				for (size_t lane = 0; lane < 16; ++lane) {
+					if (instr.args.v128[lane] >= 32) {
+						return std::nullopt;
+					}
+				}
+				if (!pop(ValueType::v128) || !pop(ValueType::v128)) {
+					return std::nullopt;
+				}
+				push(ValueType::v128);
+				break;
+
+#define SIMD_SPLAT_CASE(name, op_code, text)                                   \
+	case ByteOp::name:                                                         \
+		if (!pop(simd_lane_type(text))) {                                      \
+			return std::nullopt;                                               \
+		}                                                                      \
+		push(ValueType::v128);                                                 \
+		break;
+
+				TREBLE_FOREACH_SIMD_SPLAT_OPCODE(SIMD_SPLAT_CASE)
+
+#undef SIMD_SPLAT_CASE
+
+#define SIMD_EXTRACT_LANE_CASE(name, op_code, text)                            \
+	case ByteOp::name:                                                         \
+		if (instr.args.lane >= simd_lane_count(text) ||                        \
+			!pop(ValueType::v128)) {                                           \
+			return std::nullopt;                                               \
+		}                                                                      \
+		push(simd_lane_type(text));                                            \
+		break;
+
+				TREBLE_FOREACH_SIMD_EXTRACT_LANE_OPCODE(SIMD_EXTRACT_LANE_CASE)
+
+#undef SIMD_EXTRACT_LANE_CASE
+
+#define SIMD_REPLACE_LANE_CASE(name, op_code, text)                            \
+	case ByteOp::name:                                                         \
+		if (instr.args.lane >= simd_lane_count(text) ||                        \
+			!pop(simd_lane_type(text)) || !pop(ValueType::v128)) {             \
+			return std::nullopt;                                               \
+		}                                                                      \
+		push(ValueType::v128);                                                 \
+		break;
+
+				TREBLE_FOREACH_SIMD_REPLACE_LANE_OPCODE(SIMD_REPLACE_LANE_CASE)
+
+#undef SIMD_REPLACE_LANE_CASE
+
+			case ByteOp::v128_bitselect:
+				if (!pop(ValueType::v128) || !pop(ValueType::v128) ||
+					!pop(ValueType::v128)) {
+					return std::nullopt;
+				}
+				push(ValueType::v128);
+				break;
+
+#define SIMD_CASE(name, op_code, text) case ByteOp::name:
+
+				TREBLE_FOREACH_SIMD_UNARY_OPCODE(SIMD_CASE)
+
+				if (!pop(ValueType::v128)) {
+					return std::nullopt;
+				}
+				push(ValueType::v128);
+				break;
+
+				TREBLE_FOREACH_SIMD_BINARY_OPCODE(SIMD_CASE)
+
+				if (!pop(ValueType::v128) || !pop(ValueType::v128)) {
+					return std::nullopt;
+				}
+				push(ValueType::v128);
+				break;
+
+				TREBLE_FOREACH_SIMD_SHIFT_OPCODE(SIMD_CASE)
+
+				if (!pop(ValueType::i32) || !pop(ValueType::v128)) {
+					return std::nullopt;
+				}
+				push(ValueType::v128);
+				break;
+
+				TREBLE_FOREACH_SIMD_TEST_OPCODE(SIMD_CASE)
+
+				if (!pop(ValueType::v128)) {
+					return std::nullopt;
+				}
+				push(ValueType::i32);
+				break;
+
+#undef SIMD_CASE
+
+			case ByteOp::local_get:
+			case ByteOp::local_get_v128: {
+				const std::optional<ValueType> local =
+					local_type(op, instr.args.local.slot);
+				if (!local) {
+					return std::nullopt;
+				}
+				push(*local);
+				break;
+			}
+
+			case ByteOp::local_set:
+			case ByteOp::local_set_v128: {
+				const std::optional<ValueType> local =
+					local_type(op, instr.args.local.slot);
+				if (!local || !pop(*local)) {
+					return std::nullopt;
+				}
+				break;
+			}
+
+			case ByteOp::local_tee:
+			case ByteOp::local_tee_v128: {
+				const std::optional<ValueType> local =
+					local_type(op, instr.args.local.slot);
+				if (!local || !pop(*local)) {
+					return std::nullopt;
+				}
+				push(*local);
+				break;
+			}
+
+			case ByteOp::call: {
+				const uint32_t callee = instr.args.call.func_index;
+				if (callee >= module.func_count ||
+					module.funcs[callee].type_index >= module.type_count ||
+					!call(module.types[module.funcs[callee].type_index])) {
+					return std::nullopt;
+				}
+				break;
+			}
+
+			case ByteOp::call_indirect: {
+				const uint32_t type_index = instr.args.call_indirect.type_index;
+				const uint32_t site = instr.args.call_indirect.site;
+				if (module.table == nullptr ||
+					type_index >= module.type_count ||
+					site >= func.indirect_call_count || !pop(ValueType::i32) ||
+					!call(module.types[type_index])) {
+					return std::nullopt;
+				}
+				break;
+			}
+
+			case ByteOp::return_:
+				if (!pop_results(type)) {
+					return std::nullopt;
+				}
+				unwind();
+				break;
+
+			case ByteOp::block:
+			case ByteOp::loop:
+				frames.push_back({
+					.op = op,
+					.height = operands.size(),
+					.slot_height = height,
+					.block_type = instr.args.block.block_type,
+					.unreachable = false,
+				});
+				break;
+
+			case ByteOp::br:
+			case ByteOp::br_if: {
+				const uint32_t depth = instr.args.branch.depth;
+				if ((op == ByteOp::br_if && !pop(ValueType::i32)) ||
+					!label_types(depth, label) || !pop_values(label)) {
+					return std::nullopt;
+				}
+				if (branch_unwinds) {
+					branch_unwinds->push_back(
+						branch_unwind(i, 0, depth, label));
+				}
+
+				if (op == ByteOp::br) {
+					unwind();
+				} else {
+					// the values stay on the stack if the branch is not taken
+					for (const ValueType value : label) {
+						push(value);
+					}
+				}
+				break;
+			}
+
+			case ByteOp::br_table: {
+				const uint32_t count = instr.args.branch_table.count;
+				// the depth of every label, the default one last
+				const auto depth = [&](uint32_t label) {
+					return instr.args.branch_table.labels[label].depth;
+				};
+
+				if (!pop(ValueType::i32) || !label_types(depth(count), label) ||
+					!pop_values(label)) {
+					return std::nullopt;
+				}
+				// every label has to take the same values along as the
+				// default one
+				for (uint32_t k = 0; k <= count; ++k) {
+					if (!label_types(depth(k), other_label) ||
+						other_label != label) {
+						return std::nullopt;
+					}
+					if (branch_unwinds) {
+						branch_unwinds->push_back(
+							branch_unwind(i, k, depth(k), label));
+					}
+				}
+				unwind();
+				break;
+			}
+
+			case ByteOp::if_: {
+				if (!pop(ValueType::i32)) {
+					return std::nullopt;
+				}
+				frames.push_back({
+					.op = ByteOp::if_,
+					.height = operands.size(),
+					.slot_height = height,
+					.block_type = instr.args.if_branch.block_type,
+					.unreachable = false,
+				});
+				break;
+			}
+
+			case ByteOp::else_:
+				if (frames.back().op != ByteOp::if_ ||
+					!leave_block(frames.back())) {
+					return std::nullopt;
+				}
+				frames.back().op = ByteOp::else_;
+				frames.back().unreachable = false;
+				break;
+
+			case ByteOp::end: {
+				if (frames.size() == 1) {
+					// the end of the function body, which is the last
+					// instruction
+					if (!pop_results(type) || operands.size() != 0) {
+						return std::nullopt;
+					}
+					return static_cast<uint32_t>(max_height);
+				}
+
+				const ControlFrame frame = frames.back();
+				// without an else arm, a false condition skips the block and
+				// leaves nothing behind
+				if (!leave_block(frame) ||
+					(frame.op == ByteOp::if_ &&
+					 frame.block_type != EMPTY_BLOCK_TYPE)) {
+					return std::nullopt;
+				}
+				frames.pop_back();
+				if (frame.block_type != EMPTY_BLOCK_TYPE) {
+					push(static_cast<ValueType>(frame.block_type));
+				}
+				break;
+			}
+
+			default:
+				// treble can not run what it does not understand
+				return std::nullopt;
+			}
+		}
+
+		// the decoder makes sure that the function ends with its end marker
+		return std::nullopt;
+	}
+
+  private:
+	// marks the second slot of a v128 local in slot_locals
+	static constexpr size_t NO_LOCAL = SIZE_MAX;
+
+	/**
+	 * Number of operands that belong to enclosing blocks.
+	 */
+	size_t floor() const { return frames.back().height; }
+
+	/**
+	 * Number of stack slots a value of the given type takes.
+	 */
+	static size_t slots(ValueType type) {
+		return type == ValueType::v128 ? 2 : 1;
+	}
+
+	void push(ValueType type) {
+		operands.push_back(type);
+		height += slots(type);
+		max_height = std::max(max_height, height);
+	}
+
+	bool pop(ValueType type) {
+		if (operands.size() <= floor()) {
+			return frames.back().unreachable;
+		}
+		if (operands.back() != type) {
+			return false;
+		}
+		operands.pop_back();
+		height -= slots(type);
+		return true;
+	}
+
+	/**
+	 * Checks that an arm of the given block leaves exactly the value of its
+	 * block type behind, and takes that value off the stack.
+	 */
+	bool leave_block(const ControlFrame &frame) {
+		if (frame.block_type != EMPTY_BLOCK_TYPE &&
+			!pop(static_cast<ValueType>(frame.block_type))) {
+			return false;
+		}
+		return operands.size() == frame.height;
+	}
+
+	/**
+	 * Takes the results of the function off the stack.
+	 */
+	bool pop_results(const FunctionType &type) {
+		for (size_t i = type.result_count; i > 0; --i) {
+			if (!pop(type.result_types[i - 1])) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * Takes values of the given types off the stack, the last one first.
+	 */
+	bool pop_values(std::span<const ValueType> types) {
+		for (size_t i = types.size(); i > 0; --i) {
+			if (!pop(types[i - 1])) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * Stores the types of the values a branch out of the given number of
+	 * blocks takes along in types. Returns false if there are not that many
+	 * blocks around the branch.
+	 */
+	bool label_types(uint32_t depth, std::vector<ValueType> &types) const {
+		if (depth >= frames.size()) {
+			return false;
+		}
+
+		const ControlFrame &frame = frames[frames.size() - 1 - depth];
+		types.clear();
+		if (frame.op == ByteOp::end_function) {
+			types.assign(results.begin(), results.end());
+		} else if (frame.op != ByteOp::loop &&
+				   frame.block_type != EMPTY_BLOCK_TYPE) {
+			// a branch to a loop starts it over, and takes nothing along
+			types.push_back(static_cast<ValueType>(frame.block_type));
+		}
+		return true;
+	}
+
+	/**
+	 * How the branch at the given index unwinds the stack when it is taken to
+	 * the given label, out of depth blocks. The values it takes along must
+	 * have been taken off the stack.
+	 */
+	BranchUnwind branch_unwind(size_t index, uint32_t label, uint32_t depth,
+							   std::span<const ValueType> values) const {
+		uint32_t arity = 0;
+		for (const ValueType value : values) {
+			arity += slots(value);
+		}
+
+		// a branch that can never be taken is never unwound, and the operands
+		// it takes off the stack might not be there
+		const size_t target = frames[frames.size() - 1 - depth].slot_height;
+		const auto drop = frames.back().unreachable
+							  ? 0
+							  : static_cast<uint32_t>(height - target);
+		return {.index = index, .label = label, .arity = arity, .drop = drop};
+	}
+
+	/**
+	 * Takes the arguments of a call of a function of the given type off the
+	 * stack, and pushes its results.
+	 */
+	bool call(const FunctionType &type) {
+		for (size_t i = type.param_count; i > 0; --i) {
+			if (!pop(type.param_types[i - 1])) {
+				return false;
+			}
+		}
+		for (size_t i = 0; i < type.result_count; ++i) {
+			push(type.result_types[i]);
+		}
+		return true;
+	}
+
+	/**
+	 * Marks the rest of the current block as unreachable, and takes whatever
+	 * the block has on the stack off it.
+	 */
+	void unwind() {
+		while (operands.size() > floor()) {
+			height -= slots(operands.back());
+			operands.pop_back();
+		}
+		frames.back().unreachable = true;
+	}
+
+	/**
+	 * Type of the local the given local op accesses at the given slot, or
+	 * nothing if no local starts there, or if the op moves the wrong number of
+	 * slots for it.
+	 */
+	std::optional<ValueType> local_type(ByteOp op, uint32_t slot) const {
+		if (slot >= slot_locals.size() || slot_locals[slot] == NO_LOCAL) {
+			return std::nullopt;
+		}
+
+		const ValueType type = locals[slot_locals[slot]];
+		const bool v128_op = op == ByteOp::local_get_v128 ||
+							 op == ByteOp::local_set_v128 ||
+							 op == ByteOp::local_tee_v128;
+		if ((type == ValueType::v128) != v128_op) {
+			return std::nullopt;
+		}
+		return type;
+	}
+
+	// the parameters of the function, then the locals it declares
+	std::span<const ValueType> locals;
+	// the results of the function
+	std::span<const ValueType> results;
+	// the index in locals of the local that starts at each slot of the frame
+	std::vector<size_t> slot_locals;
+
+	std::vector<ValueType> operands;
+	std::vector<ControlFrame> frames;
+	// number of stack slots the operands take
+	size_t height = 0;
+	size_t max_height = 0;
+
+	// scratch space for the types of the values branches take along
+	std::vector<ValueType> label;
+	std::vector<ValueType> other_label;
+};
+
+std::optional<uint32_t>
+validate_function(const Function &func,
+				  std::span<const Instruction> instructions,
+				  const Module &module, std::span<const ValueType> locals,
+				  std::vector<size_t> *v128_drops,
+				  std::vector<BranchUnwind> *branch_unwinds) {
+	return Validator().validate(func, instructions, module, locals, v128_drops,
+								branch_unwinds);
+}
+
+} // namespace Treble
@@ -0,0 +1,59 @@
+#ifndef __TREBLE__VALIDATOR_HXX__
+#define __TREBLE__VALIDATOR_HXX__
+
+#include "module.hxx"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace Treble {
+
+/**
+ * How a branch unwinds the stack when it is taken, see validate_function.
+ */
+struct BranchUnwind {
+	// index of the branch among the instructions the function was decoded
+	// into
+	size_t index;
+	// which label of a br_table the branch is taken to, the default one
+	// coming last, or 0 for br and br_if
+	uint32_t label;
+	// number of slots the values the branch takes along take
+	uint32_t arity;
+	// number of slots below those values that it takes off the stack
+	uint32_t drop;
+};
+
+/**
+ * Validates the body of a function of the given module, decoded into the given
+ * instructions, the way the WebAssembly specification does: every instruction
+ * has to find operands of the right types on the stack, and a memory if it
+ * accesses one, every block has to leave the value its block type promises,
+ * both at its end and when it is branched out of, and the function has to end
+ * with exactly its results on the stack. Returns the most stack slots the
+ * operands of the function ever take at once, a v128 taking two, or nothing if
+ * the function is invalid. The locals of the function take further slots,
+ * which are not counted. locals holds the types of its parameters, followed
+ * by those of the locals it declares.
+ *
+ * If v128_drops is given, the index of every drop whose operand is a v128 is
+ * added to it, so that those can be encoded as drop_v128. If branch_unwinds is
+ * given, an entry is added to it for every br and br_if, and for every label
+ * of every br_table, in the order they come in.
+ *
+ * Validated functions can run on untagged slots, as no instruction can ever
+ * find an operand of another type than it expects, and need no stack checks
+ * past making room for the maximum stack height when they are called.
+ */
+std::optional<uint32_t>
+validate_function(const Function &func,
+				  std::span<const Instruction> instructions,
+				  const Module &module, std::span<const ValueType> locals,
+				  std::vector<size_t> *v128_drops = nullptr,
+				  std::vector<BranchUnwind> *branch_unwinds = nullptr);
+
+} // namespace Treble
+
+#endif